@@ -30,8 +30,10 @@
 /* Include */
 #include <AP_Clamp.h>
 #include <iostream>
+#include <algorithm>
 #include <math.h>
 #include <main_window.h>
+#include <gsl/gsl_errno.h>
 
 #include <QtGui>
 
@@ -47,6 +49,10 @@ namespace {
 				return 0;
 			}
 	};
+
+    // Resolution of stored traces, below the converter step at the amplifier gains in use
+    const double voltageResolution = 0.01; // mV
+    const double currentResolution = 0.1; // pA
 }
 
 // Create Module Instance
@@ -62,6 +68,18 @@ static Workspace::variable_t vars[] = {
         "Output (V or A)", "Output (V or A)", Workspace::OUTPUT, }, //  Current sent to target cell, to internal input, output(0)
     {
         "Digital Output", "Digital Output", Workspace::OUTPUT, },
+    {
+        "Input 2 (V or A)", "Input of channel 2, input(1)", Workspace::INPUT, },
+    {
+        "Input 3 (V or A)", "Input of channel 3, input(2)", Workspace::INPUT, },
+    {
+        "Input 4 (V or A)", "Input of channel 4, input(3)", Workspace::INPUT, },
+    {
+        "Output 2 (V or A)", "Output of channel 2, output(2)", Workspace::OUTPUT, },
+    {
+        "Output 3 (V or A)", "Output of channel 3, output(3)", Workspace::OUTPUT, },
+    {
+        "Output 4 (V or A)", "Output of channel 4, output(4)", Workspace::OUTPUT, },
     // States
     {
         "Time (ms)", "Time Elapsed (ms)", Workspace::STATE, }, 
@@ -71,6 +89,30 @@ static Workspace::variable_t vars[] = {
         "Beat Number", "Number of beats", Workspace::STATE, },
     {
         "APD (ms)", "Action Potential Duration of cell (ms)", Workspace::STATE, },
+    {
+        "STV (ms)", "Short-term variability of APD over the statistics window (ms)", Workspace::STATE, },
+    {
+        "Alternans (ms)", "APD alternans magnitude over the statistics window (ms)", Workspace::STATE, },
+    {
+        "APD 2 (ms)", "Action Potential Duration of channel 2 (ms)", Workspace::STATE, },
+    {
+        "APD 3 (ms)", "Action Potential Duration of channel 3 (ms)", Workspace::STATE, },
+    {
+        "APD 4 (ms)", "Action Potential Duration of channel 4 (ms)", Workspace::STATE, },
+    {
+        "Filtered Vm (mv)", "Membrane voltage after the filter stage (mv)", Workspace::STATE, },
+    {
+        "Stim Amplitude (nA)", "Stimulus magnitude of the current beat (nA)", Workspace::STATE, },
+    {
+        "Current (pA)", "Measured current during AP clamp (pA)", Workspace::STATE, },
+    {
+        "Leak-Sub Current (pA)", "AP clamp current with the test pulse leak subtracted (pA)", Workspace::STATE, },
+    {
+        "Rs (MOhm)", "Series resistance from the last test pulse (MOhm)", Workspace::STATE, },
+    {
+        "Rm (MOhm)", "Membrane resistance from the last test pulse (MOhm)", Workspace::STATE, },
+    {
+        "Cm (pF)", "Membrane capacitance from the last test pulse (pF)", Workspace::STATE, },
     // Parameters
     {
         "APD Repolarization %", "APD Repolarization %", Workspace::PARAMETER, },
@@ -90,6 +132,40 @@ static Workspace::variable_t vars[] = {
         "Stim Length (ms)", "Duration of stimulation pulse (nA", Workspace::PARAMETER, }, 
     {
         "LJP (mv)", "Liquid Junction Potential (mV)", Workspace::PARAMETER, },    
+    {
+        "Stats Window (beats)", "Number of beats used for STV and alternans statistics", Workspace::PARAMETER, },
+    {
+        "Channels", "Number of cells paced and recorded, 1 to 4", Workspace::PARAMETER, },
+    {
+        "Artifact Beats", "Number of beats averaged into the stimulus artifact template, 0 is off", Workspace::PARAMETER, },
+    {
+        "Lowpass (Hz)", "Cutoff of 4th order lowpass filter applied before APD detection, 0 is off", Workspace::PARAMETER, },
+    {
+        "Notch (Hz)", "Line frequency removed before APD detection (50 or 60), 0 is off", Workspace::PARAMETER, },
+    {
+        "Reject Beats", "If 1, failed, EAD and spontaneous beats are left out of AVERAGE steps", Workspace::PARAMETER, },
+    {
+        "EAD/DAD Pulse (ms)", "Digital output pulse sent at each detected EAD or DAD, 0 is off", Workspace::PARAMETER, },
+    {
+        "Adaptive Stim", "If 1, stimulus is raised after a missed capture and backs off to Stim Mag while capture holds", Workspace::PARAMETER, },
+    {
+        "Capture Window (ms)", "Time after the stimulus within which the upstroke must cross threshold", Workspace::PARAMETER, },
+    {
+        "Test Pulse (mV)", "Amplitude of the leak and Rs test pulse before AP clamp beats, 0 is off", Workspace::PARAMETER, },
+    {
+        "Test Pulse Length (ms)", "Length of each of the holding, pulse and recovery segments", Workspace::PARAMETER, },
+    {
+        "Test Pulse Beats", "Test pulse every N AP clamp beats, 0 only at the start of each step", Workspace::PARAMETER, },
+    {
+        "Rs Comp (%)", "Part of the Rs voltage drop added to the AP clamp command, 0 to 80", Workspace::PARAMETER, },
+    {
+        "Beat Record", "If 1, pace runs and recording steps write a beat-gated record instead of starting the data recorder", Workspace::PARAMETER, },
+    {
+        "Record Pre (ms)", "Time kept before each stimulus in the beat record", Workspace::PARAMETER, },
+    {
+        "Record Post (ms)", "Time kept after each stimulus in the beat record", Workspace::PARAMETER, },
+    {
+        "Full Beat Every", "Every Nth beat is kept in full in the beat record, 0 is never", Workspace::PARAMETER, },
 };
 
 // Number of variables in vars
@@ -99,361 +175,154 @@ AP_Clamp::Module::Module(void) : QWidget( MainWindow::getInstance()->centralWidg
 
     // Build Module GUI
 	 QWidget::setAttribute(Qt::WA_DeleteOnClose);
+    batchStartError = NULL;
+    gsl_set_error_handler_off(); // Process-wide, set here once so fits on the worker pool return errors instead of aborting RTXI
+    engine = new ClampEngine( this, RT::System::getInstance()->getPeriod()*1e-6 ); // States of the GUI point into the engine
     createGUI();
     initialize(); // Initialize parameters, initialize states, reset model, and update rate
     refreshDisplay();
     show();
+
+    // Headless command interface, one local socket per module instance
+    batchServer = new BatchServer( this, this );
+    QString error;
+    if( !batchServer->listen( "AP_Clamp-" + QString::number( getID() ), error ) )
+        ERROR_MSG( "AP_Clamp Error: Unable to open batch command socket, %s\n", error.toLocal8Bit().constData() );
 } // End constructor
 
 AP_Clamp::Module::~Module(void) {
-    delete protocol;
 	 setActive(false);
 	 AP_Clamp_SyncEvent event;
 	 RT::System::getInstance()->postEvent(&event);
+    worker->stop(); // Tasks belong to the engine
+    delete worker;
+    delete engine;
+    delete archiver;
+    delete APDTrend;
+    delete protocol;
 } // End destructor
 
 void AP_Clamp::Module::execute(void) { // Real-Time Execution
-    voltage = input(0) * 1e3 - LJP;
-    
-    switch( executeMode ) {
-    case IDLE:
-        break;
-
-    case THRESHOLD:
-        // Apply stimulus for given number of ms (StimLength) 
-        if( time - cycleStartTime <= stimLength ) {
-            backToBaseline = false;
-            peakVoltageT = Vrest;
-            output( 0 ) = stimulusLevel * 1e-9; // stimulsLevel is in nA, convert to A for amplifier
-        }
-        
-        else {
-            output( 0 ) = 0;
-
-            if( voltage > peakVoltageT ) // Find peak voltage after stimulus
-                peakVoltageT = voltage;
-
-            // If Vm is back to resting membrane potential (within 2 mV; determined when threshold detection button is first pressed) 
-            if( voltage-Vrest < 2 ) { // Vrest: voltage at the time threshold test starts
-                if ( !backToBaseline ) {
-                    responseDuration = time-cycleStartTime;
-                    responseTime = time;
-                    backToBaseline = true;
-                }
-
-                // Calculate time length of voltage response
-                if( responseDuration > 50 && peakVoltageT > 10 ) { // If the response was more than 50ms long and peakVoltage is more than 10mV, consider it an action potential
-                    stimMag = stimulusLevel*1.5; // Set the current stimulus value as the calculated threshold * 2
-                    thresholdOn = false;
-                    executeMode = IDLE;
-                }
-                // If no action potential occurred, and Vm is back to rest 
-                else {
-
-                    // If the cell has rested for  200ms since returning to baseline 
-                    if( time-responseTime > 200 ) {
-                        stimulusLevel += 0.1; // Increase the magnitude of the stimulus and try again 
-                        cycleStartTime = time; // Record the time of stimulus application 
-                    }   
-                }
-            }
-        }
-        time += period;
-        break;
-
-    case PACE:
-        
-        time += period;
-        stepTime += 1;
-        // If time is greater than BCL, advance the beat
-        if ( stepTime - cycleStartTime >= BCLInt ) {
-            beatNum++;            
-            cycleStartTime = stepTime;
-            Vrest = voltage;
-            calculateAPD( 1 ); // First step of APD calculation called at each stimulus
-        }
-        
-        // Stimulate cell for stimLength(ms), digital out on for duration of stimulus
-        if ( (stepTime - cycleStartTime) < stimLengthInt ) {
-            outputCurrent = stimMag * 1e-9; // stimMag in nA, convert to A for amplifier
-            digitalOut = 1;
-        }
-        else {
-            outputCurrent = 0;
-            digitalOut = 0;
-        }
-
-        // Inject Current
-        output( 0 ) = outputCurrent;
-        output( 1 ) = digitalOut;
-        //Calulate APD
-        calculateAPD( 2 ); // Second step of APD calculation
-        break;
-
-    case PROTOCOL:
-
-        time += period;
-        stepTime += 1;
-
-        if (protocolMode == STEPINIT) {
-            stepInitDone = false;
-
-            // These steps do not consume a thread loop by themselves
-            while (!stepInitDone) {
-                // End of protocol
-                if (currentStep >= protocolContainer->size()) {// If end of protocol has been reached
-                    protocolMode = END;
-                    stepInitDone = true;
-                }
-                else {
-                    stepPtr = protocolContainer->at(currentStep);
-                    stepType = stepPtr->stepType;
-
-                    // Start data recording
-                    if (stepType == ProtocolStep::STARTRECORD) {
-                        if( !recording ) { // Record data if dataRecord is toggled
-                            Event::Object event(Event::START_RECORDING_EVENT);
-                            Event::Manager::getInstance()->postEventRT(&event);
-                            recording = true;
-                        }
-                        currentStep++;
-                    }
-                    // Stop data recording
-                    else if (stepType == ProtocolStep::STOPRECORD) {
-                        if(recording == true) {
-                            Event::Object event(Event::STOP_RECORDING_EVENT);
-                            Event::Manager::getInstance()->postEventRT(&event);
-                            recording = false;
-                        }
-                        currentStep++;
-                    }
-                    // Start Vm recording init
-                    else if (stepType == ProtocolStep::STARTVM) {
-                        vmRecording = true;
-                        recordingIndex = stepPtr->recordIdx;
-                        vmRecordData = &voltageData[recordingIndex];
-                        vmRecordData->clear();
-                        vmRecordCnt = 0;
-                        currentStep++;
-                    }
-                    // Stop Vm recording init
-                    else if (stepType == ProtocolStep::STOPVM) {
-                        vmRecording = false;
-                        currentStep++;
-                    }
-                    else {
-                        stepTime = 0;
-                        cycleStartTime = 0;
-                        pBCLInt = stepPtr->BCL / period; // BCL for protocol
-
-                        // Pace, Average, and AP Clamp Init
-                        if (stepType == ProtocolStep::PACE ||
-                            stepType == ProtocolStep::AVERAGE ||
-                            stepType == ProtocolStep::APCLAMP ) {
-                            
-                            stepEndTime = (( stepPtr->BCL * stepPtr->numBeats ) / period ) - 1; // -1 since time starts at 0, not 1
-                            beatNum++;
-
-                            if ( stepType == ProtocolStep::AVERAGE ) {
-                                recordingIndex = stepPtr->recordIdx;
-                                avgRecordData = &voltageData[recordingIndex];
-                                avgRecordData->clear();
-                                avgRecordData->resize( stepPtr->BCL / period ); // All elements are set to 0
-                                avgCnt = 1; // Keeps track of how many beats have been added
-                            }
-                            else if ( stepType == ProtocolStep::APCLAMP ) {
-                                recordingIndex = stepPtr->recordIdx;
-                                apClampData = &voltageData[recordingIndex];
-                                apClampCnt = 1;
-                            }
-                        }
-                        // Wait Init
-                        else {
-                            stepEndTime = ( stepPtr->waitTime / period ) - 1; // -1 since time starts at 0, not 1
-                        }
-                        
-                        protocolMode = EXEC;
-                        Vrest = voltage;
-                        calculateAPD( 1 );
-                        stepInitDone = true;
-
-                        if ( stepType == ProtocolStep::APCLAMP && pBCLInt > apClampData->size() ) {
-                            ERROR_MSG("AP_Clamp Error: Not enough data for entire step\n");
-                            protocolMode = END;
-                        }
-                    }                   
-                }
-                
-            } // end while (!stepInitiDone)            
-        } // end if (protocolMode == STEPINIT)
-   
-        if ( protocolMode == EXEC ) { // Execute protocol
-
-            // Static Pacing or Averaging
-            if ( stepType == ProtocolStep::PACE || stepType == ProtocolStep::AVERAGE) { // Pace cell at BCL
-                if (stepTime - cycleStartTime >= pBCLInt) {
-                    beatNum++;
-                    cycleStartTime = stepTime;
-                    Vrest = voltage;
-                    calculateAPD( 1 );
-                    if ( stepType == ProtocolStep::AVERAGE )
-                        avgCnt++;
-                }
-                
-                // Stimulate cell for stimLength(ms), digital out on for duration for stimulus
-                if ( (stepTime - cycleStartTime) < stimLengthInt ) {
-                    outputCurrent = stimMag * 1e-9;
-                    digitalOut = stepPtr->digitalOut;
-                }
-                else {
-                    outputCurrent = 0;
-                    digitalOut = 0;
-                }
-
-                if ( stepType == ProtocolStep::AVERAGE ) {
-                    if ( avgCnt == stepPtr->numBeats ) // Voltage in mV
-                        avgRecordData->at(stepTime - cycleStartTime) =
-                            (voltage + avgRecordData->at(stepTime - cycleStartTime)) / avgCnt;
-                    else
-                        avgRecordData->at(stepTime - cycleStartTime) = voltage + avgRecordData->at(stepTime - cycleStartTime);
-                }
-                output(0) = outputCurrent;
-                output(1) = digitalOut;
-                calculateAPD(2);
-                
-            } // end if(PACE || AVERAGE)
-
-            // Wait
-            else if ( stepType == ProtocolStep::WAIT ) { 
-                output(0) = 0;
-            }
-            
-            // AP Clamp
-            else {
-                if (stepTime - cycleStartTime >= pBCLInt) {
-                    beatNum++;
-                    output(1) = stepPtr->digitalOut;
-                    cycleStartTime = stepTime;
-                }
-                if (stepTime - cycleStartTime > (50 / period) && stepPtr->digitalOut != 0) // Digital out on for 50ms
-                    output(1) = 0;
-                voltage = apClampData->at(stepTime - cycleStartTime);
-                output(0) = (voltage * 1e-3) + (LJP * 1e-3);
-            }
-            
-            if ( vmRecording ) {
-                vmRecordData->push_back(voltage); // Voltage in mV
-            }
-            
-            if( stepTime >= stepEndTime ) {
-                currentStep++;
-                protocolMode = STEPINIT;
-            }            
-        } // end EXEC
-
-        if( protocolMode == END ) { // End of Protocol: Stop Data recorder and untoggle button
-            if(recording == true) {
-                Event::Object event(Event::STOP_RECORDING_EVENT);
-                Event::Manager::getInstance()->postEventRT(&event);
-                recording = false;
-            }
-            if (currentTrial < numTrials) {
-                reset();
-                beatNum = 0; // beatNum is changed at beginning of protocol, so it must start at 0 instead of 1
-                stepTracker = -1; // Used to highlight the current step in list box, -1 to force first step to be highlighted
-                protocolMode = STEPINIT;
-                executeMode = PROTOCOL;
-                currentTrial++;
-            }
-            else {
-                protocolOn = false;
-                executeMode = IDLE;
-            }
-        } // end END
-            
-        break;
-        
-    } // end switch( executeMode )     
+    for( int i = 0; i < ClampEngine::numInputs; i++ )
+        engine->inputs[i] = input( i );
+    engine->tick();
+    for( int i = 0; i < ClampEngine::numOutputs; i++ )
+        output( i ) = engine->outputs[i];
+    worker->setActive( engine->executeMode == ClampEngine::PROTOCOL ); // Steps post their tasks, a pool thread keeps polling
 } // end execute()
 
+// Engine callbacks, RT thread
+void AP_Clamp::Module::engineRecord( bool start ) {
+    Event::Object event( start ? Event::START_RECORDING_EVENT : Event::STOP_RECORDING_EVENT );
+    Event::Manager::getInstance()->postEventRT( &event );
+}
+
+void AP_Clamp::Module::enginePost( int task ) {
+    worker->post( task );
+}
+
+void AP_Clamp::Module::engineError( const char *message ) {
+    ERROR_MSG( "%s", message );
+}
+
+long long AP_Clamp::Module::engineClock( void ) {
+    return RT::OS::getTime();
+}
+
 void AP_Clamp::Module::initialize(void){ // Initialize all variables, protocol, and model cell
     protocol = new Protocol();
     protocolContainer = &protocol->protocolContainer; // Pointer to protocol container
-        
-    // States
-    time = 0;
-    voltage = 0;
-    beatNum = 0;
-    APD = 0;
-	 executeMode = IDLE;
-
-    // Parameters
-    APDRepol = 90;    
-    minAPD = 50;
-    stimWindow = 4;
-    numTrials = 1;
-    intervalTime = 1000;
-    BCL = 1000;
-    stimMag = 4;
-    stimLength = 1;
-    LJP = 0;
+    protocolModel = new ProtocolModel( protocol, this );
+    mainWindow->protocolEditorListBox->setModel( protocolModel );
+
+    // Parameters, the others start at the engine defaults
+    lowpassCutoff = 0;
+    notchFrequency = 0;
+    beatRecord = 0;
+    recordPre = 10;
+    recordPost = 500;
+    fullBeatInterval = 0;
     
-    mainWindow->APDRepolEdit->setText( QString::number(APDRepol) );
-    mainWindow->minAPDEdit->setText( QString::number(minAPD) );
-    mainWindow->stimWindowEdit->setText( QString::number(stimWindow) );
-    mainWindow->numTrialEdit->setText( QString::number(numTrials) );
-    mainWindow->intervalTimeEdit->setText( QString::number(intervalTime) );
-    mainWindow->BCLEdit->setText( QString::number(BCL) );
-    mainWindow->stimMagEdit->setText( QString::number(stimMag) );
-    mainWindow->stimLengthEdit->setText( QString::number(stimLength) );
-    mainWindow->LJPEdit->setText( QString::number(LJP) );
+    mainWindow->APDRepolEdit->setText( QString::number(engine->APDRepol) );
+    mainWindow->minAPDEdit->setText( QString::number(engine->minAPD) );
+    mainWindow->stimWindowEdit->setText( QString::number(engine->stimWindow) );
+    mainWindow->numTrialEdit->setText( QString::number(engine->numTrials) );
+    mainWindow->intervalTimeEdit->setText( QString::number(engine->intervalTime) );
+    mainWindow->BCLEdit->setText( QString::number(engine->BCL) );
+    mainWindow->stimMagEdit->setText( QString::number(engine->stimMag) );
+    mainWindow->stimLengthEdit->setText( QString::number(engine->stimLength) );
+    mainWindow->LJPEdit->setText( QString::number(engine->LJP) );
+    mainWindow->statsWindowEdit->setText( QString::number(engine->statsWindow) );
+    mainWindow->channelsEdit->setText( QString::number(engine->numChannels) );
+    mainWindow->artifactBeatsEdit->setText( QString::number(engine->artifactBeats) );
+    mainWindow->lowpassEdit->setText( QString::number(lowpassCutoff) );
+    mainWindow->notchEdit->setText( QString::number(notchFrequency) );
+    mainWindow->rejectBeatsEdit->setText( QString::number(engine->rejectBeats) );
+    mainWindow->eventPulseEdit->setText( QString::number(engine->eventPulseLength) );
+    mainWindow->adaptiveStimEdit->setText( QString::number(engine->adaptiveStim) );
+    mainWindow->captureWindowEdit->setText( QString::number(engine->captureWindow) );
+    mainWindow->testPulseEdit->setText( QString::number(engine->testPulseAmplitude) );
+    mainWindow->testPulseLengthEdit->setText( QString::number(engine->testPulseLength) );
+    mainWindow->testPulseBeatsEdit->setText( QString::number(engine->testPulseBeats) );
+    mainWindow->rsCompensationEdit->setText( QString::number(engine->rsCompensation) );
+    mainWindow->beatRecordEdit->setText( QString::number(beatRecord) );
+    mainWindow->recordPreEdit->setText( QString::number(recordPre) );
+    mainWindow->recordPostEdit->setText( QString::number(recordPost) );
+    mainWindow->fullBeatEdit->setText( QString::number(fullBeatInterval) );
     
     // Flags
-    recording = false;
     loadedFile = "";
-    protocolOn = false;
-
-    // APD parameters
-   upstrokeThreshold = -40;
-
-   // AP Clamp Variables
-    voltageData.resize(100);
+    paceOn = false;
+
+    // Additional channels, states point into the bank
+    for( int c = 1; c < ChannelBank::maxChannels; c++ )
+        setData( Workspace::STATE, 5 + c, &engine->channelBank->APD[c] );
+
+    // Analysis tasks of the engine and the trace archiver
+    APDTrend = new TrendDecimator( 512 );
+    worker = new WorkerPool( 0, 20, 64 );
+    worker->addTask( engine->traceDecimator );
+    worker->addTask( engine->artifact );
+    engine->leakTask = worker->addTask( engine->leak );
+    engine->sweepTask = worker->addTask( engine->sweeps );
+    engine->restitutionTask = worker->addTask( engine->restitution );
+    worker->addTask( engine->beatRecorder );
+    archiver = new TraceArchiver();
+    worker->addTask( archiver );
+    worker->start();
 }
 
 void AP_Clamp::Module::reset( void ) {
-    period = RT::System::getInstance()->getPeriod()*1e-6; // Grabs RTXI thread period and converts to ms (from ns)
-    BCLInt = BCL / period;
-    stimLengthInt = stimLength / period;
-     
-    stepTime = -1;
-    time = -period;
-    cycleStartTime = 0;
-    beatNum = 1;
-    Vrest = voltage;
-    calculateAPD( 1 );
+    engine->setPeriod( RT::System::getInstance()->getPeriod()*1e-6 ); // Grabs RTXI thread period and converts to ms (from ns)
+    engine->reset();
+}
 
-    // Protocol variables
-    currentStep = 0;
+int AP_Clamp::Module::selectedStep( void ) {
+    QModelIndex index = mainWindow->protocolEditorListBox->currentIndex();
+    return index.isValid() ? index.row() : -1;
 }
 
 void AP_Clamp::Module::addStep( void ) {
-    int idx = mainWindow->protocolEditorListBox->currentRow();
-    if( idx == -1 ) { // Protocol is empty or nothing is selected, add step to end
-        if( protocol->addStep( this ) )   // Update protocolEditorListBox if a step was added
-            rebuildListBox();
+    ProtocolStepPtr step = Protocol::stepFromDialog( this );
+    if( !step ) // Dialog was closed
+        return ;
+
+    int idx = selectedStep();
+    if( idx == -1 ) // Protocol is empty or nothing is selected, add step to end
+        protocolModel->insertStep( protocolContainer->size(), step );
+    else { // If a step is selected, add step after
+        protocolModel->insertStep( idx+1, step );
+        mainWindow->protocolEditorListBox->setCurrentIndex( protocolModel->index( idx+1 ) );
     }
-    else // If a step is selected, add step after
-        if( protocol->addStep( this, idx ) )   // Update protocolEditorListBox if a step was added
-            rebuildListBox();            
 }
 
 void AP_Clamp::Module::deleteStep( void ) {
-    int idx = mainWindow->protocolEditorListBox->currentRow();
+    int idx = selectedStep();
     if( idx == -1 ) // Protocol is empty or nothing is selected, return
         return ;
     
-    protocol->deleteStep( this, idx ); // Delete the currently selected step in the list box
-    rebuildListBox();
+    if( Protocol::confirmDelete( this, idx ) ) // Delete the currently selected step in the list box
+        protocolModel->removeStep( idx );
 }
 
 void AP_Clamp::Module::saveProtocol( void ) {
@@ -462,73 +331,85 @@ void AP_Clamp::Module::saveProtocol( void ) {
 
 void AP_Clamp::Module::loadProtocol( void ) {
     loadedFile = protocol->loadProtocol( this );
-    rebuildListBox();
+    protocolModel->protocolReset();
 }
 
 void AP_Clamp::Module::clearProtocol( void ) {
-    protocol->clearProtocol();
-    rebuildListBox();
+    protocolModel->clearProtocol();
 }
 
 void AP_Clamp::Module::toggleThreshold( void ) {
-    thresholdOn = mainWindow->thresholdButton->isChecked();
+    engine->thresholdOn = mainWindow->thresholdButton->isChecked();
 	 
     setActive(false); //breakage maybe...
 	 AP_Clamp_SyncEvent event;
 	 RT::System::getInstance()->postEvent(&event);
 
-    if( thresholdOn ) { // Start protocol, reinitialize parameters to start values
-        executeMode = THRESHOLD;
-        reset();
-        Vrest = input(0) * 1e3;
-        peakVoltageT = Vrest;
-        stimulusLevel = 2.0; // na
-        responseDuration = 0;
-        responseTime = 0;
+    if( engine->thresholdOn ) { // Start protocol, reinitialize parameters to start values
+        engine->setPeriod( RT::System::getInstance()->getPeriod()*1e-6 );
+        engine->startThreshold( input(0) * 1e3 );
         setActive( true );
     }
     else { // Stop protocol, only called when pace button is unclicked in the middle of a run
-        executeMode = IDLE;
+        engine->stop();
         setActive( false );
     }
 }
 
 void AP_Clamp::Module::toggleProtocol( void ) {
-    bool protocolOn = mainWindow->startProtocolButton->isChecked();
-
-	 setActive(false);
-	 AP_Clamp_SyncEvent event;
-	 RT::System::getInstance()->postEvent(&event);
-    if( protocolOn ){
-        if( protocolContainer->size() <= 0 ) {
+    if( mainWindow->startProtocolButton->isChecked() ) {
+        QString error;
+        if( !startProtocol( error ) ) {
+            if( batchStartError ) // Batch command, the error is its reply and no dialog is opened
+                *batchStartError = error;
+            else {
 				QMessageBox * msgBox = new QMessageBox;
 				msgBox->setWindowTitle("Error");
-				msgBox->setText("No protocol entered");
+				msgBox->setText( error );
 				msgBox->setStandardButtons(QMessageBox::Ok);
 				msgBox->setDefaultButton(QMessageBox::NoButton);
 				msgBox->setWindowModality(Qt::WindowModal);
 				msgBox->open();
-            protocolOn = false;
-				executeMode = IDLE;
-        } else {
-			  executeMode = IDLE; // Keep on IDLE until update is finished
-			  reset();
-			  beatNum = 0; // beatNum is changed at beginning of protocol, so it must start at 0 instead of 1
-			  stepTracker = -1; // Used to highlight the current step in list box, -1 to force first step to be highlighted
-			  protocolMode = STEPINIT; 
-			  executeMode = PROTOCOL;
-              currentTrial = 1;
-			  setActive( true );
-		  }
-	 } else { // Stop protocol, only called when protocol button is unclicked in the middle of a run
-		  if( recording ) { // Stop data recorder if recording
-            ::Event::Object event(::Event::STOP_RECORDING_EVENT);
-            ::Event::Manager::getInstance()->postEventRT(&event);
-				recording = false;
-        } 
-        executeMode = IDLE;
-        setActive( false );
-	 }
+            }
+        }
+	 } else // Stop protocol, only called when protocol button is unclicked in the middle of a run
+        stopProtocol();
+}
+
+bool AP_Clamp::Module::startProtocol( QString &error ) {
+	 setActive(false);
+	 AP_Clamp_SyncEvent event;
+	 RT::System::getInstance()->postEvent(&event);
+
+    ProtocolProgram program;
+    if( !protocol->compile( program, error ) ) {
+        engine->stop();
+        return false;
+    }
+    engine->setPeriod( RT::System::getInstance()->getPeriod()*1e-6 ); // Beat record and buffers are sized at this period
+    if( !openBeatRecord() ) {
+        error = "Unable to create beat record " + beatRecordBase;
+        engine->stop();
+        return false;
+    }
+    clearResults(); // Results of previous run are discarded
+    sweepNames = protocol->sweepNames();
+    engine->startProtocol( program, sweepNames.size() );
+	 setActive( true );
+    return true;
+}
+
+void AP_Clamp::Module::stopProtocol( void ) {
+	 setActive(false);
+	 AP_Clamp_SyncEvent event;
+	 RT::System::getInstance()->postEvent(&event);
+
+    if( engine->recording ) { // Stop data recorder if recording
+        ::Event::Object event(::Event::STOP_RECORDING_EVENT);
+        ::Event::Manager::getInstance()->postEventRT(&event);
+        engine->recording = false;
+    } 
+    engine->stop();
 }
 
 void AP_Clamp::Module::togglePace( void ) {
@@ -539,77 +420,55 @@ void AP_Clamp::Module::togglePace( void ) {
 	 RT::System::getInstance()->postEvent(&event);
     
 	 if( paceOn ) { // Start protocol, reinitialize parameters to start values
-        reset();
-        executeMode = PACE;
+        engine->setPeriod( RT::System::getInstance()->getPeriod()*1e-6 );
+        clearResults();
+        if( !openBeatRecord() )
+            ERROR_MSG("AP_Clamp Error: Unable to create beat record, pacing without it\n");
+        engine->startPace();
         setActive( true );
     }
     else { // Stop protocol, only called when pace button is unclicked in the middle of a run
-        if( recording ) { // Stop data recorder if recording
+        if( engine->recording ) { // Stop data recorder if recording
             ::Event::Object event(::Event::STOP_RECORDING_EVENT);
             ::Event::Manager::getInstance()->postEventRT(&event);
-				recording = false;
+				engine->recording = false;
         }        
-        executeMode = IDLE;
+        engine->stop();
         setActive( false );
     }
 }
 
-/*** Other Functions ***/
-
-void AP_Clamp::Module::Module::calculateAPD(int step){ // Two APDs are calculated based on different criteria
-    switch( step ) {
-    case 1:
-        APDMode = START;
-        break;
+void AP_Clamp::Module::drainBeats( void ) {
+    BeatResult result;
+    while( engine->beatFifo->pop( result ) ) {
+        beatLog.push_back( result );
+        if( result.complete ) APDTrend->add( result.APD );
+    }
 
-    case 2:
-        switch( APDMode ) { 
-        case START:// Find time membrane voltage passes upstroke threshold, start of AP            
-            if( voltage >= upstrokeThreshold ) {
-                APStart = time;
-                peakVoltage = Vrest;
-                APDMode = PEAK;
-            }
-            break;
-            
-        case PEAK: // Find peak of AP, points within "window" are ignored to eliminate effect of stimulus artifact
-            if( (time - APStart) > stimWindow ) { // If we are outside the chosen time window after the AP
-                if( peakVoltage < voltage  ) { // Find peak voltage                    
-                    peakVoltage = voltage;
-                    peakTime = time;
-                }
-                else if ( (time - peakTime) > 5 ) { // Keep looking for the peak for 5ms to account for noise
-                    double APAmp;                    
-                    APAmp = peakVoltage - Vrest ; // Amplitude of action potential based on resting membrane and peak voltage
-                    // Calculate downstroke threshold based on AP amplitude and desired AP repolarization %
-                    downstrokeThreshold = peakVoltage - ( APAmp * (APDRepol / 100.0) );
-                    APDMode = DOWN;
-                }
-            }
-            break;
-            
-        case DOWN: // Find downstroke threshold and calculate APD
-            if( voltage <= downstrokeThreshold ) {
-                APD = time - APStart;
-                APDMode = DONE;
-            }
-            break;
+    StatisticsSummary summary;
+    while( engine->statisticsFifo->pop( summary ) )
+        statisticsLog.push_back( summary );
+}
 
-        default: // DONE: APD has been found, do nothing
-            break;
-        }
-    }
+// Only called while the RT thread is inactive, the engine clears its own results when a run starts
+void AP_Clamp::Module::clearResults( void ) {
+    beatLog.clear();
+    statisticsLog.clear();
+    APDTrend->clear();
 }
 
-// Rebuilds list box, run after modifying protocol
-void AP_Clamp::Module::rebuildListBox( void ) {
-    mainWindow->protocolEditorListBox->clear(); // Clear list box
+// Only called while the RT thread is inactive, a batch file name is reused by every run
+bool AP_Clamp::Module::openBeatRecord( void ) {
+    engine->closeBeatRecord();
+    if( !beatRecord ) return true;
 
-    // Rebuild list box
-    for( int i = 0; i < protocolContainer->size(); i++ ) {
-        mainWindow->protocolEditorListBox->insertItem( i,  protocol->getStepDescription( i ) );
-    }
+    beatRecordBase = recordFile;
+    if( beatRecordBase.isEmpty() )
+        beatRecordBase = QDir::homePath() + "/AP_Clamp_" + QDateTime::currentDateTime().toString( "yyyyMMdd_hhmmss" );
+    return engine->openBeatRecord( beatRecordBase.toStdString(), recordPre, recordPost, fullBeatInterval,
+                                   voltageResolution, currentResolution );
 }
+
 /* Build Module GUI */
 void AP_Clamp::Module::createGUI( void ) {
 
@@ -628,6 +487,8 @@ void AP_Clamp::Module::createGUI( void ) {
     // Set GUI refresh rate
     QTimer *timer = new QTimer(this);
     timer->start(500);
+    QTimer *plotTimer = new QTimer(this); // Plots are refreshed faster than the state display
+    plotTimer->start(100);
 
     // Set validators
     mainWindow->APDRepolEdit->setValidator( new QIntValidator(mainWindow->APDRepolEdit) );
@@ -639,6 +500,23 @@ void AP_Clamp::Module::createGUI( void ) {
     mainWindow->stimMagEdit->setValidator( new QDoubleValidator(mainWindow->stimMagEdit) );
     mainWindow->stimLengthEdit->setValidator( new QDoubleValidator(mainWindow->stimLengthEdit) );
     mainWindow->LJPEdit->setValidator( new QDoubleValidator(mainWindow->LJPEdit) );
+    mainWindow->statsWindowEdit->setValidator( new QIntValidator(mainWindow->statsWindowEdit) );
+    mainWindow->channelsEdit->setValidator( new QIntValidator(mainWindow->channelsEdit) );
+    mainWindow->artifactBeatsEdit->setValidator( new QIntValidator(mainWindow->artifactBeatsEdit) );
+    mainWindow->lowpassEdit->setValidator( new QDoubleValidator(mainWindow->lowpassEdit) );
+    mainWindow->notchEdit->setValidator( new QDoubleValidator(mainWindow->notchEdit) );
+    mainWindow->rejectBeatsEdit->setValidator( new QIntValidator(0, 1, mainWindow->rejectBeatsEdit) );
+    mainWindow->eventPulseEdit->setValidator( new QDoubleValidator(mainWindow->eventPulseEdit) );
+    mainWindow->adaptiveStimEdit->setValidator( new QIntValidator(0, 1, mainWindow->adaptiveStimEdit) );
+    mainWindow->captureWindowEdit->setValidator( new QDoubleValidator(mainWindow->captureWindowEdit) );
+    mainWindow->testPulseEdit->setValidator( new QDoubleValidator(mainWindow->testPulseEdit) );
+    mainWindow->testPulseLengthEdit->setValidator( new QDoubleValidator(mainWindow->testPulseLengthEdit) );
+    mainWindow->testPulseBeatsEdit->setValidator( new QIntValidator(mainWindow->testPulseBeatsEdit) );
+    mainWindow->rsCompensationEdit->setValidator( new QDoubleValidator(0, ClampEngine::maxRsCompensation, 1, mainWindow->rsCompensationEdit) );
+    mainWindow->beatRecordEdit->setValidator( new QIntValidator(0, 1, mainWindow->beatRecordEdit) );
+    mainWindow->recordPreEdit->setValidator( new QDoubleValidator(mainWindow->recordPreEdit) );
+    mainWindow->recordPostEdit->setValidator( new QDoubleValidator(mainWindow->recordPostEdit) );
+    mainWindow->fullBeatEdit->setValidator( new QIntValidator(mainWindow->fullBeatEdit) );
     
     // Connect MainWindow elements to slot functions
     QObject::connect( mainWindow->addStepButton, SIGNAL(clicked(void)), this, SLOT( addStep(void)) );
@@ -659,7 +537,25 @@ void AP_Clamp::Module::createGUI( void ) {
     QObject::connect( mainWindow->stimMagEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
     QObject::connect( mainWindow->stimLengthEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
     QObject::connect( mainWindow->LJPEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->statsWindowEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->channelsEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->artifactBeatsEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->lowpassEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->notchEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->rejectBeatsEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->eventPulseEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->adaptiveStimEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->captureWindowEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->testPulseEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->testPulseLengthEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->testPulseBeatsEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->rsCompensationEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->beatRecordEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->recordPreEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->recordPostEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
+    QObject::connect( mainWindow->fullBeatEdit, SIGNAL(returnPressed(void)), this, SLOT( modify(void)) );
     QObject::connect(timer, SIGNAL(timeout(void)), this, SLOT(refreshDisplay(void)));
+    QObject::connect(plotTimer, SIGNAL(timeout(void)), this, SLOT(refreshPlots(void)));
 
     // Connections to allow only one button being toggled at a time
     QObject::connect( mainWindow->thresholdButton, SIGNAL(toggled(bool)), mainWindow->staticPacingButton, SLOT( setDisabled(bool)) );
@@ -670,10 +566,19 @@ void AP_Clamp::Module::createGUI( void ) {
     QObject::connect( mainWindow->staticPacingButton, SIGNAL(toggled(bool)), mainWindow->startProtocolButton, SLOT( setDisabled(bool)) );
                       
     // Connect states to workspace
-    setData( Workspace::STATE, 0, &time );
-    setData( Workspace::STATE, 1, &voltage );
-    setData( Workspace::STATE, 2, &beatNum );
-    setData( Workspace::STATE, 3, &APD );
+    setData( Workspace::STATE, 0, &engine->time );
+    setData( Workspace::STATE, 1, &engine->voltage );
+    setData( Workspace::STATE, 2, &engine->beatNum );
+    setData( Workspace::STATE, 3, &engine->APD );
+    setData( Workspace::STATE, 4, &engine->STV );
+    setData( Workspace::STATE, 5, &engine->alternans );
+    setData( Workspace::STATE, 9, &engine->vmFiltered ); // 6-8 are set up with the channel bank
+    setData( Workspace::STATE, 10, &engine->stimAmplitude );
+    setData( Workspace::STATE, 11, &engine->current );
+    setData( Workspace::STATE, 12, &engine->currentCorrected );
+    setData( Workspace::STATE, 13, &engine->Rs );
+    setData( Workspace::STATE, 14, &engine->Rm );
+    setData( Workspace::STATE, 15, &engine->Cm );
 
 	 subWindow->show();
 } // End createGUI()
@@ -693,7 +598,7 @@ void AP_Clamp::Module::doLoad(const Settings::Object::State &s) {
     loadedFile = QString::fromStdString(s.loadString("Protocol"));
     if( loadedFile != "" ) {        
         protocol->loadProtocol( this, loadedFile );
-        rebuildListBox();
+        protocolModel->protocolReset();
     }
 
     mainWindow->APDRepolEdit->setText( QString::number( s.loadInteger("APD Repol") ) );
@@ -705,6 +610,29 @@ void AP_Clamp::Module::doLoad(const Settings::Object::State &s) {
     mainWindow->stimMagEdit->setText( QString::number( s.loadInteger("Stim Mag") ) );
     mainWindow->stimLengthEdit->setText( QString::number( s.loadInteger("Stim Length") ) );
     mainWindow->LJPEdit->setText( QString::number( s.loadInteger("LJP") ) );    
+    if( s.loadInteger("Stats Window") > 0 ) // Not present in settings saved by older versions
+        mainWindow->statsWindowEdit->setText( QString::number( s.loadInteger("Stats Window") ) );
+    if( s.loadInteger("Channels") > 0 )
+        mainWindow->channelsEdit->setText( QString::number( s.loadInteger("Channels") ) );
+    mainWindow->artifactBeatsEdit->setText( QString::number( s.loadInteger("Artifact Beats") ) ); // 0 (off) if not present
+    mainWindow->lowpassEdit->setText( QString::number( s.loadDouble("Lowpass") ) );
+    mainWindow->notchEdit->setText( QString::number( s.loadDouble("Notch") ) );
+    mainWindow->rejectBeatsEdit->setText( QString::number( s.loadInteger("Reject Beats") ) ); // 0 (average every beat) if not present
+    mainWindow->eventPulseEdit->setText( QString::number( s.loadDouble("EAD/DAD Pulse") ) );
+    mainWindow->adaptiveStimEdit->setText( QString::number( s.loadInteger("Adaptive Stim") ) );
+    if( s.loadDouble("Capture Window") > 0 ) // Not present in settings saved by older versions
+        mainWindow->captureWindowEdit->setText( QString::number( s.loadDouble("Capture Window") ) );
+    mainWindow->testPulseEdit->setText( QString::number( s.loadDouble("Test Pulse") ) ); // 0 (off) if not present
+    if( s.loadDouble("Test Pulse Length") > 0 )
+        mainWindow->testPulseLengthEdit->setText( QString::number( s.loadDouble("Test Pulse Length") ) );
+    mainWindow->testPulseBeatsEdit->setText( QString::number( s.loadInteger("Test Pulse Beats") ) );
+    mainWindow->rsCompensationEdit->setText( QString::number( s.loadDouble("Rs Comp") ) );
+    mainWindow->beatRecordEdit->setText( QString::number( s.loadInteger("Beat Record") ) ); // 0 (data recorder) if not present
+    if( s.loadDouble("Record Pre") > 0 )
+        mainWindow->recordPreEdit->setText( QString::number( s.loadDouble("Record Pre") ) );
+    if( s.loadDouble("Record Post") > 0 )
+        mainWindow->recordPostEdit->setText( QString::number( s.loadDouble("Record Post") ) );
+    mainWindow->fullBeatEdit->setText( QString::number( s.loadInteger("Full Beat Every") ) );
     
     modify();
 }
@@ -722,15 +650,32 @@ void AP_Clamp::Module::doSave(Settings::Object::State &s) const {
     s.saveInteger( "W", parentWidget()->width() );
     s.saveInteger( "H", parentWidget()->height() );
     s.saveString( "Protocol", loadedFile.toStdString() );
-    s.saveInteger( "APD Repol", APDRepol );
-    s.saveInteger( "Min APD", minAPD );
-    s.saveInteger( "Stim Window", stimWindow );
-    s.saveInteger( "Num Trials", numTrials);
-    s.saveInteger( "Interval Time", intervalTime );
-    s.saveInteger( "BCL", BCL );
-    s.saveDouble( "Stim Mag", stimMag );
-    s.saveDouble( "Stim Length", stimLength );
-    s.saveDouble( "LJP", LJP );
+    s.saveInteger( "APD Repol", engine->APDRepol );
+    s.saveInteger( "Min APD", engine->minAPD );
+    s.saveInteger( "Stim Window", engine->stimWindow );
+    s.saveInteger( "Num Trials", engine->numTrials);
+    s.saveInteger( "Interval Time", engine->intervalTime );
+    s.saveInteger( "BCL", engine->BCL );
+    s.saveDouble( "Stim Mag", engine->stimMag );
+    s.saveDouble( "Stim Length", engine->stimLength );
+    s.saveDouble( "LJP", engine->LJP );
+    s.saveInteger( "Stats Window", engine->statsWindow );
+    s.saveInteger( "Channels", engine->numChannels );
+    s.saveInteger( "Artifact Beats", engine->artifactBeats );
+    s.saveDouble( "Lowpass", lowpassCutoff );
+    s.saveDouble( "Notch", notchFrequency );
+    s.saveInteger( "Reject Beats", engine->rejectBeats );
+    s.saveDouble( "EAD/DAD Pulse", engine->eventPulseLength );
+    s.saveInteger( "Adaptive Stim", engine->adaptiveStim );
+    s.saveDouble( "Capture Window", engine->captureWindow );
+    s.saveDouble( "Test Pulse", engine->testPulseAmplitude );
+    s.saveDouble( "Test Pulse Length", engine->testPulseLength );
+    s.saveInteger( "Test Pulse Beats", engine->testPulseBeats );
+    s.saveDouble( "Rs Comp", engine->rsCompensation );
+    s.saveInteger( "Beat Record", beatRecord );
+    s.saveDouble( "Record Pre", recordPre );
+    s.saveDouble( "Record Post", recordPost );
+    s.saveInteger( "Full Beat Every", fullBeatInterval );
 }
 
 void AP_Clamp::Module::modify(void) {
@@ -743,9 +688,66 @@ void AP_Clamp::Module::modify(void) {
     double sm = mainWindow->stimMagEdit->text().toDouble();
     double sl = mainWindow->stimLengthEdit->text().toDouble();
     double ljp = mainWindow->LJPEdit->text().toDouble();
+    int stw = mainWindow->statsWindowEdit->text().toInt();
+    int ch = mainWindow->channelsEdit->text().toInt();
+    int ab = mainWindow->artifactBeatsEdit->text().toInt();
+    double lp = mainWindow->lowpassEdit->text().toDouble();
+    double nf = mainWindow->notchEdit->text().toDouble();
+    int rb = mainWindow->rejectBeatsEdit->text().toInt() ? 1 : 0;
+    mainWindow->rejectBeatsEdit->setText( QString::number( rb ) );
+    double ep = mainWindow->eventPulseEdit->text().toDouble();
+    if( ep < 0 ) ep = 0;
+    int as = mainWindow->adaptiveStimEdit->text().toInt() ? 1 : 0;
+    mainWindow->adaptiveStimEdit->setText( QString::number( as ) );
+    double cw = mainWindow->captureWindowEdit->text().toDouble();
+    double tpa = mainWindow->testPulseEdit->text().toDouble();
+    double tpl = mainWindow->testPulseLengthEdit->text().toDouble();
+    int tpb = mainWindow->testPulseBeatsEdit->text().toInt();
+    double rsc = mainWindow->rsCompensationEdit->text().toDouble();
+    int br = mainWindow->beatRecordEdit->text().toInt() ? 1 : 0;
+    mainWindow->beatRecordEdit->setText( QString::number( br ) );
+    double rpre = mainWindow->recordPreEdit->text().toDouble();
+    double rpost = mainWindow->recordPostEdit->text().toDouble();
+    int fbe = mainWindow->fullBeatEdit->text().toInt();
+
+    if( lp != lowpassCutoff || nf != notchFrequency ) { // Filter is installed by its own event, not by ModifyEvent
+        lowpassCutoff = lp;
+        notchFrequency = nf;
+        setValue( 12, lp );
+        setValue( 13, nf );
+        updateFilter();
+    }
 
-    if( APDr == APDRepol && mAPD == minAPD && sw == stimWindow && nt == numTrials && it == intervalTime
-        && b == BCL && sm == stimMag && sl == stimLength && ljp == LJP ) // If nothing has changed
+    if( stw < 2 ) stw = 2; // At least one beat-to-beat difference
+    if( stw > ClampEngine::maxStatsWindow ) stw = ClampEngine::maxStatsWindow;
+    mainWindow->statsWindowEdit->setText( QString::number( stw ) );
+    if( ch < 1 ) ch = 1;
+    if( ch > ChannelBank::maxChannels ) ch = ChannelBank::maxChannels;
+    mainWindow->channelsEdit->setText( QString::number( ch ) );
+    if( ab < 0 ) ab = 0;
+    if( ab > ClampEngine::maxArtifactBeats ) ab = ClampEngine::maxArtifactBeats;
+    mainWindow->artifactBeatsEdit->setText( QString::number( ab ) );
+    if( tpl > ClampEngine::maxTestPulseLength * engine->period ) tpl = ClampEngine::maxTestPulseLength * engine->period; // Capture buffer is sized in ticks
+    if( tpl < 0 ) tpl = 0;
+    mainWindow->testPulseLengthEdit->setText( QString::number( tpl ) );
+    if( tpb < 0 ) tpb = 0;
+    mainWindow->testPulseBeatsEdit->setText( QString::number( tpb ) );
+    if( rsc < 0 ) rsc = 0;
+    if( rsc > ClampEngine::maxRsCompensation ) rsc = ClampEngine::maxRsCompensation;
+    mainWindow->rsCompensationEdit->setText( QString::number( rsc ) );
+    if( rpre < 0 ) rpre = 0;
+    mainWindow->recordPreEdit->setText( QString::number( rpre ) );
+    if( rpost < 0 ) rpost = 0;
+    mainWindow->recordPostEdit->setText( QString::number( rpost ) );
+    if( fbe < 0 ) fbe = 0;
+    mainWindow->fullBeatEdit->setText( QString::number( fbe ) );
+
+    if( APDr == engine->APDRepol && mAPD == engine->minAPD && sw == engine->stimWindow && nt == engine->numTrials && it == engine->intervalTime
+        && b == engine->BCL && sm == engine->stimMag && sl == engine->stimLength && ljp == engine->LJP && stw == engine->statsWindow
+        && ch == engine->numChannels && ab == engine->artifactBeats && rb == engine->rejectBeats
+        && ep == engine->eventPulseLength && as == engine->adaptiveStim && cw == engine->captureWindow && tpa == engine->testPulseAmplitude
+        && tpl == engine->testPulseLength && tpb == engine->testPulseBeats && rsc == engine->rsCompensation && br == beatRecord
+        && rpre == recordPre && rpost == recordPost && fbe == fullBeatInterval ) // If nothing has changed
         return ;
 
     // Set parameters
@@ -758,76 +760,370 @@ void AP_Clamp::Module::modify(void) {
     setValue( 6, sm );
     setValue( 7, sl );
     setValue( 8, ljp );
-
-    ModifyEvent event( this, APDr, mAPD, sw, nt, it, b, sm, sl, ljp );
+    setValue( 9, stw );
+    setValue( 10, ch );
+    setValue( 11, ab );
+    setValue( 14, rb );
+    setValue( 15, ep );
+    setValue( 16, as );
+    setValue( 17, cw );
+    setValue( 18, tpa );
+    setValue( 19, tpl );
+    setValue( 20, tpb );
+    setValue( 21, rsc );
+    setValue( 22, br );
+    setValue( 23, rpre );
+    setValue( 24, rpost );
+    setValue( 25, fbe );
+
+    ModifyEvent event( this, APDr, mAPD, sw, nt, it, b, sm, sl, ljp, stw, ch, ab, rb, ep, as, cw, tpa, tpl, tpb, rsc,
+                       br, rpre, rpost, fbe );
     RT::System::getInstance()->postEvent( &event );
 }
 
 void AP_Clamp::Module::refreshDisplay(void) {
-    mainWindow->timeEdit->setText( QString::number(time) );
-    mainWindow->voltageEdit->setText( QString::number(voltage) );
-    mainWindow->beatNumEdit->setText( QString::number(beatNum) );
-    mainWindow->APDEdit->setText( QString::number(APD) );
+    drainBeats();
+    mainWindow->timeEdit->setText( QString::number(engine->time) );
+    mainWindow->voltageEdit->setText( QString::number(engine->voltage) );
+    mainWindow->beatNumEdit->setText( QString::number(engine->beatNum) );
+    mainWindow->APDEdit->setText( QString::number(engine->APD) );
+    mainWindow->STVEdit->setText( QString::number(engine->STV) );
+    mainWindow->alternansEdit->setText( QString::number(engine->alternans) );
     
-    if( executeMode == IDLE ) {
-        if( mainWindow->startProtocolButton->isChecked() && !protocolOn ) {
+    if( engine->executeMode == ClampEngine::IDLE ) {
+        if( mainWindow->startProtocolButton->isChecked() && !engine->protocolOn ) {
             mainWindow->startProtocolButton->setChecked( false );
-		  } else if( mainWindow->thresholdButton->isChecked() && !thresholdOn ) {
+		  } else if( mainWindow->thresholdButton->isChecked() && !engine->thresholdOn ) {
             mainWindow->thresholdButton->setChecked( false );
-            mainWindow->stimMagEdit->setText( QString::number( stimMag ) );
+            mainWindow->stimMagEdit->setText( QString::number( engine->stimMag ) );
             modify();
 		  }
     }
-    else if( executeMode == PROTOCOL ) {
-        if( stepTracker != currentStep ) {
-            stepTracker = currentStep;
-            mainWindow->protocolEditorListBox->setCurrentRow( currentStep );
+    else if( engine->executeMode == ClampEngine::PROTOCOL ) {
+        if( engine->stepTracker != engine->currentStep ) { // Only the old and new current rows are repainted
+            engine->stepTracker = engine->currentStep;
+            protocolModel->setCurrentStep( engine->currentStep );
+            mainWindow->protocolEditorListBox->scrollTo( protocolModel->index( engine->currentStep ) );
         }        
     }
 }
 
+// Decimated data is pulled from the worker, cost is bounded by the plot widths
+void AP_Clamp::Module::refreshPlots( void ) {
+    if( !mainWindow->plotTab->isVisible() ) // Nothing to draw, decimator keeps running in the background
+        return ;
+
+    double sweepLength = engine->BCL;
+    if( engine->executeMode == ClampEngine::PROTOCOL && engine->pBCLInt > 0 )
+        sweepLength = engine->pBCLInt * engine->period;
+    engine->traceDecimator->setGeometry( mainWindow->vmPlot->plotWidth(), engine->period, sweepLength );
+    engine->traceDecimator->snapshot( traceSnapshot );
+    mainWindow->vmPlot->setXRange( 0, sweepLength );
+    mainWindow->vmPlot->setSeries( traceSnapshot );
+
+    drainBeats();
+    std::vector<MinMaxColumns> trend( 1, APDTrend->columns() );
+    mainWindow->APDPlot->setXRange( 0, trend[0].min.size() * APDTrend->bucketSize() ); // Beats
+    mainWindow->APDPlot->setSeries( trend );
+}
+
 AP_Clamp::Module::ModifyEvent::ModifyEvent(
                                            Module *m, int APDr, int mAPD, int sw, int nt, int it,
-                                           int b, double sm, double sl, double ljp ) 
+                                           int b, double sm, double sl, double ljp, int stw, int ch, int ab, int rb,
+                                           double ep, int as, double cw, double tpa, double tpl, int tpb, double rsc,
+                                           int br, double rpre, double rpost, int fbe ) 
     : module( m ), APDRepolValue( APDr ), 
       minAPDValue( mAPD ), stimWindowValue( sw ),
       numTrialsValue( nt ), intervalTimeValue( it ), 
       BCLValue( b ), stimMagValue( sm ), 
-      stimLengthValue( sl ), LJPValue( ljp ) { }
+      stimLengthValue( sl ), LJPValue( ljp ), statsWindowValue( stw ),
+      channelsValue( ch ), artifactBeatsValue( ab ), rejectBeatsValue( rb ),
+      eventPulseValue( ep ), adaptiveStimValue( as ), captureWindowValue( cw ),
+      testPulseAmplitudeValue( tpa ), testPulseLengthValue( tpl ), testPulseBeatsValue( tpb ),
+      rsCompensationValue( rsc ), beatRecordValue( br ), recordPreValue( rpre ),
+      recordPostValue( rpost ), fullBeatIntervalValue( fbe ) { }
 
 int AP_Clamp::Module::ModifyEvent::callback( void ) {
-    module->APDRepol = APDRepolValue;
-    module->minAPD = minAPDValue;
-    module->numTrials = numTrialsValue;
-    module->intervalTime = intervalTimeValue;
-    module->BCL = BCLValue;
-    module->BCLInt = module->BCL / module->period; // Update BCLInt when BCL is updated
-    module->stimMag = stimMagValue;
-    module->stimLength = stimLengthValue;
-    module->LJP = LJPValue;
+    module->engine->APDRepol = APDRepolValue;
+    module->engine->minAPD = minAPDValue;
+    module->engine->numTrials = numTrialsValue;
+    module->engine->intervalTime = intervalTimeValue;
+    module->engine->BCL = BCLValue;
+    module->engine->BCLInt = module->engine->timeBase.ticks( module->engine->BCL ); // Update BCLInt when BCL is updated
+    module->engine->stimMag = stimMagValue;
+    module->engine->stimLength = stimLengthValue;
+    module->engine->LJP = LJPValue;
+    if( module->engine->statsWindow != statsWindowValue ) { // Restarts the sliding window, no allocation
+        module->engine->statsWindow = statsWindowValue;
+        module->engine->windowStatistics->setWindow( statsWindowValue );
+    }
+    for( int c = channelsValue; c < module->engine->numChannels; c++ ) // Channels being switched off are left at 0
+        module->engine->outputs[1 + c] = module->output( 1 + c ) = 0;
+    module->engine->numChannels = channelsValue;
+    module->engine->channelBank->setChannels( channelsValue );
+    module->engine->artifactBeats = artifactBeatsValue; // Used when the next run starts
+    module->engine->rejectBeats = rejectBeatsValue;
+    module->engine->eventPulseLength = eventPulseValue;
+    module->engine->adaptiveStim = adaptiveStimValue;
+    module->engine->captureWindow = captureWindowValue;
+    if( !adaptiveStimValue ) module->engine->stimControl->reset();
+    module->engine->stimControl->setEnabled( adaptiveStimValue );
+    module->engine->updateStimAmplitude(); // stimMag may have changed
+    module->engine->testPulseAmplitude = testPulseAmplitudeValue; // Used when the next run starts
+    module->engine->testPulseLength = testPulseLengthValue;
+    module->engine->testPulseBeats = testPulseBeatsValue;
+    module->engine->rsCompensation = rsCompensationValue;
+    module->beatRecord = beatRecordValue; // Used when the next run starts
+    module->recordPre = recordPreValue;
+    module->recordPost = recordPostValue;
+    module->fullBeatInterval = fullBeatIntervalValue;
     
     return 0;
 }
 
+AP_Clamp::Module::FilterEvent::FilterEvent( Module *m, const FilterCoefficients &c ) : module( m ), coefficients( c ) { }
+
+int AP_Clamp::Module::FilterEvent::callback( void ) {
+    module->engine->filter->setCoefficients( coefficients, module->engine->voltage );
+    return 0;
+}
+
+// Coefficients depend on the thread period, so they are redesigned whenever it changes
+void AP_Clamp::Module::updateFilter( void ) {
+    FilterCoefficients coefficients;
+    if( lowpassCutoff > 0 && !coefficients.addLowpass( lowpassCutoff, engine->period ) )
+        ERROR_MSG("AP_Clamp Error: Lowpass cutoff must be below half the sampling rate\n");
+    if( notchFrequency > 0 && !coefficients.addNotch( notchFrequency, engine->period, 30 ) )
+        ERROR_MSG("AP_Clamp Error: Notch frequency must be below half the sampling rate\n");
+
+    FilterEvent event( this, coefficients );
+    RT::System::getInstance()->postEvent( &event );
+}
+
+/*** Batch Interface ***/
+
+Protocol *AP_Clamp::Module::batchProtocol( void ) {
+    return protocol;
+}
+
+bool AP_Clamp::Module::batchInsertStep( int idx, ProtocolStepPtr step ) {
+    return protocolModel->insertStep( idx, step );
+}
+
+bool AP_Clamp::Module::batchRemoveStep( int idx ) {
+    return protocolModel->removeStep( idx );
+}
+
+void AP_Clamp::Module::batchProtocolChanged( void ) {
+    protocolModel->protocolReset();
+}
+
+bool AP_Clamp::Module::batchBusy( void ) {
+    return engine->executeMode != ClampEngine::IDLE;
+}
+
+// Protocol is started through the button so the GUI stays consistent with the RT state
+bool AP_Clamp::Module::batchStart( QString &error ) {
+    if( engine->executeMode != ClampEngine::IDLE ) {
+        error = "Module is busy";
+        return false;
+    }
+    ProtocolProgram check; // startProtocol() compiles again, this only catches errors for the reply
+    if( !protocol->compile( check, error ) )
+        return false;
+
+    if( mainWindow->startProtocolButton->isChecked() ) // Previous run finished but display has not caught up yet
+        mainWindow->startProtocolButton->setChecked( false );
+    batchStartError = &error;
+    mainWindow->startProtocolButton->setChecked( true ); // Calls toggleProtocol()
+    batchStartError = NULL;
+    if( engine->protocolOn )
+        return true;
+    mainWindow->startProtocolButton->setChecked( false ); // Not left checked for the display to clear
+    return false;
+}
+
+void AP_Clamp::Module::batchStop( void ) {
+    if( mainWindow->startProtocolButton->isChecked() )
+        mainWindow->startProtocolButton->setChecked( false ); // Calls toggleProtocol()
+    else
+        stopProtocol();
+}
+
+QString AP_Clamp::Module::batchStatus( void ) {
+    const char *modeNames[] = { "IDLE", "THRESHOLD", "PACE", "PROTOCOL" };
+    const char *artifactNames[] = { "off", "learning", "learning", "ready" };
+    drainBeats();
+    return QString( "mode=%1 trial=%2 step=%3 beat=%4 time=%5 APD=%6 beats=%7 artifact=%8 stimscale=%9" )
+        .arg( modeNames[engine->executeMode] ).arg( engine->currentTrial ).arg( engine->currentStep )
+        .arg( engine->beatNum ).arg( engine->time ).arg( engine->APD ).arg( beatLog.size() ).arg( artifactNames[engine->artifact->status()] )
+        .arg( engine->stimScale )
+        + QString( " Rs=%1 Rm=%2 Cm=%3" ).arg( engine->Rs ).arg( engine->Rm ).arg( engine->Cm ) // 0 until a test pulse has been fitted
+        + QString( " droppedsweeps=%1" ).arg( engine->sweeps->dropped() )
+        + QString( " recordedbeats=%1 droppedsamples=%2" ).arg( engine->beatRecorder->beats() ).arg( engine->beatRecorder->dropped() )
+        + QString( " pendingsaves=%1 failedsaves=%2" ).arg( archiver->pending() ).arg( archiver->failed() )
+        + QString( " workers=%1 droppedposts=%2" ).arg( worker->threads() ).arg( worker->dropped() );
+}
+
+const std::vector<BeatResult> &AP_Clamp::Module::batchBeats( void ) {
+    drainBeats();
+    return beatLog;
+}
+
+const std::vector<StatisticsSummary> &AP_Clamp::Module::batchStatistics( void ) {
+    drainBeats();
+    return statisticsLog;
+}
+
+void AP_Clamp::Module::batchRestitution( std::vector<RestitutionPoint> &points, RestitutionFit &fit ) {
+    engine->restitution->results( points, fit );
+}
+
+// Taken from the last beat so the RT thread's accumulators are never read directly
+BeatStatisticsResult AP_Clamp::Module::batchWindowStatistics( void ) {
+    drainBeats();
+    if( beatLog.size() > 0 )
+        return beatLog.back().windowStats;
+
+    BeatStatisticsResult empty = { 0, 0, 0, 0, 0, 0 };
+    return empty;
+}
+
+QStringList AP_Clamp::Module::batchSweepNames( void ) {
+    return sweepNames;
+}
+
+std::vector<SweepResult> AP_Clamp::Module::batchSweepResults( void ) {
+    std::vector<SweepResult> results;
+    engine->sweeps->results( results );
+    return results;
+}
+
+bool AP_Clamp::Module::batchSweepData( int sweep, bool difference, std::vector<double> &data, double &samplePeriod ) {
+    samplePeriod = engine->sweeps->samplePeriod();
+    return difference ? engine->sweeps->difference( sweep, data ) : engine->sweeps->mean( sweep, data );
+}
+
+void AP_Clamp::Module::batchSetRecordFile( QString base ) {
+    recordFile = base;
+}
+
+// Slot is copied here and compressed by the worker, blocks are one beat long
+bool AP_Clamp::Module::batchSaveTrace( int slot, QString file, double blockLength, double resolution, QString &error ) {
+    if( engine->executeMode != ClampEngine::IDLE ) { // RT thread may be writing the slot
+        error = "Module is busy";
+        return false;
+    }
+    if( slot < 0 || slot >= Protocol::numRecordSlots || engine->traces->slot( slot )->size() == 0 ) {
+        error = "Slot is empty or out of range";
+        return false;
+    }
+
+    const TraceSlot *trace = engine->traces->slot( slot );
+    double slotPeriod = trace->period() > 0 ? trace->period() : engine->period; // Saved at the period it was taken at
+    int length = ( blockLength > 0 ? blockLength : engine->BCL ) / slotPeriod;
+    std::vector<double> data( trace->size() );
+    trace->read( 0, data.size(), &data[0] );
+    archiver->save( file.toStdString(), data, length, resolution > 0 ? resolution : voltageResolution, slotPeriod );
+    return true;
+}
+
+// Whole trace, or a single block (beat) if block >= 0, returns the number of samples loaded
+int AP_Clamp::Module::batchLoadTrace( int slot, QString file, int block, QString &error ) {
+    if( engine->executeMode != ClampEngine::IDLE ) {
+        error = "Module is busy";
+        return -1;
+    }
+    if( slot < 0 || slot >= Protocol::numRecordSlots ) {
+        error = "Slot out of range";
+        return -1;
+    }
+
+    TraceFileReader reader;
+    if( !reader.open( file.toStdString() ) ) {
+        error = "Unable to read trace file " + file;
+        return -1;
+    }
+    std::vector<double> data;
+    bool ok = block < 0 ? reader.readAll( data ) : reader.readBlock( block, data );
+    if( !ok ) {
+        error = block < reader.blocks() ? "Trace file is truncated" : "Block out of range";
+        return -1;
+    }
+    TraceSlot *trace = engine->traces->slot( slot ); // Converted to the slot type
+    trace->clear();
+    trace->resize( data.size() );
+    trace->write( 0, data.size(), data.empty() ? 0 : &data[0] );
+    trace->setPeriod( reader.header().period ); // Resampled when a protocol uses it at another period
+    return data.size();
+}
+
+bool AP_Clamp::Module::batchSetSlotFormat( int slot, TraceSlot::format_t format, double scale, double offset, QString &error ) {
+    if( engine->executeMode != ClampEngine::IDLE ) {
+        error = "Module is busy";
+        return false;
+    }
+    if( slot < 0 || slot >= Protocol::numRecordSlots ) {
+        error = "Slot out of range";
+        return false;
+    }
+    engine->traces->setFormat( slot, format, scale > 0 ? scale : voltageResolution, offset );
+    return true;
+}
+
+const TraceStore *AP_Clamp::Module::batchTraceStore( void ) {
+    return engine->traces;
+}
+
+bool AP_Clamp::Module::batchSetDigest( bool on, int slot, QString &error ) {
+    if( engine->executeMode != ClampEngine::IDLE ) {
+        error = "Module is busy";
+        return false;
+    }
+    if( slot < -1 || slot >= Protocol::numRecordSlots ) {
+        error = "Slot out of range";
+        return false;
+    }
+    engine->digestRequested = on;
+    engine->replaySlot = on ? slot : -1;
+    return true;
+}
+
+// Reset after reading is done by the RT thread at its next tick, false in builds without APC_PROFILE
+bool AP_Clamp::Module::batchProfile( bool reset, double &samplePeriod, std::vector<TickProfileSummary> &summaries ) {
+#ifdef APC_PROFILE
+    samplePeriod = engine->period;
+    summaries.clear();
+    for( int i = 0; i < engine->profile->size(); i++ )
+        summaries.push_back( engine->profile->summary( i ) );
+    if( reset )
+        engine->profile->requestReset();
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Digest and tick count of the current or last digested run, and execute() throughput over it
+QString AP_Clamp::Module::batchDigest( void ) {
+    return QString( "%1 %2 %3" ).arg( engine->digest.value(), 16, 16, QChar('0') ).arg( engine->digest.ticks() ).arg( engine->digest.throughput(), 0, 'f', 0 );
+}
+
 // Event handling
 void AP_Clamp::Module::receiveEvent( const ::Event::Object *event ) {
-    if( event->getName() == Event::RT_POSTPERIOD_EVENT ) {
-        period = RT::System::getInstance()->getPeriod()*1e-6; // Grabs RTXI thread period and converts to ms (from ns)
-        BCLInt = BCL / period;
-        stimLengthInt = stimLength / period;
+    if( event->getName() == Event::RT_POSTPERIOD_EVENT ) { // receiveEventRT has already carried the run over to the new period
+        QTimer::singleShot( 0, this, SLOT(updateFilter(void)) ); // Posted once event handling is done
     }
 
-    if( event->getName() == Event::START_RECORDING_EVENT ) recording = true;
-    if( event->getName() == Event::STOP_RECORDING_EVENT ) recording = false;
+    if( event->getName() == Event::START_RECORDING_EVENT ) engine->recording = true;
+    if( event->getName() == Event::STOP_RECORDING_EVENT ) engine->recording = false;
 }
 
 void AP_Clamp::Module::receiveEventRT( const ::Event::Object *event ) {
     if( event->getName() == Event::RT_POSTPERIOD_EVENT ) {
-        period = RT::System::getInstance()->getPeriod()*1e-6; // Grabs RTXI thread period and converts to ms (from ns)
-        BCLInt = BCL / period;
-        stimLengthInt = stimLength / period;
+        engine->setPeriod( RT::System::getInstance()->getPeriod()*1e-6 ); // Grabs RTXI thread period and converts to ms (from ns)
     }
 
-    if( event->getName() == Event::START_RECORDING_EVENT ) recording = true;
-    if( event->getName() == Event::STOP_RECORDING_EVENT ) recording = false;
+    if( event->getName() == Event::START_RECORDING_EVENT ) engine->recording = true;
+    if( event->getName() == Event::STOP_RECORDING_EVENT ) engine->recording = false;
 }
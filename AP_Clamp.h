@@ -30,6 +30,12 @@
 
 #include "include/APC_Protocol.h" // Protocol Library
 #include "include/APC_MainWindowUI.h" // Main Window GUI
+#include "include/APC_ProtocolModel.h" // Protocol list model
+#include "include/APC_BatchServer.h" // Headless command interface
+#include "include/APC_Engine.h" // RT core, no Qt or RTXI
+#include "include/APC_Worker.h" // Background analysis threads
+#include "include/APC_Decimator.h" // Plot decimation
+#include "include/APC_TraceArchive.h" // Compressed trace files
 
 #include <vector>
 
@@ -43,7 +49,8 @@
 
 namespace AP_Clamp {
     class Module: public QWidget, public RT::Thread, public Plugin::Object, 
-                  public Workspace::Instance, public Event::Handler, public Event::RTHandler {
+                  public Workspace::Instance, public Event::Handler, public Event::RTHandler,
+                  public BatchTarget, public EngineHost {
     
         Q_OBJECT // macro needed if slots are implemented
     
@@ -54,6 +61,37 @@ namespace AP_Clamp {
         void execute( void );
         void receiveEvent( const ::Event::Object * );
         void receiveEventRT( const ::Event::Object * );
+
+        // Batch interface
+        Protocol *batchProtocol( void );
+        bool batchInsertStep( int, ProtocolStepPtr );
+        bool batchRemoveStep( int );
+        void batchProtocolChanged( void );
+        bool batchBusy( void );
+        bool batchStart( QString & );
+        void batchStop( void );
+        QString batchStatus( void );
+        const std::vector<BeatResult> &batchBeats( void );
+        const std::vector<StatisticsSummary> &batchStatistics( void );
+        BeatStatisticsResult batchWindowStatistics( void );
+        QStringList batchSweepNames( void );
+        std::vector<SweepResult> batchSweepResults( void );
+        bool batchSweepData( int, bool, std::vector<double> &, double & );
+        void batchRestitution( std::vector<RestitutionPoint> &, RestitutionFit & );
+        void batchSetRecordFile( QString );
+        bool batchSaveTrace( int, QString, double, double, QString & );
+        int batchLoadTrace( int, QString, int, QString & );
+        bool batchSetSlotFormat( int, TraceSlot::format_t, double, double, QString & );
+        const TraceStore *batchTraceStore( void );
+        bool batchSetDigest( bool, int, QString & );
+        QString batchDigest( void );
+        bool batchProfile( bool, double &, std::vector<TickProfileSummary> & );
+
+        // Engine callbacks, RT thread
+        void engineRecord( bool );
+        void enginePost( int );
+        void engineError( const char * );
+        long long engineClock( void );
                          
     public slots:
         void modify( void ); // Updates parameters
@@ -67,92 +105,62 @@ namespace AP_Clamp {
         void togglePace( void ); // Called when pace button is toggled
         void toggleThreshold( void ); // Called when threshold button is toggled
         void refreshDisplay( void );
+        void refreshPlots( void ); // Updates live Vm and APD plots
 
     private:
         // GUI
         AP_ClampUI *mainWindow;
+        BatchServer *batchServer;
+        QString *batchStartError; // Set while batchStart() toggles the protocol button, a failed start is returned instead of shown
     
+        // RT core, states and parameters shown by the GUI live here
+        ClampEngine *engine;
+
         // Flags
-        enum executeMode_t { IDLE, THRESHOLD, PACE, PROTOCOL } executeMode;
-        enum protocolMode_t { STEPINIT, EXEC, END } protocolMode;
-        bool recording; // True if data recording is recording
-        bool vmRecording;
-        bool stepInitDone;
         QString loadedFile;
-        bool protocolOn;
-        bool thresholdOn;
         bool paceOn;
-        int stepTracker;
-        int currentTrial;
-
-        // States
-        double time; // Time (ms)
-        double voltage; // Membrane voltage
-        double beatNum; // Beat number
-        double APD; // Action potential duration
-
-        // Parameters
-        int APDRepol; // APD Repolarization percentage
-        int minAPD; // Minimum duration of depolarization that counts as action potential
-        int stimWindow; // Window of time after stimulus ignored by APD calculation
-        int numTrials; // Number of trials to be run
-        int intervalTime; // Time between trials
-        int BCL; // Basic cycle length
-        double stimMag; // Stimulation magnitude (nA)
-        double stimLength; // Stimulation length (ms)
-        double LJP; // Liquid junction potential (mV);
+
+        // Parameters applied outside the engine
+        double lowpassCutoff; // Hz, 0 is off
+        double notchFrequency; // Hz, 0 is off
+        int beatRecord; // If 1, recording spans go to the beat recorder instead of the data recorder
+        double recordPre; // Kept before each stimulus (ms)
+        double recordPost; // Kept after each stimulus (ms)
+        int fullBeatInterval; // Every Nth beat is kept in full, 0 is never
 
         // Protocol Variables
         Protocol *protocol;
+        ProtocolModel *protocolModel; // Model behind protocolEditorListBox
         std::vector<ProtocolStepPtr> *protocolContainer; // Protocol container
-        ProtocolStepPtr stepPtr; // Pointer to protocol step in protocol ctonainer
-        ProtocolStep::stepType_t stepType; // Current step type for current step
-        double outputCurrent; // Current output
-        int currentStep; // Current step in protocol
-        int stepTime; // Time tracker for step
-        int stepEndTime; // Time end tracker for step
-        int cycleStartTime; // Time tracker for BCL
-        double period; // Period based on RTXI thread rate
-        int BCLInt; // BCL / period (unitless)
-        int pBCLInt; // BCL for protocol
-        int stimLengthInt; // stimLength / period (unitless)
-        int digitalOut; // Digital output for triggering
-
-        // APD Calculation    
-        double upstrokeThreshold; // Upstroke threshold for start of AP
-        double downstrokeThreshold; // Downstroke threshold for end of AP
-        enum APDMode_t { START, PEAK, DOWN, DONE } APDMode;
-        double APStart; // Time the action potential starts   
-        double peakVoltage; // Peak of action potential
-        double peakTime; // Time of action potential peak
-        double Vrest;
-
-        // Threshold Variables
-        bool actionPotential;
-        bool thresholdStimulate;
-        bool backToBaseline;
-        double stimulusLevel;
-        double startingStimulusLevel;
-        double responseTime, initialStimulusTime;
-        double diastolicThreshold;
-        double responseDuration;
-        double peakVoltageT;
-
-        // AP Clamp Variables
-        std::vector< std::vector<double> > voltageData;
-        std::vector<double> *vmRecordData;
-        std::vector<double> *avgRecordData;
-        std::vector<double> *apClampData;
-        int recordingIndex;
-        int vmRecordCnt, avgCnt, apClampCnt;
+        QStringList sweepNames; // Names of the sweep numbers of the running protocol
+
+        // Beat-gated recording, replaces the data recorder while beatRecord is set
+        QString recordFile; // Base name set through batch, empty for a timestamped name
+        QString beatRecordBase; // Base name of the current or last beat record
+
+        // Per-beat results, filled from the engine fifos by GUI thread
+        std::vector<BeatResult> beatLog; // Results of current run
+        std::vector<StatisticsSummary> statisticsLog;
+
+        // Live plots
+        WorkerPool *worker; // Services the analysis tasks of the engine off the RT and GUI threads
+        TrendDecimator *APDTrend; // APD vs beat
+        std::vector<MinMaxColumns> traceSnapshot;
+
+        TraceArchiver *archiver; // Compresses slots saved through batch, serviced by worker
    
         // Module functions
         void createGUI(); // Construct GUI
         void initialize(); // Initialization
-        void rebuildListBox( void ); // Builds protocol list box
-        void calculateAPD( int ); // Calulates action potential duration
+        int selectedStep( void ); // Step selected in protocol list box, -1 if none
+        void drainBeats( void ); // Moves finished beats from the engine fifos to beatLog
+        void clearResults( void ); // Discards per-beat results before a new run
+        bool openBeatRecord( void ); // Opens the beat recorder if beatRecord is set, false if the files cannot be created
+        bool startProtocol( QString & ); // Starts protocol, error message returned by reference
+        void stopProtocol( void ); // Stops protocol and data recorder
 
         friend class ModifyEvent;
+        friend class FilterEvent;
         friend class ToggleProtocolEvent;
         friend class TogglePaceEvent;
         friend class ToggleThresholdEvent;
@@ -160,7 +168,8 @@ namespace AP_Clamp {
         class ModifyEvent : public RT::Event {
         public:
             ModifyEvent( Module *, int, int, int, int, int, int,
-                         double, double, double );
+                         double, double, double, int, int, int, int, double, int, double,
+                         double, double, int, double, int, double, double, int );
             ~ModifyEvent( void ) { };
 
             int callback( void );
@@ -176,14 +185,43 @@ namespace AP_Clamp {
             double stimMagValue;
             double stimLengthValue;
             double LJPValue;
+            int statsWindowValue;
+            int channelsValue;
+            int artifactBeatsValue;
+            int rejectBeatsValue;
+            double eventPulseValue;
+            int adaptiveStimValue;
+            double captureWindowValue;
+            double testPulseAmplitudeValue;
+            double testPulseLengthValue;
+            int testPulseBeatsValue;
+            double rsCompensationValue;
+            int beatRecordValue;
+            double recordPreValue;
+            double recordPostValue;
+            int fullBeatIntervalValue;
 
         }; // class ModifyEvent
+
+        class FilterEvent : public RT::Event {
+        public:
+            FilterEvent( Module *, const FilterCoefficients & );
+            ~FilterEvent( void ) { };
+
+            int callback( void );
+
+        private:
+            Module *module;
+            FilterCoefficients coefficients;
+
+        }; // class FilterEvent
         
     protected:
         void doLoad( const Settings::Object::State & );
         void doSave( Settings::Object::State & ) const;
                                           
     private slots:
+        void updateFilter( void ); // Designs filter for the current period and installs it in the RT thread
 
     }; // Class Module
     
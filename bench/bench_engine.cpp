@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * bench_engine.cpp
+ * Cost of ClampEngine::tick() per execute mode and step type, across
+ * sample rates, beat lengths and slot formats, with the cache counters
+ * of the CPU when the kernel gives access to them
+ *
+ *** NOTES
+ *
+ * Every benchmark is run twice. The first pass paces the model cell in
+ * closed loop and records the input of every tick. The second pass
+ * builds the same engine and feeds it the recorded input, so only
+ * tick() is timed and the engine takes exactly the path of the closed
+ * loop run. Steps before the measured one (the AVERAGE that fills the
+ * AP clamp slot) are replayed untimed. The analysis tasks are serviced
+ * every 20 ms of ticks, outside the timed blocks, as the worker pool
+ * would from another core.
+ *
+ * The beat length sets the size of the AVERAGE staging buffer and of
+ * the AP clamp slot, from 5 KB (250 ms of int16 at 10 kHz) to 1.3 MB
+ * (4 s of doubles at 40 kHz), so the buffer sizes cross the cache
+ * levels. Cache
+ * references, misses and L1D read misses are read with perf_event_open
+ * around the timed blocks only. They are reported as null if the
+ * kernel refuses (perf_event_paranoid, containers).
+ *
+ * This measures the engine offline. The time execute() takes on the
+ * rig, with RTXI and the amplifier, is still read from the PROFILE=1
+ * build through the batch profile command.
+ *
+ *   bench_engine [--ticks N] [--repetitions N] [--filter TEXT] [--json]
+ *
+ ***/
+
+#include "APC_TestRig.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const double serviceInterval = 20; // ms, same as the plugin's worker pool
+const int measuredSlot = 1;
+
+enum mode_t { IDLE, PACE, PROTOCOL };
+
+struct Benchmark {
+    std::string name;
+    mode_t mode;
+    ProtocolDefs::stepType_t step; // Measured step of a protocol
+    double period; // ms
+    double BCL; // ms
+    TraceSlot::format_t format; // AP clamp slot
+};
+
+struct Result {
+    double nsPerTick;
+    bool counted;
+    double references; // Per tick
+    double misses;
+    double L1DMisses;
+    size_t bufferBytes; // AVERAGE staging buffer or AP clamp slot
+};
+
+// Cache references, cache misses and L1D read misses as one group
+class CacheCounters {
+public:
+    CacheCounters( void ) : leader( -1 ) {
+        leader = open( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, -1 );
+        if( leader < 0 ) return ;
+        fds.push_back( leader );
+        fds.push_back( open( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, leader ) );
+        fds.push_back( open( PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) |
+                             ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ), leader ) );
+        if( fds[1] < 0 || fds[2] < 0 ) close();
+    }
+    ~CacheCounters( void ) { close(); }
+
+    bool available( void ) const { return leader >= 0; }
+    void reset( void ) { if( available() ) ioctl( leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP ); }
+    void enable( void ) { if( available() ) ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP ); }
+    void disable( void ) { if( available() ) ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP ); }
+    bool read( uint64_t values[3] ) {
+        uint64_t buffer[4]; // Number of events, then the values
+        if( !available() || ::read( leader, buffer, sizeof(buffer) ) != sizeof(buffer) ) return false;
+        for( int i = 0; i < 3; i++ )
+            values[i] = buffer[i + 1];
+        return true;
+    }
+
+private:
+    static int open( uint32_t type, uint64_t config, int group ) {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = ( group < 0 );
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return syscall( __NR_perf_event_open, &attr, 0, -1, group, 0 );
+    }
+    void close( void ) {
+        for( size_t i = 0; i < fds.size(); i++ )
+            if( fds[i] >= 0 ) ::close( fds[i] );
+        fds.clear();
+        leader = -1;
+    }
+
+    int leader;
+    std::vector<int> fds;
+};
+
+// Same engine setup for the recording and the timed pass, enough beats to outlast both
+void start( ClampEngine &engine, const Benchmark &b, long long ticks ) {
+    engine.BCL = (int)b.BCL;
+    if( b.mode == PACE ) engine.startPace();
+    if( b.mode != PROTOCOL ) return ;
+
+    int beats = (int)( ticks * b.period / b.BCL ) + 4;
+    ProtocolProgram program;
+    if( b.step == ProtocolDefs::WAIT )
+        program.push_back( protocolStep( ProtocolDefs::WAIT, 0, 0, 0, (int)( ticks * b.period ) + 1000 ) );
+    else if( b.step == ProtocolDefs::APCLAMP ) { // Command is the average of two paced beats
+        engine.traces->setFormat( measuredSlot, b.format, 0.01, 0 );
+        program.push_back( protocolStep( ProtocolDefs::AVERAGE, b.BCL, 2, measuredSlot ) );
+        program.push_back( protocolStep( ProtocolDefs::APCLAMP, b.BCL, beats, measuredSlot ) );
+        program.back().sweep = 0;
+    }
+    else
+        program.push_back( protocolStep( b.step, b.BCL, beats, measuredSlot ) );
+    engine.startProtocol( program, 1 );
+}
+
+bool measuring( const ClampEngine &engine, const Benchmark &b ) {
+    return b.mode != PROTOCOL || ( engine.protocolMode == ClampEngine::EXEC && engine.stepType == b.step );
+}
+
+long long now( void ) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+Result run( const Benchmark &b, long long ticks, CacheCounters &counters ) {
+    // Closed loop, input of every tick
+    std::vector<double> input;
+    size_t prefix = 0;
+    {
+        TestHost host;
+        ClampEngine engine( &host, b.period );
+        host.attach( &engine );
+        ModelCell cell;
+        settle( engine, cell );
+        start( engine, b, ticks );
+        for( ;; ) {
+            if( measuring( engine, b ) && input.size() >= prefix + ticks ) break;
+            if( !measuring( engine, b ) ) prefix = input.size() + 1;
+            input.push_back( cell.input() );
+            drive( engine, cell );
+        }
+    }
+
+    // Same engine fed the recorded input, only the measured ticks are timed
+    TestHost host;
+    ClampEngine engine( &host, b.period );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+    start( engine, b, ticks );
+    int service = engine.timeBase.ticks( serviceInterval );
+    for( size_t t = 0; t < prefix; t++ ) {
+        engine.inputs[0] = input[t];
+        engine.tick();
+        if( t % service == (size_t)service - 1 ) host.service();
+    }
+
+    Result result;
+    long long busy = 0;
+    counters.reset();
+    for( size_t t = prefix; t < input.size(); ) {
+        size_t end = std::min( input.size(), t + service );
+        counters.enable();
+        long long begin = now();
+        for( ; t < end; t++ ) {
+            engine.inputs[0] = input[t];
+            engine.tick();
+        }
+        busy += now() - begin;
+        counters.disable();
+        host.service();
+    }
+
+    uint64_t values[3];
+    result.nsPerTick = (double)busy / ticks;
+    result.counted = counters.read( values );
+    result.references = result.counted ? (double)values[0] / ticks : 0;
+    result.misses = result.counted ? (double)values[1] / ticks : 0;
+    result.L1DMisses = result.counted ? (double)values[2] / ticks : 0;
+    result.bufferBytes = 0;
+    if( b.step == ProtocolDefs::AVERAGE ) result.bufferBytes = engine.avgBeatData.size() * sizeof(double);
+    if( b.step == ProtocolDefs::APCLAMP ) result.bufferBytes = engine.traces->slot( measuredSlot )->bytes();
+    if( host.errors ) printf( "%s: engine error: %s", b.name.c_str(), host.lastError.c_str() );
+    return result;
+}
+
+std::string format( const char *fmt, double value ) {
+    char text[64];
+    snprintf( text, sizeof(text), fmt, value );
+    return text;
+}
+
+std::vector<Benchmark> benchmarks( void ) {
+    const double periods[] = { 0.1, 0.05, 0.025 }; // 10, 20 and 40 kHz
+    const double BCLs[] = { 250, 1000, 4000 };
+    const TraceSlot::format_t formats[] = { TraceSlot::DOUBLE, TraceSlot::FLOAT, TraceSlot::INT16 };
+
+    std::vector<Benchmark> list;
+    for( int p = 0; p < 3; p++ ) {
+        std::string rate = "/period:" + format( "%g", periods[p] );
+        Benchmark b;
+        b.period = periods[p];
+        b.BCL = 1000;
+        b.format = TraceSlot::DOUBLE;
+        b.step = ProtocolDefs::PACE;
+
+        b.mode = IDLE; b.name = "idle" + rate; list.push_back( b );
+        b.mode = PACE; b.name = "pace" + rate; list.push_back( b );
+        b.mode = PROTOCOL;
+        b.step = ProtocolDefs::WAIT; b.name = "wait" + rate; list.push_back( b );
+        for( int c = 0; c < 3; c++ ) {
+            b.BCL = BCLs[c];
+            std::string beat = "/bcl:" + format( "%g", BCLs[c] );
+            b.step = ProtocolDefs::PACE; b.name = "step-pace" + beat + rate; list.push_back( b );
+            b.step = ProtocolDefs::AVERAGE; b.name = "average" + beat + rate; list.push_back( b );
+            b.step = ProtocolDefs::APCLAMP;
+            for( int f = 0; f < 3; f++ ) {
+                b.format = formats[f];
+                b.name = std::string( "apclamp/" ) + TraceSlot::formatName( formats[f] ) + beat + rate;
+                list.push_back( b );
+            }
+            b.format = TraceSlot::DOUBLE;
+        }
+    }
+    return list;
+}
+
+} // namespace
+
+int main( int argc, char **argv ) {
+    long long ticks = 200000;
+    int repetitions = 3;
+    std::string filter;
+    bool json = false;
+    for( int i = 1; i < argc; i++ ) {
+        if( !strcmp( argv[i], "--ticks" ) && i + 1 < argc ) ticks = atoll( argv[++i] );
+        else if( !strcmp( argv[i], "--repetitions" ) && i + 1 < argc ) repetitions = atoi( argv[++i] );
+        else if( !strcmp( argv[i], "--filter" ) && i + 1 < argc ) filter = argv[++i];
+        else if( !strcmp( argv[i], "--json" ) ) json = true;
+        else {
+            printf( "usage: %s [--ticks N] [--repetitions N] [--filter TEXT] [--json]\n", argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if( ticks < 1 || repetitions < 1 ) return EXIT_FAILURE;
+
+    CacheCounters counters;
+    if( json ) printf( "{\n  \"ticks\": %lld,\n  \"repetitions\": %d,\n  \"cache_counters\": %s,\n  \"benchmarks\": [",
+                       ticks, repetitions, counters.available() ? "true" : "false" );
+    else {
+        printf( "%lld ticks, median of %d repetitions%s\n", ticks, repetitions,
+                counters.available() ? "" : ", cache counters unavailable" );
+        printf( "%-36s %10s %12s %10s %10s %10s %12s\n", "Benchmark", "ns/tick", "ticks/s", "refs/tick", "miss/tick",
+                "L1D/tick", "buffer (B)" );
+    }
+
+    std::vector<Benchmark> list = benchmarks();
+    bool first = true;
+    for( size_t i = 0; i < list.size(); i++ ) {
+        const Benchmark &b = list[i];
+        if( !filter.empty() && b.name.find( filter ) == std::string::npos ) continue;
+
+        std::vector<Result> results;
+        for( int r = 0; r < repetitions; r++ )
+            results.push_back( run( b, ticks, counters ) );
+        std::vector<double> times;
+        for( size_t r = 0; r < results.size(); r++ )
+            times.push_back( results[r].nsPerTick );
+        std::nth_element( times.begin(), times.begin() + times.size() / 2, times.end() );
+        double median = times[times.size() / 2];
+        const Result *m = &results[0];
+        for( size_t r = 0; r < results.size(); r++ )
+            if( results[r].nsPerTick == median ) m = &results[r];
+
+        if( json ) {
+            printf( "%s\n    { \"name\": \"%s\", \"period_ms\": %g, \"bcl_ms\": %g, \"ns_per_tick\": %.2f, \"ticks_per_s\": %.0f, ",
+                    first ? "" : ",", b.name.c_str(), b.period, b.BCL, m->nsPerTick, 1e9 / m->nsPerTick );
+            if( m->counted )
+                printf( "\"cache_refs_per_tick\": %.3f, \"cache_misses_per_tick\": %.3f, \"l1d_misses_per_tick\": %.3f, ",
+                        m->references, m->misses, m->L1DMisses );
+            else
+                printf( "\"cache_refs_per_tick\": null, \"cache_misses_per_tick\": null, \"l1d_misses_per_tick\": null, " );
+            printf( "\"buffer_bytes\": %zu }", m->bufferBytes );
+        }
+        else {
+            printf( "%-36s %10.1f %12.0f ", b.name.c_str(), m->nsPerTick, 1e9 / m->nsPerTick );
+            if( m->counted ) printf( "%10.3f %10.3f %10.3f ", m->references, m->misses, m->L1DMisses );
+            else printf( "%10s %10s %10s ", "-", "-", "-" );
+            printf( "%12zu\n", m->bufferBytes );
+        }
+        first = false;
+        fflush( stdout );
+    }
+    if( json ) printf( "\n  ]\n}\n" );
+    return EXIT_SUCCESS;
+}
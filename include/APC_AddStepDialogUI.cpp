@@ -55,6 +55,9 @@ AddStepDialog::AddStepDialog( QWidget* parent  ) : QDialog( parent ) {
     stepComboBox->insertItem( 6, tr( "Start: Data recorder" ) );
     stepComboBox->insertItem( 7, tr( "Stop: Data recorder" ) );
     stepComboBox->insertItem( 8, tr( "Wait" ) );
+    stepComboBox->insertItem( 9, tr( "Loop" ) );
+    stepComboBox->insertItem( 10, tr( "End Loop" ) );
+    stepComboBox->insertItem( 11, tr( "Branch" ) );
 
     AddStepDialogLayout->addWidget( stepComboBox );
 
@@ -103,6 +106,94 @@ AddStepDialog::AddStepDialog( QWidget* parent  ) : QDialog( parent ) {
     layout6->addWidget( digitalOutEdit );
     AddStepDialogLayout->addLayout( layout6 );
 
+    layout7 = new QHBoxLayout;
+    convergeModeLabel = new QLabel( "Steady State End", this );
+    convergeModeLabel->setAlignment( Qt::AlignCenter );
+    layout7->addWidget( convergeModeLabel );
+    convergeModeComboBox = new QComboBox( this );
+    convergeModeComboBox->insertItem( 0, tr( "Off" ) );
+    convergeModeComboBox->insertItem( 1, tr( "APD change" ) );
+    convergeModeComboBox->insertItem( 2, tr( "APD slope" ) );
+    layout7->addWidget( convergeModeComboBox );
+    AddStepDialogLayout->addLayout( layout7 );
+
+    layout8 = new QHBoxLayout;
+    convergeBeatsLabel = new QLabel( "Steady State Beats", this );
+    convergeBeatsLabel->setAlignment( Qt::AlignCenter );
+    layout8->addWidget( convergeBeatsLabel );
+    convergeBeatsEdit = new QLineEdit( "", this );
+	convergeBeatsEdit->setValidator( new QIntValidator(2, 200, convergeBeatsEdit) );
+    layout8->addWidget( convergeBeatsEdit );
+    AddStepDialogLayout->addLayout( layout8 );
+
+    layout9 = new QHBoxLayout;
+    convergeTolLabel = new QLabel( "Tolerance (ms or ms/beat)", this );
+    convergeTolLabel->setAlignment( Qt::AlignCenter );
+    layout9->addWidget( convergeTolLabel );
+    convergeTolEdit = new QLineEdit( "", this );
+	convergeTolEdit->setValidator( new QDoubleValidator(0, 1000, 3, convergeTolEdit) );
+    layout9->addWidget( convergeTolEdit );
+    AddStepDialogLayout->addLayout( layout9 );
+
+    layout10 = new QHBoxLayout;
+    branchConditionLabel = new QLabel( "Branch If", this );
+    branchConditionLabel->setAlignment( Qt::AlignCenter );
+    layout10->addWidget( branchConditionLabel );
+    branchConditionComboBox = new QComboBox( this );
+    branchConditionComboBox->insertItem( 0, tr( "Always" ) );
+    branchConditionComboBox->insertItem( 1, tr( "Capture failed" ) );
+    branchConditionComboBox->insertItem( 2, tr( "APD converged" ) );
+    branchConditionComboBox->insertItem( 3, tr( "EAD" ) );
+    layout10->addWidget( branchConditionComboBox );
+    AddStepDialogLayout->addLayout( layout10 );
+
+    layout11 = new QHBoxLayout;
+    branchActionLabel = new QLabel( "Branch Action", this );
+    branchActionLabel->setAlignment( Qt::AlignCenter );
+    layout11->addWidget( branchActionLabel );
+    branchActionComboBox = new QComboBox( this );
+    branchActionComboBox->insertItem( 0, tr( "Go to step" ) );
+    branchActionComboBox->insertItem( 1, tr( "Exit loop" ) );
+    branchActionComboBox->insertItem( 2, tr( "Retry previous step" ) );
+    layout11->addWidget( branchActionComboBox );
+    AddStepDialogLayout->addLayout( layout11 );
+
+    layout12 = new QHBoxLayout;
+    branchTargetLabel = new QLabel( "Step / Max Retries", this );
+    branchTargetLabel->setAlignment( Qt::AlignCenter );
+    layout12->addWidget( branchTargetLabel );
+    branchTargetEdit = new QLineEdit( "", this );
+	branchTargetEdit->setValidator( new QIntValidator(1, 10000, branchTargetEdit) );
+    layout12->addWidget( branchTargetEdit );
+    AddStepDialogLayout->addLayout( layout12 );
+
+    layout13 = new QHBoxLayout;
+    stimScaleLabel = new QLabel( "Stim Scale per Retry", this );
+    stimScaleLabel->setAlignment( Qt::AlignCenter );
+    layout13->addWidget( stimScaleLabel );
+    stimScaleEdit = new QLineEdit( "1.2", this );
+	stimScaleEdit->setValidator( new QDoubleValidator(0, 10, 3, stimScaleEdit) );
+    layout13->addWidget( stimScaleEdit );
+    AddStepDialogLayout->addLayout( layout13 );
+
+    layout14 = new QHBoxLayout;
+    sweepNameLabel = new QLabel( "Sweep Name", this );
+    sweepNameLabel->setAlignment( Qt::AlignCenter );
+    layout14->addWidget( sweepNameLabel );
+    sweepNameEdit = new QLineEdit( "", this );
+	sweepNameEdit->setValidator( new QRegExpValidator(QRegExp("[A-Za-z0-9_-]*"), sweepNameEdit) );
+    layout14->addWidget( sweepNameEdit );
+    AddStepDialogLayout->addLayout( layout14 );
+
+    layout15 = new QHBoxLayout;
+    referenceSweepLabel = new QLabel( "Reference Sweep", this );
+    referenceSweepLabel->setAlignment( Qt::AlignCenter );
+    layout15->addWidget( referenceSweepLabel );
+    referenceSweepEdit = new QLineEdit( "", this );
+	referenceSweepEdit->setValidator( new QRegExpValidator(QRegExp("[A-Za-z0-9_-]*"), referenceSweepEdit) );
+    layout15->addWidget( referenceSweepEdit );
+    AddStepDialogLayout->addLayout( layout15 );
+
     buttonGroup = new QButtonGroup( this );
 	 buttonGroupBox = new QGroupBox( this );
     buttonGroupBoxLayout = new QHBoxLayout( buttonGroupBox );
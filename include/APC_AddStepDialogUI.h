@@ -53,6 +53,24 @@ class AddStepDialog : public QDialog {
 		QLineEdit* waitTimeEdit;
         QLabel* digitalOutLabel;
 		QLineEdit* digitalOutEdit;
+		QLabel* convergeModeLabel;
+		QComboBox* convergeModeComboBox;
+		QLabel* convergeBeatsLabel;
+		QLineEdit* convergeBeatsEdit;
+		QLabel* convergeTolLabel;
+		QLineEdit* convergeTolEdit;
+		QLabel* branchConditionLabel;
+		QComboBox* branchConditionComboBox;
+		QLabel* branchActionLabel;
+		QComboBox* branchActionComboBox;
+		QLabel* branchTargetLabel;
+		QLineEdit* branchTargetEdit;
+		QLabel* stimScaleLabel;
+		QLineEdit* stimScaleEdit;
+		QLabel* sweepNameLabel;
+		QLineEdit* sweepNameEdit;
+		QLabel* referenceSweepLabel;
+		QLineEdit* referenceSweepEdit;
 		QButtonGroup* buttonGroup;
 		QGroupBox* buttonGroupBox;
 		QPushButton* addStepButton;
@@ -65,6 +83,15 @@ class AddStepDialog : public QDialog {
 		QHBoxLayout* layout4;
 		QHBoxLayout* layout5;
         QHBoxLayout* layout6;
+		QHBoxLayout* layout7;
+		QHBoxLayout* layout8;
+		QHBoxLayout* layout9;
+		QHBoxLayout* layout10;
+		QHBoxLayout* layout11;
+		QHBoxLayout* layout12;
+		QHBoxLayout* layout13;
+		QHBoxLayout* layout14;
+		QHBoxLayout* layout15;
 		QHBoxLayout* buttonGroupLayout;
 		QHBoxLayout* buttonGroupBoxLayout;
 };
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Afterdepolarization.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Afterdepolarization.h"
+
+AfterdepolarizationDetector::AfterdepolarizationDetector( double t ) :
+    threshold( t ), phase( NONE ), rising( false ), trough( 0 ), peak( 0 ) {
+    beginBeat();
+}
+
+AfterdepolarizationDetector::~AfterdepolarizationDetector( void ) { }
+
+void AfterdepolarizationDetector::beginBeat( void ) {
+    phase = NONE;
+    beat.EADCount = 0;
+    beat.EADAmplitude = 0;
+    beat.DADCount = 0;
+    beat.DADAmplitude = 0;
+}
+
+bool AfterdepolarizationDetector::update( phase_t p, double v ) {
+    if( p != phase ) { // Tracking restarts at every phase change
+        phase = p;
+        rising = false;
+        trough = v;
+    }
+    if( phase == NONE )
+        return false;
+
+    if( !rising ) {
+        if( v < trough )
+            trough = v;
+        else if( v - trough > threshold ) { // Turned upwards, event starts
+            rising = true;
+            peak = v;
+            if( phase == REPOLARIZATION ) beat.EADCount++;
+            else beat.DADCount++;
+            return true;
+        }
+    }
+    else {
+        if( v > peak ) {
+            peak = v;
+            double amplitude = peak - trough;
+            if( phase == REPOLARIZATION && amplitude > beat.EADAmplitude ) beat.EADAmplitude = amplitude;
+            if( phase == DIASTOLE && amplitude > beat.DADAmplitude ) beat.DADAmplitude = amplitude;
+        }
+        else if( peak - v > threshold ) { // Turned downwards, event is over
+            rising = false;
+            trough = v;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Afterdepolarization.h
+ * Online early (EAD) and delayed (DAD) afterdepolarization detection
+ *
+ *** NOTES
+ *
+ * During repolarization (from the AP peak to the APD threshold) and
+ * during diastole (after the APD threshold until the next stimulus) Vm
+ * is followed by a trough/peak tracker. An event starts when Vm turns
+ * from falling to rising by more than the threshold above the lowest
+ * Vm since the last event, and ends when it turns down again by the
+ * same amount. The hysteresis keeps noise from being counted as dV/dt
+ * sign changes. The amplitude of an event is its peak minus the trough
+ * it started from. The cost is a few comparisons per tick.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_AFTERDEPOLARIZATION_H
+#define APC_AFTERDEPOLARIZATION_H
+
+struct AfterdepolarizationResult {
+    int EADCount;
+    double EADAmplitude; // Largest EAD of the beat (mV)
+    int DADCount;
+    double DADAmplitude; // Largest DAD of the beat (mV)
+};
+
+class AfterdepolarizationDetector {
+public:
+    enum phase_t { NONE, REPOLARIZATION, DIASTOLE };
+
+    AfterdepolarizationDetector( double ); // Threshold (mV)
+    ~AfterdepolarizationDetector( void );
+
+    void setThreshold( double t ) { threshold = t; }
+    void beginBeat( void ); // Clears counts, called at the stimulus
+    bool update( phase_t, double ); // Phase and Vm, returns true when an event starts
+    const AfterdepolarizationResult &result( void ) const { return beat; }
+
+private:
+    double threshold;
+    phase_t phase;
+    bool rising; // Inside an event
+    double trough; // Lowest Vm since the last event
+    double peak; // Highest Vm of the current event
+    AfterdepolarizationResult beat;
+};
+
+#endif // APC_AFTERDEPOLARIZATION_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Artifact.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Artifact.h"
+
+using namespace std;
+
+ArtifactTemplate::ArtifactTemplate( int l, int b ) :
+    state( OFF ), maxLength( l ), maxBeats( b ), length( 0 ), numBeats( 0 ),
+    capturedBeats( 0 ), capturing( false ), baseline( 0 ) {
+    capture.resize( maxLength * maxBeats );
+    table.resize( maxLength );
+}
+
+ArtifactTemplate::~ArtifactTemplate( void ) { }
+
+void ArtifactTemplate::restart( int l, int b ) {
+    lock_guard<mutex> lock( processMutex );
+    length = l < maxLength ? l : maxLength;
+    numBeats = b < maxBeats ? b : maxBeats;
+    capturedBeats = 0;
+    capturing = false;
+    state.store( ( length > 0 && numBeats > 0 ) ? LEARNING : OFF, memory_order_release );
+}
+
+void ArtifactTemplate::beginBeat( double v ) {
+    capturing = ( state.load( memory_order_acquire ) == LEARNING ); // An unfinished capture is overwritten
+    baseline = v;
+}
+
+double ArtifactTemplate::subtract( int offset, double v ) {
+    if( offset < 0 || offset >= length ) // Outside of the stimulus pulse
+        return v;
+
+    if( state.load( memory_order_acquire ) == READY )
+        return v - table[offset];
+
+    if( capturing ) {
+        capture[capturedBeats * maxLength + offset] = v - baseline;
+        if( offset == length - 1 ) { // Beat is complete
+            capturing = false;
+            if( ++capturedBeats == numBeats )
+                state.store( CAPTURED, memory_order_release ); // Capture belongs to the worker from now on
+        }
+    }
+    return v;
+}
+
+void ArtifactTemplate::process( void ) {
+    lock_guard<mutex> lock( processMutex );
+    if( state.load( memory_order_acquire ) != CAPTURED )
+        return ;
+
+    for( int i = 0; i < length; i++ ) {
+        double sum = 0;
+        for( int b = 0; b < numBeats; b++ )
+            sum += capture[b * maxLength + i];
+        table[i] = sum / numBeats;
+    }
+    state.store( READY, memory_order_release ); // Table is read-only from now on
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Artifact.h
+ * Stimulus artifact template, learned from the first beats of a run and
+ * subtracted from Vm before APD detection
+ *
+ *** NOTES
+ *
+ * The template covers the stimulus pulse (stimLengthInt ticks) and is
+ * the average of Vm - Vrest over the first numBeats beats. The RT
+ * thread writes raw samples into a preallocated capture buffer while
+ * learning, the worker thread averages them into the table once every
+ * beat has been captured, and from then on the RT thread only does one
+ * table lookup and subtraction per tick. The state variable hands the
+ * buffers over between threads, so neither side ever waits.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_ARTIFACT_H
+#define APC_ARTIFACT_H
+
+#include "APC_WorkerTask.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class ArtifactTemplate : public WorkerTask {
+public:
+    enum { OFF, LEARNING, CAPTURED, READY }; // LEARNING: RT owns capture, CAPTURED: worker owns capture and table, READY: RT reads table
+
+    ArtifactTemplate( int, int ); // Maximum template length (ticks), maximum number of beats averaged
+    ~ArtifactTemplate( void );
+
+    void restart( int, int ); // Template length (ticks), beats to average (0 turns subtraction off), only called while RT thread is inactive
+    int status( void ) const { return state.load( std::memory_order_acquire ); }
+
+    // RT thread
+    void beginBeat( double ); // Vm at the stimulus, baseline of the captured beat, same signal as subtract()
+    double subtract( int, double ); // Ticks since stimulus and Vm, returns Vm with artifact removed
+
+    // Worker thread
+    void process( void );
+
+private:
+    std::mutex processMutex; // Keeps restart() from racing the worker, never taken by the RT thread
+    std::atomic<int> state;
+    int maxLength;
+    int maxBeats;
+    int length;
+    int numBeats;
+
+    // RT side of learning
+    int capturedBeats; // Complete beats in capture
+    bool capturing; // Current beat is being captured
+    double baseline;
+
+    std::vector<double> capture; // maxBeats rows of maxLength samples
+    std::vector<double> table;
+};
+
+#endif // APC_ARTIFACT_H
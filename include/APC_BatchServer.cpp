@@ -0,0 +1,587 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BatchServer.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_BatchServer.h"
+
+using namespace std;
+
+namespace {
+    const char *stepTypeNames[] = { "pace", "startvm", "stopvm", "average", "apclamp", "startrecord", "stoprecord", "wait",
+                                    "loop", "endloop", "branch" };
+    const int numStepTypes = sizeof(stepTypeNames) / sizeof(stepTypeNames[0]);
+    const char *convergeModeNames[] = { "off", "delta", "slope" };
+    const int numConvergeModes = sizeof(convergeModeNames) / sizeof(convergeModeNames[0]);
+    const char *beatClassNames[] = { "captured", "failed", "ead", "spontaneous" };
+    const char *branchConditionNames[] = { "always", "failed", "converged", "ead" };
+    const char *branchActionNames[] = { "goto", "exit", "retry" };
+    const char *profileBucketNames[] = { "idle", "threshold", "pace", "protocol", "apd-start", "apd-peak", "apd-down", "apd-done" };
+    const int waitPoll = 100; // ms between checks of a pending wait
+    const char *waitTimeout = "ERR Timeout, module is still busy";
+
+    // Index of name in names, or the number itself, -1 if neither
+    int lookup( const QString &value, const char **names, int numNames ) {
+        bool ok;
+        int idx = value.toInt( &ok );
+        if( ok ) return idx;
+        for( int i = 0; i < numNames; i++ )
+            if( value.toLower() == names[i] ) return i;
+        return -1;
+    }
+}
+
+BatchServer::BatchServer( BatchTarget *t, QObject *parent ) : QObject( parent ), target( t ), sourceDepth( 0 ) {
+    server = new QLocalServer( this );
+    QObject::connect( server, SIGNAL(newConnection(void)), this, SLOT(newConnection(void)) );
+    waitTimer = new QTimer( this );
+    QObject::connect( waitTimer, SIGNAL(timeout(void)), this, SLOT(checkWaits(void)) );
+    waitTimer->start( waitPoll );
+    clock.start();
+}
+
+BatchServer::~BatchServer( void ) { }
+
+bool BatchServer::listen( QString name, QString &error ) {
+    QLocalSocket probe; // A live server accepts the connection, a stale socket left behind by a crashed session does not
+    probe.connectToServer( name );
+    if( probe.waitForConnected( 500 ) ) {
+        probe.abort();
+        error = "Another instance is already serving " + name;
+        return false;
+    }
+    QLocalServer::removeServer( name );
+    if( !server->listen( name ) ) {
+        error = server->errorString();
+        return false;
+    }
+    return true;
+}
+
+QString BatchServer::serverName( void ) const {
+    return server->fullServerName();
+}
+
+void BatchServer::newConnection( void ) {
+    while( server->hasPendingConnections() ) {
+        QLocalSocket *socket = server->nextPendingConnection();
+        QObject::connect( socket, SIGNAL(readyRead(void)), this, SLOT(readCommands(void)) );
+        QObject::connect( socket, SIGNAL(disconnected(void)), socket, SLOT(deleteLater(void)) );
+        Client client = { socket, false, -1 };
+        clients.push_back( client );
+    }
+}
+
+void BatchServer::readCommands( void ) {
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>( sender() );
+    for( list<Client>::iterator c = clients.begin(); c != clients.end(); ++c )
+        if( c->socket == socket ) serve( *c );
+}
+
+// Executes every complete line received from a client and writes back the replies. Nothing is read while the client
+// waits, or while a command file waits, whose commands would otherwise interleave with the client's
+void BatchServer::serve( Client &client ) {
+    while( client.socket && !client.waiting && sourceDepth == 0 && client.socket->canReadLine() ) {
+        QString line = QString::fromUtf8( client.socket->readLine() ).trimmed();
+        QStringList args = line.split( QRegExp("\\s+"), QString::SkipEmptyParts );
+        QStringList reply;
+        QString error;
+
+        if( args.value( 0 ).toLower() == "wait" ) { // Answered by checkWaits(), the GUI thread is not blocked
+            qint64 deadline = waitDeadline( args, error );
+            if( deadline == -2 ) reply << "ERR " + error;
+            else if( target->batchBusy() ) {
+                client.waiting = true;
+                client.deadline = deadline;
+            }
+            else reply << "OK";
+        }
+        else
+            reply = execute( line );
+
+        for( int i = 0; client.socket && i < reply.size(); i++ )
+            client.socket->write( (reply.at(i) + "\n").toUtf8() );
+    }
+    if( client.socket )
+        client.socket->flush();
+}
+
+void BatchServer::checkWaits( void ) {
+    for( list<Client>::iterator c = clients.begin(); c != clients.end(); ) {
+        if( !c->socket ) {
+            if( sourceDepth == 0 ) { // Otherwise serve() may be running for it further up the stack
+                c = clients.erase( c );
+                continue;
+            }
+        }
+        else if( c->waiting ) {
+            bool idle = !target->batchBusy();
+            if( idle || ( c->deadline >= 0 && clock.elapsed() >= c->deadline ) ) {
+                QString reply = idle ? QString( "OK" ) : QString( waitTimeout );
+                c->socket->write( ( reply + "\n" ).toUtf8() );
+                c->waiting = false;
+            }
+        }
+        serve( *c ); // Lines held by a wait
+        ++c;
+    }
+}
+
+qint64 BatchServer::waitDeadline( const QStringList &args, QString &error ) {
+    if( args.size() < 2 ) return -1;
+    bool ok;
+    double timeout = args.at( 1 ).toDouble( &ok );
+    if( !ok || timeout < 0 || args.size() > 2 ) {
+        error = "Expected wait [timeout s]";
+        return -2;
+    }
+    return clock.elapsed() + (qint64)( timeout * 1e3 );
+}
+
+bool BatchServer::waitIdle( qint64 deadline ) {
+    while( target->batchBusy() ) {
+        if( deadline >= 0 && clock.elapsed() >= deadline ) return false;
+        QEventLoop loop; // Results, the display and other events are handled meanwhile
+        QTimer::singleShot( waitPoll, &loop, SLOT(quit(void)) );
+        loop.exec();
+    }
+    return true;
+}
+
+QStringList BatchServer::executeFile( QString fileName ) {
+    QStringList reply;
+    QFile file( fileName );
+
+    if( sourceDepth > 8 ) {
+        reply << "ERR Command files nested too deeply";
+        return reply;
+    }
+    if( !file.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
+        reply << "ERR Unable to open command file " + fileName;
+        return reply;
+    }
+
+    sourceDepth++;
+    QTextStream ts( &file );
+    while( !ts.atEnd() ) {
+        QString line = ts.readLine().trimmed();
+        if( line.isEmpty() || line.startsWith( "#" ) ) continue; // Skip blank lines and comments
+        QStringList lineReply = execute( line );
+        reply << lineReply;
+        if( !lineReply.isEmpty() && lineReply.last().startsWith( "ERR" ) ) // Stop at the first failing command
+            break;
+    }
+    sourceDepth--;
+    file.close();
+    return reply;
+}
+
+// Parses "<type> <BCL> <beats> <idx> <wait> <DO> [<steady> <N> <tol>] [sweep=<name>] [ref=<name>]" starting at args[first],
+// or the short forms of loop, endloop and branch steps
+bool BatchServer::parseStep( const QStringList &args, int first, ProtocolStepPtr &step, QString &error ) {
+    if( args.size() > first && lookup( args.at( first ), stepTypeNames, numStepTypes ) >= ProtocolStep::LOOP )
+        return parseControlStep( args.mid( first ), step, error );
+
+    QStringList values;
+    QString sweepName, referenceSweep;
+    for( int i = first; i < args.size(); i++ ) { // Named tokens can be anywhere after the type
+        if( args.at( i ).startsWith( "sweep=" ) ) sweepName = args.at( i ).mid( 6 );
+        else if( args.at( i ).startsWith( "ref=" ) ) referenceSweep = args.at( i ).mid( 4 );
+        else values << args.at( i );
+    }
+
+    if( values.size() != 6 && values.size() != 9 ) {
+        error = "Expected <type> <BCL> <beats> <idx> <wait> <DO> [<steady> <N> <tol>] [sweep=<name>] [ref=<name>]";
+        return false;
+    }
+
+    bool ok;
+    int type = values.at( 0 ).toInt( &ok );
+    if( !ok ) {
+        type = -1;
+        for( int i = 0; i < numStepTypes; i++ )
+            if( values.at( 0 ).toLower() == stepTypeNames[i] ) type = i;
+    }
+    if( type < 0 || type >= numStepTypes ) {
+        error = "Unknown step type " + values.at( 0 );
+        return false;
+    }
+    values[0] = QString::number( type );
+
+    if( values.size() == 9 ) { // Steady state criterion by name or number
+        for( int i = 0; i < numConvergeModes; i++ )
+            if( values.at( 6 ).toLower() == convergeModeNames[i] ) values[6] = QString::number( i );
+    }
+
+    vector<QString> inputAnswers;
+    for( int i = 0; i < values.size(); i++ ) {
+        values.at( i ).toDouble( &ok );
+        if( !ok ) {
+            error = "Invalid number " + values.at( i );
+            return false;
+        }
+        inputAnswers.push_back( values.at( i ) );
+    }
+    if( !sweepName.isEmpty() || !referenceSweep.isEmpty() ) {
+        QString zero( "0" );
+        if( inputAnswers.size() == 6 ) inputAnswers.resize( 9, zero );
+        inputAnswers.resize( 13, zero );
+        inputAnswers[12] = "1"; // stimScale
+        inputAnswers.push_back( sweepName );
+        inputAnswers.push_back( referenceSweep );
+    }
+
+    step = Protocol::stepFromInput( inputAnswers );
+    return true;
+}
+
+// "loop <N>", "endloop" or "branch <condition> <action> [<step or retries>] [<stim scale>]"
+bool BatchServer::parseControlStep( const QStringList &values, ProtocolStepPtr &step, QString &error ) {
+    int type = lookup( values.at( 0 ), stepTypeNames, numStepTypes );
+    QString zero( "0" );
+    vector<QString> inputAnswers( 13, zero );
+    inputAnswers[0] = QString::number( type );
+    inputAnswers[12] = "1";
+    bool ok = true;
+
+    if( type == ProtocolStep::LOOP ) {
+        if( values.size() != 2 ) ok = false;
+        else inputAnswers[2] = values.at( 1 );
+    }
+    else if( type == ProtocolStep::ENDLOOP ) {
+        if( values.size() != 1 ) ok = false;
+    }
+    else if( type == ProtocolStep::BRANCH ) {
+        int condition = lookup( values.value( 1 ), branchConditionNames, 4 );
+        int action = lookup( values.value( 2 ), branchActionNames, 3 );
+        if( values.size() < 3 || values.size() > 5 || condition < 0 || action < 0 ) ok = false;
+        else {
+            inputAnswers[9] = QString::number( condition );
+            inputAnswers[10] = QString::number( action );
+            if( values.size() > 3 ) inputAnswers[11] = values.at( 3 );
+            if( values.size() > 4 ) inputAnswers[12] = values.at( 4 );
+        }
+    }
+    else ok = false;
+
+    for( size_t i = 1; ok && i < inputAnswers.size(); i++ )
+        inputAnswers[i].toDouble( &ok );
+    if( !ok ) {
+        error = "Expected loop <N> | endloop | branch <always|failed|converged|ead> <goto|exit|retry> [<step|retries>] [<scale>]";
+        return false;
+    }
+
+    step = Protocol::stepFromInput( inputAnswers );
+    return true;
+}
+
+QStringList BatchServer::execute( QString line ) {
+    QStringList reply;
+    QStringList args = line.split( QRegExp("\\s+"), QString::SkipEmptyParts );
+    if( args.isEmpty() ) return reply;
+
+    QString cmd = args.at( 0 ).toLower();
+    Protocol *protocol = target->batchProtocol();
+    QString error;
+    bool ok;
+
+    bool edit = ( cmd == "clear" || cmd == "add" || cmd == "insert" || cmd == "delete" || cmd == "load" );
+    if( edit && target->batchBusy() ) {
+        reply << "ERR Module is busy";
+        return reply;
+    }
+
+    if( cmd == "help" ) {
+        reply << "help | clear | add <step> | insert <n> <step>, step is <type> <BCL> <beats> <idx> <wait> <DO> [<off|delta|slope> <N> <tol>]"
+              << "[sweep=<name>] [ref=<name>]"
+              << "or loop <N> | endloop | branch <always|failed|converged|ead> <goto|exit|retry> [<step|retries>] [<scale>]"
+              << "delete <n> | list | load <file> | save <file> | validate | run | stop | wait [timeout s] | status | beats [first] | stats"
+              << "sweeps | sweep <name> [diff] | restitution | recordfile [<base>] | beatfile <base> [n]"
+              << "savetrace <slot> <file> [beat ms] [resolution mV] | loadtrace <slot> <file> [block] | slots | slotformat <slot> <double|float|int16> [scale mV] [offset mV]"
+              << "digest [on [slot] | off] | profile [reset] | source <file>"
+              << "OK";
+    }
+    else if( cmd == "clear" ) {
+        protocol->clearProtocol();
+        target->batchProtocolChanged();
+        reply << "OK";
+    }
+    else if( cmd == "add" || cmd == "insert" ) {
+        ProtocolStepPtr step;
+        int idx = protocol->protocolContainer.size();
+        int first = 1;
+
+        if( cmd == "insert" ) {
+            idx = args.value( 1 ).toInt( &ok );
+            if( !ok ) {
+                reply << "ERR Invalid step number";
+                return reply;
+            }
+            first = 2;
+        }
+        if( !parseStep( args, first, step, error ) )
+            reply << "ERR " + error;
+        else if( !target->batchInsertStep( idx, step ) )
+            reply << "ERR Step number out of range";
+        else
+            reply << "OK " + QString::number( idx );
+    }
+    else if( cmd == "delete" ) {
+        int idx = args.value( 1 ).toInt( &ok );
+        if( !ok || !target->batchRemoveStep( idx ) )
+            reply << "ERR Step number out of range";
+        else
+            reply << "OK";
+    }
+    else if( cmd == "list" ) {
+        for( int i = 0; i < (int)protocol->protocolContainer.size(); i++ )
+            reply << QString::number( i ) + " " + protocol->getStepDescription( i );
+        reply << "OK " + QString::number( protocol->protocolContainer.size() );
+    }
+    else if( cmd == "load" ) {
+        if( args.size() < 2 ) reply << "ERR Missing file name";
+        else if( !protocol->readProtocol( line.section( ' ', 1 ).trimmed(), error ) ) {
+            target->batchProtocolChanged();
+            reply << "ERR " + error;
+        }
+        else {
+            target->batchProtocolChanged();
+            reply << "OK " + QString::number( protocol->protocolContainer.size() );
+        }
+    }
+    else if( cmd == "save" ) {
+        if( args.size() < 2 ) reply << "ERR Missing file name";
+        else if( !protocol->writeProtocol( line.section( ' ', 1 ).trimmed(), error ) ) reply << "ERR " + error;
+        else reply << "OK";
+    }
+    else if( cmd == "validate" ) {
+        ProtocolProgram program;
+        if( !protocol->compile( program, error ) ) reply << "ERR " + error;
+        else reply << "OK";
+    }
+    else if( cmd == "run" ) {
+        if( !target->batchStart( error ) ) reply << "ERR " + error;
+        else reply << "OK";
+    }
+    else if( cmd == "stop" ) {
+        target->batchStop();
+        reply << "OK";
+    }
+    else if( cmd == "wait" ) { // From command files, socket clients are answered by checkWaits()
+        qint64 deadline = waitDeadline( args, error );
+        if( deadline == -2 ) reply << "ERR " + error;
+        else if( !waitIdle( deadline ) ) reply << waitTimeout;
+        else reply << "OK";
+    }
+    else if( cmd == "status" ) {
+        reply << "OK " + target->batchStatus();
+    }
+    else if( cmd == "beats" ) {
+        const vector<BeatResult> &beats = target->batchBeats();
+        int first = args.size() > 1 ? args.at( 1 ).toInt() : 0;
+
+        for( int i = qMax( first, 0 ); i < (int)beats.size(); i++ ) {
+            const BeatResult &b = beats.at( i );
+            QString beatLine = QString( "%1 %2 %3 %4 %5 %6 %7" ).arg( i ).arg( b.trial ).arg( b.step ).arg( b.beat )
+                .arg( b.time, 0, 'f', 3 ).arg( b.complete ? QString::number( b.APD, 'f', 3 ) : QString( "nan" ) )
+                .arg( beatClassNames[b.beatClass] );
+            const AfterdepolarizationResult &a = b.afterdepolarizations;
+            beatLine += QString( " %1 %2 %3 %4" ).arg( a.EADCount ).arg( a.EADAmplitude, 0, 'f', 2 )
+                .arg( a.DADCount ).arg( a.DADAmplitude, 0, 'f', 2 );
+            beatLine += QString( " %1" ).arg( b.stimAmplitude, 0, 'f', 3 );
+            for( int c = 1; c < b.channels; c++ ) // APD of additional channels
+                beatLine += " " + ( b.channelComplete[c] ? QString::number( b.channelAPD[c], 'f', 3 ) : QString( "nan" ) );
+            reply << beatLine;
+        }
+        reply << "OK " + QString::number( beats.size() );
+    }
+    else if( cmd == "stats" ) { // <trial> <step> <paced> <steady> <beats> <mean APD> <STV> <alternans> <SD1> <SD2>
+                                // <captured> <failed> <ead> <spontaneous>, step -1 is a trial summary
+        const vector<StatisticsSummary> &summaries = target->batchStatistics();
+        for( int i = 0; i < (int)summaries.size(); i++ ) {
+            const StatisticsSummary &s = summaries.at( i );
+            const BeatStatisticsResult &r = s.stats;
+            reply << QString( "%1 %2 %3 %4 " ).arg( s.trial ).arg( s.step ).arg( s.stepBeats ).arg( s.converged ? 1 : 0 ) +
+                QString( "%1 %2 %3 %4 %5 %6 " ).arg( r.numBeats ).arg( r.meanAPD ).arg( r.STV ).arg( r.alternans ).arg( r.SD1 ).arg( r.SD2 ) +
+                QString( "%1 %2 %3 %4" ).arg( s.classCounts[BeatClass::CAPTURED] ).arg( s.classCounts[BeatClass::FAILED] )
+                .arg( s.classCounts[BeatClass::EAD] ).arg( s.classCounts[BeatClass::SPONTANEOUS] );
+        }
+        BeatStatisticsResult w = target->batchWindowStatistics();
+        reply << QString( "window %1 %2 %3 %4 %5 %6" ).arg( w.numBeats ).arg( w.meanAPD ).arg( w.STV )
+            .arg( w.alternans ).arg( w.SD1 ).arg( w.SD2 );
+        reply << "OK " + QString::number( summaries.size() );
+    }
+    else if( cmd == "sweeps" ) { // <sweep> <name> <reference> <beats> <samples> <charge> <diff charge> <inward> <outward>
+                                 // <peak inward> <peak outward>, reference is - and difference columns 0 if none
+        QStringList names = target->batchSweepNames();
+        vector<SweepResult> results = target->batchSweepResults();
+        for( int i = 0; i < (int)results.size(); i++ ) {
+            const SweepResult &r = results.at( i );
+            reply << QString( "%1 %2 %3 %4 %5 %6 " ).arg( r.sweep ).arg( names.value( r.sweep ) )
+                .arg( r.reference >= 0 ? names.value( r.reference ) : QString( "-" ) ).arg( r.beats ).arg( r.length )
+                .arg( r.charge, 0, 'g', 6 ) +
+                QString( "%1 %2 %3 %4 %5" ).arg( r.differenceCharge, 0, 'g', 6 ).arg( r.inwardCharge, 0, 'g', 6 )
+                .arg( r.outwardCharge, 0, 'g', 6 ).arg( r.peakInward, 0, 'f', 2 ).arg( r.peakOutward, 0, 'f', 2 );
+        }
+        reply << "OK " + QString::number( results.size() );
+    }
+    else if( cmd == "sweep" ) {
+        int sweep = target->batchSweepNames().indexOf( args.value( 1 ) );
+        bool diff = args.value( 2 ).toLower() == "diff";
+        vector<double> data;
+        double period;
+        if( sweep < 0 ) reply << "ERR Unknown sweep " + args.value( 1 );
+        else if( !target->batchSweepData( sweep, diff, data, period ) ) reply << "ERR Sweep has not been recorded yet";
+        else {
+            for( int i = 0; i < (int)data.size(); i++ )
+                reply << QString( "%1 %2" ).arg( i * period, 0, 'f', 3 ).arg( data[i], 0, 'g', 6 );
+            reply << "OK " + QString::number( data.size() );
+        }
+    }
+    else if( cmd == "restitution" ) {
+        vector<RestitutionPoint> points;
+        RestitutionFit fit;
+        target->batchRestitution( points, fit );
+        for( int i = 0; i < (int)points.size(); i++ ) {
+            const RestitutionPoint &p = points.at( i );
+            reply << QString( "%1 %2 %3 %4 %5" ).arg( p.step ).arg( p.BCL, 0, 'f', 1 ).arg( p.DI, 0, 'f', 3 )
+                .arg( p.APD, 0, 'f', 3 ).arg( p.beats );
+        }
+        if( fit.valid )
+            reply << QString( "fit %1 %2 %3 %4 %5 %6 %7" ).arg( fit.APDmax, 0, 'f', 3 ).arg( fit.A, 0, 'g', 6 )
+                .arg( fit.tau, 0, 'f', 3 ).arg( fit.maxSlope, 0, 'f', 4 ).arg( fit.minDI, 0, 'f', 3 )
+                .arg( fit.rms, 0, 'f', 3 ).arg( fit.points );
+        else
+            reply << "fit none";
+        reply << "OK " + QString::number( points.size() );
+    }
+    else if( cmd == "recordfile" ) {
+        QString base = line.section( ' ', 1 ).trimmed();
+        target->batchSetRecordFile( base );
+        reply << "OK " + base;
+    }
+    else if( cmd == "beatfile" ) {
+        BeatFileReader reader;
+        int n = args.size() > 2 ? args.at( 2 ).toInt( &ok ) : -1;
+        if( args.size() < 2 ) reply << "ERR Missing file name";
+        else if( !reader.open( args.at( 1 ).toStdString() ) ) reply << "ERR Unable to read beat record " + args.at( 1 );
+        else if( args.size() > 2 && ( !ok || n < 0 || n >= reader.size() ) ) reply << "ERR Beat index out of range";
+        else if( n < 0 ) {
+            BeatIndexEntry e;
+            int count = reader.size();
+            for( int i = 0; i < count && reader.entry( i, e ); i++ )
+                reply << QString( "%1 %2 %3 %4 %5" ).arg( i ).arg( e.beat ).arg( e.samples ).arg( e.preSamples ).arg( e.full );
+            reply << "OK " + QString::number( count );
+        }
+        else {
+            BeatIndexEntry e;
+            vector<float> voltage, current;
+            if( !reader.entry( n, e ) || !reader.read( n, voltage, current ) ) reply << "ERR Beat record is truncated";
+            else {
+                double period = reader.header().period;
+                for( int i = 0; i < (int)voltage.size(); i++ )
+                    reply << QString( "%1 %2 %3" ).arg( ( i - e.preSamples ) * period, 0, 'f', 3 )
+                        .arg( voltage[i], 0, 'f', 3 ).arg( current[i], 0, 'g', 6 );
+                reply << "OK " + QString::number( voltage.size() );
+            }
+        }
+    }
+    else if( cmd == "savetrace" ) {
+        int slot = args.value( 1 ).toInt( &ok );
+        if( !ok || args.size() < 3 ) reply << "ERR Expected <slot> <file> [beat ms] [resolution mV]";
+        else if( !target->batchSaveTrace( slot, args.at( 2 ), args.value( 3 ).toDouble(), args.value( 4 ).toDouble(), error ) )
+            reply << "ERR " + error;
+        else
+            reply << "OK";
+    }
+    else if( cmd == "loadtrace" ) {
+        int slot = args.value( 1 ).toInt( &ok );
+        int block = args.size() > 3 ? args.at( 3 ).toInt() : -1;
+        int samples = -1;
+        if( !ok || args.size() < 3 ) reply << "ERR Expected <slot> <file> [block]";
+        else if( ( samples = target->batchLoadTrace( slot, args.at( 2 ), block, error ) ) < 0 ) reply << "ERR " + error;
+        else reply << "OK " + QString::number( samples );
+    }
+    else if( cmd == "slots" ) {
+        const TraceStore *store = target->batchTraceStore();
+        for( int i = 0; i < store->size(); i++ ) {
+            const TraceSlot *s = store->slot( i );
+            if( s->size() == 0 && s->format() == TraceSlot::DOUBLE ) continue;
+            reply << QString( "%1 %2 %3 %4 %5" ).arg( i ).arg( TraceSlot::formatName( s->format() ) )
+                .arg( s->size() ).arg( s->bytes() ).arg( s->period() );
+        }
+        reply << "OK";
+    }
+    else if( cmd == "slotformat" ) {
+        int slot = args.value( 1 ).toInt( &ok );
+        QString type = args.value( 2 ).toLower();
+        int format = -1;
+        for( int f = 0; f < TraceSlot::numFormats; f++ )
+            if( type == TraceSlot::formatName( (TraceSlot::format_t)f ) ) format = f;
+        if( !ok || format < 0 ) reply << "ERR Expected <slot> <double|float|int16> [scale mV] [offset mV]";
+        else if( !target->batchSetSlotFormat( slot, (TraceSlot::format_t)format, args.value( 3 ).toDouble(),
+                                              args.value( 4 ).toDouble(), error ) )
+            reply << "ERR " + error;
+        else
+            reply << "OK";
+    }
+    else if( cmd == "digest" ) {
+        QString mode = args.value( 1 ).toLower();
+        int slot = args.size() > 2 ? args.at( 2 ).toInt( &ok ) : -1;
+        if( args.size() < 2 )
+            reply << target->batchDigest() << "OK";
+        else if( ( mode != "on" && mode != "off" ) || ( args.size() > 2 && !ok ) ) reply << "ERR Expected [on [slot] | off]";
+        else if( !target->batchSetDigest( mode == "on", slot, error ) ) reply << "ERR " + error;
+        else reply << "OK";
+    }
+    else if( cmd == "profile" ) {
+        double samplePeriod;
+        vector<TickProfileSummary> summaries;
+        if( args.size() > 1 && args.at( 1 ).toLower() != "reset" ) reply << "ERR Expected [reset]";
+        else if( !target->batchProfile( args.size() > 1, samplePeriod, summaries ) ) reply << "ERR Not built with APC_PROFILE";
+        else {
+            reply << "period " + QString::number( samplePeriod );
+            for( size_t i = 0; i < summaries.size(); i++ ) {
+                const TickProfileSummary &s = summaries[i];
+                if( s.ticks == 0 ) continue;
+                QString name = (int)i < TickProfile::STEP ? QString( profileBucketNames[i] )
+                    : QString( "step-" ) + ( (int)i - TickProfile::STEP < numStepTypes ? stepTypeNames[i - TickProfile::STEP] : "unknown" );
+                reply << QString( "%1 %2 %3 %4 %5 %6 %7 %8" ).arg( name ).arg( s.ticks ).arg( s.mean, 0, 'f', 1 )
+                    .arg( s.min ).arg( s.median ).arg( s.p99 ).arg( s.p999 ).arg( s.max );
+            }
+            reply << "OK";
+        }
+    }
+    else if( cmd == "source" ) {
+        if( args.size() < 2 ) reply << "ERR Missing file name";
+        else reply << executeFile( line.section( ' ', 1 ).trimmed() );
+    }
+    else
+        reply << "ERR Unknown command " + cmd;
+
+    return reply;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BatchServer.h
+ * Headless command interface for building, loading, validating and
+ * running protocols without the Qt dialogs
+ *
+ *** NOTES
+ *
+ * Commands are plain text, one per line, either read from a command
+ * file or from clients of a local (Unix) socket. Every command is
+ * answered with "OK [info]" or "ERR message", commands returning lists
+ * send one line per item before the final OK line.
+ *
+ *   help                                   List commands
+ *   clear                                  Clear protocol
+ *   add <step>                             Append step
+ *   insert <n> <step>                      Insert step at position n
+ *   delete <n>                             Delete step n (0 based)
+ *   list                                   List step descriptions
+ *   load <file> / save <file>              Read or write xml protocol
+ *   validate                               Check protocol parameters, loops and branches
+ *   run / stop                             Start or stop the protocol
+ *   wait [timeout]                         Wait until the run in progress is over, OK once the
+ *                                          module is idle, ERR after timeout s (none by default)
+ *   status                                 Mode, trial, step and beat number
+ *   beats [first]                          Per-beat results starting at index first, with beat
+ *                                          class, EAD and DAD counts and amplitudes, stimulus
+ *                                          magnitude, and one APD column per additional channel
+ *   stats                                  Step/trial summaries with beat class counts and
+ *                                          sliding window statistics
+ *   sweeps                                 Averaged AP clamp sweeps with beats, samples, charge
+ *                                          and difference current charges and peaks
+ *   sweep <name> [diff]                    Averaged (or difference) current of a sweep, one
+ *                                          "<time> <current>" line per sample
+ *   restitution                            Restitution points of the current run, one "<step>
+ *                                          <BCL> <DI> <APD> <beats>" line per pace or average
+ *                                          step, then "fit <APDmax> <A> <tau> <max slope>
+ *                                          <min DI> <rms> <points>" or "fit none"
+ *   recordfile [<base>]                    Base name of the beat record of the next runs, none
+ *                                          for a timestamped name in the home directory
+ *   beatfile <base> [n]                    Index of a beat record, one "<index> <beat> <samples>
+ *                                          <pre samples> <full>" line per beat, or beat n as
+ *                                          "<time from stimulus> <Vm> <current>" lines
+ *   savetrace <slot> <file> [beat] [res]   Compress a Vm recording slot into a trace file, in
+ *                                          blocks of beat ms (BCL by default) at a resolution of
+ *                                          res mV, written in the background (see status)
+ *   loadtrace <slot> <file> [block]        Load a trace file, or only one of its blocks, into
+ *                                          a recording slot, resampled when a protocol uses it
+ *                                          at another thread period
+ *   slots                                  Recording slots in use or not stored as double, one
+ *                                          "<slot> <format> <samples> <bytes> <period ms>" line
+ *                                          per slot
+ *   slotformat <slot> <type> [scale] [off] Sample type of a slot: double, float or int16, int16
+ *                                          samples are scale * s + off mV (0.01 mV steps by
+ *                                          default), the contents are converted
+ *   digest [on [slot] | off]               Digest the outputs and states of every tick of the
+ *                                          next runs, with Vm replayed from a recording slot
+ *                                          instead of the amplifier. Without arguments, reply
+ *                                          "<digest> <ticks> <ticks/s>" for the current or
+ *                                          last run, ticks/s of execute() time
+ *   profile [reset]                        Cost of execute() per tick in APC_PROFILE builds,
+ *                                          "period <ms>" then one "<bucket> <ticks> <mean>
+ *                                          <min> <median> <p99> <p99.9> <max>" line (ns) per
+ *                                          mode, APD state and step type with ticks, cleared
+ *                                          after reading with reset
+ *   source <file>                          Execute commands from a file
+ *
+ * A step is "<type> <BCL> <beats> <idx> <wait> <DO> [<steady> <N> <tol>]".
+ * Step types may be given by number or by name: pace, startvm, stopvm,
+ * average, apclamp, startrecord, stoprecord, wait, loop, endloop, branch. The optional steady
+ * state criterion of pace steps is off, delta or slope over N beats.
+ * AP clamp steps take optional "sweep=<name>" and "ref=<name>" tokens
+ * to keep their averaged current and the difference current against
+ * the reference sweep.
+ *
+ * Commands that change the protocol (clear, add, insert, delete, load)
+ * are refused with "ERR Module is busy" while a run is in progress, as
+ * is a second run. Scripts running several cells wait between runs:
+ *
+ *   load pacing.xml
+ *   recordfile /data/plate1/cell1
+ *   run
+ *   wait 900
+ *   recordfile /data/plate1/cell2
+ *   run
+ *   wait 900
+ *
+ * A command file waits in a local event loop, so the GUI and the other
+ * clients are served meanwhile. A socket client's wait is answered by
+ * a timer instead, and its later commands are held until the reply is
+ * sent. Only one socket per name is served: listen() fails if another
+ * instance answers on it, a stale socket left by a crash is replaced.
+ *
+ * Control steps have short forms: "loop <N>", "endloop" and
+ * "branch <condition> <action> [<step|retries>] [<stim scale>]" with
+ * condition always, failed, converged or ead (of the last pace or
+ * average step) and action goto (1 based step number), exit (innermost
+ * loop) or retry (previous step, stimulus scaled on every retry).
+ *
+ * Regression runs replay a Vm recording through a protocol with the
+ * digest on and compare the digest against the one of a known-good
+ * build, which catches any change in outputs, digital outputs, states
+ * or step timing. Throughput of the same run catches slowdowns.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_BATCHSERVER_H
+#define APC_BATCHSERVER_H
+
+#include <QtCore>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <list>
+#include <vector>
+
+#include "APC_Protocol.h"
+#include "APC_BeatResult.h"
+#include "APC_BeatStatistics.h"
+#include "APC_Sweeps.h"
+#include "APC_Restitution.h"
+#include "APC_BeatRecorder.h"
+#include "APC_TraceStore.h"
+#include "APC_TickProfile.h"
+
+// Interface implemented by the module so the batch server can drive it
+class BatchTarget {
+public:
+    virtual ~BatchTarget( void ) { }
+    virtual Protocol *batchProtocol( void ) = 0; // Protocol being edited
+    virtual bool batchInsertStep( int, ProtocolStepPtr ) = 0; // Insert step at position, false if out of range
+    virtual bool batchRemoveStep( int ) = 0; // Remove step, false if out of range
+    virtual void batchProtocolChanged( void ) = 0; // Called after the protocol was replaced so views can be updated
+    virtual bool batchBusy( void ) = 0; // True while a run is in progress, the protocol is left alone
+    virtual bool batchStart( QString & ) = 0; // Start protocol, error message returned by reference
+    virtual void batchStop( void ) = 0; // Stop protocol
+    virtual QString batchStatus( void ) = 0; // One line status summary
+    virtual const std::vector<BeatResult> &batchBeats( void ) = 0; // Per-beat results of the current run
+    virtual const std::vector<StatisticsSummary> &batchStatistics( void ) = 0; // Step and trial summaries of the current run
+    virtual BeatStatisticsResult batchWindowStatistics( void ) = 0; // Statistics of the sliding beat window
+    virtual QStringList batchSweepNames( void ) = 0; // Sweep names of the current run, index is the sweep number
+    virtual std::vector<SweepResult> batchSweepResults( void ) = 0; // Sweeps finished so far
+    virtual bool batchSweepData( int, bool, std::vector<double> &, double & ) = 0; // Mean (false) or difference (true) current and sample period
+    virtual void batchRestitution( std::vector<RestitutionPoint> &, RestitutionFit & ) = 0; // Points and fit of the current run
+    virtual void batchSetRecordFile( QString ) = 0; // Base name of the beat record, empty for a timestamped name
+    virtual bool batchSaveTrace( int, QString, double, double, QString & ) = 0; // Slot, file, block length (ms, 0 is BCL), resolution (mV, 0 is default)
+    virtual int batchLoadTrace( int, QString, int, QString & ) = 0; // Slot, file, block (-1 is all), returns samples or -1
+    virtual bool batchSetSlotFormat( int, TraceSlot::format_t, double, double, QString & ) = 0; // Slot, type, scale and offset (mV, int16 only)
+    virtual const TraceStore *batchTraceStore( void ) = 0; // Recording slots
+    virtual bool batchSetDigest( bool, int, QString & ) = 0; // Digest of the next runs on or off, slot replayed as Vm (-1 for none)
+    virtual QString batchDigest( void ) = 0; // "<digest> <ticks> <ticks/s>" of the current or last run
+    virtual bool batchProfile( bool, double &, std::vector<TickProfileSummary> & ) = 0; // Reset after reading, period (ms) and buckets, false if not built with APC_PROFILE
+};
+
+class BatchServer : public QObject {
+    Q_OBJECT
+
+public:
+    BatchServer( BatchTarget *, QObject *parent = 0 );
+    ~BatchServer( void );
+
+    bool listen( QString, QString & ); // Start listening on local socket name or path, error message returned by reference
+    QString serverName( void ) const;
+    QStringList execute( QString ); // Execute a single command, returns reply lines
+    QStringList executeFile( QString ); // Execute every command of a command file
+
+private slots:
+    void newConnection( void );
+    void readCommands( void );
+    void checkWaits( void ); // Answers socket clients whose wait is over
+
+private:
+    struct Client {
+        QPointer<QLocalSocket> socket;
+        bool waiting; // Commands after a wait are held until it is answered
+        qint64 deadline; // ms of clock, -1 for no timeout
+    };
+
+    BatchTarget *target;
+    QLocalServer *server;
+    int sourceDepth; // Guards against command files sourcing themselves
+    std::list<Client> clients; // Entries of closed sockets are dropped by checkWaits()
+    QTimer *waitTimer;
+    QElapsedTimer clock;
+
+    void serve( Client & ); // Executes the complete lines of a client, up to a wait
+    bool waitIdle( qint64 ); // Blocks in a local event loop until idle or the deadline, false on timeout
+    qint64 waitDeadline( const QStringList &, QString & ); // Deadline of a wait command, -2 if its timeout is invalid
+
+    bool parseStep( const QStringList &, int, ProtocolStepPtr &, QString & );
+    bool parseControlStep( const QStringList &, ProtocolStepPtr &, QString & );
+};
+
+#endif // APC_BATCHSERVER_H
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BeatRecorder.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_BeatRecorder.h"
+
+#include <stddef.h>
+#include <string.h>
+
+using namespace std;
+
+namespace {
+    const char indexMagic[4] = { 'A', 'P', 'C', 'I' };
+    const int fileVersion = 2; // Version 1 stored raw floats
+
+    // Version 1 header and index entries end where the coded block fields start
+    const size_t headerSizeV1 = offsetof( BeatFileHeader, voltageResolution );
+    const size_t entrySizeV1 = offsetof( BeatIndexEntry, voltageBytes );
+}
+
+BeatRecorder::BeatRecorder( size_t n ) :
+    samples( n ), beatsWritten( 0 ), droppedSamples( 0 ), dataFile( NULL ), indexFile( NULL ), position( 0 ),
+    pre( 0 ), post( 0 ), fullBeatInterval( 0 ), historyHead( 0 ), historyCount( 0 ), lastBeat( -1 ),
+    inBeat( false ), fullBeat( false ), beatPreSamples( 0 ), voltageCodec( 1 ), currentCodec( 1 ) { }
+
+BeatRecorder::~BeatRecorder( void ) {
+    close();
+}
+
+bool BeatRecorder::open( const string &base, int preTicks, int postTicks, int interval, double period,
+                         double voltageResolution, double currentResolution ) {
+    close();
+    lock_guard<mutex> lock( fileMutex );
+
+    dataFile = fopen( ( base + ".apcb" ).c_str(), "wb" );
+    indexFile = fopen( ( base + ".apci" ).c_str(), "wb" );
+    if( !dataFile || !indexFile ) {
+        if( dataFile ) fclose( dataFile );
+        if( indexFile ) fclose( indexFile );
+        dataFile = indexFile = NULL;
+        return false;
+    }
+
+    pre = preTicks > 0 ? preTicks : 0;
+    post = postTicks > 0 ? postTicks : 0;
+    fullBeatInterval = interval > 0 ? interval : 0;
+    voltageCodec = TraceCodec( voltageResolution );
+    currentCodec = TraceCodec( currentResolution );
+
+    BeatFileHeader header;
+    memcpy( header.magic, indexMagic, 4 );
+    header.version = fileVersion;
+    header.channels = 2;
+    header.preSamples = pre;
+    header.postSamples = post;
+    header.fullBeatInterval = fullBeatInterval;
+    header.period = period;
+    header.voltageResolution = voltageCodec.resolution();
+    header.currentResolution = currentCodec.resolution();
+    fwrite( &header, sizeof(header), 1, indexFile );
+    fflush( indexFile );
+
+    position = 0;
+    samples.clear();
+    beatsWritten.store( 0 );
+    droppedSamples.store( 0 );
+    history.assign( pre, RecordSample() );
+    historyHead = historyCount = 0;
+    lastBeat = -1;
+    inBeat = false;
+    return true;
+}
+
+void BeatRecorder::close( void ) {
+    lock_guard<mutex> lock( fileMutex );
+    if( !dataFile ) return ;
+
+    drain();
+    endBeat();
+    fclose( dataFile );
+    fclose( indexFile );
+    dataFile = indexFile = NULL;
+}
+
+void BeatRecorder::process( void ) {
+    lock_guard<mutex> lock( fileMutex );
+    if( !dataFile ) {
+        samples.clear();
+        return ;
+    }
+    drain();
+    fflush( dataFile );
+    fflush( indexFile ); // Index is written after its block, so a reader never sees an entry without data
+}
+
+void BeatRecorder::drain( void ) {
+    RecordSample s;
+    while( samples.pop( s ) ) {
+        if( s.beat < 0 ) { // End of span, the next beat has no pre window from before the gap
+            endBeat();
+            lastBeat = -1;
+            historyCount = 0;
+            continue;
+        }
+
+        if( s.beat != lastBeat ) {
+            endBeat();
+            beginBeat( s.beat );
+            lastBeat = s.beat;
+        }
+
+        if( inBeat ) {
+            if( fullBeat || s.offset < post ) {
+                beatVoltage.push_back( s.voltage );
+                beatCurrent.push_back( s.current );
+            }
+            else
+                endBeat(); // Window is over, rest of the beat is skipped
+        }
+
+        if( pre > 0 ) {
+            history[historyHead] = s;
+            historyHead = ( historyHead + 1 ) % pre;
+            if( historyCount < pre ) historyCount++;
+        }
+    }
+}
+
+// Pre window is the history at the first sample of the beat, oldest first
+void BeatRecorder::beginBeat( int beat ) {
+    fullBeat = ( fullBeatInterval > 0 && beat % fullBeatInterval == 0 );
+    inBeat = ( fullBeat || pre > 0 || post > 0 );
+    if( !inBeat ) return ;
+
+    beatVoltage.clear();
+    beatCurrent.clear();
+    beatPreSamples = historyCount;
+    for( int i = 0; i < historyCount; i++ ) {
+        const RecordSample &h = history[( historyHead - historyCount + i + pre ) % pre];
+        beatVoltage.push_back( h.voltage );
+        beatCurrent.push_back( h.current );
+    }
+}
+
+void BeatRecorder::endBeat( void ) {
+    if( !inBeat ) return ;
+    inBeat = false;
+
+    BeatIndexEntry entry;
+    entry.position = position;
+    entry.beat = lastBeat;
+    entry.samples = beatVoltage.size();
+    entry.preSamples = beatPreSamples;
+    entry.full = fullBeat ? 1 : 0;
+
+    block.clear();
+    if( entry.samples > 0 ) voltageCodec.encode( &beatVoltage[0], entry.samples, block );
+    entry.voltageBytes = block.size();
+    if( entry.samples > 0 ) currentCodec.encode( &beatCurrent[0], entry.samples, block );
+    entry.currentBytes = block.size() - entry.voltageBytes;
+
+    if( !block.empty() ) fwrite( &block[0], 1, block.size(), dataFile );
+    fwrite( &entry, sizeof(entry), 1, indexFile );
+    position += block.size();
+    beatsWritten.fetch_add( 1, memory_order_relaxed );
+}
+
+BeatFileReader::BeatFileReader( void ) :
+    dataFile( NULL ), indexFile( NULL ), headerSize( sizeof(BeatFileHeader) ), entrySize( sizeof(BeatIndexEntry) ) {
+    memset( &fileHeader, 0, sizeof(fileHeader) );
+}
+
+BeatFileReader::~BeatFileReader( void ) {
+    close();
+}
+
+bool BeatFileReader::open( const string &base ) {
+    close();
+    dataFile = fopen( ( base + ".apcb" ).c_str(), "rb" );
+    indexFile = fopen( ( base + ".apci" ).c_str(), "rb" );
+    memset( &fileHeader, 0, sizeof(fileHeader) );
+    if( !dataFile || !indexFile || fread( &fileHeader, headerSizeV1, 1, indexFile ) != 1
+        || memcmp( fileHeader.magic, indexMagic, 4 ) != 0 || fileHeader.version < 1 || fileHeader.version > fileVersion ) {
+        close();
+        return false;
+    }
+
+    headerSize = fileHeader.version == 1 ? headerSizeV1 : sizeof(BeatFileHeader);
+    entrySize = fileHeader.version == 1 ? entrySizeV1 : sizeof(BeatIndexEntry);
+    if( headerSize > headerSizeV1
+        && fread( (char *)&fileHeader + headerSizeV1, headerSize - headerSizeV1, 1, indexFile ) != 1 ) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void BeatFileReader::close( void ) {
+    if( dataFile ) fclose( dataFile );
+    if( indexFile ) fclose( indexFile );
+    dataFile = indexFile = NULL;
+}
+
+int BeatFileReader::size( void ) {
+    if( !indexFile || fseek( indexFile, 0, SEEK_END ) != 0 ) return 0;
+    long bytes = ftell( indexFile ) - (long)headerSize;
+    return bytes > 0 ? bytes / entrySize : 0;
+}
+
+bool BeatFileReader::entry( int k, BeatIndexEntry &e ) {
+    if( !indexFile || k < 0 ) return false;
+    if( fseek( indexFile, headerSize + (long)k * entrySize, SEEK_SET ) != 0 ) return false;
+    memset( &e, 0, sizeof(e) );
+    return fread( &e, entrySize, 1, indexFile ) == 1;
+}
+
+bool BeatFileReader::read( int k, vector<float> &voltage, vector<float> &current ) {
+    BeatIndexEntry e;
+    if( !entry( k, e ) || fseek( dataFile, e.position, SEEK_SET ) != 0 ) return false;
+
+    voltage.resize( e.samples );
+    current.resize( e.samples );
+    if( e.samples == 0 ) return true;
+
+    if( fileHeader.version == 1 ) // Raw floats
+        return fread( &voltage[0], sizeof(float), e.samples, dataFile ) == (size_t)e.samples
+            && fread( &current[0], sizeof(float), e.samples, dataFile ) == (size_t)e.samples;
+
+    block.resize( e.voltageBytes + e.currentBytes );
+    if( block.empty() || fread( &block[0], 1, block.size(), dataFile ) != block.size() ) return false;
+    TraceCodec voltageCodec( fileHeader.voltageResolution ), currentCodec( fileHeader.currentResolution );
+    return voltageCodec.decode( &block[0], e.voltageBytes, e.samples, &voltage[0] )
+        && currentCodec.decode( &block[e.voltageBytes], e.currentBytes, e.samples, &current[0] );
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BeatRecorder.h
+ * Beat-gated recording of Vm and current into a compact, indexed file
+ * pair, as an alternative to the data recorder on long pacing runs
+ *
+ *** NOTES
+ *
+ * Only a window around each stimulus is kept, pre ticks before it and
+ * post ticks after it, plus every Nth beat in full (stimulus to next
+ * stimulus, with the same pre window). The RT thread pushes one sample
+ * per tick into a lock-free ring and never touches the files. The
+ * worker thread keeps the last pre samples, cuts the stream into beats
+ * and writes each beat as one block.
+ *
+ * <base>.apcb  Beat blocks, voltage (mV) of the beat followed by its
+ *              current (pA), each coded by TraceCodec at the resolution
+ *              given in the header
+ * <base>.apci  BeatFileHeader followed by one BeatIndexEntry per beat,
+ *              so beat k is found with a single seek
+ *
+ * Current is the measured current during AP clamp and the stimulus
+ * current otherwise. Both files are in host byte order. A beat is
+ * written once its window is over, or at the next stimulus for full
+ * beats, and is on disk after the next worker pass.
+ *
+ * Version 1 files store the blocks as 32 bit floats, without the
+ * resolutions in the header or the block sizes in the index. The
+ * reader still opens them, their resolutions read as 0.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_BEATRECORDER_H
+#define APC_BEATRECORDER_H
+
+#include "APC_RingBuffer.h"
+#include "APC_TraceCodec.h"
+#include "APC_WorkerTask.h"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct BeatFileHeader {
+    char magic[4]; // "APCI"
+    int32_t version;
+    int32_t channels; // Voltage and current
+    int32_t preSamples; // Window before the stimulus (ticks)
+    int32_t postSamples; // Window after the stimulus (ticks)
+    int32_t fullBeatInterval; // Every Nth beat is kept in full, 0 is never
+    double period; // ms
+    double voltageResolution; // mV
+    double currentResolution; // pA
+};
+
+struct BeatIndexEntry {
+    int64_t position; // Byte offset of the block in the data file
+    int32_t beat; // Beat number
+    int32_t samples; // Samples per channel
+    int32_t preSamples; // Samples before the stimulus, fewer than the window at the start of a run
+    int32_t full; // 1 if the whole beat was kept
+    int32_t voltageBytes; // Coded size of the voltage block, current block follows it
+    int32_t currentBytes;
+};
+
+// Sample as seen by the RT thread, beat < 0 marks the end of a recording span
+struct RecordSample {
+    float voltage;
+    float current;
+    int beat;
+    int offset; // Ticks since the stimulus
+};
+
+class BeatRecorder : public WorkerTask {
+public:
+    BeatRecorder( size_t ); // Ring size (samples)
+    ~BeatRecorder( void );
+
+    // GUI thread, only while the RT thread is not pushing
+    bool open( const std::string &, int, int, int, double, double, double ); // Base name, pre and post window (ticks), full beat interval,
+                                                                             // period (ms), voltage (mV) and current (pA) resolution
+    void close( void ); // Writes what is left and closes the files
+    int beats( void ) const { return beatsWritten.load( std::memory_order_relaxed ); }
+    int dropped( void ) const { return droppedSamples.load( std::memory_order_relaxed ); }
+
+    // RT thread
+    void push( int beat, int offset, double voltage, double current ) {
+        RecordSample s = { (float)voltage, (float)current, beat, offset };
+        if( !samples.push( s ) ) droppedSamples.fetch_add( 1, std::memory_order_relaxed );
+    }
+    void stop( void ) { push( -1, 0, 0, 0 ); } // Ends the span, last beat is written without waiting for a stimulus
+
+    // Worker thread
+    void process( void );
+
+private:
+    void drain( void ); // fileMutex held
+    void beginBeat( int );
+    void endBeat( void );
+
+    RingBuffer<RecordSample> samples;
+    std::atomic<int> beatsWritten;
+    std::atomic<int> droppedSamples;
+
+    std::mutex fileMutex; // Worker and GUI thread, never taken by the RT thread
+    FILE *dataFile;
+    FILE *indexFile;
+    int64_t position;
+    int pre;
+    int post;
+    int fullBeatInterval;
+
+    // Worker side
+    std::vector<RecordSample> history; // Last pre samples, circular
+    int historyHead;
+    int historyCount;
+    int lastBeat;
+    bool inBeat; // Samples of lastBeat are being kept
+    bool fullBeat;
+    int beatPreSamples;
+    std::vector<float> beatVoltage;
+    std::vector<float> beatCurrent;
+    TraceCodec voltageCodec;
+    TraceCodec currentCodec;
+    std::vector<uint8_t> block;
+};
+
+// Random access to a file pair written by BeatRecorder
+class BeatFileReader {
+public:
+    BeatFileReader( void );
+    ~BeatFileReader( void );
+
+    bool open( const std::string & ); // Base name, false if either file is missing or not a beat record
+    void close( void );
+    const BeatFileHeader &header( void ) const { return fileHeader; }
+    int size( void ); // Beats in the file, grows while the file is being recorded
+    bool entry( int, BeatIndexEntry & );
+    bool read( int, std::vector<float> &, std::vector<float> & ); // Voltage and current of a beat
+
+private:
+    FILE *dataFile;
+    FILE *indexFile;
+    BeatFileHeader fileHeader;
+    size_t headerSize; // Size of the header and of each index entry in the version of the file
+    size_t entrySize;
+    std::vector<uint8_t> block;
+};
+
+#endif // APC_BEATRECORDER_H
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BeatResult.h
+ * Per-beat biomarker record passed from the RT thread to the GUI thread
+ *
+ *** NOTES
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_BEATRESULT_H
+#define APC_BEATRESULT_H
+
+#include "APC_BeatStatistics.h"
+#include "APC_Channels.h"
+#include "APC_Afterdepolarization.h"
+
+struct BeatResult {
+    int trial; // Protocol trial, 0 when pacing outside of a protocol
+    int step; // Protocol step, -1 when pacing outside of a protocol
+    int beat; // Beat number
+    double time; // Time of stimulus (ms)
+    double APD; // Action potential duration (ms), only valid if complete
+    double DI; // Diastolic interval before this beat (ms), negative if the previous beat did not repolarize
+    bool complete; // True if repolarization was found before the next beat
+    int beatClass; // BeatClass::type_t
+    AfterdepolarizationResult afterdepolarizations; // EADs and DADs of this beat
+    double stimAmplitude; // Stimulus magnitude used for this beat (nA)
+    bool captured; // Upstroke crossed within the capture window after the stimulus
+    BeatStatisticsResult windowStats; // Sliding window statistics including this beat
+    int channels; // Channels in use, entries 1..channels-1 below are valid
+    double channelAPD[ChannelBank::maxChannels]; // APD of additional channels (ms), entry 0 is unused
+    bool channelComplete[ChannelBank::maxChannels];
+};
+
+#endif // APC_BEATRESULT_H
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BeatStatistics.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_BeatStatistics.h"
+#include <math.h>
+
+using namespace std;
+
+BeatStatistics::BeatStatistics( int c ) : values( c > 2 ? c : 2 ), capacity( c > 2 ? c : 2 ), window( 0 ) {
+    clear();
+}
+
+BeatStatistics::~BeatStatistics( void ) { }
+
+void BeatStatistics::setWindow( int w ) {
+    if( w < 0 ) w = 0;
+    if( w == 1 ) w = 2; // At least one beat-to-beat difference
+    if( w > capacity ) w = capacity;
+    window = w;
+    clear();
+}
+
+void BeatStatistics::clear( void ) {
+    first = 0;
+    numValues = 0;
+    index = 0;
+    last = 0;
+    sum = sumSq = 0;
+    sumAbsDiff = sumDiff = sumDiffSq = 0;
+    sumEven = sumOdd = 0;
+    numEven = numOdd = 0;
+}
+
+void BeatStatistics::accumulate( double x, long i, int sign ) {
+    sum += sign * x;
+    sumSq += sign * x * x;
+    if( i % 2 == 0 ) {
+        sumEven += sign * x;
+        numEven += sign;
+    }
+    else {
+        sumOdd += sign * x;
+        numOdd += sign;
+    }
+}
+
+void BeatStatistics::accumulateDiff( double d, int sign ) {
+    sumAbsDiff += sign * fabs( d );
+    sumDiff += sign * d;
+    sumDiffSq += sign * d * d;
+}
+
+void BeatStatistics::add( double x ) {
+    if( window > 0 && numValues == window ) { // Slide: remove oldest value and its difference to the next one
+        double oldest = values[first];
+        accumulate( oldest, index - numValues, -1 );
+        accumulateDiff( values[(first + 1) % window] - oldest, -1 );
+        first = (first + 1) % window;
+        numValues--;
+    }
+
+    if( numValues > 0 )
+        accumulateDiff( x - last, 1 );
+    accumulate( x, index, 1 );
+
+    if( window > 0 )
+        values[(first + numValues) % window] = x;
+    numValues++;
+    index++;
+    last = x;
+
+    if( window > 0 && index % window == 0 ) // Amortized O(1), bounds rounding error of the running sums
+        rebuild();
+}
+
+void BeatStatistics::rebuild( void ) {
+    sum = sumSq = 0;
+    sumAbsDiff = sumDiff = sumDiffSq = 0;
+    sumEven = sumOdd = 0;
+    numEven = numOdd = 0;
+
+    long firstIndex = index - numValues;
+    for( int i = 0; i < numValues; i++ ) {
+        double x = values[(first + i) % window];
+        accumulate( x, firstIndex + i, 1 );
+        if( i > 0 )
+            accumulateDiff( x - values[(first + i - 1) % window], 1 );
+    }
+}
+
+BeatStatisticsResult BeatStatistics::result( void ) const {
+    BeatStatisticsResult r;
+    r.numBeats = numValues;
+    r.meanAPD = r.STV = r.alternans = r.SD1 = r.SD2 = 0;
+    if( numValues == 0 ) return r;
+
+    r.meanAPD = sum / numValues;
+    if( numEven > 0 && numOdd > 0 )
+        r.alternans = fabs( sumEven / numEven - sumOdd / numOdd );
+
+    int numDiff = numValues - 1;
+    if( numDiff > 0 ) {
+        r.STV = sumAbsDiff / ( numDiff * sqrt( 2.0 ) );
+
+        double varAPD = sumSq / numValues - r.meanAPD * r.meanAPD;
+        double meanDiff = sumDiff / numDiff;
+        double varDiff = sumDiffSq / numDiff - meanDiff * meanDiff;
+        if( varAPD < 0 ) varAPD = 0; // Rounding
+        if( varDiff < 0 ) varDiff = 0;
+
+        r.SD1 = sqrt( varDiff / 2 );
+        double sd2Sq = 2 * varAPD - varDiff / 2;
+        r.SD2 = sd2Sq > 0 ? sqrt( sd2Sq ) : 0;
+    }
+    return r;
+}
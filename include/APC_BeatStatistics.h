@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_BeatStatistics.h
+ * Online beat-to-beat variability and alternans statistics of the APD
+ * stream
+ *
+ *** NOTES
+ *
+ * All statistics are derived from running sums, so adding a beat costs
+ * O(1) and never allocates (safe to call from the RT thread). With a
+ * window of N beats the oldest beat is subtracted as a new one arrives,
+ * and the sums are rebuilt from the ring every N beats to stop rounding
+ * error from accumulating. A window of 0 accumulates every beat since
+ * the last clear(), used for the per step and per trial summaries.
+ *
+ *   STV       = sum(|APD(n+1) - APD(n)|) / (nDiff * sqrt(2))
+ *   Alternans = |mean(APD even beats) - mean(APD odd beats)|
+ *   SD1, SD2  = Poincare plot dispersion perpendicular to and along
+ *               the line of identity
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_BEATSTATISTICS_H
+#define APC_BEATSTATISTICS_H
+
+#include <vector>
+
+struct BeatStatisticsResult {
+    int numBeats;
+    double meanAPD; // ms
+    double STV; // Short-term variability (ms)
+    double alternans; // ms
+    double SD1; // ms
+    double SD2; // ms
+};
+
+// Beat classification, only CAPTURED beats enter the statistics
+struct BeatClass {
+    enum type_t { CAPTURED, FAILED, EAD, SPONTANEOUS, numClasses };
+};
+
+// Summary published at the end of a protocol step (or trial, step == -1)
+struct StatisticsSummary {
+    int trial;
+    int step;
+    int stepBeats; // Beats paced, including beats left out of the statistics
+    bool converged; // Step was ended early by its steady state criterion
+    int classCounts[BeatClass::numClasses]; // Beats of each class
+    BeatStatisticsResult stats;
+};
+
+class BeatStatistics {
+public:
+    BeatStatistics( int ); // Maximum window size, storage is allocated here
+    ~BeatStatistics( void );
+
+    void setWindow( int ); // Number of beats, 0 for cumulative, clears statistics
+    int getWindow( void ) const { return window; }
+    void add( double ); // Adds APD of next beat
+    void clear( void );
+    int count( void ) const { return numValues; }
+    BeatStatisticsResult result( void ) const;
+
+private:
+    std::vector<double> values; // Ring of the last window values
+    int capacity;
+    int window;
+    int first; // Ring index of oldest value
+    int numValues; // Values currently included in the sums
+    long index; // Number of values added since clear, sets even/odd parity
+    double last;
+
+    double sum, sumSq;
+    double sumAbsDiff, sumDiff, sumDiffSq;
+    double sumEven, sumOdd;
+    int numEven, numOdd;
+
+    void accumulate( double, long, int ); // Value, parity index, sign (+1 add, -1 remove)
+    void accumulateDiff( double, int ); // Difference, sign
+    void rebuild( void ); // Recompute sums from the ring
+};
+
+#endif // APC_BEATSTATISTICS_H
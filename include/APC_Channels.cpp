@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Channels.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Channels.h"
+
+ChannelBank::ChannelBank( void ) : numChannels( 1 ) {
+    for( int c = 0; c < maxChannels; c++ ) {
+        voltage[c] = Vrest[c] = APStart[c] = 0;
+        peakVoltage[c] = peakTime[c] = downstrokeThreshold[c] = 0;
+        APD[c] = 0;
+        mode[c] = DONE;
+    }
+}
+
+ChannelBank::~ChannelBank( void ) { }
+
+void ChannelBank::setChannels( int n ) {
+    numChannels = n < 1 ? 1 : ( n > maxChannels ? maxChannels : n );
+}
+
+void ChannelBank::beginBeat( void ) {
+    for( int c = 0; c < maxChannels; c++ ) {
+        Vrest[c] = voltage[c];
+        mode[c] = START;
+    }
+}
+
+// One state transition per tick and channel, decided from the mode at the start of the tick
+void ChannelBank::update( double time, double upstrokeThreshold, double stimWindow, double repol ) {
+    for( int c = 0; c < maxChannels; c++ ) { // Full width so the loop maps onto vector lanes
+        double v = voltage[c];
+        double m = mode[c];
+        double start = APStart[c];
+        double peak = peakVoltage[c];
+        double tPeak = peakTime[c];
+        double down = downstrokeThreshold[c];
+        double apd = APD[c];
+
+        // START: upstroke threshold crossed
+        bool started = ( m == START ) & ( v >= upstrokeThreshold );
+
+        // PEAK: outside stimulus window, track peak until it has not changed for 5 ms
+        bool searching = ( m == PEAK ) & ( ( time - start ) > stimWindow );
+        bool higher = searching & ( peak < v );
+        bool peakFound = searching & !higher & ( ( time - tPeak ) > 5 );
+
+        // DOWN: repolarization threshold crossed
+        bool repolarized = ( m == DOWN ) & ( v <= down );
+
+        APStart[c] = started ? time : start;
+        peakVoltage[c] = started ? Vrest[c] : ( higher ? v : peak );
+        peakTime[c] = higher ? time : tPeak;
+        downstrokeThreshold[c] = peakFound ? peak - ( peak - Vrest[c] ) * repol : down;
+        APD[c] = repolarized ? time - start : apd;
+        mode[c] = started ? (double)PEAK : ( peakFound ? (double)DOWN : ( repolarized ? (double)DONE : m ) );
+    }
+}
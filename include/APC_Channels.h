@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Channels.h
+ * Structure-of-arrays state for the additional cells paced and recorded
+ * by a multi-channel module
+ *
+ *** NOTES
+ *
+ * Channel 0 is the primary cell and keeps using the module's scalar
+ * state (threshold search, statistics, AP clamp recording). Channels
+ * 1..maxChannels-1 share its protocol timeline and stimulus, and their
+ * APD detection is done here. update() runs the same state machine as
+ * Module::calculateAPD, written as branch-free selects over fixed
+ * length arrays so the compiler can vectorize it across channels.
+ * Lane 0 and inactive lanes are computed too but never read.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_CHANNELS_H
+#define APC_CHANNELS_H
+
+class ChannelBank {
+public:
+    enum { maxChannels = 4 }; // Including primary channel 0
+    enum { START, PEAK, DOWN, DONE }; // Same order as Module::APDMode_t
+
+    ChannelBank( void );
+    ~ChannelBank( void );
+
+    void setChannels( int ); // Number of channels in use including primary, clamped to 1..maxChannels
+    int channels( void ) const { return numChannels; }
+
+    void beginBeat( void ); // Called at the stimulus together with calculateAPD(1)
+    void update( double, double, double, double ); // Time since the stimulus, upstroke threshold, stim window (ms), repolarization fraction
+
+    // Per channel state, index 0 is unused
+    double voltage[maxChannels]; // mV, set by the module every tick
+    double Vrest[maxChannels];
+    double APStart[maxChannels];
+    double peakVoltage[maxChannels];
+    double peakTime[maxChannels];
+    double downstrokeThreshold[maxChannels];
+    double APD[maxChannels];
+    double mode[maxChannels]; // Kept as double so every array has the same lane type
+
+private:
+    int numChannels;
+};
+
+#endif // APC_CHANNELS_H
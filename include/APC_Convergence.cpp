@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Convergence.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Convergence.h"
+#include <math.h>
+
+using namespace std;
+
+ConvergenceDetector::ConvergenceDetector( int c ) : mode( NONE ), capacity( c > 2 ? c : 2 ), numBeats( 2 ), tolerance( 0 ),
+    values( capacity ), maxQueue( capacity ), minQueue( capacity ) {
+    clear();
+}
+
+ConvergenceDetector::~ConvergenceDetector( void ) { }
+
+void ConvergenceDetector::configure( mode_t m, int n, double tol ) {
+    mode = m;
+    numBeats = n < 2 ? 2 : ( n > capacity ? capacity : n );
+    tolerance = tol;
+    clear();
+}
+
+void ConvergenceDetector::clear( void ) {
+    first = count = 0;
+    index = 0;
+    maxHead = maxSize = minHead = minSize = 0;
+    sumY = sumXY = 0;
+}
+
+double ConvergenceDetector::valueAt( long i ) const {
+    return values[( first + ( i - ( index - count ) ) ) % numBeats];
+}
+
+void ConvergenceDetector::add( double y ) {
+    if( mode == NONE ) return ;
+
+    if( count == numBeats ) { // Slide window, every remaining beat moves one step down in x
+        double oldest = values[first];
+        sumY -= oldest;
+        sumXY = sumXY - sumY + ( numBeats - 1 ) * y;
+        sumY += y;
+        values[first] = y;
+        first = ( first + 1 ) % numBeats;
+    }
+    else {
+        sumXY += count * y;
+        sumY += y;
+        values[( first + count ) % numBeats] = y;
+        count++;
+    }
+
+    // Drop indices that left the window, then beats that can no longer be the max/min
+    long oldestIndex = index + 1 - count;
+    if( maxSize > 0 && maxQueue[maxHead] < oldestIndex ) { maxHead = ( maxHead + 1 ) % capacity; maxSize--; }
+    if( minSize > 0 && minQueue[minHead] < oldestIndex ) { minHead = ( minHead + 1 ) % capacity; minSize--; }
+    index++;
+
+    while( maxSize > 0 && valueAt( maxQueue[( maxHead + maxSize - 1 ) % capacity] ) <= y ) maxSize--;
+    maxQueue[( maxHead + maxSize ) % capacity] = index - 1;
+    maxSize++;
+
+    while( minSize > 0 && valueAt( minQueue[( minHead + minSize - 1 ) % capacity] ) >= y ) minSize--;
+    minQueue[( minHead + minSize ) % capacity] = index - 1;
+    minSize++;
+}
+
+double ConvergenceDetector::spread( void ) const {
+    if( count == 0 ) return 0;
+    return valueAt( maxQueue[maxHead] ) - valueAt( minQueue[minHead] );
+}
+
+double ConvergenceDetector::slope( void ) const {
+    if( count < 2 ) return 0;
+    double n = count;
+    double sumX = n * ( n - 1 ) / 2;
+    double sumXX = ( n - 1 ) * n * ( 2 * n - 1 ) / 6;
+    return ( n * sumXY - sumX * sumY ) / ( n * sumXX - sumX * sumX );
+}
+
+// Only true once a full window of beats has been seen
+bool ConvergenceDetector::converged( void ) const {
+    if( mode == NONE || count < numBeats ) return false;
+    if( mode == DELTA ) return spread() < tolerance;
+    return fabs( slope() ) < tolerance;
+}
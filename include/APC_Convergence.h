@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Convergence.h
+ * Steady-state detection of the APD stream, used to end pacing steps
+ * early once the cell has adapted to the new rate
+ *
+ *** NOTES
+ *
+ * Both criteria look at the last N beats and are updated in O(1) per
+ * beat without allocation:
+ *   DELTA - max(APD) - min(APD) < tolerance (ms), tracked with
+ *           monotonic min/max queues
+ *   SLOPE - |slope| of the least squares line through APD vs beat
+ *           < tolerance (ms/beat), sum(x*y) is updated by recurrence
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_CONVERGENCE_H
+#define APC_CONVERGENCE_H
+
+#include <vector>
+
+class ConvergenceDetector {
+public:
+    enum mode_t { NONE, DELTA, SLOPE };
+
+    ConvergenceDetector( int ); // Maximum number of beats, storage is allocated here
+    ~ConvergenceDetector( void );
+
+    void configure( mode_t, int, double ); // Mode, number of beats, tolerance, clears history
+    void add( double ); // APD of next beat
+    void clear( void ); // Forget history, e.g. after a failed beat
+    bool converged( void ) const;
+    double spread( void ) const; // Current max - min (ms)
+    double slope( void ) const; // Current slope (ms/beat)
+
+private:
+    mode_t mode;
+    int capacity;
+    int numBeats;
+    double tolerance;
+
+    std::vector<double> values; // Ring of last numBeats APDs
+    int first;
+    int count;
+    long index; // Beats added since clear
+
+    // Monotonic queues of beat indices, front is the current max/min
+    std::vector<long> maxQueue, minQueue;
+    int maxHead, maxSize, minHead, minSize;
+
+    double sumY, sumXY; // x runs from 0 (oldest) to count-1 (newest)
+
+    double valueAt( long ) const; // APD of beat index still in the window
+};
+
+#endif // APC_CONVERGENCE_H
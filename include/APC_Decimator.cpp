@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Decimator.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Decimator.h"
+#include <limits>
+
+using namespace std;
+
+/* MinMaxColumns */
+void MinMaxColumns::reset( int n ) {
+    min.assign( n, numeric_limits<float>::max() );
+    max.assign( n, -numeric_limits<float>::max() );
+}
+
+void MinMaxColumns::add( int col, float value ) {
+    if( value < min[col] ) min[col] = value;
+    if( value > max[col] ) max[col] = value;
+}
+
+/* TraceDecimator Class */
+TraceDecimator::TraceDecimator( size_t ringSize, int b ) :
+    samples( ringSize ), columns( 1 ), period( 1 ), sweepLength( 1000 ), maxBeats( b ), lastOffset( 0 ) {
+    current.reset( columns );
+}
+
+TraceDecimator::~TraceDecimator( void ) { }
+
+void TraceDecimator::setGeometry( int c, double p, double s ) {
+    lock_guard<mutex> lock( dataMutex );
+    if( c < 1 || p <= 0 || s <= 0 ) return ;
+    if( c == columns && p == period && s == sweepLength ) return ;
+
+    columns = c;
+    period = p;
+    sweepLength = s;
+    beats.clear(); // Old beats were bucketed with the previous geometry
+    current.reset( columns );
+}
+
+void TraceDecimator::process( void ) {
+    lock_guard<mutex> lock( dataMutex );
+    double scale = period * columns / sweepLength; // Ticks to columns
+    TraceSample s;
+
+    while( samples.pop( s ) ) {
+        if( s.offset < lastOffset ) { // New stimulus, beat in progress is complete
+            beats.push_back( current );
+            if( (int)beats.size() > maxBeats ) beats.pop_front();
+            current.reset( columns );
+        }
+        lastOffset = s.offset;
+
+        int col = s.offset * scale;
+        if( col >= 0 && col < columns ) // Samples beyond the sweep length are not shown
+            current.add( col, s.voltage );
+    }
+}
+
+void TraceDecimator::snapshot( vector<MinMaxColumns> &out ) {
+    lock_guard<mutex> lock( dataMutex );
+    out.assign( beats.begin(), beats.end() );
+    out.push_back( current );
+}
+
+/* TrendDecimator Class */
+TrendDecimator::TrendDecimator( int n ) : numBuckets( n ), perBucket( 1 ), numValues( 0 ) {
+    data.reset( numBuckets );
+}
+
+TrendDecimator::~TrendDecimator( void ) { }
+
+void TrendDecimator::add( float value ) {
+    if( numValues == numBuckets * perBucket ) { // Out of buckets, merge pairs and double bucket size
+        int merged = ( numBuckets + 1 ) / 2;
+        for( int i = 0; i < merged; i++ ) {
+            int j = std::min( 2*i+1, numBuckets-1 ); // Last bucket has no partner if numBuckets is odd
+            data.min[i] = std::min( data.min[2*i], data.min[j] );
+            data.max[i] = std::max( data.max[2*i], data.max[j] );
+        }
+        for( int i = merged; i < numBuckets; i++ ) {
+            data.min[i] = numeric_limits<float>::max();
+            data.max[i] = -numeric_limits<float>::max();
+        }
+        perBucket *= 2;
+    }
+    data.add( numValues / perBucket, value );
+    numValues++;
+}
+
+void TrendDecimator::clear( void ) {
+    data.reset( numBuckets );
+    perBucket = 1;
+    numValues = 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Decimator.h
+ * Min/max decimation of the Vm stream and of the per-beat APD stream
+ * down to one bucket per screen column
+ *
+ *** NOTES
+ *
+ * TraceDecimator is fed by the RT thread through a lock-free ring and
+ * reduced on the worker thread, beats are overlaid by their offset from
+ * the stimulus. TrendDecimator keeps a fixed number of buckets and
+ * doubles the number of beats per bucket whenever it runs out of room,
+ * so both the update and the drawing cost are independent of the
+ * number of beats.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_DECIMATOR_H
+#define APC_DECIMATOR_H
+
+#include "APC_RingBuffer.h"
+#include "APC_WorkerTask.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Min/max envelope of one series, buckets with min > max are empty
+struct MinMaxColumns {
+    std::vector<float> min;
+    std::vector<float> max;
+
+    void reset( int );
+    void add( int, float );
+};
+
+// Vm sample as seen by the RT thread, offset is the number of ticks since the last stimulus
+struct TraceSample {
+    float voltage;
+    int offset;
+};
+
+class TraceDecimator : public WorkerTask {
+public:
+    TraceDecimator( size_t, int ); // Ring size (samples), number of overlaid beats kept
+    ~TraceDecimator( void );
+
+    RingBuffer<TraceSample> samples; // Filled by the RT thread
+
+    void setGeometry( int, double, double ); // Columns, period (ms), sweep length (ms), called by GUI thread
+    void process( void ); // Called by worker thread
+    void snapshot( std::vector<MinMaxColumns> & ); // Oldest beat first, beat in progress last, called by GUI thread
+
+private:
+    std::mutex dataMutex; // Guards everything below, shared by worker and GUI threads only
+    int columns;
+    double period;
+    double sweepLength;
+    int maxBeats;
+    int lastOffset;
+    std::deque<MinMaxColumns> beats;
+    MinMaxColumns current;
+};
+
+class TrendDecimator {
+public:
+    TrendDecimator( int ); // Number of buckets
+    ~TrendDecimator( void );
+
+    void add( float ); // Adds next value of the series
+    void clear( void );
+    int count( void ) const { return numValues; } // Number of values added
+    int bucketSize( void ) const { return perBucket; } // Number of values per bucket
+    const MinMaxColumns &columns( void ) const { return data; }
+
+private:
+    MinMaxColumns data;
+    int numBuckets;
+    int perBucket;
+    int numValues;
+};
+
+#endif // APC_DECIMATOR_H
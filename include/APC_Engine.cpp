@@ -0,0 +1,1032 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Engine.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Engine.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+ClampEngine::ClampEngine( EngineHost *h, double p ) : host( h ) {
+    for( int i = 0; i < numInputs; i++ )
+        inputs[i] = 0;
+    for( int i = 0; i < numOutputs; i++ )
+        outputs[i] = 0;
+
+    // Flags
+    executeMode = IDLE;
+    protocolMode = STEPINIT;
+    recording = vmRecording = false;
+    protocolOn = thresholdOn = false;
+    stepTracker = -1;
+    currentTrial = 0;
+
+    // States
+    time = 0;
+    voltage = 0;
+    vmFiltered = 0;
+    vmDetect = 0;
+    beatNum = 0;
+    APD = 0;
+    STV = 0;
+    alternans = 0;
+
+    // Parameters
+    APDRepol = 90;
+    minAPD = 50;
+    stimWindow = 4;
+    numTrials = 1;
+    intervalTime = 1000;
+    BCL = 1000;
+    stimMag = 4;
+    stimLength = 1;
+    LJP = 0;
+    statsWindow = 20;
+    numChannels = 1;
+    artifactBeats = 0;
+    rejectBeats = 1;
+    eventPulseLength = 0;
+    adaptiveStim = 0;
+    captureWindow = 20;
+    testPulseAmplitude = 0;
+    testPulseLength = 10;
+    testPulseBeats = 0;
+    rsCompensation = 0;
+
+    // Protocol
+    currentStep = 0;
+    stimScale = 1;
+    lastStepFailed = lastStepConverged = lastStepEAD = false;
+    stepPtr = 0;
+    stepType = ProtocolDefs::PACE;
+
+    // Timing, updated again by reset() and on period change
+    timeBase.setPeriod( p );
+    updateTicks();
+    stepTime = 0;
+    stepEndTime = 0;
+    cycleStartTime = 0;
+    pBCLInt = 0;
+    digitalOut = 0;
+
+    // APD parameters
+    upstrokeThreshold = -40;
+    APDMode = START;
+    APStart = peakTime = 0;
+    beatStartTime = 0;
+    repolarization = 0;
+    DI = -1;
+
+    // Per-beat results
+    beatFifo = new RingBuffer<BeatResult>( 4096 );
+    statisticsFifo = new RingBuffer<StatisticsSummary>( 256 );
+    windowStatistics = new BeatStatistics( maxStatsWindow );
+    windowStatistics->setWindow( statsWindow );
+    stepStatistics = new BeatStatistics( 2 );
+    trialStatistics = new BeatStatistics( 2 ); // Cumulative, window of 0 needs no storage
+    convergence = new ConvergenceDetector( ProtocolDefs::maxConvergeBeats );
+    stepConverged = false;
+    stepStartBeat = 0;
+    spontaneousBeat = false;
+    afterdepolarization = new AfterdepolarizationDetector( afterdepolarizationRise );
+    eventPulseEnd = 0;
+    thresholdStimulus = responseTime = 0;
+    stimControl = new StimulusController( 0.2, 0.1, 10, 3 ); // +20% per miss, 10% back every 10 captured beats, at most 3x
+    stimAmplitude = stimMag;
+    current = currentCorrected = 0;
+    outputCurrent = 0;
+    Rs = Rm = Cm = 0;
+    testPulseStart = testPulseEnd = 0;
+    beatsSinceTestPulse = 0;
+    testPulseTrigger = false;
+    for( int i = 0; i < BeatClass::numClasses; i++ )
+        stepClassCounts[i] = trialClassCounts[i] = 0;
+
+    // Additional channels
+    channelBank = new ChannelBank();
+    channelBank->setChannels( numChannels );
+
+    // Analysis tasks, serviced by the host, ring holds ~3 s of samples at 20 kHz
+    traceDecimator = new TraceDecimator( 65536, 8 );
+    artifact = new ArtifactTemplate( maxArtifactLength, maxArtifactBeats );
+    leak = new LeakEstimator( maxTestPulseLength );
+    sweeps = new SweepStore( ProtocolDefs::maxSweeps );
+    restitution = new RestitutionAnalyzer( 1024 );
+    beatRecorder = new BeatRecorder( 65536 );
+    leakTask = sweepTask = restitutionTask = -1;
+    beatRecordOpen = beatRecording = false;
+    filter = new FilterCascade(); // Passes input through until a filter is set
+
+    // AP Clamp Variables
+    traces = new TraceStore( ProtocolDefs::numRecordSlots );
+    vmRecordData = avgRecordData = apClampData = traces->slot( 0 );
+    avgLength = 0;
+    recordingIndex = 0;
+    vmRecordCnt = avgCnt = apClampCnt = 0;
+
+    // Regression runs, off until requested
+    digestRequested = digestOn = false;
+    replaySlot = -1;
+    replaying = false;
+    replayTick = 0;
+    profile = new TickProfile( TickProfile::STEP + ProtocolDefs::numStepTypes );
+}
+
+// Tasks must no longer be serviced by the host's pool
+ClampEngine::~ClampEngine( void ) {
+    delete traceDecimator;
+    delete artifact;
+    delete filter;
+    delete afterdepolarization;
+    delete stimControl;
+    delete leak;
+    delete sweeps;
+    delete restitution;
+    delete beatRecorder; // Closes the files
+    delete traces;
+    delete beatFifo;
+    delete statisticsFifo;
+    delete windowStatistics;
+    delete stepStatistics;
+    delete trialStatistics;
+    delete convergence;
+    delete channelBank;
+    delete profile;
+}
+
+void ClampEngine::tick( void ) {
+    bool hashed = digestOn && executeMode != IDLE;
+#ifdef APC_PROFILE
+    int modeBucket = profileBucket();
+    int APDBucket = ( executeMode == PACE || executeMode == PROTOCOL ) ? TickProfile::APDSTART + APDMode : -1;
+    long long tickStart = host->engineClock();
+#else
+    long long tickStart = hashed ? host->engineClock() : 0;
+#endif
+
+    voltage = replaying ? replayPlayer.sample( replayTick++ ) : inputs[0] * 1e3 - LJP; // Replayed slots are already in mV
+    vmFiltered = filter->process( voltage ); // Filter state runs continuously, recorder keeps the raw voltage
+    for( int c = 1; c < numChannels; c++ )
+        channelBank->voltage[c] = inputs[c] * 1e3 - LJP;
+    
+    switch( executeMode ) {
+    case IDLE:
+        break;
+
+    case THRESHOLD:
+        // Apply stimulus for given number of ms (StimLength) 
+        if( timeBase.since( thresholdStimulus ) <= stimLength ) {
+            backToBaseline = false;
+            peakVoltageT = Vrest;
+            outputs[0] = stimulusLevel * 1e-9; // stimulsLevel is in nA, convert to A for amplifier
+        }
+        
+        else {
+            outputs[0] = 0;
+
+            if( voltage > peakVoltageT ) // Find peak voltage after stimulus
+                peakVoltageT = voltage;
+
+            // If Vm is back to resting membrane potential (within 2 mV; determined when threshold detection button is first pressed) 
+            if( voltage-Vrest < 2 ) { // Vrest: voltage at the time threshold test starts
+                if ( !backToBaseline ) {
+                    responseDuration = timeBase.since( thresholdStimulus );
+                    responseTime = timeBase.now();
+                    backToBaseline = true;
+                }
+
+                // Calculate time length of voltage response
+                if( responseDuration > 50 && peakVoltageT > 10 ) { // If the response was more than 50ms long and peakVoltage is more than 10mV, consider it an action potential
+                    stimMag = stimulusLevel*1.5; // Set the current stimulus value as the calculated threshold * 2
+                    thresholdOn = false;
+                    executeMode = IDLE;
+                }
+                // If no action potential occurred, and Vm is back to rest 
+                else {
+
+                    // If the cell has rested for  200ms since returning to baseline 
+                    if( timeBase.since( responseTime ) > 200 ) {
+                        stimulusLevel += 0.1; // Increase the magnitude of the stimulus and try again 
+                        thresholdStimulus = timeBase.now(); // Record the time of stimulus application 
+                    }   
+                }
+            }
+        }
+        timeBase.tick();
+        time = timeBase.time(); // Derived from the tick count, never accumulated
+        break;
+
+    case PACE:
+        
+        timeBase.tick();
+        time = timeBase.time(); // Derived from the tick count, never accumulated
+        stepTime += 1;
+        // If time is greater than BCL, advance the beat
+        if ( stepTime - cycleStartTime >= BCLInt ) {
+            endBeat();
+            beatNum++;            
+            cycleStartTime = stepTime;
+            Vrest = voltage;
+            calculateAPD( 1 ); // First step of APD calculation called at each stimulus
+        }
+        
+        // Stimulate cell for stimLength(ms), digital out on for duration of stimulus
+        if ( (stepTime - cycleStartTime) < stimLengthInt ) {
+            outputCurrent = stimAmplitude * 1e-9; // stimAmplitude in nA, convert to A for amplifier
+            digitalOut = 1;
+        }
+        else {
+            outputCurrent = 0;
+            digitalOut = 0;
+        }
+
+        // Inject Current
+        writeOutputs( outputCurrent );
+        outputs[1] = timeBase.now() < eventPulseEnd ? 1 : digitalOut;
+        //Calulate APD
+        calculateAPD( 2 ); // Second step of APD calculation
+        pushTrace();
+        pushRecord();
+        break;
+
+    case PROTOCOL:
+
+        timeBase.tick();
+        time = timeBase.time(); // Derived from the tick count, never accumulated
+        stepTime += 1;
+
+        if (protocolMode == STEPINIT) {
+            stepInitDone = false;
+
+            // These steps do not consume a thread loop by themselves
+            while (!stepInitDone) {
+                // End of protocol
+                if ((size_t)currentStep >= program.size()) {// If end of protocol has been reached
+                    protocolMode = END;
+                    stepInitDone = true;
+                }
+                else {
+                    const ProtocolInstruction &instruction = program[currentStep];
+
+                    // Loops and branches
+                    if (instruction.op == ProtocolInstruction::LOOP) {
+                        programCounters[currentStep] = instruction.count;
+                        iterationStarts[currentStep] = timeBase.now();
+                        currentStep++;
+                        continue;
+                    }
+                    else if (instruction.op == ProtocolInstruction::ENDLOOP) {
+                        if (programCounters[instruction.jump] > 1 && iterationStarts[instruction.jump] == timeBase.now()) {
+                            stepInitDone = true; // Branches skipped every timed step, the next iteration waits for the next tick
+                            break;
+                        }
+                        if (--programCounters[instruction.jump] > 0) {
+                            currentStep = instruction.jump + 1; // Next iteration
+                            iterationStarts[instruction.jump] = timeBase.now();
+                        }
+                        else
+                            currentStep++;
+                        continue;
+                    }
+                    else if (instruction.op == ProtocolInstruction::BRANCH) {
+                        currentStep = executeBranch(currentStep);
+                        continue;
+                    }
+
+                    stepPtr = &instruction;
+                    stepType = stepPtr->type;
+
+                    // Start data recording
+                    if (stepType == ProtocolDefs::STARTRECORD) {
+                        if( beatRecordOpen ) // Beat record replaces the data recorder
+                            beatRecording = true;
+                        else if( !recording ) { // Record data if dataRecord is toggled
+                            host->engineRecord( true );
+                            recording = true;
+                        }
+                        currentStep++;
+                    }
+                    // Stop data recording
+                    else if (stepType == ProtocolDefs::STOPRECORD) {
+                        if( beatRecording ) {
+                            beatRecorder->stop();
+                            beatRecording = false;
+                        }
+                        else if(recording == true) {
+                            host->engineRecord( false );
+                            recording = false;
+                        }
+                        currentStep++;
+                    }
+                    // Start Vm recording init
+                    else if (stepType == ProtocolDefs::STARTVM) {
+                        vmRecording = true;
+                        recordingIndex = stepPtr->recordIdx;
+                        vmRecordData = traces->slot(recordingIndex);
+                        vmRecordData->clear();
+                        vmRecordData->setPeriod(period);
+                        vmRecordCnt = 0;
+                        currentStep++;
+                    }
+                    // Stop Vm recording init
+                    else if (stepType == ProtocolDefs::STOPVM) {
+                        vmRecording = false;
+                        currentStep++;
+                    }
+                    else {
+                        stepTime = 0;
+                        cycleStartTime = 0;
+                        pBCLInt = timeBase.ticks(stepPtr->BCL); // BCL for protocol
+
+                        // Pace, Average, and AP Clamp Init
+                        if (stepType == ProtocolDefs::PACE ||
+                            stepType == ProtocolDefs::AVERAGE ||
+                            stepType == ProtocolDefs::APCLAMP ) {
+                            
+                            stepEndTime = timeBase.ticks(stepPtr->BCL * stepPtr->numBeats) - 1; // -1 since time starts at 0, not 1
+                            beatNum++;
+
+                            if ( stepType == ProtocolDefs::AVERAGE ) {
+                                recordingIndex = stepPtr->recordIdx;
+                                avgRecordData = traces->slot(recordingIndex); // Written when the step ends
+                                avgLength = std::min( timeBase.ticks(stepPtr->BCL), (int)avgSum.size() - 1 ); // Sized at the period the protocol started with
+                                std::fill( avgSum.begin(), avgSum.begin() + avgLength, 0.0 );
+                                avgCnt = 0; // Keeps track of how many beats have been added
+                            }
+                            else if ( stepType == ProtocolDefs::APCLAMP ) {
+                                recordingIndex = stepPtr->recordIdx;
+                                apClampData = traces->slot(recordingIndex);
+                                apClampPlayer.start( apClampData, period );
+                                apClampCnt = 1;
+                                testPulseEnd = 0;
+                                beatsSinceTestPulse = 0;
+                                testPulseTrigger = false;
+                                if ( stepPtr->sweep >= 0 && !sweeps->beginSweep( stepPtr->sweep, stepPtr->reference ) )
+                                    host->engineError("AP_Clamp Error: Previous sweep is still being averaged, step is not kept\n");
+                            }
+                        }
+                        // Wait Init
+                        else {
+                            stepEndTime = timeBase.ticks(stepPtr->waitTime) - 1; // -1 since time starts at 0, not 1
+                        }
+
+                        updateStimAmplitude(); // Retry branches may have changed stimScale
+
+                        // Steady state criterion, only PACE steps can end early
+                        stepStartBeat = beatNum;
+                        stepConverged = false;
+                        convergence->configure( stepType == ProtocolDefs::PACE ?
+                                                (ConvergenceDetector::mode_t)stepPtr->convergeMode : ConvergenceDetector::NONE,
+                                                stepPtr->convergeBeats, stepPtr->convergeTol );
+                        
+                        protocolMode = EXEC;
+                        Vrest = voltage;
+                        calculateAPD( 1 );
+                        stepInitDone = true;
+
+                        if ( stepType == ProtocolDefs::APCLAMP && pBCLInt > (int)apClampPlayer.length() ) {
+                            host->engineError("AP_Clamp Error: Not enough data for entire step\n");
+                            protocolMode = END;
+                        }
+                        else if ( stepType == ProtocolDefs::APCLAMP )
+                            startTestPulse(); // Every AP clamp step starts with a test pulse
+                    }                   
+                }
+                
+            } // end while (!stepInitiDone)            
+
+            if (protocolMode == STEPINIT) { // Held on an ENDLOOP, the tick is spent as a wait
+                writeOutputs( 0 );
+                if ( vmRecording )
+                    vmRecordData->push(voltage);
+                pushTrace();
+                pushRecord();
+            }
+        } // end if (protocolMode == STEPINIT)
+   
+        if ( protocolMode == EXEC ) { // Execute protocol
+
+            // Static Pacing or Averaging
+            if ( stepType == ProtocolDefs::PACE || stepType == ProtocolDefs::AVERAGE) { // Pace cell at BCL
+                if (stepTime - cycleStartTime >= pBCLInt) {
+                    endBeat();
+                    if ( convergence->converged() ) { // Steady state, step ends now instead of giving the next stimulus
+                        stepConverged = true;
+                        stepEndTime = stepTime;
+                    }
+                    else {
+                        beatNum++;
+                        cycleStartTime = stepTime;
+                        Vrest = voltage;
+                        calculateAPD( 1 );
+                    }
+                }
+                
+                // Stimulate cell for stimLength(ms), digital out on for duration for stimulus
+                if ( (stepTime - cycleStartTime) < stimLengthInt ) {
+                    outputCurrent = stimAmplitude * 1e-9;
+                    digitalOut = stepPtr->digitalOut;
+                }
+                else {
+                    outputCurrent = 0;
+                    digitalOut = 0;
+                }
+
+                if ( stepType == ProtocolDefs::AVERAGE && stepTime - cycleStartTime <= avgLength ) // Voltage in mV, staged until the beat is classified
+                    avgBeatData[stepTime - cycleStartTime] = voltage;
+                writeOutputs( outputCurrent );
+                outputs[1] = timeBase.now() < eventPulseEnd ? 1 : digitalOut;
+                calculateAPD(2);
+                
+            } // end if(PACE || AVERAGE)
+
+            // Wait
+            else if ( stepType == ProtocolDefs::WAIT ) { 
+                writeOutputs( 0 );
+            }
+            
+            // AP Clamp
+            else {
+                current = inputs[0] * 1e12; // Amplifier is in voltage clamp, current in A converted to pA
+                if ( leak->update() ) { // Worker finished fitting the last test pulse
+                    Rs = leak->estimate().Rs;
+                    Rm = leak->estimate().Rm;
+                    Cm = leak->estimate().Cm;
+                }
+
+                if (stepTime - cycleStartTime >= pBCLInt) {
+                    beatNum++;
+                    cycleStartTime = stepTime;
+                    if ( testPulseBeats > 0 && ++beatsSinceTestPulse >= testPulseBeats && startTestPulse() )
+                        testPulseTrigger = ( stepPtr->digitalOut != 0 ); // Beat is delayed until the test pulse is over
+                    else
+                        outputs[1] = stepPtr->digitalOut;
+                }
+
+                if (stepTime < testPulseEnd) { // Test pulse, cycleStartTime is at its end
+                    voltage = leak->command( stepTime - testPulseStart, current );
+                    if( stepTime - testPulseStart == leak->window() - 1 ) // Captured, fitted without waiting for the next service
+                        host->enginePost( leakTask );
+                }
+                else {
+                    if (testPulseTrigger) {
+                        outputs[1] = stepPtr->digitalOut;
+                        testPulseTrigger = false;
+                    }
+                    if (stepTime - cycleStartTime > (50 / period) && stepPtr->digitalOut != 0) // Digital out on for 50ms
+                        outputs[1] = 0;
+                    voltage = apClampPlayer.sample(stepTime - cycleStartTime);
+                }
+                currentCorrected = current - leak->leakCurrent( voltage );
+                sweeps->add( stepTime - cycleStartTime, currentCorrected ); // Ignored during test pulses and for unnamed steps
+
+                // Rs compensation adds part of the drop across Rs (pA * MOhm = 1e-3 mV) to the command, test pulses are uncompensated
+                double command = voltage;
+                if (stepTime >= testPulseEnd)
+                    command += rsCompensation * 1e-2 * current * Rs * 1e-3;
+                writeOutputs( (command * 1e-3) + (LJP * 1e-3) ); // Same command waveform for every channel
+            }
+            
+            if ( vmRecording ) {
+                vmRecordData->push(voltage); // Voltage in mV
+            }
+            pushTrace();
+            pushRecord();
+            
+            if( stepTime >= stepEndTime ) {
+                if ( stepType == ProtocolDefs::PACE || stepType == ProtocolDefs::AVERAGE ) {
+                    if ( !stepConverged ) // Converged steps already ended their last beat
+                        endBeat(); // Last beat of the step
+                    lastStepFailed = ( stepClassCounts[BeatClass::FAILED] > 0 ); // Outcome seen by branches
+                    lastStepEAD = ( stepClassCounts[BeatClass::EAD] > 0 );
+                    lastStepConverged = stepConverged;
+                    publishStatistics( stepStatistics, stepClassCounts, currentStep, beatNum - stepStartBeat + 1, stepConverged );
+                    if( restitution->endStep( currentStep, stepPtr->BCL ) ) // Last beats of the step are its restitution point
+                        host->enginePost( restitutionTask );
+                }
+                if ( stepType == ProtocolDefs::AVERAGE ) { // Sum of accepted beats to average, converted to the slot type here
+                    for ( int i = 0; i < avgLength; i++ )
+                        avgSum[i] = avgCnt > 0 ? avgSum[i] / avgCnt : 0;
+                    avgRecordData->resize( avgLength ); // Capacity reserved when the protocol started
+                    avgRecordData->write( 0, avgLength, &avgSum[0] );
+                    avgRecordData->setPeriod( period );
+                }
+                if ( stepType == ProtocolDefs::APCLAMP ) { // Worker averages the sweep and computes its difference current
+                    sweeps->endSweep();
+                    host->enginePost( sweepTask ); // Step completion, no allocation
+                }
+                currentStep++;
+                protocolMode = STEPINIT;
+            }            
+        } // end EXEC
+
+        if( protocolMode == END ) { // End of Protocol: Stop Data recorder and untoggle button
+            if( beatRecording ) {
+                beatRecorder->stop();
+                beatRecording = false;
+            }
+            if(recording == true) {
+                host->engineRecord( false );
+                recording = false;
+            }
+            publishStatistics( trialStatistics, trialClassCounts, -1, beatNum, false ); // Trial summary
+            if (currentTrial < numTrials) {
+                reset();
+                beatNum = 0; // beatNum is changed at beginning of protocol, so it must start at 0 instead of 1
+                stepTracker = -1; // Used to highlight the current step in list box, -1 to force first step to be highlighted
+                protocolMode = STEPINIT;
+                executeMode = PROTOCOL;
+                currentTrial++;
+            }
+            else {
+                protocolOn = false;
+                executeMode = IDLE;
+            }
+        } // end END
+            
+        break;
+        
+    } // end switch( executeMode )     
+
+#ifdef APC_PROFILE
+    profileTick( modeBucket, APDBucket, tickStart );
+#endif
+    if( hashed )
+        hashTick( tickStart );
+} // end tick()
+
+void ClampEngine::reset( void ) {
+    updateTicks(); // Period is kept current by setPeriod()
+     
+    stepTime = -1;
+    timeBase.restartClock( -1 ); // First tick is time 0
+    time = timeBase.time();
+    eventPulseEnd = timeBase.now(); // No pulse left over from the previous run
+    stimControl->reset();
+    cycleStartTime = 0;
+    beatNum = 1;
+    Vrest = voltage;
+    APDMode = START; // No diastolic interval across runs
+    calculateAPD( 1 );
+
+    // Protocol variables
+    currentStep = 0;
+    updateStimAmplitude();
+    std::fill( programCounters.begin(), programCounters.end(), 0 ); // No retries carried over into the next trial
+}
+
+void ClampEngine::setPeriod( double p ) {
+    if( timeBase.setPeriod( p ) )
+        retime();
+}
+
+void ClampEngine::startProtocol( const ProtocolProgram &compiled, int numSweeps ) {
+    program = compiled;
+    programCounters.assign( program.size(), 0 );
+    iterationStarts.assign( program.size(), 0 );
+    stimScale = 1;
+    lastStepFailed = lastStepConverged = lastStepEAD = false;
+
+    executeMode = IDLE; // Keep on IDLE until update is finished
+    armDigest(); // Before reset(), so Vrest is taken from the replay
+    reset();
+    beatNum = 0; // beatNum is changed at beginning of protocol, so it must start at 0 instead of 1
+    stepTracker = -1; // Used to highlight the current step in list box, -1 to force first step to be highlighted
+    protocolMode = STEPINIT;
+    currentTrial = 1;
+    clearResults(); // Results of previous run are discarded
+    restitution->restart();
+    artifact->restart( stimLengthInt, artifactBeats ); // Template is kept across trials
+    leak->restart( timeBase.ticks( testPulseLength ), testPulseAmplitude, period ); // Estimate is kept across trials
+    Rs = Rm = Cm = 0;
+
+    size_t avgLength = 0; // Longest AVERAGE beat, so the RT thread never resizes the staging buffer or the slots
+    for( size_t i = 0; i < program.size(); i++ ) {
+        if( program[i].type == ProtocolDefs::AVERAGE && timeBase.ticks( program[i].BCL ) > (int)avgLength )
+            avgLength = timeBase.ticks( program[i].BCL );
+    }
+    avgBeatData.assign( avgLength + 1, 0 );
+    avgSum.assign( avgLength + 1, 0 );
+    for( size_t i = 0; i < program.size(); i++ ) {
+        const ProtocolInstruction &step = program[i];
+        if( step.recordIdx < 0 || step.recordIdx >= traces->size() ) continue;
+        if( step.type == ProtocolDefs::AVERAGE ) // Slot is resized when the step ends, up to avgLength after a period change
+            traces->slot( step.recordIdx )->reserve( avgLength );
+        else if( step.type == ProtocolDefs::APCLAMP ) // Slots recorded or loaded at another period
+            traces->resample( step.recordIdx, period );
+    }
+
+    size_t sweepLength = 0; // Longest AP clamp beat, sweep accumulators are allocated here
+    for( size_t i = 0; i < program.size(); i++ ) {
+        if( program[i].type == ProtocolDefs::APCLAMP && timeBase.ticks( program[i].BCL ) > (int)sweepLength )
+            sweepLength = timeBase.ticks( program[i].BCL );
+    }
+    sweeps->restart( numSweeps, sweepLength + 1, period ); // Sweeps are kept across trials
+    protocolOn = true;
+    executeMode = PROTOCOL;
+}
+
+// Beat record is opened first, the whole pace run is recorded
+void ClampEngine::startPace( void ) {
+    armDigest();
+    reset();
+    clearResults();
+    artifact->restart( stimLengthInt, artifactBeats );
+    beatRecording = beatRecordOpen;
+    executeMode = PACE;
+}
+
+void ClampEngine::startThreshold( double vm ) {
+    executeMode = THRESHOLD;
+    armDigest();
+    reset();
+    Vrest = vm;
+    peakVoltageT = Vrest;
+    stimulusLevel = 2.0; // na
+    responseDuration = 0;
+    responseTime = 0;
+    thresholdStimulus = 0;
+}
+
+void ClampEngine::stop( void ) {
+    closeBeatRecord();
+    protocolOn = false;
+    executeMode = IDLE;
+}
+
+// A run at another period needs the record opened again, windows are sized in ticks
+bool ClampEngine::openBeatRecord( const string &base, double pre, double post, int fullBeatInterval,
+                                  double voltageResolution, double currentResolution ) {
+    closeBeatRecord();
+    beatRecordOpen = beatRecorder->open( base, timeBase.ticks( pre ), timeBase.ticks( post ),
+                                         fullBeatInterval, period, voltageResolution, currentResolution );
+    return beatRecordOpen;
+}
+
+// Holding potential is the first sample of the AP clamp waveform, the beat resumes when the window is over
+bool ClampEngine::startTestPulse( void ) {
+    if( !leak->beginPulse( apClampData->at(0) ) ) // Off, or the worker is still fitting the last pulse
+        return false;
+
+    testPulseStart = stepTime;
+    testPulseEnd = stepTime + leak->window();
+    stepEndTime += leak->window();
+    cycleStartTime = testPulseEnd;
+    beatsSinceTestPulse = 0;
+    return true;
+}
+
+void ClampEngine::updateTicks( void ) {
+    period = timeBase.period();
+    BCLInt = timeBase.ticks( BCL );
+    stimLengthInt = timeBase.ticks( stimLength );
+}
+
+// Called between two ticks, so tick() never sees tick counts of both periods. Counters in flight are rescaled,
+// lengths are derived again from ms. Buffers sized in ticks when the run started (artifact template, test pulse, average beat,
+// sweep and beat record windows) keep their length until the next run, all of them ignore samples past their end
+void ClampEngine::retime( void ) {
+    updateTicks();
+    profile->requestReset(); // One profile per sample rate
+
+    // Clock stamps, including the future end of the event pulse and the threshold test ones
+    APStart = timeBase.rescaleStamp( APStart );
+    peakTime = timeBase.rescaleStamp( peakTime );
+    beatStartTime = timeBase.rescaleStamp( beatStartTime );
+    repolarization = timeBase.rescaleStamp( repolarization );
+    eventPulseEnd = timeBase.rescaleStamp( eventPulseEnd );
+    thresholdStimulus = timeBase.rescaleStamp( thresholdStimulus );
+    responseTime = timeBase.rescaleStamp( responseTime );
+
+    if( replaying ) { // Interpolated like the AP clamp command
+        replayPlayer.start( traces->slot( replaySlot ), period );
+        replayTick = (int)timeBase.rescale( replayTick );
+    }
+    if( executeMode != PACE && executeMode != PROTOCOL ) return ;
+
+    stepTime = timeBase.rescale( stepTime );
+    cycleStartTime = timeBase.rescale( cycleStartTime );
+    if( executeMode == PACE || protocolMode != EXEC ) return ;
+
+    pBCLInt = timeBase.ticks( stepPtr->BCL );
+    stepEndTime = timeBase.rescale( stepEndTime + 1 ) - 1; // May include test pulses
+    if( stepType == ProtocolDefs::AVERAGE ) { // Beats so far were summed at the old period, averaging starts over
+        avgLength = std::min( timeBase.ticks( stepPtr->BCL ), (int)avgSum.size() - 1 );
+        std::fill( avgSum.begin(), avgSum.begin() + avgLength, 0.0 );
+        avgCnt = 0;
+    }
+    else if( stepType == ProtocolDefs::APCLAMP ) {
+        testPulseStart = timeBase.rescale( testPulseStart );
+        testPulseEnd = timeBase.rescale( testPulseEnd );
+        apClampPlayer.start( apClampData, period ); // Interpolated until the slot is resampled by the next run
+    }
+}
+
+// Retry counters are kept in programCounters and reset whenever the branch falls through
+int ClampEngine::executeBranch( int pc ) {
+    const ProtocolInstruction &instruction = program[pc];
+    bool taken = false;
+
+    switch( instruction.condition ) {
+    case ProtocolDefs::ALWAYS: taken = true; break;
+    case ProtocolDefs::CAPTUREFAILED: taken = lastStepFailed; break;
+    case ProtocolDefs::CONVERGED: taken = lastStepConverged; break;
+    case ProtocolDefs::EAD: taken = lastStepEAD; break;
+    }
+
+    if( taken && instruction.action == ProtocolDefs::RETRY ) {
+        if( programCounters[pc] >= instruction.count ) // Out of retries, carry on with the raised stimulus
+            taken = false;
+        else {
+            programCounters[pc]++;
+            stimScale *= instruction.scale;
+        }
+    }
+    if( !taken ) {
+        programCounters[pc] = 0;
+        return pc + 1;
+    }
+    return instruction.jump;
+}
+
+// Replayed runs start from the same state every time, filter primed and Vm at the first sample of the replay
+void ClampEngine::armDigest( void ) {
+    digestOn = digestRequested;
+    if( digestOn )
+        digest.reset();
+
+    replaying = false;
+    if( !digestOn || replaySlot < 0 || traces->slot( replaySlot )->size() == 0 ) return ;
+    traces->resample( replaySlot, period );
+    replayPlayer.start( traces->slot( replaySlot ), period );
+    replayTick = 0;
+    replaying = true;
+    voltage = replayPlayer.sample( 0 );
+    filter->prime( voltage );
+}
+
+// Busy time is measured before hashing, so the throughput is that of tick() alone
+void ClampEngine::hashTick( long long start ) {
+    long long busy = host->engineClock() - start;
+    for( int i = 0; i <= ChannelBank::maxChannels; i++ ) // Outputs of every channel and the digital output
+        digest.add( outputs[i] );
+    digest.add( time );
+    digest.add( voltage );
+    digest.add( beatNum );
+    digest.add( APD );
+    digest.add( STV );
+    digest.add( alternans );
+    digest.add( stimAmplitude );
+    digest.add( current );
+    digest.add( (uint64_t)currentStep );
+    digest.add( (uint64_t)stepTime );
+    digest.endTick( busy );
+}
+
+int ClampEngine::profileBucket( void ) {
+    switch( executeMode ) {
+    case THRESHOLD: return TickProfile::THRESHOLD;
+    case PACE: return TickProfile::PACE;
+    case PROTOCOL: return protocolMode == EXEC ? TickProfile::STEP + stepType : TickProfile::PROTOCOL;
+    default: return TickProfile::IDLE;
+    }
+}
+
+// Hashing is not part of the tick cost
+void ClampEngine::profileTick( int modeBucket, int APDBucket, long long start ) {
+    long long busy = host->engineClock() - start;
+    profile->add( modeBucket, busy );
+    if( APDBucket >= 0 )
+        profile->add( APDBucket, busy );
+}
+
+void ClampEngine::calculateAPD(int step){ // Two APDs are calculated based on different criteria
+    switch( step ) {
+    case 1:
+        DI = ( APDMode == DONE ) ? timeBase.since( repolarization ) : -1; // Previous beat must have repolarized
+        APDMode = START;
+        beatStartTime = timeBase.now();
+        spontaneousBeat = false;
+        afterdepolarization->beginBeat();
+        artifact->beginBeat( vmFiltered ); // Same signal the template is subtracted from
+        channelBank->beginBeat(); // Vrest of each channel is its voltage at the stimulus
+        break;
+
+    case 2:
+        vmDetect = artifact->subtract( stepTime - cycleStartTime, vmFiltered ); // Captures the artifact while it is being learned
+        switch( APDMode ) { 
+        case START:// Find time membrane voltage passes upstroke threshold, start of AP            
+            if( vmDetect >= upstrokeThreshold ) {
+                APStart = timeBase.now();
+                peakVoltage = Vrest;
+                APDMode = PEAK;
+            }
+            break;
+            
+        case PEAK: // Find peak of AP, points within "window" are ignored to eliminate effect of stimulus artifact
+            if( timeBase.since( APStart ) > stimWindow ) { // If we are outside the chosen time window after the AP
+                if( peakVoltage < vmDetect  ) { // Find peak voltage                    
+                    peakVoltage = vmDetect;
+                    peakTime = timeBase.now();
+                }
+                else if ( timeBase.since( peakTime ) > 5 ) { // Keep looking for the peak for 5ms to account for noise
+                    double APAmp;                    
+                    APAmp = peakVoltage - Vrest ; // Amplitude of action potential based on resting membrane and peak voltage
+                    // Calculate downstroke threshold based on AP amplitude and desired AP repolarization %
+                    downstrokeThreshold = peakVoltage - ( APAmp * (APDRepol / 100.0) );
+                    APDMode = DOWN;
+                }
+            }
+            break;
+            
+        case DOWN: // Find downstroke threshold and calculate APD
+            if( vmDetect <= downstrokeThreshold ) {
+                APD = timeBase.since( APStart );
+                repolarization = timeBase.now();
+                APDMode = DONE;
+            }
+            break;
+
+        default: // DONE: APD has been found, only watch for an unstimulated upstroke
+            if( vmDetect >= upstrokeThreshold )
+                spontaneousBeat = true;
+            break;
+        }
+
+        // EADs from the peak to the APD threshold, DADs after it
+        AfterdepolarizationDetector::phase_t phase = AfterdepolarizationDetector::NONE;
+        if( APDMode == DOWN ) phase = AfterdepolarizationDetector::REPOLARIZATION;
+        else if( APDMode == DONE ) phase = AfterdepolarizationDetector::DIASTOLE;
+        if( afterdepolarization->update( phase, vmDetect ) && eventPulseLength > 0 )
+            eventPulseEnd = timeBase.now() + timeBase.ticks( eventPulseLength );
+
+        if( numChannels > 1 ) // Same state machine for all additional channels at once
+            channelBank->update( timeBase.since( beatStartTime ), upstrokeThreshold, stimWindow, APDRepol / 100.0 );
+    }
+}
+
+// Sends the result of the beat that just finished to the GUI thread, called before beatNum is advanced
+void ClampEngine::endBeat( void ) {
+    BeatResult result;
+    result.trial = ( executeMode == PROTOCOL ) ? currentTrial : 0;
+    result.step = ( executeMode == PROTOCOL ) ? currentStep : -1;
+    result.beat = beatNum;
+    result.time = timeBase.time( beatStartTime );
+    result.APD = APD;
+    result.DI = DI;
+    result.complete = ( APDMode == DONE );
+    result.beatClass = classifyBeat();
+    result.afterdepolarizations = afterdepolarization->result();
+    result.stimAmplitude = stimAmplitude;
+    result.captured = ( APDMode != START && timeBase.ms( APStart - beatStartTime ) <= captureWindow );
+    stimControl->beatResult( result.captured );
+    updateStimAmplitude();
+    result.channels = numChannels;
+    for( int c = 0; c < ChannelBank::maxChannels; c++ ) {
+        result.channelAPD[c] = channelBank->APD[c];
+        result.channelComplete[c] = ( channelBank->mode[c] == ChannelBank::DONE );
+    }
+
+    bool accepted = ( result.beatClass == BeatClass::CAPTURED );
+    if( accepted ) { // Rejected beats are left out of the statistics
+        windowStatistics->add( APD );
+        if( executeMode == PROTOCOL ) {
+            stepStatistics->add( APD );
+            trialStatistics->add( APD );
+            convergence->add( APD );
+        }
+    }
+    else if( executeMode == PROTOCOL ) // A rejected beat restarts the steady state window
+        convergence->clear();
+
+    if( executeMode == PROTOCOL ) {
+        stepClassCounts[result.beatClass]++;
+        trialClassCounts[result.beatClass]++;
+        if( stepType == ProtocolDefs::AVERAGE )
+            addAverageBeat( accepted || !rejectBeats );
+        restitution->addBeat( currentStep, DI, APD, accepted && result.complete );
+    }
+    result.windowStats = windowStatistics->result();
+    STV = result.windowStats.STV;
+    alternans = result.windowStats.alternans;
+
+    beatFifo->push( result ); // Result is dropped if the GUI thread has fallen behind
+}
+
+// Failed: no upstroke, or depolarization shorter than minAPD, or no repolarization before the next beat
+int ClampEngine::classifyBeat( void ) {
+    if( spontaneousBeat )
+        return BeatClass::SPONTANEOUS;
+    if( APDMode == START || ( APDMode == DONE && APD < minAPD ) )
+        return BeatClass::FAILED;
+    if( afterdepolarization->result().EADCount > 0 )
+        return BeatClass::EAD;
+    if( APDMode != DONE )
+        return BeatClass::FAILED;
+    return BeatClass::CAPTURED;
+}
+
+// Adds the staged beat to the AVERAGE step sum, the sum is divided by avgCnt when the step ends
+void ClampEngine::addAverageBeat( bool accept ) {
+    if( !accept ) return ;
+
+    int samples = (int)( stepTime - cycleStartTime + 1 ); // Last beat of the step ends one tick early
+    if( samples > avgLength ) samples = avgLength;
+    for( int i = 0; i < samples; i++ )
+        avgSum[i] += avgBeatData[i];
+    avgCnt++;
+}
+
+// Sends summary of a finished step (or trial, step == -1) to the GUI thread and starts a new summary
+void ClampEngine::publishStatistics( BeatStatistics *statistics, int *classCounts, int step, int beats, bool converged ) {
+    StatisticsSummary summary;
+    summary.trial = currentTrial;
+    summary.step = step;
+    summary.stepBeats = beats;
+    summary.converged = converged;
+    for( int i = 0; i < BeatClass::numClasses; i++ ) {
+        summary.classCounts[i] = classCounts[i];
+        classCounts[i] = 0;
+    }
+    summary.stats = statistics->result();
+    statisticsFifo->push( summary );
+    statistics->clear();
+}
+
+// Only called while the RT thread is inactive
+void ClampEngine::clearResults( void ) {
+    beatFifo->clear();
+    statisticsFifo->clear();
+    windowStatistics->clear();
+    stepStatistics->clear();
+    trialStatistics->clear();
+    for( int i = 0; i < BeatClass::numClasses; i++ )
+        stepClassCounts[i] = trialClassCounts[i] = 0;
+    STV = 0;
+    alternans = 0;
+}
+
+// Offset from the last stimulus is used by the decimator to overlay beats, samples are dropped if the ring is full
+void ClampEngine::pushTrace( void ) {
+    TraceSample sample;
+    sample.voltage = voltage;
+    sample.offset = stepTime - cycleStartTime;
+    traceDecimator->samples.push( sample );
+}
+
+// Current is the measured current during AP clamp and the stimulus current otherwise, in pA
+void ClampEngine::pushRecord( void ) {
+    if( !beatRecording ) return ;
+
+    double i = outputCurrent * 1e12;
+    if( executeMode == PROTOCOL && stepType == ProtocolDefs::APCLAMP ) i = current;
+    else if( executeMode == PROTOCOL && stepType == ProtocolDefs::WAIT ) i = 0;
+    beatRecorder->push( beatNum, stepTime - cycleStartTime, voltage, i );
+}
+
+void ClampEngine::closeBeatRecord( void ) {
+    beatRecording = false;
+    beatRecordOpen = false;
+    beatRecorder->close();
+}
+
+// Configured magnitude, scaled by retry branches (protocol only) and by the adaptive gain
+void ClampEngine::updateStimAmplitude( void ) {
+    stimAmplitude = stimMag * stimControl->gain();
+    if( executeMode == PROTOCOL )
+        stimAmplitude *= stimScale;
+}
+
+void ClampEngine::writeOutputs( double value ) {
+    outputs[0] = value;
+    for( int c = 1; c < numChannels; c++ )
+        outputs[1 + c] = value; // Output 1 is the digital output
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Engine.h
+ * Pacing, protocol, AP clamp and APD detection, everything the RT
+ * thread does once per tick, without Qt or RTXI
+ *
+ *** NOTES
+ *
+ * The plugin copies the amplifier inputs into inputs[], calls tick()
+ * and copies outputs[] back to RTXI (output 1 is the digital output).
+ * GUI, settings, workspace, batch commands and the worker pool stay in
+ * the plugin. Headless tools and benchmarks drive an engine the same
+ * way, from recorded inputs or replayed slots.
+ *
+ * What the engine needs from its surroundings goes through EngineHost:
+ * starting and stopping the data recorder, waking worker tasks, error
+ * messages and the clock read by the digest and the profile. Every
+ * EngineHost call comes from the RT thread.
+ *
+ * Parameters, states and results are public members, as they were in
+ * the module. Parameters are written by RT events, states are read by
+ * the GUI thread. Functions under "RT thread" are called from tick()
+ * or an RT event, the others only while the RT thread is not running
+ * the engine.
+ *
+ * The analysis tasks (artifact template, leak fit, sweeps, restitution,
+ * beat recorder, trace decimator) belong to the engine and are
+ * serviced by the host's worker pool. The host registers them and
+ * stores the handles of the tasks the engine wakes in leakTask,
+ * sweepTask and restitutionTask (-1 if not serviced).
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_ENGINE_H
+#define APC_ENGINE_H
+
+#include "APC_ProtocolProgram.h"
+#include "APC_RingBuffer.h"
+#include "APC_BeatResult.h"
+#include "APC_BeatStatistics.h"
+#include "APC_Convergence.h"
+#include "APC_Channels.h"
+#include "APC_Artifact.h"
+#include "APC_Filter.h"
+#include "APC_Afterdepolarization.h"
+#include "APC_StimControl.h"
+#include "APC_Leak.h"
+#include "APC_Sweeps.h"
+#include "APC_Restitution.h"
+#include "APC_BeatRecorder.h"
+#include "APC_Decimator.h"
+#include "APC_TraceStore.h"
+#include "APC_TimeBase.h"
+#include "APC_StreamDigest.h"
+#include "APC_TickProfile.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Implemented by whatever runs the engine, every call comes from the RT thread
+class EngineHost {
+public:
+    virtual ~EngineHost( void ) { }
+    virtual void engineRecord( bool ) = 0; // Start (true) or stop the data recorder
+    virtual void enginePost( int ) = 0; // Wakes the worker task with this handle
+    virtual void engineError( const char * ) = 0; // Message for the user
+    virtual long long engineClock( void ) = 0; // ns, only read for the digest and the profile
+};
+
+class ClampEngine {
+public:
+    static const int numInputs = ChannelBank::maxChannels; // Vm (or current) of each cell
+    static const int numOutputs = ChannelBank::maxChannels + 1; // Output 1 is the digital output
+    static const int maxStatsWindow = 1000;
+    static const int maxArtifactLength = 4096; // Ticks
+    static const int maxArtifactBeats = 16;
+    static const int afterdepolarizationRise = 5; // Rise counted as an EAD or DAD (mV)
+    static const int maxTestPulseLength = 4096; // Ticks per segment
+    static const int maxRsCompensation = 80; // %, higher fractions make the clamp oscillate
+
+    ClampEngine( EngineHost *, double ); // Host and thread period (ms)
+    ~ClampEngine( void );
+
+    // RT thread
+    void tick( void ); // One sample, inputs[] to outputs[]
+    void reset( void ); // Clock, beat and step back to the start, at the current period
+    void setPeriod( double ); // New thread period (ms), a run in progress is carried over
+    void updateStimAmplitude( void ); // Stimulus magnitude for the next beat
+
+    // RT thread inactive
+    void startProtocol( const ProtocolProgram &, int ); // Compiled protocol and its number of sweeps
+    void startPace( void );
+    void startThreshold( double ); // Resting Vm (mV)
+    void stop( void ); // Back to IDLE, the beat record is closed
+    bool openBeatRecord( const std::string &, double, double, int, double, double ); // Base name, pre and post (ms), full beat interval, voltage and current resolution
+    void closeBeatRecord( void ); // Stops pushing and writes what is left
+    void clearResults( void ); // Discards per-beat results before a new run
+
+    EngineHost *host;
+    double inputs[numInputs]; // V or A, as read from RTXI
+    double outputs[numOutputs]; // A or V, as written to RTXI
+
+    // Flags
+    enum executeMode_t { IDLE, THRESHOLD, PACE, PROTOCOL } executeMode;
+    enum protocolMode_t { STEPINIT, EXEC, END } protocolMode;
+    bool recording; // True if data recording is recording
+    bool vmRecording;
+    bool stepInitDone;
+    bool protocolOn;
+    bool thresholdOn;
+    int stepTracker;
+    int currentTrial;
+
+    // States
+    double time; // Time (ms), derived from timeBase.now() every tick
+    double voltage; // Membrane voltage
+    double vmFiltered; // Membrane voltage after filter stage
+    double vmDetect; // Membrane voltage seen by APD detection, filtered and stimulus artifact removed
+    double beatNum; // Beat number
+    double APD; // Action potential duration
+    double STV; // Short-term variability of APD over statsWindow beats
+    double alternans; // APD alternans magnitude over statsWindow beats
+    double stimAmplitude; // Stimulus magnitude of the current beat (nA)
+    double current; // Measured current during AP clamp (pA)
+    double currentCorrected; // AP clamp current with the leak subtracted (pA)
+    double Rs; // Series resistance of the last test pulse fit (MOhm)
+    double Rm; // Membrane resistance of the last test pulse fit (MOhm)
+    double Cm; // Membrane capacitance of the last test pulse fit (pF)
+
+    // Parameters
+    int APDRepol; // APD Repolarization percentage
+    int minAPD; // Minimum duration of depolarization that counts as action potential
+    int stimWindow; // Window of time after stimulus ignored by APD calculation
+    int numTrials; // Number of trials to be run
+    int intervalTime; // Time between trials
+    int BCL; // Basic cycle length
+    double stimMag; // Stimulation magnitude (nA)
+    double stimLength; // Stimulation length (ms)
+    double LJP; // Liquid junction potential (mV);
+    int statsWindow; // Number of beats in sliding statistics window
+    int numChannels; // Number of cells paced and recorded, including the primary cell
+    int artifactBeats; // Number of beats averaged into the stimulus artifact template, 0 is off
+    int rejectBeats; // If 1, AVERAGE steps only use captured beats
+    double eventPulseLength; // Digital output pulse at each EAD or DAD (ms), 0 is off
+    int adaptiveStim; // If 1, stimulus is raised after missed captures and backs off while capture holds
+    double captureWindow; // Upstroke must cross threshold within this time after the stimulus (ms)
+    double testPulseAmplitude; // AP clamp test pulse (mV), 0 is off
+    double testPulseLength; // Length of each test pulse segment (ms)
+    int testPulseBeats; // Test pulse every N AP clamp beats, 0 only at the start of each step
+    double rsCompensation; // Percentage of the Rs voltage drop added to the AP clamp command, 0 to maxRsCompensation
+
+    // Protocol Variables
+    ProtocolProgram program; // Compiled protocol, one instruction per step, copied when the protocol starts
+    std::vector<int> programCounters; // Loop counters and retry counts, indexed like program
+    std::vector<int64_t> iterationStarts; // Tick the current iteration of each LOOP started on, indexed like program
+    double stimScale; // Stimulus scale set by retry branches, reset when the protocol starts
+    bool lastStepFailed; // Outcome of the last pace or average step, tested by branches
+    bool lastStepConverged;
+    bool lastStepEAD;
+    const ProtocolInstruction *stepPtr; // Instruction of the current step
+    ProtocolDefs::stepType_t stepType; // Current step type for current step
+    double outputCurrent; // Current output
+    int currentStep; // Current step in protocol
+    int64_t stepTime; // Time tracker for step, runs for the whole of a pace run
+    int64_t stepEndTime; // Time end tracker for step
+    int64_t cycleStartTime; // Time tracker for BCL
+    TimeBase timeBase; // Derives every tick count below from its duration in ms
+    double period; // Thread period (ms), same as timeBase.period()
+    int BCLInt; // BCL / period (unitless)
+    int pBCLInt; // BCL for protocol
+    int stimLengthInt; // stimLength / period (unitless)
+    int digitalOut; // Digital output for triggering
+
+    // APD Calculation
+    double upstrokeThreshold; // Upstroke threshold for start of AP
+    double downstrokeThreshold; // Downstroke threshold for end of AP
+    enum APDMode_t { START, PEAK, DOWN, DONE } APDMode;
+    int64_t APStart; // Tick the action potential starts
+    double peakVoltage; // Peak of action potential
+    int64_t peakTime; // Tick of action potential peak
+    double Vrest;
+    int64_t beatStartTime; // Tick of the stimulus of the current beat
+    int64_t repolarization; // Tick the last action potential repolarized
+    double DI; // Diastolic interval before the current beat (ms), negative if unknown
+    ArtifactTemplate *artifact; // Learned at the start of each run, serviced by worker
+    FilterCascade *filter; // Coefficients only replaced by an RT event
+
+    // Beat classification, decided at the end of each beat
+    bool spontaneousBeat; // Upstroke after repolarization without a stimulus
+    AfterdepolarizationDetector *afterdepolarization;
+    int64_t eventPulseEnd; // Tick digital output pulse for the last EAD or DAD ends
+
+    // Test pulses, inserted between AP clamp beats
+    LeakEstimator *leak; // Restarted with each protocol run, fitted by worker
+    int leakTask; // Pool handle, posted when a test pulse is complete
+    int64_t testPulseStart; // stepTime the current test pulse started
+    int64_t testPulseEnd; // stepTime the current test pulse ends, next beat starts here
+    int beatsSinceTestPulse;
+    bool testPulseTrigger; // Digital output is sent when the beat after a test pulse starts
+
+    // AP clamp current, averaged per named sweep
+    SweepStore *sweeps; // Accumulators sized when the protocol starts, averaged by worker
+    int sweepTask; // Pool handle, posted when a sweep is complete
+
+    // Restitution, one point per pace or average step
+    RestitutionAnalyzer *restitution; // Restarted with each protocol run, fitted by worker
+    int restitutionTask; // Pool handle, posted when a step ends
+
+    // Beat-gated recording, replaces the data recorder while the plugin's beatRecord is set
+    BeatRecorder *beatRecorder; // Opened when a run starts, written by worker
+    bool beatRecordOpen; // Recorder was opened for this run
+    bool beatRecording; // Samples are being pushed to the recorder
+
+    // Capture verification
+    StimulusController *stimControl;
+    int stepClassCounts[BeatClass::numClasses];
+    int trialClassCounts[BeatClass::numClasses];
+
+    // Per-beat results
+    RingBuffer<BeatResult> *beatFifo; // Written by RT thread at the end of each beat
+    RingBuffer<StatisticsSummary> *statisticsFifo; // Step and trial summaries sent to GUI thread
+
+    // Beat-to-beat statistics, updated by RT thread once per beat
+    BeatStatistics *windowStatistics; // Sliding window of statsWindow beats
+    BeatStatistics *stepStatistics; // Current protocol step
+    BeatStatistics *trialStatistics; // Current protocol trial
+
+    // Steady state detection for PACE steps
+    ConvergenceDetector *convergence;
+    bool stepConverged; // True if current step was ended by its steady state criterion
+    int stepStartBeat; // Beat number of first beat of current step
+
+    // Additional channels, share the protocol timeline and stimulus of the primary cell
+    ChannelBank *channelBank;
+
+    // Live plots
+    TraceDecimator *traceDecimator; // Vm stream, overlaid by beat
+
+    // Threshold Variables
+    bool actionPotential;
+    bool thresholdStimulate;
+    bool backToBaseline;
+    double stimulusLevel;
+    double startingStimulusLevel;
+    int64_t thresholdStimulus; // Tick of the last threshold test stimulus
+    int64_t responseTime; // Tick Vm returned to baseline
+    double initialStimulusTime;
+    double diastolicThreshold;
+    double responseDuration;
+    double peakVoltageT;
+
+    // AP Clamp Variables
+    TraceStore *traces; // Vm recording slots, sample type is set per slot
+    TraceSlot *vmRecordData;
+    TraceSlot *avgRecordData;
+    std::vector<double> avgBeatData; // Beat in progress of an AVERAGE step, added to avgSum once classified
+    std::vector<double> avgSum; // Sum of accepted beats, kept in double whatever the slot type
+    int avgLength; // Samples in the AVERAGE beat
+    TraceSlot *apClampData;
+    TracePlayer apClampPlayer; // Converted AP clamp command, refilled a block at a time
+    int recordingIndex;
+    int vmRecordCnt, avgCnt, apClampCnt;
+
+    // Regression runs, outputs and states of every tick are digested, Vm can be replayed from a slot
+    StreamDigest digest;
+    bool digestRequested; // Applies from the next run
+    bool digestOn; // Digest of the current run
+    int replaySlot; // Slot replayed as the primary input, -1 for the amplifier
+    bool replaying;
+    TracePlayer replayPlayer;
+    int replayTick; // Next replayed sample
+    TickProfile *profile; // Only written in APC_PROFILE builds
+
+private:
+    void calculateAPD( int ); // Calulates action potential duration
+    void endBeat( void ); // Sends results of the finished beat to the GUI thread
+    int classifyBeat( void ); // Class of the beat that just finished
+    void addAverageBeat( bool ); // Adds beat to AVERAGE step sum if accepted
+    void publishStatistics( BeatStatistics *, int *, int, int, bool ); // Sends step/trial summary to the GUI thread
+    void pushTrace( void ); // Sends current Vm sample to the plot decimator
+    void pushRecord( void ); // Sends current Vm and current sample to the beat recorder
+    void writeOutputs( double ); // Sets output of the primary cell and mirrors it to active channels
+    bool startTestPulse( void ); // Inserts a test pulse before the next AP clamp beat, false if not possible now
+    void updateTicks( void ); // Tick counts of BCL and stimLength at the current period
+    void retime( void ); // Carries the run in progress over to a new period
+    int executeBranch( int ); // Evaluates branch instruction, returns next step
+    void armDigest( void ); // Resets the digest and starts the replay for a new run
+    void hashTick( long long ); // Adds this tick to the digest, with the time tick() started (ns)
+    int profileBucket( void ); // Profile bucket of the mode this tick starts in
+    void profileTick( int, int, long long ); // Mode and APD buckets (-1 for none), time tick() started (ns)
+};
+
+#endif // APC_ENGINE_H
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Filter.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Filter.h"
+#include <math.h>
+
+/* FilterCoefficients */
+bool FilterCoefficients::addLowpass( double fc, double period ) {
+    double fs = 1000.0 / period; // Hz
+    if( fc <= 0 || fc >= fs / 2 || numSections + 2 > maxSections )
+        return false;
+
+    const double Q[2] = { 0.54119610, 1.30656296 }; // 4th order Butterworth pole pairs
+    double w0 = 2 * M_PI * fc / fs;
+    for( int i = 0; i < 2; i++ ) {
+        double alpha = sin( w0 ) / ( 2 * Q[i] );
+        double a0 = 1 + alpha;
+        BiquadCoefficients &s = section[numSections++];
+        s.b0 = ( ( 1 - cos( w0 ) ) / 2 ) / a0;
+        s.b1 = ( 1 - cos( w0 ) ) / a0;
+        s.b2 = s.b0;
+        s.a1 = ( -2 * cos( w0 ) ) / a0;
+        s.a2 = ( 1 - alpha ) / a0;
+    }
+    return true;
+}
+
+bool FilterCoefficients::addNotch( double f0, double period, double Q ) {
+    double fs = 1000.0 / period; // Hz
+    if( f0 <= 0 || f0 >= fs / 2 || Q <= 0 || numSections + 1 > maxSections )
+        return false;
+
+    double w0 = 2 * M_PI * f0 / fs;
+    double alpha = sin( w0 ) / ( 2 * Q );
+    double a0 = 1 + alpha;
+    BiquadCoefficients &s = section[numSections++];
+    s.b0 = 1 / a0;
+    s.b1 = ( -2 * cos( w0 ) ) / a0;
+    s.b2 = s.b0;
+    s.a1 = s.b1;
+    s.a2 = ( 1 - alpha ) / a0;
+    return true;
+}
+
+/* FilterCascade */
+FilterCascade::FilterCascade( void ) {
+    for( int i = 0; i < FilterCoefficients::maxSections; i++ )
+        z1[i] = z2[i] = 0;
+}
+
+FilterCascade::~FilterCascade( void ) { }
+
+// Each section is set to its steady state for a constant input x
+void FilterCascade::setCoefficients( const FilterCoefficients &c, double x ) {
+    coefficients = c;
+    prime( x );
+}
+
+void FilterCascade::prime( double x ) {
+    for( int i = 0; i < coefficients.numSections; i++ ) {
+        const BiquadCoefficients &s = coefficients.section[i];
+        double y = x * ( s.b0 + s.b1 + s.b2 ) / ( 1 + s.a1 + s.a2 ); // DC gain
+        z2[i] = s.b2 * x - s.a2 * y;
+        z1[i] = s.b1 * x - s.a1 * y + z2[i];
+        x = y;
+    }
+}
+
+double FilterCascade::process( double x ) {
+    for( int i = 0; i < coefficients.numSections; i++ ) {
+        const BiquadCoefficients &s = coefficients.section[i];
+        double y = s.b0 * x + z1[i];
+        z1[i] = s.b1 * x - s.a1 * y + z2[i];
+        z2[i] = s.b2 * x - s.a2 * y;
+        x = y;
+    }
+    return x;
+}
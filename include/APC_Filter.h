@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Filter.h
+ * Biquad filter cascade applied to Vm before APD detection
+ *
+ *** NOTES
+ *
+ * Coefficients are designed outside the RT thread (design functions
+ * below follow the RBJ audio EQ cookbook) and handed to the RT thread
+ * as a plain FilterCoefficients value, so installing them is a copy
+ * with no allocation. Sections are transposed direct form II, five
+ * multiply-adds per section and tick. The lowpass is a 4th order
+ * Butterworth built from two sections, the notch is one section.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_FILTER_H
+#define APC_FILTER_H
+
+struct BiquadCoefficients {
+    double b0, b1, b2, a1, a2; // a0 normalized to 1
+};
+
+struct FilterCoefficients {
+    enum { maxSections = 4 };
+    int numSections; // 0 passes the input through
+    BiquadCoefficients section[maxSections];
+
+    FilterCoefficients( void ) : numSections( 0 ) { }
+
+    // Design, called outside the RT thread. Frequencies in Hz, sample period in ms. Return false if no section was added
+    bool addLowpass( double, double );
+    bool addNotch( double, double, double ); // Center frequency, sample period, quality factor
+};
+
+class FilterCascade {
+public:
+    FilterCascade( void );
+    ~FilterCascade( void );
+
+    void setCoefficients( const FilterCoefficients &, double ); // New coefficients and current input, state is primed so the output does not jump
+    void prime( double ); // State of a constant input, output starts at its DC response
+    double process( double ); // One sample through every section
+
+private:
+    FilterCoefficients coefficients;
+    double z1[FilterCoefficients::maxSections];
+    double z2[FilterCoefficients::maxSections];
+};
+
+#endif // APC_FILTER_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Leak.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Leak.h"
+
+#include <math.h>
+
+using namespace std;
+
+LeakEstimator::LeakEstimator( int l ) :
+    state( OFF ), maxLength( l ), length( 0 ), amplitude( 0 ), period( 1 ), holdVoltage( 0 ) {
+    capture.resize( 3 * maxLength );
+    current.valid = current.transientValid = false;
+    current.holdVoltage = current.holdCurrent = current.conductance = 0;
+    current.Rs = current.Rm = current.Cm = current.tau = 0;
+    fit = current;
+}
+
+LeakEstimator::~LeakEstimator( void ) { }
+
+void LeakEstimator::restart( int l, double a, double p ) {
+    lock_guard<mutex> lock( processMutex );
+    length = l < maxLength ? l : maxLength;
+    amplitude = a;
+    period = p;
+    current.valid = current.transientValid = false; // Estimate of a previous cell is not reused
+    state.store( ( length >= 10 && amplitude != 0 ) ? IDLE : OFF, memory_order_release ); // At least 10 ticks per segment to fit
+}
+
+bool LeakEstimator::beginPulse( double v ) {
+    int s = state.load( memory_order_acquire );
+    if( s != IDLE && s != READY ) // Off, or the worker still owns the capture
+        return false;
+    if( s == READY ) update();
+
+    holdVoltage = v;
+    state.store( CAPTURING, memory_order_release );
+    return true;
+}
+
+double LeakEstimator::command( int offset, double i ) {
+    if( offset < 0 || offset >= 3 * length )
+        return holdVoltage;
+
+    if( state.load( memory_order_relaxed ) == CAPTURING ) { // Only the RT thread leaves CAPTURING
+        capture[offset] = i;
+        if( offset == 3 * length - 1 )
+            state.store( CAPTURED, memory_order_release ); // Capture belongs to the worker from now on
+    }
+    return ( offset >= length && offset < 2 * length ) ? holdVoltage + amplitude : holdVoltage;
+}
+
+bool LeakEstimator::update( void ) {
+    if( state.load( memory_order_acquire ) != READY )
+        return false;
+
+    bool changed = fit.valid;
+    if( changed ) current = fit; // A failed fit keeps the last good estimate
+    state.store( IDLE, memory_order_release );
+    return changed;
+}
+
+void LeakEstimator::process( void ) {
+    lock_guard<mutex> lock( processMutex );
+    if( state.load( memory_order_acquire ) != CAPTURED )
+        return ;
+
+    const int n = length;
+    const double *pulse = &capture[n];
+    fit.valid = fit.transientValid = false;
+    fit.holdVoltage = holdVoltage;
+
+    double sum = 0;
+    for( int i = n / 2; i < n; i++ )
+        sum += capture[i];
+    fit.holdCurrent = sum / ( n - n / 2 );
+
+    sum = 0;
+    for( int i = n - n / 5; i < n; i++ )
+        sum += pulse[i];
+    double steadyCurrent = sum / ( n / 5 );
+    double deltaCurrent = steadyCurrent - fit.holdCurrent;
+    fit.conductance = deltaCurrent / amplitude;
+
+    if( fit.conductance > 0 ) { // A negative slope conductance is not leak, pulse is discarded
+        fit.valid = true;
+
+        // Transient relative to the steady state, positive for either pulse polarity
+        double sign = amplitude > 0 ? 1 : -1;
+        int peak = 0;
+        for( int i = 1; i < n / 5; i++ ) // Peak is delayed by the amplifier and the RT loop
+            if( sign * ( pulse[i] - steadyCurrent ) > sign * ( pulse[peak] - steadyCurrent ) )
+                peak = i;
+        double peakValue = sign * ( pulse[peak] - steadyCurrent );
+
+        double st = 0, sy = 0, stt = 0, sty = 0;
+        int m = 0;
+        for( int i = peak; i < n - n / 5; i++ ) {
+            double y = sign * ( pulse[i] - steadyCurrent );
+            if( y <= 0.1 * peakValue ) break;
+            double t = ( i - 1 ) * period; // Command reaches the input one tick after it was written
+            double ly = log( y );
+            st += t; sy += ly; stt += t * t; sty += t * ly;
+            m++;
+        }
+
+        double denominator = m * stt - st * st;
+        if( peakValue > 0 && m >= 3 && denominator > 0 ) {
+            double slope = ( m * sty - st * sy ) / denominator;
+            double intercept = ( sy - slope * st ) / m;
+            if( slope < 0 ) {
+                fit.tau = -1 / slope;
+                double instantCurrent = exp( intercept ) + sign * deltaCurrent; // At pulse onset, all current flows through Rs
+                fit.Rs = sign * amplitude / instantCurrent * 1e3; // mV / pA is GOhm
+                fit.Rm = 1e3 / fit.conductance - fit.Rs;
+                if( fit.Rm > 0 ) {
+                    fit.Cm = fit.tau * ( fit.Rs + fit.Rm ) / ( fit.Rs * fit.Rm ) * 1e3; // ms / MOhm is nF
+                    fit.transientValid = true;
+                }
+            }
+        }
+    }
+    if( !fit.transientValid )
+        fit.Rs = fit.Rm = fit.Cm = fit.tau = 0;
+
+    state.store( READY, memory_order_release ); // Fit is read-only from now on
+}
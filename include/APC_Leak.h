@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Leak.h
+ * Leak and series resistance estimation from small voltage clamp test
+ * pulses, used to leak subtract and Rs compensate AP clamp currents
+ *
+ *** NOTES
+ *
+ * A test pulse window is three segments of equal length: holding,
+ * holding + amplitude and holding again. The RT thread writes the
+ * current of every tick into a preallocated capture buffer and hands it
+ * to the worker thread once the window is over. The worker fits the
+ * window and hands the estimate back, after which the RT thread copies
+ * it into its own estimate in a single tick. Neither side ever waits,
+ * a pulse is skipped while the previous one is still being fitted.
+ *
+ * Fit:
+ *   Ihold = mean of the second half of the holding segment
+ *   Iss   = mean of the last fifth of the pulse segment
+ *   gLeak = ( Iss - Ihold ) / amplitude
+ *   Pulse transient I - Iss is fitted by a mono-exponential (log-linear
+ *   least squares) from its peak down to 10% of the peak, extrapolated
+ *   to the pulse onset to get the instantaneous current through Rs. The
+ *   command reaches the input one tick after it is written.
+ *   Rs = amplitude / Ipeak, Rm = 1 / gLeak - Rs, Cm = tau / ( Rs || Rm )
+ *
+ * The leak is the linear component around the holding potential,
+ *   Ileak( V ) = Ihold + gLeak * ( V - Vhold )
+ * Units are mV, pA, nS, MOhm, pF and ms.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_LEAK_H
+#define APC_LEAK_H
+
+#include "APC_WorkerTask.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+struct LeakEstimate {
+    bool valid; // Leak fit succeeded, false until the first pulse has been fitted
+    bool transientValid; // Rs, Rm, Cm and tau are only valid if the transient could be fitted
+    double holdVoltage; // mV
+    double holdCurrent; // pA
+    double conductance; // Leak conductance (nS)
+    double Rs; // Series resistance (MOhm)
+    double Rm; // Membrane resistance (MOhm)
+    double Cm; // Membrane capacitance (pF)
+    double tau; // Decay of the capacitive transient (ms)
+};
+
+class LeakEstimator : public WorkerTask {
+public:
+    enum { OFF, IDLE, CAPTURING, CAPTURED, READY }; // CAPTURING: RT owns capture, CAPTURED: worker owns capture and fit, READY: RT takes fit
+
+    LeakEstimator( int ); // Maximum segment length (ticks)
+    ~LeakEstimator( void );
+
+    void restart( int, double, double ); // Segment length (ticks), pulse amplitude (mV, 0 is off), period (ms), only called while RT thread is inactive
+    int status( void ) const { return state.load( std::memory_order_acquire ); }
+    int window( void ) const { return 3 * length; } // Ticks taken by one test pulse
+
+    // RT thread
+    bool beginPulse( double ); // Holding potential (mV), false if off or the last pulse is still being fitted
+    double command( int, double ); // Ticks since the start of the window and measured current (pA), returns command potential (mV)
+    bool update( void ); // Takes over a finished fit, true if the estimate changed
+    const LeakEstimate &estimate( void ) const { return current; }
+    double leakCurrent( double v ) const { // Leak at command potential v (pA), 0 until the first fit
+        return current.valid ? current.holdCurrent + current.conductance * ( v - current.holdVoltage ) : 0;
+    }
+
+    // Worker thread
+    void process( void );
+
+private:
+    std::mutex processMutex; // Keeps restart() from racing the worker, never taken by the RT thread
+    std::atomic<int> state;
+    int maxLength;
+    int length;
+    double amplitude;
+    double period;
+    double holdVoltage; // Holding potential of the pulse being captured
+
+    LeakEstimate current; // Used by the RT thread
+    LeakEstimate fit; // Written by the worker while CAPTURED
+    std::vector<double> capture; // Three segments of maxLength samples
+};
+
+#endif // APC_LEAK_H
@@ -120,6 +120,20 @@ AP_ClampUI::AP_ClampUI( QWidget* parent ) : QWidget( parent ) {
     APDEdit->setAlignment( Qt::AlignHCenter );
     APDEdit->setReadOnly( true );
     TabPageLayout->addWidget( APDEdit, 3, 1 );
+
+    STVLabel = new QLabel( "STV (ms)", TabPage );
+    TabPageLayout->addWidget( STVLabel, 4, 0 );
+    STVEdit = new QLineEdit( "", TabPage );
+    STVEdit->setAlignment( Qt::AlignHCenter );
+    STVEdit->setReadOnly( true );
+    TabPageLayout->addWidget( STVEdit, 4, 1 );
+
+    alternansLabel = new QLabel( "Alternans (ms)", TabPage );
+    TabPageLayout->addWidget( alternansLabel, 5, 0 );
+    alternansEdit = new QLineEdit( "", TabPage );
+    alternansEdit->setAlignment( Qt::AlignHCenter );
+    alternansEdit->setReadOnly( true );
+    TabPageLayout->addWidget( alternansEdit, 5, 1 );
     tabBox->addTab( TabPage, QString::fromLatin1("") );
 	 tabBox->setTabText( tabBox->indexOf(TabPage), "States" );
 
@@ -152,6 +166,24 @@ AP_ClampUI::AP_ClampUI( QWidget* parent ) : QWidget( parent ) {
     LJPEdit = new QLineEdit( "", TabPage_2 );
     LJPEdit->setAlignment( Qt::AlignHCenter );
     TabPageLayout_2->addWidget( LJPEdit, 4, 1 );
+
+    channelsLabel = new QLabel( "Channels", TabPage_2 );
+    TabPageLayout_2->addWidget( channelsLabel, 5, 0 );
+    channelsEdit = new QLineEdit( "", TabPage_2 );
+    channelsEdit->setAlignment( Qt::AlignHCenter );
+    TabPageLayout_2->addWidget( channelsEdit, 5, 1 );
+
+    adaptiveStimLabel = new QLabel( "Adaptive Stim (0/1)", TabPage_2 );
+    TabPageLayout_2->addWidget( adaptiveStimLabel, 6, 0 );
+    adaptiveStimEdit = new QLineEdit( "", TabPage_2 );
+    adaptiveStimEdit->setAlignment( Qt::AlignHCenter );
+    TabPageLayout_2->addWidget( adaptiveStimEdit, 6, 1 );
+
+    captureWindowLabel = new QLabel( "Capture Window (ms)", TabPage_2 );
+    TabPageLayout_2->addWidget( captureWindowLabel, 7, 0 );
+    captureWindowEdit = new QLineEdit( "", TabPage_2 );
+    captureWindowEdit->setAlignment( Qt::AlignHCenter );
+    TabPageLayout_2->addWidget( captureWindowEdit, 7, 1 );
     tabBox->addTab( TabPage_2, QString::fromLatin1("") );
 	 tabBox->setTabText( tabBox->indexOf(TabPage_2), "Stim" );
 
@@ -173,6 +205,54 @@ AP_ClampUI::AP_ClampUI( QWidget* parent ) : QWidget( parent ) {
     intervalTimeEdit = new QLineEdit( "", tab );
     intervalTimeEdit->setAlignment( Qt::AlignHCenter );
     tabLayout->addWidget( intervalTimeEdit, 1, 1 );
+
+    testPulseLabel = new QLabel( "Test Pulse (mV)", tab );
+    tabLayout->addWidget( testPulseLabel, 2, 0 );
+    testPulseEdit = new QLineEdit( "", tab );
+    testPulseEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( testPulseEdit, 2, 1 );
+
+    testPulseLengthLabel = new QLabel( "Test Pulse Length (ms)", tab );
+    tabLayout->addWidget( testPulseLengthLabel, 3, 0 );
+    testPulseLengthEdit = new QLineEdit( "", tab );
+    testPulseLengthEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( testPulseLengthEdit, 3, 1 );
+
+    testPulseBeatsLabel = new QLabel( "Test Pulse Beats", tab );
+    tabLayout->addWidget( testPulseBeatsLabel, 4, 0 );
+    testPulseBeatsEdit = new QLineEdit( "", tab );
+    testPulseBeatsEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( testPulseBeatsEdit, 4, 1 );
+
+    rsCompensationLabel = new QLabel( "Rs Comp (%)", tab );
+    tabLayout->addWidget( rsCompensationLabel, 5, 0 );
+    rsCompensationEdit = new QLineEdit( "", tab );
+    rsCompensationEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( rsCompensationEdit, 5, 1 );
+
+    beatRecordLabel = new QLabel( "Beat Record", tab );
+    tabLayout->addWidget( beatRecordLabel, 6, 0 );
+    beatRecordEdit = new QLineEdit( "", tab );
+    beatRecordEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( beatRecordEdit, 6, 1 );
+
+    recordPreLabel = new QLabel( "Record Pre (ms)", tab );
+    tabLayout->addWidget( recordPreLabel, 7, 0 );
+    recordPreEdit = new QLineEdit( "", tab );
+    recordPreEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( recordPreEdit, 7, 1 );
+
+    recordPostLabel = new QLabel( "Record Post (ms)", tab );
+    tabLayout->addWidget( recordPostLabel, 8, 0 );
+    recordPostEdit = new QLineEdit( "", tab );
+    recordPostEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( recordPostEdit, 8, 1 );
+
+    fullBeatLabel = new QLabel( "Full Beat Every", tab );
+    tabLayout->addWidget( fullBeatLabel, 9, 0 );
+    fullBeatEdit = new QLineEdit( "", tab );
+    fullBeatEdit->setAlignment( Qt::AlignHCenter );
+    tabLayout->addWidget( fullBeatEdit, 9, 1 );
     
     tabBox->addTab( tab, QString::fromLatin1("") );
 	 tabBox->setTabText( tabBox->indexOf(tab), "Protocol" );
@@ -227,11 +307,59 @@ AP_ClampUI::AP_ClampUI( QWidget* parent ) : QWidget( parent ) {
     stimWindowEdit->setAlignment( Qt::AlignCenter );
     tabLayout_2->addWidget( stimWindowEdit, 2, 1);
 
+    statsWindowLabel = new QLabel( "Stats Window (beats)", tab_2 );
+    tabLayout_2->addWidget( statsWindowLabel, 3, 0);
+    statsWindowEdit = new QLineEdit( "", tab_2 );
+    statsWindowEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( statsWindowEdit, 3, 1);
+
+    artifactBeatsLabel = new QLabel( "Artifact Beats", tab_2 );
+    tabLayout_2->addWidget( artifactBeatsLabel, 4, 0);
+    artifactBeatsEdit = new QLineEdit( "", tab_2 );
+    artifactBeatsEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( artifactBeatsEdit, 4, 1);
+
+    lowpassLabel = new QLabel( "Lowpass (Hz)", tab_2 );
+    tabLayout_2->addWidget( lowpassLabel, 5, 0);
+    lowpassEdit = new QLineEdit( "", tab_2 );
+    lowpassEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( lowpassEdit, 5, 1);
+
+    notchLabel = new QLabel( "Notch (Hz)", tab_2 );
+    tabLayout_2->addWidget( notchLabel, 6, 0);
+    notchEdit = new QLineEdit( "", tab_2 );
+    notchEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( notchEdit, 6, 1);
+
+    rejectBeatsLabel = new QLabel( "Reject Beats (0/1)", tab_2 );
+    tabLayout_2->addWidget( rejectBeatsLabel, 7, 0);
+    rejectBeatsEdit = new QLineEdit( "", tab_2 );
+    rejectBeatsEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( rejectBeatsEdit, 7, 1);
+
+    eventPulseLabel = new QLabel( "EAD/DAD Pulse (ms)", tab_2 );
+    tabLayout_2->addWidget( eventPulseLabel, 8, 0);
+    eventPulseEdit = new QLineEdit( "", tab_2 );
+    eventPulseEdit->setAlignment( Qt::AlignCenter );
+    tabLayout_2->addWidget( eventPulseEdit, 8, 1);
+
     tabBox->addTab( tab_2, QString::fromLatin1("") );
 	 tabBox->setTabText( tabBox->indexOf(tab_2), "APD" );
+
+    plotTab = new QWidget( tabBox );
+    plotTabLayout = new QVBoxLayout( plotTab );
+	 plotTab->setLayout(plotTabLayout);
+    vmPlot = new PlotWidget( "Vm (overlaid beats)", "mV", plotTab );
+    plotTabLayout->addWidget( vmPlot );
+    APDPlot = new PlotWidget( "APD trend", "ms", plotTab );
+    plotTabLayout->addWidget( APDPlot );
+    tabBox->addTab( plotTab, QString::fromLatin1("") );
+	 tabBox->setTabText( tabBox->indexOf(plotTab), "Plots" );
     AP_ClampUILayout->addWidget( tabBox );
 
-    protocolEditorListBox = new QListWidget( this );
+    protocolEditorListBox = new QListView( this );
+    protocolEditorListBox->setUniformItemSizes( true ); // Only visible rows are queried for their description
+    protocolEditorListBox->setSelectionMode( QAbstractItemView::SingleSelection );
     protocolEditorListBox->setVerticalScrollBarPolicy( Qt::ScrollBarAlwaysOn );
     protocolEditorListBox->setHorizontalScrollBarPolicy( Qt::ScrollBarAsNeeded );
     AP_ClampUILayout->addWidget( protocolEditorListBox );
@@ -34,6 +34,7 @@
 #define AP_CLAMPUI_H
 
 #include <QtGui>
+#include "APC_PlotWidget.h"
 
 class AP_ClampUI : public QWidget {
 	Q_OBJECT
@@ -58,6 +59,10 @@ class AP_ClampUI : public QWidget {
 		QLineEdit* voltageEdit;
 		QLabel* APDLabel;
 		QLineEdit* APDEdit;
+		QLabel* STVLabel;
+		QLineEdit* STVEdit;
+		QLabel* alternansLabel;
+		QLineEdit* alternansEdit;
 		QWidget* TabPage_2;
 		QLabel* BCLLabel;
 		QLineEdit* BCLEdit;
@@ -67,11 +72,33 @@ class AP_ClampUI : public QWidget {
 		QLineEdit* stimLengthEdit;
 		QLabel* LJPLabel;
 		QLineEdit* LJPEdit;
+		QLabel* channelsLabel;
+		QLineEdit* channelsEdit;
+		QLabel* adaptiveStimLabel;
+		QLineEdit* adaptiveStimEdit;
+		QLabel* captureWindowLabel;
+		QLineEdit* captureWindowEdit;
 		QWidget* tab;
 		QLabel* numTrialLabel;
 		QLineEdit* numTrialEdit;
 		QLabel* intervalTimeLabel;
 		QLineEdit* intervalTimeEdit;
+		QLabel* testPulseLabel;
+		QLineEdit* testPulseEdit;
+		QLabel* testPulseLengthLabel;
+		QLineEdit* testPulseLengthEdit;
+		QLabel* testPulseBeatsLabel;
+		QLineEdit* testPulseBeatsEdit;
+		QLabel* rsCompensationLabel;
+		QLineEdit* rsCompensationEdit;
+		QLabel* beatRecordLabel;
+		QLineEdit* beatRecordEdit;
+		QLabel* recordPreLabel;
+		QLineEdit* recordPreEdit;
+		QLabel* recordPostLabel;
+		QLineEdit* recordPostEdit;
+		QLabel* fullBeatLabel;
+		QLineEdit* fullBeatEdit;
 		QCheckBox* recordDataCheckBox;
 		QWidget* TabPage_3;
 		QPushButton* deleteStepButton;
@@ -86,7 +113,22 @@ class AP_ClampUI : public QWidget {
 		QLineEdit* minAPDEdit;
 		QLabel* stimWindowLabel;
 		QLineEdit* stimWindowEdit;
-		QListWidget* protocolEditorListBox;
+		QLabel* statsWindowLabel;
+		QLineEdit* statsWindowEdit;
+		QLabel* artifactBeatsLabel;
+		QLineEdit* artifactBeatsEdit;
+		QLabel* lowpassLabel;
+		QLineEdit* lowpassEdit;
+		QLabel* notchLabel;
+		QLineEdit* notchEdit;
+		QLabel* rejectBeatsLabel;
+		QLineEdit* rejectBeatsEdit;
+		QLabel* eventPulseLabel;
+		QLineEdit* eventPulseEdit;
+		QWidget* plotTab;
+		PlotWidget* vmPlot;
+		PlotWidget* APDPlot;
+		QListView* protocolEditorListBox;
 
 	protected:
 		QVBoxLayout* AP_ClampUILayout;
@@ -111,6 +153,7 @@ class AP_ClampUI : public QWidget {
 		QSpacerItem* spacer1;
 		QSpacerItem* spacer2;
 		QGridLayout* tabLayout_2;
+		QVBoxLayout* plotTabLayout;
 };
 
 #endif // AP_CLAMPUI_H
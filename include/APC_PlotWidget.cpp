@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_PlotWidget.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_PlotWidget.h"
+
+using namespace std;
+
+PlotWidget::PlotWidget( QString t, QString y, QWidget *parent ) : QWidget( parent ), title( t ), yLabel( y ),
+    xMin( 0 ), xMax( 1 ), yMin( 0 ), yMax( 0 ), autoScale( true ) {
+    setSizePolicy( QSizePolicy::Expanding, QSizePolicy::Expanding );
+    setAttribute( Qt::WA_OpaquePaintEvent );
+}
+
+PlotWidget::~PlotWidget( void ) { }
+
+QSize PlotWidget::sizeHint( void ) const {
+    return QSize( 300, 150 );
+}
+
+int PlotWidget::plotWidth( void ) const {
+    return qMax( width() - margin - 5, 1 );
+}
+
+void PlotWidget::setSeries( const vector<MinMaxColumns> &s ) {
+    series = s;
+    update();
+}
+
+void PlotWidget::setXRange( double min, double max ) {
+    xMin = min;
+    xMax = max;
+}
+
+void PlotWidget::setYRange( double min, double max ) {
+    yMin = min;
+    yMax = max;
+    autoScale = ( min >= max );
+}
+
+void PlotWidget::paintEvent( QPaintEvent * ) {
+    QPainter painter( this );
+    painter.fillRect( rect(), Qt::white );
+
+    QRect plotRect( margin, 15, plotWidth(), height() - 30 );
+    painter.setPen( Qt::gray );
+    painter.drawRect( plotRect );
+
+    // Y range, autoscale looks at non-empty columns of every series
+    double low = yMin, high = yMax;
+    if( autoScale ) {
+        low = 1e30;
+        high = -1e30;
+        for( size_t s = 0; s < series.size(); s++ )
+            for( size_t i = 0; i < series[s].min.size(); i++ )
+                if( series[s].min[i] <= series[s].max[i] ) {
+                    low = qMin( low, (double)series[s].min[i] );
+                    high = qMax( high, (double)series[s].max[i] );
+                }
+        if( low > high ) { low = 0; high = 1; } // No data yet
+        double pad = ( high - low ) * 0.05 + 1e-3;
+        low -= pad;
+        high += pad;
+    }
+    double yScale = plotRect.height() / ( high - low );
+
+    // Labels
+    painter.setPen( Qt::black );
+    painter.drawText( QRect( 0, 0, width(), 15 ), Qt::AlignCenter, title );
+    painter.drawText( QRect( 0, plotRect.top(), margin - 2, 15 ), Qt::AlignRight, QString::number( high, 'g', 4 ) );
+    painter.drawText( QRect( 0, plotRect.bottom() - 15, margin - 2, 15 ), Qt::AlignRight, QString::number( low, 'g', 4 ) );
+    painter.drawText( QRect( 0, plotRect.center().y() - 7, margin - 2, 15 ), Qt::AlignRight, yLabel );
+    painter.drawText( QRect( margin, plotRect.bottom(), plotRect.width(), 15 ), Qt::AlignLeft, QString::number( xMin, 'g', 5 ) );
+    painter.drawText( QRect( margin, plotRect.bottom(), plotRect.width(), 15 ), Qt::AlignRight, QString::number( xMax, 'g', 5 ) );
+
+    // Series, older ones are drawn lighter so the newest stands out
+    painter.setClipRect( plotRect );
+    for( size_t s = 0; s < series.size(); s++ ) {
+        bool newest = ( s == series.size() - 1 );
+        painter.setPen( newest ? QColor( 0, 0, 200 ) : QColor( 170, 170, 220 ) );
+
+        const MinMaxColumns &c = series[s];
+        int n = c.min.size();
+        int lastY = -1;
+        for( int i = 0; i < n; i++ ) {
+            if( c.min[i] > c.max[i] ) { // Empty column
+                lastY = -1;
+                continue;
+            }
+            int x = plotRect.left() + ( i * plotRect.width() ) / n;
+            int yTop = plotRect.bottom() - ( c.max[i] - low ) * yScale;
+            int yBottom = plotRect.bottom() - ( c.min[i] - low ) * yScale;
+            if( lastY >= 0 ) { // Join to previous column so the trace stays continuous
+                yTop = qMin( yTop, lastY );
+                yBottom = qMax( yBottom, lastY );
+            }
+            painter.drawLine( x, yTop, x, yBottom );
+            lastY = plotRect.bottom() - ( ( c.min[i] + c.max[i] ) / 2 - low ) * yScale;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_PlotWidget.h
+ * Lightweight plot drawing pre-decimated min/max columns
+ *
+ *** NOTES
+ *
+ * Each series is drawn as one vertical min/max segment per column, so
+ * painting cost depends on the widget width only. Decimation itself is
+ * done by the classes in APC_Decimator.h.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_PLOTWIDGET_H
+#define APC_PLOTWIDGET_H
+
+#include <QtGui>
+#include <vector>
+
+#include "APC_Decimator.h"
+
+class PlotWidget : public QWidget {
+public:
+    PlotWidget( QString, QString, QWidget *parent = 0 ); // Title, y axis label
+    ~PlotWidget( void );
+
+    void setSeries( const std::vector<MinMaxColumns> & ); // Oldest series first, newest is highlighted
+    void setXRange( double, double );
+    void setYRange( double, double ); // Fixed y range, autoscale if min >= max
+    int plotWidth( void ) const; // Number of columns available for data
+
+    QSize sizeHint( void ) const;
+
+protected:
+    void paintEvent( QPaintEvent * );
+
+private:
+    QString title;
+    QString yLabel;
+    std::vector<MinMaxColumns> series;
+    double xMin, xMax;
+    double yMin, yMax;
+    bool autoScale;
+
+    static const int margin = 40; // Left margin for axis labels (pixels)
+};
+
+#endif // APC_PLOTWIDGET_H
@@ -40,13 +40,41 @@ AddStepInputDialog::AddStepInputDialog(QWidget* parent ) : AddStepDialog( parent
     QObject::connect( exitButton, SIGNAL(clicked(void)), this, SLOT( reject() ) );
     QObject::connect( this, SIGNAL(checked(void)), this, SLOT(accept()) ); // Dialog returns Accept after inputs have been checked
     QObject::connect( stepComboBox, SIGNAL(activated(int)), SLOT(stepComboBoxUpdate(int)) ); // Updates when combo box selection is changed
+    QObject::connect( convergeModeComboBox, SIGNAL(activated(int)), SLOT(convergeComboBoxUpdate(int)) );
+    QObject::connect( branchActionComboBox, SIGNAL(activated(int)), SLOT(branchComboBoxUpdate(int)) );
     
     stepComboBoxUpdate(0);
 }
 
 AddStepInputDialog::~AddStepInputDialog( void ) { }
 
+void AddStepInputDialog::convergeComboBoxUpdate( int selection ) {
+    bool enable = convergeModeComboBox->isEnabled() && selection != 0;
+    convergeBeatsEdit->setEnabled( enable );
+    convergeTolEdit->setEnabled( enable );
+}
+
+void AddStepInputDialog::branchComboBoxUpdate( int selection ) {
+    bool enable = branchActionComboBox->isEnabled();
+    branchTargetEdit->setEnabled( enable && selection != ProtocolStep::EXITLOOP );
+    stimScaleEdit->setEnabled( enable && selection == ProtocolStep::RETRY );
+}
+
 void AddStepInputDialog::stepComboBoxUpdate( int selection ) {
+    // Steady state detection is only available for pacing
+    convergeModeComboBox->setEnabled( (ProtocolStep::stepType_t)selection == ProtocolStep::PACE );
+    convergeComboBoxUpdate( convergeModeComboBox->currentIndex() );
+
+    // Branch settings
+    branchConditionComboBox->setEnabled( (ProtocolStep::stepType_t)selection == ProtocolStep::BRANCH );
+    branchActionComboBox->setEnabled( (ProtocolStep::stepType_t)selection == ProtocolStep::BRANCH );
+    branchComboBoxUpdate( branchActionComboBox->currentIndex() );
+    numBeatsLabel->setText( (ProtocolStep::stepType_t)selection == ProtocolStep::LOOP ? "Iterations" : "Number of Beats" );
+
+    // Sweep settings
+    sweepNameEdit->setEnabled( (ProtocolStep::stepType_t)selection == ProtocolStep::APCLAMP );
+    referenceSweepEdit->setEnabled( (ProtocolStep::stepType_t)selection == ProtocolStep::APCLAMP );
+
     switch( (ProtocolStep::stepType_t)selection ) {
     case ProtocolStep::PACE:
         BCLEdit->setEnabled(true);
@@ -111,6 +139,23 @@ void AddStepInputDialog::stepComboBoxUpdate( int selection ) {
         waitTimeEdit->setEnabled(true);
         digitalOutEdit->setEnabled(true);
         break;
+
+    case ProtocolStep::LOOP:
+        BCLEdit->setEnabled(false);
+        numBeatsEdit->setEnabled(true);
+        recordIdxEdit->setEnabled(false);
+        waitTimeEdit->setEnabled(false);
+        digitalOutEdit->setEnabled(false);
+        break;
+
+    case ProtocolStep::ENDLOOP:
+    case ProtocolStep::BRANCH:
+        BCLEdit->setEnabled(false);
+        numBeatsEdit->setEnabled(false);
+        recordIdxEdit->setEnabled(false);
+        waitTimeEdit->setEnabled(false);
+        digitalOutEdit->setEnabled(false);
+        break;
     }
 }
 
@@ -122,10 +167,30 @@ void AddStepInputDialog::addStepClicked( void ) { // Initializes QStrings and ch
     recordIdx = recordIdxEdit->text();
     waitTime = waitTimeEdit->text();
     digitalOut = digitalOutEdit->text();
+    convergeMode = QString::number( convergeModeComboBox->currentIndex() );
+    convergeBeats = convergeBeatsEdit->text();
+    convergeTol = convergeTolEdit->text();
+    branchCondition = QString::number( branchConditionComboBox->currentIndex() );
+    branchAction = QString::number( branchActionComboBox->currentIndex() );
+    branchTarget = branchTargetEdit->text();
+    stimScale = stimScaleEdit->text();
+    sweepName = sweepNameEdit->text().trimmed();
+    referenceSweep = referenceSweepEdit->text().trimmed();
  
+    if( stepComboBox->currentIndex() != 0 ) // Steady state detection only applies to pacing
+        convergeMode = convergeBeats = convergeTol = "0";
+    if( stepComboBox->currentIndex() != ProtocolStep::BRANCH ) { // Branch settings only apply to branches
+        branchCondition = branchAction = branchTarget = "0";
+        stimScale = "1";
+    }
+    if( stepComboBox->currentIndex() != ProtocolStep::APCLAMP ) // Sweeps only apply to AP clamp
+        sweepName = referenceSweep = "";
+
     switch( stepComboBox->currentIndex() ) {
     case 0: // Pace
         if (BCL == "" || numBeats == "" ) check = false;
+        if (convergeMode != "0" && (convergeBeats == "" || convergeTol == "")) check = false;
+        if (convergeMode == "0") convergeBeats = convergeTol = "0";
         break;
         
     case 1: // Start Vm Recording
@@ -141,6 +206,7 @@ void AddStepInputDialog::addStepClicked( void ) { // Initializes QStrings and ch
         
     case 4: // AP Clamp
         if (recordIdx == "" || BCL == "" || numBeats == "" || digitalOut == "")  check = false;
+        if (referenceSweep != "" && sweepName == "") check = false;
         break;
         
     case 5: // Start Data Recording
@@ -152,6 +218,20 @@ void AddStepInputDialog::addStepClicked( void ) { // Initializes QStrings and ch
     case 7: // Wait
         if (waitTime == "") check = false;
         break;
+
+    case 8: // Loop
+        if (numBeats == "") check = false;
+        break;
+
+    case 9: // End Loop
+        break;
+
+    case 10: // Branch
+        if (branchAction.toInt() != ProtocolStep::EXITLOOP && branchTarget == "") check = false;
+        if (branchAction.toInt() == ProtocolStep::RETRY && stimScale == "") check = false;
+        if (branchAction.toInt() != ProtocolStep::RETRY) stimScale = "1";
+        if (branchAction.toInt() == ProtocolStep::EXITLOOP) branchTarget = "0";
+        break;
     }
 
     if (check) emit checked();
@@ -171,16 +251,33 @@ vector<QString> AddStepInputDialog::gatherInput( void ) {
         inputAnswers.push_back( recordIdx );
         inputAnswers.push_back( waitTime );
         inputAnswers.push_back( digitalOut );
+        inputAnswers.push_back( convergeMode );
+        inputAnswers.push_back( convergeBeats );
+        inputAnswers.push_back( convergeTol );
+        inputAnswers.push_back( branchCondition );
+        inputAnswers.push_back( branchAction );
+        inputAnswers.push_back( branchTarget );
+        inputAnswers.push_back( stimScale );
+        inputAnswers.push_back( sweepName );
+        inputAnswers.push_back( referenceSweep );
         return inputAnswers;
     }
 }
 
 /* Protocol Step Class */
-ProtocolStep::ProtocolStep( stepType_t st, double bcl, int nb, int ri, int w, int dout ) :
-		stepType(st), BCL(bcl), numBeats(nb), recordIdx(ri), waitTime(w), digitalOut(dout) { }
+ProtocolStep::ProtocolStep( stepType_t st, double bcl, int nb, int ri, int w, int dout, int cm, int cb, double ct,
+                            int bc, int ba, int bt, double ss, QString sn, QString rs ) :
+		stepType(st), BCL(bcl), numBeats(nb), recordIdx(ri), waitTime(w), digitalOut(dout),
+        convergeMode(cm), convergeBeats(cb), convergeTol(ct),
+        branchCondition(bc), branchAction(ba), branchTarget(bt), stimScale(ss),
+        sweepName(sn), referenceSweep(rs) { }
 
 ProtocolStep::~ProtocolStep( void ) { }
 
+bool ProtocolStep::isTimed( void ) const {
+    return stepType == PACE || stepType == AVERAGE || stepType == APCLAMP || stepType == WAIT;
+}
+
 int ProtocolStep::stepLength( double period ) {
     return 0;
 }
@@ -190,23 +287,312 @@ Protocol::Protocol( void ) { }
 
 Protocol::~Protocol( void ) { }
 
-// Opens input dialogs to gather step information, then adds to protocol container *at the end*
-// Returns true if a step was added
-bool Protocol::addStep( QWidget *parent ) {
-    AddStepInputDialog *dlg = new AddStepInputDialog(parent); // Special dialog box for step parameter input
-    vector<QString> inputAnswers = dlg->gatherInput(); // Opens dialog box for input
-    
-    if( inputAnswers.size() > 0 ) {
-        // Add a new step to protocol container
-        protocolContainer.push_back( 
-            ProtocolStepPtr( new ProtocolStep (
+// Builds a step from the answers gathered by AddStepInputDialog, same ordering is used by the batch interface
+// Steady state (answers 6-8), branch (answers 9-12) and sweep (answers 13-14) settings are optional
+ProtocolStepPtr Protocol::stepFromInput( const vector<QString> &inputAnswers ) {
+    return ProtocolStepPtr( new ProtocolStep(
                 (ProtocolStep::stepType_t)( inputAnswers[0].toInt() ), // stepType
                 inputAnswers[1].toDouble(), // BCL
                 inputAnswers[2].toInt(), // numBeats
                 inputAnswers[3].toInt(), // recordIdx
                 inputAnswers[4].toInt(), // waitTime
-                inputAnswers[5].toInt() // digitalOut
-            ) ) );
+                inputAnswers[5].toInt(), // digitalOut
+                inputAnswers.size() > 8 ? inputAnswers[6].toInt() : 0, // convergeMode
+                inputAnswers.size() > 8 ? inputAnswers[7].toInt() : 0, // convergeBeats
+                inputAnswers.size() > 8 ? inputAnswers[8].toDouble() : 0, // convergeTol
+                inputAnswers.size() > 12 ? inputAnswers[9].toInt() : 0, // branchCondition
+                inputAnswers.size() > 12 ? inputAnswers[10].toInt() : 0, // branchAction
+                inputAnswers.size() > 12 ? inputAnswers[11].toInt() : 0, // branchTarget
+                inputAnswers.size() > 12 ? inputAnswers[12].toDouble() : 1, // stimScale
+                inputAnswers.size() > 14 ? inputAnswers[13] : QString(), // sweepName
+                inputAnswers.size() > 14 ? inputAnswers[14] : QString() // referenceSweep
+            ) );
+}
+
+void Protocol::appendStep( ProtocolStepPtr step ) {
+    protocolContainer.push_back( step );
+}
+
+// Inserts step so that it becomes step number idx, returns false if idx is out of range
+bool Protocol::insertStep( int idx, ProtocolStepPtr step ) {
+    if( idx < 0 || idx > (int)protocolContainer.size() )
+        return false;
+
+    protocolContainer.insert( protocolContainer.begin() + idx, step );
+    return true;
+}
+
+bool Protocol::removeStep( int stepNumber ) {
+    if( stepNumber < 0 || stepNumber >= (int)protocolContainer.size() )
+        return false;
+
+    protocolContainer.erase( protocolContainer.begin() + stepNumber );
+    return true;
+}
+
+// Checks that every step has the parameters its type needs before the protocol is handed to the RT thread
+bool Protocol::validate( QString &error ) const {
+    if( protocolContainer.size() == 0 ) {
+        error = "A protocol must contain at least one step";
+        return false;
+    }
+
+    for( int i = 0; i < (int)protocolContainer.size(); i++ ) {
+        ProtocolStepPtr step = protocolContainer.at( i );
+        QString stepText = "Step " + QString::number( i+1 ) + ": ";
+
+        switch( step->stepType ) {
+        case ProtocolStep::PACE:
+        case ProtocolStep::AVERAGE:
+        case ProtocolStep::APCLAMP:
+            if( step->BCL <= 0 || step->numBeats <= 0 ) {
+                error = stepText + "BCL and number of beats must be greater than 0";
+                return false;
+            }
+            if( step->stepType != ProtocolStep::PACE &&
+                ( step->recordIdx < 0 || step->recordIdx >= numRecordSlots ) ) {
+                error = stepText + "Recording index must be between 0 and " + QString::number( numRecordSlots-1 );
+                return false;
+            }
+            if( step->stepType == ProtocolStep::PACE && step->convergeMode != 0 ) {
+                if( step->convergeMode < 0 || step->convergeMode > 2 ) {
+                    error = stepText + "Unknown steady state criterion";
+                    return false;
+                }
+                if( step->convergeBeats < 2 || step->convergeBeats > ProtocolStep::maxConvergeBeats ||
+                    step->convergeTol <= 0 ) {
+                    error = stepText + "Steady state needs 2 to " + QString::number( ProtocolStep::maxConvergeBeats ) +
+                        " beats and a tolerance greater than 0";
+                    return false;
+                }
+            }
+            if( step->stepType == ProtocolStep::APCLAMP ) {
+                QRegExp name( "[A-Za-z0-9_-]*" ); // Names are single batch tokens
+                if( !name.exactMatch( step->sweepName ) || !name.exactMatch( step->referenceSweep ) ) {
+                    error = stepText + "Sweep names can only contain letters, digits, '_' and '-'";
+                    return false;
+                }
+                if( !step->referenceSweep.isEmpty() &&
+                    ( step->sweepName.isEmpty() || step->referenceSweep == step->sweepName ) ) {
+                    error = stepText + "A reference sweep needs a different sweep name for this step";
+                    return false;
+                }
+            }
+            break;
+
+        case ProtocolStep::STARTVM:
+            if( step->recordIdx < 0 || step->recordIdx >= numRecordSlots ) {
+                error = stepText + "Recording index must be between 0 and " + QString::number( numRecordSlots-1 );
+                return false;
+            }
+            break;
+
+        case ProtocolStep::WAIT:
+            if( step->waitTime <= 0 ) {
+                error = stepText + "Wait time must be greater than 0";
+                return false;
+            }
+            break;
+
+        case ProtocolStep::LOOP:
+            if( step->numBeats <= 0 ) {
+                error = stepText + "Number of iterations must be greater than 0";
+                return false;
+            }
+            break;
+
+        case ProtocolStep::BRANCH:
+            if( step->branchCondition < ProtocolStep::ALWAYS || step->branchCondition > ProtocolStep::EAD ) {
+                error = stepText + "Unknown branch condition";
+                return false;
+            }
+            if( step->branchAction < ProtocolStep::GOTO || step->branchAction > ProtocolStep::RETRY ) {
+                error = stepText + "Unknown branch action";
+                return false;
+            }
+            if( step->branchAction == ProtocolStep::RETRY && ( step->branchTarget <= 0 || step->stimScale <= 0 ) ) {
+                error = stepText + "Retry needs a number of retries and a stimulus scale greater than 0";
+                return false;
+            }
+            break;
+
+        case ProtocolStep::STOPVM:
+        case ProtocolStep::STARTRECORD:
+        case ProtocolStep::STOPRECORD:
+        case ProtocolStep::ENDLOOP:
+            break;
+
+        default:
+            error = stepText + "Unknown step type";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Builds the program run by the RT thread, loops and branches are checked here since they depend on the step order
+bool Protocol::compile( ProtocolProgram &program, QString &error ) const {
+    if( !validate( error ) )
+        return false;
+
+    int n = protocolContainer.size();
+    vector<int> loopOf( n, -1 ); // Innermost LOOP enclosing each step, ENDLOOP belongs to the loop it closes
+    vector<int> openLoops;
+    vector<bool> loopTimed( n, false ); // Loop body contains a timed step
+    program.resize( n );
+
+    for( int i = 0; i < n; i++ ) {
+        ProtocolStepPtr step = protocolContainer.at( i );
+        ProtocolInstruction &ins = program[i];
+        ins.op = ProtocolInstruction::EXEC;
+        ins.condition = ins.action = ins.jump = ins.count = 0;
+        ins.scale = 1;
+        ins.type = step->stepType;
+        ins.BCL = step->BCL;
+        ins.numBeats = step->numBeats;
+        ins.recordIdx = step->recordIdx;
+        ins.waitTime = step->waitTime;
+        ins.digitalOut = step->digitalOut;
+        ins.convergeMode = step->convergeMode;
+        ins.convergeBeats = step->convergeBeats;
+        ins.convergeTol = step->convergeTol;
+        loopOf[i] = openLoops.empty() ? -1 : openLoops.back();
+
+        if( step->isTimed() )
+            for( size_t l = 0; l < openLoops.size(); l++ )
+                loopTimed[openLoops[l]] = true;
+
+        if( step->stepType == ProtocolStep::LOOP ) {
+            ins.op = ProtocolInstruction::LOOP;
+            ins.count = step->numBeats;
+            openLoops.push_back( i );
+        }
+        else if( step->stepType == ProtocolStep::ENDLOOP ) {
+            if( openLoops.empty() ) {
+                error = "Step " + QString::number( i+1 ) + ": End loop without loop";
+                return false;
+            }
+            ins.op = ProtocolInstruction::ENDLOOP;
+            ins.jump = openLoops.back();
+            program[ins.jump].jump = i; // LOOP keeps its ENDLOOP for EXITLOOP resolution below
+            if( !loopTimed[ins.jump] ) {
+                error = "Step " + QString::number( ins.jump+1 ) + ": Loop must contain a pace, average, AP clamp or wait step";
+                return false;
+            }
+            openLoops.pop_back();
+        }
+        else if( step->stepType == ProtocolStep::BRANCH ) {
+            ins.op = ProtocolInstruction::BRANCH;
+            ins.condition = step->branchCondition;
+            ins.action = step->branchAction;
+            ins.count = step->branchTarget;
+            ins.scale = step->stimScale;
+        }
+    }
+    if( !openLoops.empty() ) {
+        error = "Step " + QString::number( openLoops.back()+1 ) + ": Loop without end loop";
+        return false;
+    }
+
+    // Sweep numbers, every reference must be recorded by some AP clamp step
+    QStringList sweeps = sweepNames();
+    if( sweeps.size() > maxSweeps ) {
+        error = "A protocol can use at most " + QString::number( maxSweeps ) + " sweep names";
+        return false;
+    }
+    for( int i = 0; i < n; i++ ) {
+        ProtocolStepPtr step = protocolContainer.at( i );
+        program[i].sweep = program[i].reference = -1;
+        if( step->stepType != ProtocolStep::APCLAMP ) continue;
+        program[i].sweep = sweeps.indexOf( step->sweepName ); // -1 for empty names
+        if( !step->referenceSweep.isEmpty() ) {
+            program[i].reference = sweeps.indexOf( step->referenceSweep );
+            if( program[i].reference == -1 ) {
+                error = "Step " + QString::number( i+1 ) + ": Reference sweep " + step->referenceSweep +
+                    " is not recorded by any AP clamp step";
+                return false;
+            }
+        }
+    }
+
+    // Branch targets, LOOP/ENDLOOP pairs are known now
+    for( int i = 0; i < n; i++ ) {
+        ProtocolStepPtr step = protocolContainer.at( i );
+        if( step->stepType != ProtocolStep::BRANCH ) continue;
+        ProtocolInstruction &ins = program[i];
+        QString stepText = "Step " + QString::number( i+1 ) + ": ";
+
+        if( ins.action == ProtocolStep::GOTO ) {
+            int target = step->branchTarget - 1; // Step numbers start at 1 as in the error messages, n is the end of the protocol
+            if( target <= i || target > n ) {
+                error = stepText + "Branch can only jump forward, up to step " + QString::number( n+1 ) + " (end of protocol)";
+                return false;
+            }
+            int context = target < n ? loopOf[target] : -1; // Jumping onto an ENDLOOP continues its loop
+            bool reachable = ( context == -1 );
+            for( int l = loopOf[i]; l != -1 && !reachable; l = loopOf[l] )
+                reachable = ( l == context );
+            if( !reachable ) {
+                error = stepText + "Branch can not jump into a loop";
+                return false;
+            }
+            ins.jump = target;
+        }
+        else if( ins.action == ProtocolStep::EXITLOOP ) {
+            if( loopOf[i] == -1 ) {
+                error = stepText + "Exit loop branch must be inside a loop";
+                return false;
+            }
+            ins.jump = program[loopOf[i]].jump + 1; // Step after the ENDLOOP
+        }
+        else { // RETRY
+            if( i == 0 || ( protocolContainer.at( i-1 )->stepType != ProtocolStep::PACE &&
+                            protocolContainer.at( i-1 )->stepType != ProtocolStep::AVERAGE ) ) {
+                error = stepText + "Retry branch must follow a pace or average step";
+                return false;
+            }
+            ins.jump = i - 1;
+        }
+    }
+
+    return true;
+}
+
+QStringList Protocol::sweepNames( void ) const {
+    QStringList names;
+    for( size_t i = 0; i < protocolContainer.size(); i++ ) {
+        ProtocolStepPtr step = protocolContainer.at( i );
+        if( step->stepType == ProtocolStep::APCLAMP && !step->sweepName.isEmpty() && !names.contains( step->sweepName ) )
+            names << step->sweepName;
+    }
+    return names;
+}
+
+// Opens input dialog to gather step information, step is not added to the protocol container
+ProtocolStepPtr Protocol::stepFromDialog( QWidget *parent ) {
+    AddStepInputDialog *dlg = new AddStepInputDialog(parent); // Special dialog box for step parameter input
+    vector<QString> inputAnswers = dlg->gatherInput(); // Opens dialog box for input
+
+    if( inputAnswers.size() > 0 )
+        return stepFromInput( inputAnswers );
+    else
+        return ProtocolStepPtr(); // Dialog was closed, no step
+}
+
+// Message box asking for confirmation whether step should be deleted, returns true if answer is yes
+bool Protocol::confirmDelete( QWidget *parent, int stepNumber ) {
+    QString text = "Do you wish to delete step " + QString::number(stepNumber+1) + "?"; // Text pointing out specific step
+    return QMessageBox::question(parent,"Delete Step Confirmation",text,"Yes","No") == 0;
+}
+
+// Opens input dialogs to gather step information, then adds to protocol container *at the end*
+// Returns true if a step was added
+bool Protocol::addStep( QWidget *parent ) {
+    ProtocolStepPtr step = stepFromDialog( parent );
+    
+    if( step ) {
+        appendStep( step ); // Add a new step to protocol container
         return true;
     }
     else {
@@ -217,40 +603,18 @@ bool Protocol::addStep( QWidget *parent ) {
 // Opens input dialogs to gather step information, then adds to protocol container at *a specific point*
 // Returns true if a step was added
 bool Protocol::addStep( QWidget *parent, int idx ) {
-    AddStepInputDialog *dlg = new AddStepInputDialog(parent); // Special dialog box for step parameter input
-    vector<QString> inputAnswers = dlg->gatherInput(); // Opens dialog box for input
+    ProtocolStepPtr step = stepFromDialog( parent );
 
-    vector<ProtocolStepPtr>::iterator it = protocolContainer.begin();
-    
-    if( inputAnswers.size() > 0 ) {
-        // Add a new step to protocol container
-        protocolContainer.insert( 
-		      it+idx+1, ProtocolStepPtr( new ProtocolStep(
-                (ProtocolStep::stepType_t)( inputAnswers[0].toInt() ), // stepType
-                inputAnswers[1].toDouble(), // BCL
-                inputAnswers[2].toInt(), // numBeats
-                inputAnswers[3].toInt(), // recordIdx
-                inputAnswers[4].toInt(), // waitTime
-                inputAnswers[5].toInt() // digitalOut
-            ) ) );
-        return true;
-    }
+    if( step ) // Add a new step to protocol container after the selected step
+        return insertStep( idx+1, step );
     else
         return false;// No step added
 }
 
     // Deletes a step
 void Protocol::deleteStep( QWidget *parent, int stepNumber ) {
-    // Message box asking for confirmation whether step should be deleted
-    QString text = "Do you wish to delete step " + QString::number(stepNumber+1) + "?"; // Text pointing out specific step
-    if( QMessageBox::question(parent,"Delete Step Confirmation",text,"Yes","No") ) {
-        return ; // Answer is no
-	 }
-
-    // If only 1 step exists, explicitly clear step pointer
-    if( protocolContainer.size() == 1 ) protocolContainer.clear();
-    else protocolContainer.erase(protocolContainer.begin() + stepNumber);
-
+    if( confirmDelete( parent, stepNumber ) )
+        removeStep( stepNumber );
 }
 
 QString Protocol::saveProtocol( QWidget *parent ) {
@@ -261,13 +625,9 @@ QString Protocol::saveProtocol( QWidget *parent ) {
         return "";
     }
     
-    // Create QDomDocument
-    QDomDocument protocolDoc("APC_Protocol");
-    QDomElement root = protocolDoc.createElement( "APC_protocol-v1.0");
-    protocolDoc.appendChild(root);   
-    
     // Save dialog to retrieve desired filename and location
     QString fileName = QFileDialog::getSaveFileName(parent,"Save protocol","~/","XML Files (*.xml)" );
+    if( fileName.isEmpty() ) return ""; // Dialog was cancelled
 
     // If filename does not include .xml extension, add extension
     if( !(fileName.endsWith(".xml")) ) fileName.append(".xml");
@@ -281,6 +641,25 @@ QString Protocol::saveProtocol( QWidget *parent ) {
                               | QMessageBox::Escape) != QMessageBox::Yes)
         return ""; // Return if answer is no
 
+    QString error;
+    if( !writeProtocol( fileName, error ) ) {
+        QMessageBox::warning( parent, "Error", error );
+        return "";
+    }
+    return fileName;
+}
+
+bool Protocol::writeProtocol( QString fileName, QString &error ) {
+    if( protocolContainer.size() == 0 ) { 
+        error = "A protocol must contain at least one step";
+        return false;
+    }
+
+    // Create QDomDocument
+    QDomDocument protocolDoc("APC_Protocol");
+    QDomElement root = protocolDoc.createElement( "APC_protocol-v1.0");
+    protocolDoc.appendChild(root);   
+
     // Add segment elements to protocolDoc
     for( int i = 0; i < protocolContainer.size(); i++ ) {
         root.appendChild( stepToNode(protocolDoc, protocolContainer.at(i), i) );
@@ -289,14 +668,14 @@ QString Protocol::saveProtocol( QWidget *parent ) {
     // Save protocol to file
     QFile file(fileName); // Open file
     if( !file.open(QIODevice::WriteOnly) ) { // Open file, return error if unable to do so
-        QMessageBox::warning(parent,"Error","Unable to save file: Please check folder permissions." );
-        return "";
+        error = "Unable to save file: Please check folder permissions.";
+        return false;
     }
     
 	 QTextStream ts(&file); // Open text stream
     ts << protocolDoc.toString(); // Write to file
     file.close(); // Close file
-    return fileName;
+    return true;
 }
 
 QString Protocol::loadProtocol( QWidget *parent ) {
@@ -311,54 +690,13 @@ QString Protocol::loadProtocol( QWidget *parent ) {
 
     // Save dialog to retrieve desired filename and location
     QString fileName = QFileDialog::getOpenFileName(parent,"Open a protocol","~/","XML Files (*.xml)");
-    QDomDocument doc( "APC_Protocol" );
-    QFile file( fileName );
+    if( fileName.isEmpty() ) return ""; // Dialog was cancelled
 
-    if( !file.open( QIODevice::ReadOnly ) ) { // Make sure file can be opened, if not, warn user
-        QMessageBox::warning(parent, "Error", "Unable to open protocol file" );
-        return "";
-    }   
-    
-	 if( !doc.setContent( &file ) ) { // Make sure file contents are loaded into document
-        QMessageBox::warning(parent, "Error", "Unable to set file contents to document" );
-        file.close();
+    QString error;
+    if( !readProtocol( fileName, error ) ) {
+        QMessageBox::warning( parent, "Error", error );
         return "";
     }
-    
-	 file.close();
-
-    QDomElement root = doc.documentElement(); // Get root element from document
-    if( root.tagName() != "APC_protocol-v1.0" ) { // Check if tagname is correct for this module version
-        QMessageBox::warning(parent, "Error", "Incompatible XML file" );
-        return "";
-    }
-
-    // Retrieve information from document and set to protocolContainer
-    QDomNode stepNode = root.firstChild(); // Retrieve first segment
-    protocolContainer.clear(); // Clear vector containing protocol
-          
-    while( !stepNode.isNull() ) { // Step iteration
-        QDomElement stepElement = stepNode.toElement();
-
-        // Add new step to protocol container
-        protocolContainer.push_back( 
-		      ProtocolStepPtr( new ProtocolStep(
-                (ProtocolStep::stepType_t)stepElement.attribute("stepType").toInt(),
-                stepElement.attribute( "BCL" ).toDouble(),
-                stepElement.attribute( "numBeats" ).toInt(),
-                stepElement.attribute( "recordIdx" ).toInt(),
-                stepElement.attribute( "waitTime" ).toInt(),
-                stepElement.attribute( "digitalOut" ).toInt()
-            ) ) ); // Add step to segment container            
-
-        stepNode = stepNode.nextSibling(); // Move to next step
-    } // End step iteration
-
-    // Update segment summary and table
-    if( protocolContainer.size() == 0 ) {
-        QMessageBox::warning(parent, "Error", "Protocol did not contain any steps" );
-	 }
-
     return fileName;
 }
 
@@ -373,26 +711,33 @@ void Protocol::loadProtocol( QWidget *parent, QString fileName ) {
                              | QMessageBox::Escape) != QMessageBox::Yes )
         return ; // Return if answer is no
 
+    QString error;
+    if( !readProtocol( fileName, error ) )
+        QMessageBox::warning( parent, "Error", error );
+}
+
+// Parses xml protocol file into the protocol container, no user interaction
+bool Protocol::readProtocol( QString fileName, QString &error ) {
     QDomDocument doc( "APC_Protocol" );
     QFile file( fileName );
 
-    if( !file.open( QIODevice::ReadOnly ) ) { // Make sure file can be opened, if not, warn user
-        QMessageBox::warning(parent, "Error", "Unable to open protocol file" );
-        return ;
+    if( !file.open( QIODevice::ReadOnly ) ) { // Make sure file can be opened
+        error = "Unable to open protocol file";
+        return false;
     }   
     if( !doc.setContent( &file ) ) { // Make sure file contents are loaded into document
-        QMessageBox::warning(parent, "Error", "Unable to set file contents to document" );
+        error = "Unable to set file contents to document";
         file.close();
-        return ;
+        return false;
     }
     file.close();
 
-    QDomElement root = doc.documentElement(); // Get root element from documen
+    QDomElement root = doc.documentElement(); // Get root element from document
 	 
-	 // Check if tagname is correct for this module versiont
+	 // Check if tagname is correct for this module version
     if( root.tagName() != "APC_protocol-v1.0" ) { 
-        QMessageBox::warning(parent, "Error", "Incompatible XML file" );
-        return;
+        error = "Incompatible XML file";
+        return false;
     }
 
     // Retrieve information from document and set to protocolContainer
@@ -410,16 +755,27 @@ void Protocol::loadProtocol( QWidget *parent, QString fileName ) {
                 stepElement.attribute( "numBeats" ).toInt(),
                 stepElement.attribute( "recordIdx" ).toInt(),
                 stepElement.attribute( "waitTime" ).toInt(),
-                stepElement.attribute( "digitalOut" ).toInt()
+                stepElement.attribute( "digitalOut" ).toInt(),
+                stepElement.attribute( "convergeMode", "0" ).toInt(), // Steady state attributes are optional
+                stepElement.attribute( "convergeBeats", "0" ).toInt(),
+                stepElement.attribute( "convergeTol", "0" ).toDouble(),
+                stepElement.attribute( "branchCondition", "0" ).toInt(), // Branch attributes are optional
+                stepElement.attribute( "branchAction", "0" ).toInt(),
+                stepElement.attribute( "branchTarget", "0" ).toInt(),
+                stepElement.attribute( "stimScale", "1" ).toDouble(),
+                stepElement.attribute( "sweepName" ), // Sweep attributes are optional
+                stepElement.attribute( "referenceSweep" )
             ) ) ); // Add step to segment container            
 
         stepNode = stepNode.nextSibling(); // Move to next step
     } // End step iteration
 
-    // Update segment summary and table
     if( protocolContainer.size() == 0 ) {
-        QMessageBox::warning(parent, "Error", "Protocol did not contain any steps" );
+        error = "Protocol did not contain any steps";
+        return false;
 	 }
+
+    return true;
 }
 
 QDomElement Protocol::stepToNode( QDomDocument &doc, const ProtocolStepPtr stepPtr, int stepNumber ) {
@@ -432,6 +788,21 @@ QDomElement Protocol::stepToNode( QDomDocument &doc, const ProtocolStepPtr stepP
     stepElement.setAttribute( "recordIdx", QString::number( stepPtr->recordIdx ) );
     stepElement.setAttribute( "waitTime", QString::number( stepPtr->waitTime ) );
     stepElement.setAttribute( "digitalOut", QString::number( stepPtr->digitalOut ) );
+    if( stepPtr->convergeMode != 0 ) {
+        stepElement.setAttribute( "convergeMode", QString::number( stepPtr->convergeMode ) );
+        stepElement.setAttribute( "convergeBeats", QString::number( stepPtr->convergeBeats ) );
+        stepElement.setAttribute( "convergeTol", QString::number( stepPtr->convergeTol ) );
+    }
+    if( stepPtr->stepType == ProtocolStep::BRANCH ) {
+        stepElement.setAttribute( "branchCondition", QString::number( stepPtr->branchCondition ) );
+        stepElement.setAttribute( "branchAction", QString::number( stepPtr->branchAction ) );
+        stepElement.setAttribute( "branchTarget", QString::number( stepPtr->branchTarget ) );
+        stepElement.setAttribute( "stimScale", QString::number( stepPtr->stimScale ) );
+    }
+    if( !stepPtr->sweepName.isEmpty() )
+        stepElement.setAttribute( "sweepName", stepPtr->sweepName );
+    if( !stepPtr->referenceSweep.isEmpty() )
+        stepElement.setAttribute( "referenceSweep", stepPtr->referenceSweep );
 
     return stepElement;
 }
@@ -451,6 +822,10 @@ QString Protocol::getStepDescription( int stepNumber ) {
     case ProtocolStep::PACE:
         type = "Pace ";
         description = type + ": " + QString::number( step->numBeats ) + " beats - " + QString::number( step->BCL ) + "ms BCL" + "ms | DO(" + QString::number( step->digitalOut ) + ")";
+        if( step->convergeMode == 1 )
+            description += " | Steady: dAPD<" + QString::number( step->convergeTol ) + "ms over " + QString::number( step->convergeBeats );
+        else if( step->convergeMode == 2 )
+            description += " | Steady: slope<" + QString::number( step->convergeTol ) + "ms/beat over " + QString::number( step->convergeBeats );
         break;
 
     case ProtocolStep::STARTVM:
@@ -473,6 +848,10 @@ QString Protocol::getStepDescription( int stepNumber ) {
         type = "AP Clamp ";
         description = type + ": Index(" + QString::number( step->recordIdx ) + ") | " + QString::number( step->numBeats ) +
             " iterations - Repeats every " + QString::number( step->BCL ) + "ms | DO(" + QString::number( step->digitalOut ) + ")";
+        if( !step->sweepName.isEmpty() )
+            description += " | Sweep(" + step->sweepName + ")";
+        if( !step->referenceSweep.isEmpty() )
+            description += " | Difference(" + step->referenceSweep + " - " + step->sweepName + ")";
         break;
 
     case ProtocolStep::STARTRECORD:
@@ -489,6 +868,29 @@ QString Protocol::getStepDescription( int stepNumber ) {
         type = "Wait ";
         description = type + " : " + QString::number( step->waitTime ) + "ms";
         break;
+
+    case ProtocolStep::LOOP:
+        type = "Loop ";
+        description = type + ": " + QString::number( step->numBeats ) + " iterations";
+        break;
+
+    case ProtocolStep::ENDLOOP:
+        type = "End Loop";
+        description = type;
+        break;
+
+    case ProtocolStep::BRANCH: {
+        const char *conditions[] = { "always", "capture failed", "converged", "EAD" };
+        type = "Branch ";
+        description = type + ": If " + conditions[step->branchCondition];
+        if( step->branchAction == ProtocolStep::GOTO )
+            description += " go to step " + QString::number( step->branchTarget );
+        else if( step->branchAction == ProtocolStep::EXITLOOP )
+            description += " exit loop";
+        else
+            description += " retry x" + QString::number( step->branchTarget ) + " | Stim x" + QString::number( step->stimScale );
+        break;
+    }
                 
     }
 
@@ -36,6 +36,7 @@
 #include <qdom.h>
 #include <QtGui>
 #include "APC_AddStepDialogUI.h"
+#include "APC_ProtocolProgram.h"
 
 class AddStepInputDialog: public AddStepDialog {
     Q_OBJECT
@@ -47,6 +48,15 @@ class AddStepInputDialog: public AddStepDialog {
     QString recordIdx;
     QString waitTime;
     QString digitalOut;
+    QString convergeMode;
+    QString convergeBeats;
+    QString convergeTol;
+    QString branchCondition;
+    QString branchAction;
+    QString branchTarget;
+    QString stimScale;
+    QString sweepName;
+    QString referenceSweep;
     
     signals:
     void checked( void );
@@ -54,6 +64,8 @@ class AddStepInputDialog: public AddStepDialog {
     private slots:
     void addStepClicked( void );
     void stepComboBoxUpdate( int );
+    void convergeComboBoxUpdate( int );
+    void branchComboBoxUpdate( int );
     
     public:
     AddStepInputDialog( QWidget * );
@@ -61,16 +73,27 @@ class AddStepInputDialog: public AddStepDialog {
     std::vector<QString> gatherInput(void);    
 };
 
-class ProtocolStep {
+class ProtocolStep : public ProtocolDefs {
 public:
-    enum stepType_t { PACE, STARTVM, STOPVM, AVERAGE, APCLAMP, STARTRECORD, STOPRECORD, WAIT } stepType;    
+    stepType_t stepType;
     double BCL; // ms
-    int numBeats;
+    int numBeats; // Iterations for LOOP steps
     int recordIdx;
     int waitTime; // ms
     int digitalOut;
-    
-    ProtocolStep( stepType_t, double, int, int, int, int );
+    int convergeMode; // ConvergenceDetector::mode_t, PACE steps end early once APD is at steady state
+    int convergeBeats; // Number of beats the steady state criterion looks at
+    double convergeTol; // ms (APD change) or ms/beat (APD slope)
+    int branchCondition; // BRANCH steps only
+    int branchAction;
+    int branchTarget; // GOTO: step number (1 based) jumped to, RETRY: maximum number of retries
+    double stimScale; // RETRY: stimulus magnitude is multiplied by this on every retry
+    QString sweepName; // APCLAMP: averaged current is kept under this name, empty if not kept
+    QString referenceSweep; // APCLAMP: difference current is referenceSweep - sweepName, empty if none
+
+    ProtocolStep( stepType_t, double, int, int, int, int, int = 0, int = 0, double = 0,
+                  int = 0, int = 0, int = 0, double = 1, QString = QString(), QString = QString() );
+    bool isTimed( void ) const; // True if the step takes at least one tick
     ~ProtocolStep( void );
     int stepLength ( double );
 };
@@ -78,10 +101,25 @@ public:
 typedef boost::shared_ptr<ProtocolStep> ProtocolStepPtr; // Step pointer
 typedef std::vector<ProtocolStepPtr> ProtocolContainer; // Vector of steps: protocol
 
-class Protocol {
+class Protocol : public ProtocolDefs {
 public:
     Protocol( void );
     ~Protocol( void );
+
+    // GUI-free editing, used by the batch interface and wrapped by the dialog functions below
+    void appendStep( ProtocolStepPtr ); // Add a protocol step at the end
+    bool insertStep( int, ProtocolStepPtr ); // Insert a protocol step at a specific position
+    bool removeStep( int ); // Delete a protocol step without confirmation
+    bool writeProtocol( QString, QString & ); // Save protocol to xml file, error message returned by reference
+    bool readProtocol( QString, QString & ); // Build protocol container from xml file, error message returned by reference
+    bool validate( QString & ) const; // Check step parameters, error message returned by reference
+    bool compile( ProtocolProgram &, QString & ) const; // Validate and resolve loops, branches and sweeps, error message returned by reference
+    QStringList sweepNames( void ) const; // AP clamp sweep names in order of first use, index is the sweep number
+    static ProtocolStepPtr stepFromInput( const std::vector<QString> & ); // Build step from dialog/batch answers, steady state answers are optional
+
+    // Dialog based editing
+    static ProtocolStepPtr stepFromDialog( QWidget * ); // Opens add step dialog, returns empty pointer if cancelled
+    static bool confirmDelete( QWidget *, int ); // Asks user to confirm deletion of a step
     bool addStep( QWidget * ); // Add a protocol step at the end
     bool addStep( QWidget *, int ); // Add a protocol step at a specific point
     void deleteStep( QWidget *, int ); // Delete a protocol step
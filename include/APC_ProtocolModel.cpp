@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_ProtocolModel.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_ProtocolModel.h"
+
+ProtocolModel::ProtocolModel( Protocol *p, QObject *parent ) : QAbstractListModel( parent ), protocol( p ), currentStep( -1 ) { }
+
+ProtocolModel::~ProtocolModel( void ) { }
+
+int ProtocolModel::rowCount( const QModelIndex &parent ) const {
+    if( parent.isValid() ) return 0; // List model, no children
+    return protocol->protocolContainer.size();
+}
+
+QVariant ProtocolModel::data( const QModelIndex &index, int role ) const {
+    if( !index.isValid() || index.row() >= (int)protocol->protocolContainer.size() )
+        return QVariant();
+
+    switch( role ) {
+    case Qt::DisplayRole: // Description is only built for rows the view is painting
+        return protocol->getStepDescription( index.row() );
+
+    case Qt::FontRole:
+        if( index.row() == currentStep ) {
+            QFont font;
+            font.setBold( true );
+            return font;
+        }
+        break;
+
+    case Qt::BackgroundRole:
+        if( index.row() == currentStep )
+            return QBrush( QColor( 180, 220, 180 ) );
+        break;
+    }
+
+    return QVariant();
+}
+
+bool ProtocolModel::insertStep( int idx, ProtocolStepPtr step ) {
+    if( idx < 0 || idx > (int)protocol->protocolContainer.size() )
+        return false;
+
+    beginInsertRows( QModelIndex(), idx, idx );
+    protocol->insertStep( idx, step );
+    if( currentStep >= idx && currentStep != -1 ) currentStep++; // Highlight follows the step
+    endInsertRows();
+    return true;
+}
+
+bool ProtocolModel::removeStep( int idx ) {
+    if( idx < 0 || idx >= (int)protocol->protocolContainer.size() )
+        return false;
+
+    beginRemoveRows( QModelIndex(), idx, idx );
+    protocol->removeStep( idx );
+    if( currentStep == idx ) currentStep = -1;
+    else if( currentStep > idx ) currentStep--;
+    endRemoveRows();
+    return true;
+}
+
+void ProtocolModel::clearProtocol( void ) {
+    beginResetModel();
+    protocol->clearProtocol();
+    currentStep = -1;
+    endResetModel();
+}
+
+void ProtocolModel::protocolReset( void ) {
+    beginResetModel();
+    currentStep = -1;
+    endResetModel();
+}
+
+// Only the previously and newly highlighted rows are repainted
+void ProtocolModel::setCurrentStep( int step ) {
+    if( step == currentStep ) return ;
+
+    int previous = currentStep;
+    currentStep = step;
+
+    if( previous >= 0 && previous < rowCount() )
+        emit dataChanged( index( previous ), index( previous ) );
+    if( currentStep >= 0 && currentStep < rowCount() )
+        emit dataChanged( index( currentStep ), index( currentStep ) );
+}
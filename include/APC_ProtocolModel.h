@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_ProtocolModel.h
+ * List model exposing the protocol container to the protocol editor view
+ *
+ *** NOTES
+ *
+ * Step descriptions are generated on request, so only rows visible in
+ * the view are ever formatted. Edits made through the model emit row
+ * insert/remove signals instead of rebuilding the list.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_PROTOCOLMODEL_H
+#define APC_PROTOCOLMODEL_H
+
+#include <QtGui>
+#include "APC_Protocol.h"
+
+class ProtocolModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    ProtocolModel( Protocol *, QObject *parent = 0 );
+    ~ProtocolModel( void );
+
+    int rowCount( const QModelIndex &parent = QModelIndex() ) const;
+    QVariant data( const QModelIndex &, int ) const;
+
+    bool insertStep( int, ProtocolStepPtr ); // Insert step at position, notifies views
+    bool removeStep( int ); // Remove step, notifies views
+    void clearProtocol( void ); // Clear protocol, notifies views
+    void protocolReset( void ); // Call after protocol container was replaced outside of the model
+    void setCurrentStep( int ); // Highlights step being executed, -1 for none
+
+private:
+    Protocol *protocol;
+    int currentStep;
+};
+
+#endif // APC_PROTOCOLMODEL_H
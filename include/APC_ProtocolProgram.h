@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_ProtocolProgram.h
+ * Compiled form of a protocol, executed by the RT thread
+ *
+ *** NOTES
+ *
+ * Protocol::compile() turns the step list into one instruction per
+ * step, so the program counter is the step number shown in the
+ * protocol list. Jump targets are resolved at compile time, each step
+ * transition is therefore a single array lookup. Only forward GOTOs are
+ * allowed and every loop body must contain a step that takes time
+ * (pace, average, AP clamp or wait). Branches can still skip that step
+ * (a GOTO onto the ENDLOOP, a failed condition that stays set), so an
+ * ENDLOOP whose iteration started on the same tick holds the program
+ * until the next tick. The work the RT thread does between two ticks
+ * is therefore bounded by the program length, whatever the loop counts.
+ *
+ *   EXEC      Run protocol step, AP clamp current is averaged into sweep
+ *             and compared against sweep reference (-1 if unnamed)
+ *   LOOP      Load loop counter with count
+ *   ENDLOOP   Decrement counter of LOOP at jump, back to jump+1 if not 0,
+ *             a tick later if no step took time in the iteration
+ *   BRANCH    If condition holds: GOTO jump, EXITLOOP to jump (after
+ *             ENDLOOP), or RETRY step jump with the stimulus scaled,
+ *             at most count times
+ *
+ * Every instruction carries a copy of the parameters of its step, so
+ * the engine runs from the program alone and never reads the Qt based
+ * step list. Step types and limits are declared here for the same
+ * reason.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_PROTOCOLPROGRAM_H
+#define APC_PROTOCOLPROGRAM_H
+
+#include <vector>
+
+// Step types, branch settings and limits, shared by Protocol, ProtocolStep and the engine
+struct ProtocolDefs {
+    enum stepType_t { PACE, STARTVM, STOPVM, AVERAGE, APCLAMP, STARTRECORD, STOPRECORD, WAIT,
+                      LOOP, ENDLOOP, BRANCH };
+    static const int numStepTypes = BRANCH + 1;
+    enum branchCondition_t { ALWAYS, CAPTUREFAILED, CONVERGED, EAD }; // Evaluated on the last pace or average step
+    enum branchAction_t { GOTO, EXITLOOP, RETRY };
+
+    static const int maxConvergeBeats = 200;
+    static const int numRecordSlots = 100; // Number of Vm recording slots (recordIdx range)
+    static const int maxSweeps = 16; // Number of distinct AP clamp sweep names
+};
+
+struct ProtocolInstruction {
+    enum opcode_t { EXEC, LOOP, ENDLOOP, BRANCH };
+
+    opcode_t op;
+    int condition; // BRANCH: ProtocolDefs::branchCondition_t
+    int action; // BRANCH: ProtocolDefs::branchAction_t
+    int jump; // Resolved target address
+    int count; // LOOP: iterations, BRANCH RETRY: maximum retries
+    double scale; // BRANCH RETRY: stimulus scale applied on every retry
+    int sweep; // EXEC AP clamp: sweep number of ProtocolStep::sweepName, -1 if the current is not kept
+    int reference; // EXEC AP clamp: sweep number of ProtocolStep::referenceSweep, -1 if none
+
+    // Copy of the step
+    ProtocolDefs::stepType_t type;
+    double BCL; // ms
+    int numBeats;
+    int recordIdx;
+    int waitTime; // ms
+    int digitalOut;
+    int convergeMode; // ConvergenceDetector::mode_t
+    int convergeBeats;
+    double convergeTol;
+};
+
+typedef std::vector<ProtocolInstruction> ProtocolProgram;
+
+#endif // APC_PROTOCOLPROGRAM_H
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Restitution.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Restitution.h"
+
+#include <algorithm>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_multifit_nlin.h>
+#include <gsl/gsl_vector.h>
+
+using namespace std;
+
+namespace {
+    const int maxIterations = 100;
+    const double fitTolerance = 1e-6; // Relative step size at convergence
+
+    struct FitData {
+        const vector<RestitutionPoint> *points;
+    };
+
+    // Residuals APDmax - A * exp( -DI / tau ) - APD
+    int residuals( const gsl_vector *p, void *data, gsl_vector *f ) {
+        const vector<RestitutionPoint> &points = *static_cast<FitData *>( data )->points;
+        double APDmax = gsl_vector_get( p, 0 ), A = gsl_vector_get( p, 1 ), tau = gsl_vector_get( p, 2 );
+        for( size_t i = 0; i < points.size(); i++ )
+            gsl_vector_set( f, i, APDmax - A * exp( -points[i].DI / tau ) - points[i].APD );
+        return GSL_SUCCESS;
+    }
+
+    int jacobian( const gsl_vector *p, void *data, gsl_matrix *J ) {
+        const vector<RestitutionPoint> &points = *static_cast<FitData *>( data )->points;
+        double A = gsl_vector_get( p, 1 ), tau = gsl_vector_get( p, 2 );
+        for( size_t i = 0; i < points.size(); i++ ) {
+            double e = exp( -points[i].DI / tau );
+            gsl_matrix_set( J, i, 0, 1 );
+            gsl_matrix_set( J, i, 1, -e );
+            gsl_matrix_set( J, i, 2, -A * e * points[i].DI / ( tau * tau ) );
+        }
+        return GSL_SUCCESS;
+    }
+
+    int residualsJacobian( const gsl_vector *p, void *data, gsl_vector *f, gsl_matrix *J ) {
+        residuals( p, data, f );
+        return jacobian( p, data, J );
+    }
+}
+
+RestitutionAnalyzer::RestitutionAnalyzer( size_t n ) : samples( n ), bin( binBeats ) {
+    restart();
+}
+
+RestitutionAnalyzer::~RestitutionAnalyzer( void ) { }
+
+void RestitutionAnalyzer::restart( void ) {
+    lock_guard<mutex> lock( processMutex );
+    samples.clear();
+    binStep = -1;
+    binCount = 0;
+    workerPoints.clear();
+    fittedPoints = 0;
+    workerFit = RestitutionFit();
+    workerFit.valid = false;
+
+    lock_guard<mutex> dataLock( dataMutex );
+    points.clear();
+    currentFit = workerFit;
+}
+
+void RestitutionAnalyzer::results( vector<RestitutionPoint> &p, RestitutionFit &f ) {
+    lock_guard<mutex> lock( dataMutex );
+    p = points;
+    f = currentFit;
+}
+
+void RestitutionAnalyzer::process( void ) {
+    lock_guard<mutex> lock( processMutex );
+    RestitutionSample s;
+    bool added = false;
+    while( samples.pop( s ) ) {
+        if( s.step != binStep ) { // Beats of a new step, or of the next run of the same step after a marker
+            binStep = s.step;
+            binCount = 0;
+        }
+
+        if( !s.end ) {
+            if( s.complete && s.DI >= 0 )
+                bin[binCount++ % binBeats] = s;
+            continue;
+        }
+
+        if( binCount > 0 ) {
+            RestitutionPoint p = { s.step, s.BCL, 0, 0, min( binCount, (int)binBeats ) };
+            for( int i = 0; i < p.beats; i++ ) {
+                p.DI += bin[i].DI / p.beats;
+                p.APD += bin[i].APD / p.beats;
+            }
+            workerPoints.push_back( p );
+            added = true;
+        }
+        binStep = -1; // A repeated step starts a new bin
+        binCount = 0;
+    }
+
+    if( !added ) return ;
+    if( workerPoints.size() >= (size_t)minPoints && workerPoints.size() != fittedPoints )
+        fit();
+
+    lock_guard<mutex> dataLock( dataMutex );
+    points = workerPoints;
+    currentFit = workerFit;
+}
+
+void RestitutionAnalyzer::fit( void ) {
+    const size_t n = workerPoints.size();
+    fittedPoints = n; // Not retried until a new point arrives, even if this fit fails
+    double minDI = workerPoints[0].DI, maxDI = minDI, minAPD = workerPoints[0].APD, maxAPD = minAPD;
+    for( size_t i = 1; i < n; i++ ) {
+        minDI = min( minDI, workerPoints[i].DI );
+        maxDI = max( maxDI, workerPoints[i].DI );
+        minAPD = min( minAPD, workerPoints[i].APD );
+        maxAPD = max( maxAPD, workerPoints[i].APD );
+    }
+
+    // Previous fit is the starting point, otherwise a curve through the range of the points
+    double start[3];
+    if( workerFit.valid ) {
+        start[0] = workerFit.APDmax;
+        start[1] = workerFit.A;
+        start[2] = workerFit.tau;
+    }
+    else {
+        start[2] = max( ( maxDI - minDI ) / 3, 1.0 );
+        start[0] = maxAPD;
+        start[1] = max( maxAPD - minAPD, 1.0 ) * exp( minDI / start[2] );
+    }
+
+    FitData data = { &workerPoints };
+    gsl_multifit_function_fdf f;
+    f.f = residuals;
+    f.df = jacobian;
+    f.fdf = residualsJacobian;
+    f.n = n;
+    f.p = 3;
+    f.params = &data;
+
+    gsl_multifit_fdfsolver *solver = gsl_multifit_fdfsolver_alloc( gsl_multifit_fdfsolver_lmsder, n, 3 );
+    if( !solver ) return ; // With the error handler off, failures come back as NULL or a status
+    gsl_vector_view x = gsl_vector_view_array( start, 3 );
+    int status = gsl_multifit_fdfsolver_set( solver, &f, &x.vector ), iteration = 0;
+    if( status ) {
+        gsl_multifit_fdfsolver_free( solver );
+        return ;
+    }
+
+    do {
+        iteration++;
+        status = gsl_multifit_fdfsolver_iterate( solver );
+        if( status ) break;
+        status = gsl_multifit_test_delta( solver->dx, solver->x, 0, fitTolerance );
+    } while( status == GSL_CONTINUE && iteration < maxIterations );
+
+    double APDmax = gsl_vector_get( solver->x, 0 );
+    double A = gsl_vector_get( solver->x, 1 );
+    double tau = gsl_vector_get( solver->x, 2 );
+    double sumSquares = 0;
+    for( size_t i = 0; i < n; i++ )
+        sumSquares += gsl_vector_get( solver->f, i ) * gsl_vector_get( solver->f, i );
+    gsl_multifit_fdfsolver_free( solver );
+
+    bool converged = ( status == GSL_SUCCESS || status == GSL_ENOPROG ); // No progress is reported at an exact minimum
+    if( !converged || !( tau > 0 ) || !isfinite( APDmax ) || !isfinite( A ) ) // Last good fit is kept
+        return ;
+
+    workerFit.valid = true;
+    workerFit.points = n;
+    workerFit.APDmax = APDmax;
+    workerFit.A = A;
+    workerFit.tau = tau;
+    workerFit.minDI = minDI;
+    workerFit.maxSlope = A / tau * exp( -minDI / tau );
+    workerFit.rms = sqrt( sumSquares / n );
+    workerFit.iterations = iteration;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Restitution.h
+ * APD restitution: diastolic intervals, steady state points per step
+ * and a live mono-exponential fit of the restitution curve
+ *
+ *** NOTES
+ *
+ * The diastolic interval of a beat is the time from the repolarization
+ * of the previous beat to the stimulus of this one, so it is only known
+ * if the previous beat was complete. The RT thread pushes every beat
+ * (step, DI, APD) and a marker at the end of every pace or average step
+ * into a lock-free ring. The worker keeps the last binBeats complete
+ * beats of the running step, and at the marker averages them into one
+ * restitution point for the step. A BCL ramp gives one point per BCL at
+ * steady state. An S1-S2 protocol gives the S2 point from its single
+ * beat step. Steps without a complete beat give no point.
+ *
+ * Once at least minPoints points exist, the curve
+ *   APD( DI ) = APDmax - A * exp( -DI / tau )
+ * is fitted with GSL's Levenberg-Marquardt solver (lmsder). A fit only
+ * runs when new points have arrived, starting from the previous fit, so
+ * every refit converges in a few iterations. The slope of the curve
+ *   dAPD/dDI = A / tau * exp( -DI / tau )
+ * is largest at the shortest DI, which is reported as the maximum slope
+ * over the measured range (slope > 1 predicts alternans).
+ *
+ * GSL's error handler is global to the process, so the worker never
+ * touches it: the host turns it off once, on the GUI thread, before any
+ * fit can run (gsl_set_error_handler_off()). Solver errors then come
+ * back as status codes and the last good fit is kept, instead of GSL
+ * aborting RTXI.
+ *
+ * Units are ms.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_RESTITUTION_H
+#define APC_RESTITUTION_H
+
+#include "APC_RingBuffer.h"
+#include "APC_WorkerTask.h"
+
+#include <mutex>
+#include <vector>
+
+struct RestitutionPoint {
+    int step; // Protocol step the point was taken from
+    double BCL; // ms
+    double DI; // Mean over the last beats of the step (ms)
+    double APD;
+    int beats; // Beats averaged
+};
+
+struct RestitutionFit {
+    bool valid; // False until enough points have been fitted
+    int points; // Points used by the fit
+    double APDmax; // ms
+    double A; // ms
+    double tau; // ms
+    double maxSlope; // Slope at minDI
+    double minDI; // ms
+    double rms; // Residual (ms)
+    int iterations;
+};
+
+// Beat or end of step as seen by the RT thread
+struct RestitutionSample {
+    int step; // -1 outside of a protocol
+    bool end; // End of step marker, DI and APD unused
+    bool complete; // APD valid
+    double BCL; // Step BCL, end marker only
+    double DI; // Negative if unknown
+    double APD;
+};
+
+class RestitutionAnalyzer : public WorkerTask {
+public:
+    static const int binBeats = 5; // Last complete beats of a step averaged into its point
+    static const int minPoints = 4; // Three parameters and at least one degree of freedom
+
+    RestitutionAnalyzer( size_t ); // Ring size (samples)
+    ~RestitutionAnalyzer( void );
+
+    // GUI thread
+    void restart( void ); // Discards points and fit, only called while the RT thread is inactive
+    void results( std::vector<RestitutionPoint> &, RestitutionFit & );
+
+    // RT thread
+    void addBeat( int step, double DI, double APD, bool complete ) {
+        RestitutionSample s = { step, false, complete, 0, DI, APD };
+        samples.push( s ); // Only the steady state beats matter, a dropped beat is not counted
+    }
+    bool endStep( int step, double BCL ) { // False if the marker was dropped
+        RestitutionSample s = { step, true, false, BCL, 0, 0 };
+        return samples.push( s );
+    }
+
+    // Worker thread
+    void process( void );
+
+private:
+    void fit( void ); // processMutex held
+
+    RingBuffer<RestitutionSample> samples;
+    std::mutex processMutex; // Keeps restart() from racing the worker, never taken by the RT thread
+    std::mutex dataMutex; // Worker and GUI thread
+
+    // Worker side
+    int binStep;
+    std::vector<RestitutionSample> bin; // Last binBeats complete beats of binStep, circular
+    int binCount;
+    std::vector<RestitutionPoint> workerPoints;
+    size_t fittedPoints; // Points the last fit was run on
+    RestitutionFit workerFit;
+
+    // Read by the GUI thread under dataMutex
+    std::vector<RestitutionPoint> points;
+    RestitutionFit currentFit;
+};
+
+#endif // APC_RESTITUTION_H
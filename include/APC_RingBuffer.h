@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_RingBuffer.h
+ * Lock-free single producer/single consumer ring buffer, used to move
+ * data out of the RT thread without locking or allocating
+ *
+ *** NOTES
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_RINGBUFFER_H
+#define APC_RINGBUFFER_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+template<typename T>
+class RingBuffer {
+public:
+    // Capacity is rounded up to a power of two, storage is allocated once here
+    RingBuffer( size_t capacity ) : head(0), tail(0) {
+        size_t size = 2;
+        while( size < capacity ) size <<= 1;
+        buffer.resize( size );
+        mask = size - 1;
+    }
+
+    // Producer side, returns false if the buffer is full (item is dropped)
+    bool push( const T &item ) {
+        size_t h = head.load( std::memory_order_relaxed );
+        if( h - tail.load( std::memory_order_acquire ) > mask )
+            return false;
+        buffer[h & mask] = item;
+        head.store( h + 1, std::memory_order_release );
+        return true;
+    }
+
+    // Consumer side, returns false if the buffer is empty
+    bool pop( T &item ) {
+        size_t t = tail.load( std::memory_order_relaxed );
+        if( t == head.load( std::memory_order_acquire ) )
+            return false;
+        item = buffer[t & mask];
+        tail.store( t + 1, std::memory_order_release );
+        return true;
+    }
+
+    // Consumer side, drops everything currently queued
+    void clear( void ) {
+        tail.store( head.load( std::memory_order_acquire ), std::memory_order_release );
+    }
+
+    size_t capacity( void ) const { return mask + 1; }
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    std::atomic<size_t> head; // Written by producer only
+    std::atomic<size_t> tail; // Written by consumer only
+};
+
+#endif // APC_RINGBUFFER_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_StimControl.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_StimControl.h"
+
+StimulusController::StimulusController( double up, double back, int beats, double max ) :
+    enabled( false ), stepUp( up ), backOff( back ), captureBeats( beats ), maxGain( max ) {
+    reset();
+}
+
+StimulusController::~StimulusController( void ) { }
+
+void StimulusController::reset( void ) {
+    currentGain = 1;
+    capturedRun = 0;
+}
+
+void StimulusController::beatResult( bool captured ) {
+    if( !enabled ) return ;
+
+    if( !captured ) {
+        currentGain *= 1 + stepUp;
+        if( currentGain > maxGain ) currentGain = maxGain;
+        capturedRun = 0;
+    }
+    else if( ++capturedRun >= captureBeats ) {
+        currentGain -= backOff * ( currentGain - 1 );
+        capturedRun = 0;
+    }
+}
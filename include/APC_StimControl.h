@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_StimControl.h
+ * Adaptive stimulus amplitude driven by per-beat capture verification
+ *
+ *** NOTES
+ *
+ * The controller keeps a gain applied on top of the configured stimulus
+ * magnitude, which is threshold x 1.5 after a threshold search. A beat
+ * that does not capture raises the gain by stepUp for the next beat.
+ * Every captureBeats consecutive captured beats the gain backs off by
+ * the fraction backOff of its distance to 1, so the stimulus settles
+ * back towards the configured magnitude while capture holds. Updates
+ * happen once per beat on the RT thread and take constant time.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_STIMCONTROL_H
+#define APC_STIMCONTROL_H
+
+class StimulusController {
+public:
+    StimulusController( double, double, int, double ); // Step up fraction, back off fraction, beats before backing off, maximum gain
+    ~StimulusController( void );
+
+    void setEnabled( bool e ) { enabled = e; }
+    bool isEnabled( void ) const { return enabled; }
+    void reset( void ); // Gain back to 1, called when a run starts
+    void beatResult( bool ); // Capture result of the beat that just ended, updates gain for the next beat
+    double gain( void ) const { return enabled ? currentGain : 1; }
+
+private:
+    bool enabled;
+    double stepUp;
+    double backOff;
+    int captureBeats;
+    double maxGain;
+    double currentGain;
+    int capturedRun; // Consecutive captured beats since the last change
+};
+
+#endif // APC_STIMCONTROL_H
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_StreamDigest.h
+ * Running digest of the per-tick output and state streams, used to
+ * check that two runs of a protocol behave identically
+ *
+ *** NOTES
+ *
+ * Every value is hashed by its bit pattern (64 bit FNV-1a), so two runs
+ * only share a digest if every output, digital output and state sample
+ * was bit for bit the same on every tick. With a recorded Vm replayed
+ * as input the run is deterministic, and the digest of a known-good
+ * build is the golden value for step timing, zero-length steps, trial
+ * restarts and the digital output pulses alike.
+ *
+ * The RT thread adds values and publishes the digest, the tick count
+ * and the time spent in execute() once per tick; the GUI thread reads
+ * the published values only.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_STREAMDIGEST_H
+#define APC_STREAMDIGEST_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+class StreamDigest {
+public:
+    StreamDigest( void ) { reset(); }
+
+    // Only while the RT thread is not adding
+    void reset( void ) {
+        hash = offsetBasis;
+        publishedHash.store( hash );
+        publishedTicks.store( 0 );
+        publishedTime.store( 0 );
+        tickCount = 0;
+        busyTime = 0;
+    }
+
+    // RT thread
+    void add( double v ) {
+        uint64_t bits;
+        memcpy( &bits, &v, sizeof(bits) );
+        add( bits );
+    }
+    void add( uint64_t bits ) {
+        for( int i = 0; i < 8; i++ ) {
+            hash ^= ( bits >> ( 8 * i ) ) & 0xff;
+            hash *= prime;
+        }
+    }
+    void endTick( int64_t ns ) { // Time spent on this tick
+        tickCount++;
+        busyTime += ns;
+        publishedHash.store( hash, std::memory_order_relaxed );
+        publishedTicks.store( tickCount, std::memory_order_relaxed );
+        publishedTime.store( busyTime, std::memory_order_relaxed );
+    }
+
+    // GUI thread
+    uint64_t value( void ) const { return publishedHash.load( std::memory_order_relaxed ); }
+    int64_t ticks( void ) const { return publishedTicks.load( std::memory_order_relaxed ); }
+    double throughput( void ) const { // Ticks per second of execute() time, 0 before the first tick
+        int64_t ns = publishedTime.load( std::memory_order_relaxed );
+        return ns > 0 ? ticks() * 1e9 / ns : 0;
+    }
+
+private:
+    static const uint64_t offsetBasis = 14695981039346656037ULL;
+    static const uint64_t prime = 1099511628211ULL;
+
+    uint64_t hash;
+    int64_t tickCount;
+    int64_t busyTime; // ns
+    std::atomic<uint64_t> publishedHash;
+    std::atomic<int64_t> publishedTicks;
+    std::atomic<int64_t> publishedTime;
+};
+
+#endif // APC_STREAMDIGEST_H
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Sweeps.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Sweeps.h"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+    struct ChargeSums {
+        double net, inward, outward, min, max;
+    };
+
+    // out = in * k, returns the sum of out
+    double scaleSum( const double *in, double k, double *out, int n ) {
+        int i = 0;
+        double sum = 0;
+#ifdef __SSE2__
+        __m128d vk = _mm_set1_pd( k );
+        __m128d vsum = _mm_setzero_pd();
+        for( ; i + 2 <= n; i += 2 ) {
+            __m128d v = _mm_mul_pd( _mm_loadu_pd( in + i ), vk );
+            _mm_storeu_pd( out + i, v );
+            vsum = _mm_add_pd( vsum, v );
+        }
+        double lanes[2];
+        _mm_storeu_pd( lanes, vsum );
+        sum = lanes[0] + lanes[1];
+#endif
+        for( ; i < n; i++ ) {
+            out[i] = in[i] * k;
+            sum += out[i];
+        }
+        return sum;
+    }
+
+    // out = a - b, with the sums of its negative and positive parts and its range
+    ChargeSums subtractSum( const double *a, const double *b, double *out, int n ) {
+        ChargeSums s = { 0, 0, 0, numeric_limits<double>::max(), -numeric_limits<double>::max() };
+        int i = 0;
+#ifdef __SSE2__
+        __m128d zero = _mm_setzero_pd();
+        __m128d neg = zero, pos = zero;
+        __m128d lo = _mm_set1_pd( s.min ), hi = _mm_set1_pd( s.max );
+        for( ; i + 2 <= n; i += 2 ) {
+            __m128d d = _mm_sub_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) );
+            _mm_storeu_pd( out + i, d );
+            neg = _mm_add_pd( neg, _mm_min_pd( d, zero ) );
+            pos = _mm_add_pd( pos, _mm_max_pd( d, zero ) );
+            lo = _mm_min_pd( lo, d );
+            hi = _mm_max_pd( hi, d );
+        }
+        double lanes[2];
+        _mm_storeu_pd( lanes, neg ); s.inward = lanes[0] + lanes[1];
+        _mm_storeu_pd( lanes, pos ); s.outward = lanes[0] + lanes[1];
+        _mm_storeu_pd( lanes, lo ); s.min = std::min( lanes[0], lanes[1] );
+        _mm_storeu_pd( lanes, hi ); s.max = std::max( lanes[0], lanes[1] );
+#endif
+        for( ; i < n; i++ ) {
+            double d = a[i] - b[i];
+            out[i] = d;
+            if( d < 0 ) s.inward += d;
+            else s.outward += d;
+            s.min = std::min( s.min, d );
+            s.max = std::max( s.max, d );
+        }
+        s.net = s.inward + s.outward;
+        return s;
+    }
+}
+
+SweepStore::SweepStore( int m ) :
+    state( m ), droppedSweeps( 0 ), maxSweeps( m ), numSweeps( 0 ), capacity( 0 ), period( 1 ),
+    active( -1 ), activeBeats( 0 ), activeLength( 0 ),
+    accumulator( m ), capturedBeats( m, 0 ), capturedLength( m, 0 ), capturedReference( m, -1 ),
+    meanData( m ), differenceData( m ), meanReference( m, -1 ) {
+    for( int s = 0; s < maxSweeps; s++ )
+        state[s].store( EMPTY );
+}
+
+SweepStore::~SweepStore( void ) { }
+
+void SweepStore::restart( int n, int length, double p ) {
+    lock_guard<mutex> lock( dataMutex );
+    numSweeps = n < maxSweeps ? n : maxSweeps;
+    capacity = length;
+    period = p;
+    active = -1;
+    droppedSweeps.store( 0 );
+    resultLog.clear();
+    for( int s = 0; s < maxSweeps; s++ ) {
+        accumulator[s].assign( s < numSweeps ? capacity : 0, 0 );
+        meanData[s].clear();
+        differenceData[s].clear();
+        meanReference[s] = -1;
+        state[s].store( EMPTY, memory_order_release );
+    }
+}
+
+bool SweepStore::beginSweep( int sweep, int reference ) {
+    active = -1;
+    if( sweep < 0 || sweep >= numSweeps )
+        return false;
+
+    int s = state[sweep].load( memory_order_acquire );
+    if( s == CAPTURED ) { // Same sweep recorded twice in a row before the worker got to it
+        droppedSweeps.fetch_add( 1, memory_order_relaxed );
+        return false;
+    }
+    state[sweep].store( RECORDING, memory_order_release );
+    capturedReference[sweep] = reference;
+    active = sweep;
+    activeBeats = 0;
+    activeLength = 0;
+    return true;
+}
+
+void SweepStore::endSweep( void ) {
+    if( active < 0 ) return ;
+    capturedBeats[active] = activeBeats;
+    capturedLength[active] = activeLength;
+    state[active].store( CAPTURED, memory_order_release ); // Accumulator belongs to the worker from now on
+    active = -1;
+}
+
+void SweepStore::process( void ) {
+    lock_guard<mutex> lock( dataMutex );
+
+    for( int s = 0; s < numSweeps; s++ ) {
+        if( state[s].load( memory_order_acquire ) != CAPTURED )
+            continue;
+
+        int beats = capturedBeats[s];
+        int n = capturedLength[s];
+        if( beats == 0 ) { // Step was stopped before its first beat, previous mean is kept
+            state[s].store( meanData[s].empty() ? EMPTY : READY, memory_order_release );
+            continue;
+        }
+
+        meanData[s].resize( n );
+        double sum = scaleSum( &accumulator[s][0], 1.0 / beats, &meanData[s][0], n );
+        meanReference[s] = capturedReference[s];
+        state[s].store( READY, memory_order_release ); // Accumulator goes back to the RT thread
+
+        SweepResult result;
+        result.sweep = s;
+        result.reference = meanReference[s];
+        result.beats = beats;
+        result.length = n;
+        result.charge = sum * period * 1e-3; // pA * ms is fC
+        result.differenceCharge = result.inwardCharge = result.outwardCharge = 0;
+        result.peakInward = result.peakOutward = 0;
+        resultLog.push_back( result );
+
+        // Difference of this sweep, and of sweeps referencing it that were recorded first
+        updateDifference( s );
+        for( int t = 0; t < numSweeps; t++ )
+            if( t != s && meanReference[t] == s && !meanData[t].empty() )
+                updateDifference( t );
+    }
+}
+
+// Recomputes the difference current of sweep s and fills in its latest result
+void SweepStore::updateDifference( int s ) {
+    int r = meanReference[s];
+    if( r < 0 || meanData[r].empty() ) return ;
+
+    int n = std::min( meanData[s].size(), meanData[r].size() );
+    differenceData[s].resize( n );
+    ChargeSums sums = subtractSum( &meanData[r][0], &meanData[s][0], &differenceData[s][0], n );
+
+    for( int i = resultLog.size() - 1; i >= 0; i-- ) {
+        SweepResult &result = resultLog[i];
+        if( result.sweep != s ) continue;
+        result.differenceCharge = sums.net * period * 1e-3;
+        result.inwardCharge = sums.inward * period * 1e-3;
+        result.outwardCharge = sums.outward * period * 1e-3;
+        result.peakInward = n > 0 ? std::min( sums.min, 0.0 ) : 0;
+        result.peakOutward = n > 0 ? std::max( sums.max, 0.0 ) : 0;
+        break;
+    }
+}
+
+void SweepStore::results( vector<SweepResult> &out ) {
+    lock_guard<mutex> lock( dataMutex );
+    out = resultLog;
+}
+
+bool SweepStore::mean( int s, vector<double> &out ) {
+    lock_guard<mutex> lock( dataMutex );
+    if( s < 0 || s >= numSweeps || meanData[s].empty() ) return false;
+    out = meanData[s];
+    return true;
+}
+
+bool SweepStore::difference( int s, vector<double> &out ) {
+    lock_guard<mutex> lock( dataMutex );
+    if( s < 0 || s >= numSweeps || differenceData[s].empty() ) return false;
+    out = differenceData[s];
+    return true;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Sweeps.h
+ * Averaged AP clamp current sweeps, difference currents and charge
+ * integrals
+ *
+ *** NOTES
+ *
+ * Every AP clamp step with a sweep name averages its measured current
+ * over the beats of the step into that sweep (e.g. "control", "drug").
+ * A step with a reference sweep also gets the difference current
+ *   Idiff = Ireference - Isweep
+ * which for reference "control" and sweep "drug" is the drug-sensitive
+ * current. Sweep names are resolved to numbers by Protocol::compile().
+ *
+ * The RT thread sums the current of each beat into the sweep's
+ * accumulator, preallocated by restart(). At the end of the step the
+ * accumulator is handed to the worker thread, which computes the mean,
+ * the difference current against the reference (once both sweeps
+ * exist, in either order) and the charges, and hands the accumulator
+ * back. Results can be read by the GUI thread as soon as the worker has
+ * run, a few ms after the step. The sample loops use SSE2 when the
+ * compiler targets it and plain loops otherwise.
+ *
+ * Currents are in pA, charges in pC (integral over one beat).
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_SWEEPS_H
+#define APC_SWEEPS_H
+
+#include "APC_WorkerTask.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+struct SweepResult {
+    int sweep;
+    int reference; // -1 if the sweep has no reference, difference fields are 0
+    int beats; // Beats averaged into the sweep
+    int length; // Samples per beat
+    double charge; // Net charge of the averaged current (pC)
+    double differenceCharge; // Net charge of the difference current (pC)
+    double inwardCharge; // Charge of the negative part of the difference current (pC)
+    double outwardCharge; // Charge of the positive part of the difference current (pC)
+    double peakInward; // Most negative difference current (pA)
+    double peakOutward; // Most positive difference current (pA)
+};
+
+class SweepStore : public WorkerTask {
+public:
+    enum { EMPTY, RECORDING, CAPTURED, READY }; // RECORDING: RT owns accumulator, CAPTURED: worker owns it, READY: mean is available
+
+    SweepStore( int ); // Maximum number of sweeps
+    ~SweepStore( void );
+
+    void restart( int, int, double ); // Sweeps, samples per beat, period (ms), allocates, only called while RT thread is inactive
+    int dropped( void ) const { return droppedSweeps.load( std::memory_order_relaxed ); }
+
+    // RT thread
+    bool beginSweep( int, int ); // Sweep and reference sweep (-1 for none), false if the worker still owns the sweep
+    void add( int offset, double value ) { // Ticks since the start of the beat and current (pA)
+        if( active < 0 || offset < 0 || offset >= capacity ) return ;
+        if( offset == 0 ) activeBeats++;
+        double *sum = &accumulator[active][0];
+        if( activeBeats <= 1 ) sum[offset] = value; // First beat overwrites, so the accumulator is never cleared in the RT thread
+        else sum[offset] += value;
+        if( offset >= activeLength ) activeLength = offset + 1;
+    }
+    void endSweep( void );
+
+    // Worker thread
+    void process( void );
+
+    // GUI thread
+    void results( std::vector<SweepResult> & ); // Sweeps finished so far, in order of completion
+    bool mean( int, std::vector<double> & ); // Averaged current of a sweep, false if not recorded yet
+    bool difference( int, std::vector<double> & ); // Difference current of a sweep, false if not available yet
+    double samplePeriod( void ) const { return period; }
+
+private:
+    void updateDifference( int ); // Worker thread, dataMutex held
+
+    std::mutex dataMutex; // Worker and GUI thread, never taken by the RT thread
+    std::vector< std::atomic<int> > state;
+    std::atomic<int> droppedSweeps;
+    int maxSweeps;
+    int numSweeps;
+    int capacity; // Samples per accumulator
+    double period;
+
+    // RT side
+    int active; // Sweep being recorded, -1 if none
+    int activeBeats;
+    int activeLength;
+
+    // Handed over with the accumulator
+    std::vector< std::vector<double> > accumulator;
+    std::vector<int> capturedBeats;
+    std::vector<int> capturedLength;
+    std::vector<int> capturedReference;
+
+    // Worker side, read by the GUI thread under dataMutex
+    std::vector< std::vector<double> > meanData;
+    std::vector< std::vector<double> > differenceData;
+    std::vector<int> meanReference;
+    std::vector<SweepResult> resultLog;
+};
+
+#endif // APC_SWEEPS_H
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TickProfile.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_TickProfile.h"
+
+using namespace std;
+
+namespace {
+    // Relaxed read-modify-write, the RT thread is the only writer
+    inline void increment( atomic<int64_t> &counter, int64_t v ) {
+        counter.store( counter.load( memory_order_relaxed ) + v, memory_order_relaxed );
+    }
+}
+
+TickProfile::TickProfile( int n ) : resetPending( false ) {
+    for( int i = 0; i < n; i++ )
+        buckets.push_back( new Bucket() );
+    clear();
+}
+
+TickProfile::~TickProfile( void ) {
+    for( size_t i = 0; i < buckets.size(); i++ )
+        delete buckets[i];
+}
+
+void TickProfile::add( int b, int64_t ns ) {
+    if( resetPending.load( memory_order_relaxed ) ) clear();
+    if( b < 0 || b >= (int)buckets.size() ) return ;
+
+    Bucket *bucket = buckets[b];
+    if( ns < 0 ) ns = 0;
+    increment( bucket->ticks, 1 );
+    increment( bucket->sum, ns );
+    if( ns < bucket->min.load( memory_order_relaxed ) ) bucket->min.store( ns, memory_order_relaxed );
+    if( ns > bucket->max.load( memory_order_relaxed ) ) bucket->max.store( ns, memory_order_relaxed );
+    increment( bucket->bins[bin( ns )], 1 );
+}
+
+void TickProfile::clear( void ) {
+    for( size_t i = 0; i < buckets.size(); i++ ) {
+        Bucket *bucket = buckets[i];
+        bucket->ticks.store( 0 );
+        bucket->sum.store( 0 );
+        bucket->min.store( INT64_MAX );
+        bucket->max.store( 0 );
+        for( int k = 0; k < numBins; k++ )
+            bucket->bins[k].store( 0 );
+    }
+    resetPending.store( false );
+}
+
+// Percentiles are the upper end of the bin they fall in
+TickProfileSummary TickProfile::summary( int b ) const {
+    TickProfileSummary s = { 0, 0, 0, 0, 0, 0, 0 };
+    if( b < 0 || b >= (int)buckets.size() ) return s;
+
+    const Bucket *bucket = buckets[b];
+    int64_t counts[numBins];
+    int64_t total = 0;
+    for( int k = 0; k < numBins; k++ )
+        total += counts[k] = bucket->bins[k].load( memory_order_relaxed );
+    if( total == 0 ) return s;
+
+    s.ticks = total;
+    s.mean = (double)bucket->sum.load( memory_order_relaxed ) / bucket->ticks.load( memory_order_relaxed );
+    s.min = bucket->min.load( memory_order_relaxed );
+    s.max = bucket->max.load( memory_order_relaxed );
+
+    const double fractions[] = { 0.5, 0.99, 0.999 };
+    int64_t *percentiles[] = { &s.median, &s.p99, &s.p999 };
+    for( int p = 0; p < 3; p++ ) {
+        int64_t rank = (int64_t)( fractions[p] * ( total - 1 ) ), seen = 0;
+        int k = 0;
+        while( k < numBins - 1 && ( seen += counts[k] ) <= rank )
+            k++;
+        *percentiles[p] = binValue( k ) < s.max ? binValue( k ) : s.max;
+    }
+    return s;
+}
+
+// Values below 8 ns have a bin each, above that 8 bins per octave
+int TickProfile::bin( int64_t v ) {
+    if( v < 8 ) return v;
+    int octave = 63 - __builtin_clzll( v ); // At least 3
+    int k = 8 * ( octave - 2 ) + ( ( v >> ( octave - 3 ) ) & 7 );
+    return k < numBins ? k : numBins - 1;
+}
+
+int64_t TickProfile::binValue( int k ) {
+    if( k < 8 ) return k;
+    int octave = k / 8 + 2;
+    return ( ( 8 + k % 8 + 1 ) << ( octave - 3 ) ) - 1;
+}
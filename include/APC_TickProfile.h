@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TickProfile.h
+ * Cost per tick of execute(), split by execute mode, protocol step
+ * type and APD detection state
+ *
+ *** NOTES
+ *
+ * Only built with APC_PROFILE defined (make PROFILE=1), a normal build
+ * does not read the clock for it. It times execute() on the rig, under
+ * RTXI; the engine alone is measured offline by make bench. Every tick adds its execute() time
+ * to the bucket of the mode it started in. Ticks in PACE and PROTOCOL
+ * are also added to the bucket of the APD state they started in, so
+ * the cost of each calculateAPD() state can be read next to the cost
+ * of each step type.
+ *
+ * Each bucket keeps a count, the sum, the minimum and maximum, and a
+ * log histogram with 8 bins per octave (12.5% resolution), so the
+ * median and the tail percentiles are known as well as the mean. The
+ * RT thread is the only writer, counters are relaxed atomics so the
+ * GUI thread can read them at any time. A reset is requested by the
+ * GUI thread and done by the RT thread at its next tick. The module
+ * also resets the profile when the thread period changes, so every
+ * profile is taken at a single sample rate.
+ *
+ * Bucket layout: the execute modes, the APD states, then one bucket
+ * per protocol step type (ticks of STEPINIT and END count as PROTOCOL).
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TICKPROFILE_H
+#define APC_TICKPROFILE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+struct TickProfileSummary {
+    int64_t ticks;
+    double mean; // ns
+    int64_t min;
+    int64_t median;
+    int64_t p99;
+    int64_t p999;
+    int64_t max;
+};
+
+class TickProfile {
+public:
+    enum bucket_t { IDLE, THRESHOLD, PACE, PROTOCOL, APDSTART, APDPEAK, APDDOWN, APDDONE, STEP }; // STEP + step type
+    static const int numBins = 8 * 38; // Up to 2^40 ns
+
+    TickProfile( int ); // Number of buckets
+    ~TickProfile( void );
+
+    int size( void ) const { return buckets.size(); }
+
+    // RT thread
+    void add( int, int64_t ); // Bucket and tick time (ns)
+    void clear( void );
+
+    // GUI thread
+    void requestReset( void ) { resetPending.store( true ); }
+    TickProfileSummary summary( int ) const;
+
+private:
+    struct Bucket {
+        std::atomic<int64_t> ticks;
+        std::atomic<int64_t> sum;
+        std::atomic<int64_t> min;
+        std::atomic<int64_t> max;
+        std::atomic<int64_t> bins[numBins];
+    };
+
+    static int bin( int64_t );
+    static int64_t binValue( int ); // Upper end of a bin
+
+    std::vector<Bucket *> buckets;
+    std::atomic<bool> resetPending;
+};
+
+#endif // APC_TICKPROFILE_H
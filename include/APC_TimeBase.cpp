@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TimeBase.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_TimeBase.h"
+
+#include <math.h>
+
+using namespace std;
+
+namespace {
+    const double tickTolerance = 1e-6; // Fraction of a tick
+}
+
+TimeBase::TimeBase( double p ) :
+    periodMs( p ), previousMs( p ), changes( 0 ), clock( 0 ), epochTick( 0 ), epochTime( 0 ) { }
+
+int TimeBase::ticks( double ms ) const {
+    return (int)floor( ms / periodMs + tickTolerance );
+}
+
+int64_t TimeBase::rescale( int64_t t ) const {
+    return (int64_t)floor( t * previousMs / periodMs + 0.5 );
+}
+
+// Distance to now is what matters to since() and time(), the stamp keeps it to within half a tick
+int64_t TimeBase::rescaleStamp( int64_t t ) const {
+    return clock - (int64_t)floor( ( clock - t ) * previousMs / periodMs + 0.5 );
+}
+
+bool TimeBase::setPeriod( double p ) {
+    if( !( p > 0 ) || p == periodMs ) return false;
+    epochTime = time( clock );
+    epochTick = clock;
+    previousMs = periodMs;
+    periodMs = p;
+    changes++;
+    return true;
+}
+
+void TimeBase::restartClock( int64_t t ) {
+    clock = t;
+    epochTick = 0;
+    epochTime = 0;
+}
+
+size_t resampledLength( size_t n, double inPeriod, double outPeriod ) {
+    if( n == 0 || !( inPeriod > 0 ) || !( outPeriod > 0 ) ) return 0;
+    return (size_t)floor( ( n - 1 ) * inPeriod / outPeriod + tickTolerance ) + 1; // Last sample is not extrapolated
+}
+
+void resampleTrace( const vector<double> &in, double inPeriod, vector<double> &out, double outPeriod ) {
+    out.resize( resampledLength( in.size(), inPeriod, outPeriod ) );
+    double ratio = outPeriod / inPeriod;
+    for( size_t k = 0; k < out.size(); k++ ) {
+        double x = k * ratio;
+        size_t i = (size_t)x;
+        if( i + 1 >= in.size() ) {
+            out[k] = in.back();
+            continue;
+        }
+        double f = x - i;
+        out[k] = in[i] + f * ( in[i + 1] - in[i] );
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TimeBase.h
+ * Thread period, the tick clock and the conversions between
+ * milliseconds and ticks
+ *
+ *** NOTES
+ *
+ * Durations are kept in ms everywhere, tick counts are derived from
+ * them with ticks() and cached by the module. When the RTXI period
+ * changes, setPeriod() keeps the previous period so tick counters in
+ * flight (time into the step, start of the beat) can be carried over
+ * with rescale(), and every cached count is derived again in one pass
+ * on the RT thread, between two ticks.
+ *
+ * The period RTXI reports is converted from ns, so ms / period may land
+ * just below a whole number (1000 / 0.09999999999999999). ticks() adds
+ * a small tolerance before truncating so such durations are not a tick
+ * short.
+ *
+ * The clock is a 64 bit tick count, advanced once per tick by the RT
+ * thread. Times are derived from it on demand instead of accumulating
+ * the period, which drifts by about one rounding error per tick and no
+ * longer resolves a tick after a few hours at 20 kHz. A period change
+ * starts a new epoch at the current tick, so time stays continuous.
+ * Only the current epoch is kept, so tick stamps taken before the change
+ * (start of the beat, of the AP) are carried over with rescaleStamp(),
+ * after which since() and time() of the stamp are right again. Tick
+ * counters kept next to the clock (time into the step, start of the
+ * beat) are 64 bit too, rescale() takes and returns them as such, since
+ * a pace run counts them from its start and passes 2^31 ticks in under
+ * 12 hours at 50 kHz.
+ *
+ * resampleTrace() converts a uniformly sampled trace to another period
+ * by linear interpolation, for traces recorded or loaded at a period
+ * other than the current one.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TIMEBASE_H
+#define APC_TIMEBASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TimeBase {
+public:
+    TimeBase( double = 1 ); // Period (ms)
+
+    double period( void ) const { return periodMs; }
+    double previousPeriod( void ) const { return previousMs; }
+    int generation( void ) const { return changes; } // Incremented on every period change
+
+    int ticks( double ) const; // Whole ticks in a duration (ms)
+    double ms( double t ) const { return t * periodMs; }
+    int64_t rescale( int64_t ) const; // Ticks at the previous period to ticks at the current one
+    int64_t rescaleStamp( int64_t ) const; // Clock tick stamped at the previous period to the tick as far from now in ms
+
+    bool setPeriod( double ); // False if the period is unchanged
+
+    // Clock, RT thread
+    void restartClock( int64_t ); // Tick the clock restarts at, time 0 is tick 0
+    void tick( void ) { clock++; }
+    int64_t now( void ) const { return clock; }
+    double time( void ) const { return time( clock ); } // ms
+    double time( int64_t t ) const { return epochTime + ( t - epochTick ) * periodMs; }
+    double since( int64_t t ) const { return ( clock - t ) * periodMs; } // ms from tick t to now
+
+private:
+    double periodMs;
+    double previousMs;
+    int changes;
+    int64_t clock;
+    int64_t epochTick; // Tick of the last period change
+    double epochTime; // Time of epochTick (ms)
+};
+
+size_t resampledLength( size_t, double, double ); // Samples, period of the samples and new period (ms)
+void resampleTrace( const std::vector<double> &, double, std::vector<double> &, double ); // Samples and their period, resampled trace and its period
+
+#endif // APC_TIMEBASE_H
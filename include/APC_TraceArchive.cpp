@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceArchive.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_TraceArchive.h"
+#include "APC_TraceCodec.h"
+
+#include <algorithm>
+#include <string.h>
+#include <utility>
+
+using namespace std;
+
+namespace {
+    const char traceMagic[4] = { 'A', 'P', 'C', 'T' };
+    const int traceVersion = 1;
+}
+
+bool writeTraceFile( const string &fileName, const vector<double> &data, int blockLength, double resolution,
+                     double period, string &error ) {
+    if( blockLength < 1 ) blockLength = data.size() > 0 ? data.size() : 1;
+    int blocks = ( data.size() + blockLength - 1 ) / blockLength;
+
+    // Blocks are coded first so the index can be written in front of them
+    TraceCodec codec( resolution );
+    vector<uint8_t> payload;
+    vector<TraceBlockEntry> index( blocks );
+    int64_t position = sizeof(TraceFileHeader) + blocks * sizeof(TraceBlockEntry);
+    for( int b = 0; b < blocks; b++ ) {
+        size_t start = payload.size();
+        int n = min<int64_t>( blockLength, data.size() - (int64_t)b * blockLength );
+        codec.encode( &data[(size_t)b * blockLength], n, payload );
+        index[b].position = position + start;
+        index[b].samples = n;
+        index[b].bytes = payload.size() - start;
+    }
+
+    TraceFileHeader header;
+    memcpy( header.magic, traceMagic, 4 );
+    header.version = traceVersion;
+    header.blocks = blocks;
+    header.blockLength = blockLength;
+    header.samples = data.size();
+    header.resolution = codec.resolution();
+    header.period = period;
+
+    FILE *file = fopen( fileName.c_str(), "wb" );
+    if( !file ) {
+        error = "Unable to create " + fileName;
+        return false;
+    }
+    bool ok = fwrite( &header, sizeof(header), 1, file ) == 1;
+    if( blocks > 0 )
+        ok = ok && fwrite( &index[0], sizeof(TraceBlockEntry), blocks, file ) == (size_t)blocks;
+    if( !payload.empty() )
+        ok = ok && fwrite( &payload[0], 1, payload.size(), file ) == payload.size();
+    ok = ( fclose( file ) == 0 ) && ok;
+    if( !ok ) error = "Unable to write " + fileName;
+    return ok;
+}
+
+TraceArchiver::TraceArchiver( void ) : pendingJobs( 0 ), failedJobs( 0 ) { }
+
+TraceArchiver::~TraceArchiver( void ) { }
+
+void TraceArchiver::save( const string &file, vector<double> data, int blockLength, double resolution, double period ) {
+    lock_guard<mutex> lock( queueMutex );
+    Job job;
+    job.file = file;
+    job.data.swap( data );
+    job.blockLength = blockLength;
+    job.resolution = resolution;
+    job.period = period;
+    jobs.push_back( std::move( job ) );
+    pendingJobs.fetch_add( 1, memory_order_release );
+}
+
+string TraceArchiver::lastError( void ) {
+    lock_guard<mutex> lock( queueMutex );
+    return error;
+}
+
+// Files are written without holding queueMutex, so saving never blocks the GUI thread
+void TraceArchiver::process( void ) {
+    for( ;; ) {
+        Job job;
+        {
+            lock_guard<mutex> lock( queueMutex );
+            if( jobs.empty() ) return ;
+            job = std::move( jobs.front() );
+            jobs.pop_front();
+        }
+
+        string message;
+        bool ok = writeTraceFile( job.file, job.data, job.blockLength, job.resolution, job.period, message );
+        {
+            lock_guard<mutex> lock( queueMutex );
+            if( !ok ) {
+                error = message;
+                failedJobs.fetch_add( 1, memory_order_relaxed );
+            }
+        }
+        pendingJobs.fetch_sub( 1, memory_order_release );
+    }
+}
+
+TraceFileReader::TraceFileReader( void ) : file( NULL ) {
+    memset( &fileHeader, 0, sizeof(fileHeader) );
+}
+
+TraceFileReader::~TraceFileReader( void ) {
+    close();
+}
+
+bool TraceFileReader::open( const string &fileName ) {
+    close();
+    file = fopen( fileName.c_str(), "rb" );
+    if( !file || fread( &fileHeader, sizeof(fileHeader), 1, file ) != 1
+        || memcmp( fileHeader.magic, traceMagic, 4 ) != 0 || fileHeader.version != traceVersion
+        || fileHeader.blocks < 0 ) {
+        close();
+        return false;
+    }
+
+    index.resize( fileHeader.blocks );
+    if( fileHeader.blocks > 0 &&
+        fread( &index[0], sizeof(TraceBlockEntry), fileHeader.blocks, file ) != (size_t)fileHeader.blocks ) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TraceFileReader::close( void ) {
+    if( file ) fclose( file );
+    file = NULL;
+    index.clear();
+}
+
+bool TraceFileReader::decodeBlock( int b, double *out ) {
+    const TraceBlockEntry &e = index[b];
+    buffer.resize( e.bytes );
+    if( fseek( file, e.position, SEEK_SET ) != 0 ) return false;
+    if( e.bytes > 0 && fread( &buffer[0], 1, e.bytes, file ) != (size_t)e.bytes ) return false;
+
+    TraceCodec codec( fileHeader.resolution );
+    return codec.decode( e.bytes > 0 ? &buffer[0] : NULL, e.bytes, e.samples, out );
+}
+
+bool TraceFileReader::readBlock( int b, vector<double> &data ) {
+    if( !file || b < 0 || b >= blocks() ) return false;
+    data.resize( index[b].samples );
+    return data.empty() || decodeBlock( b, &data[0] );
+}
+
+bool TraceFileReader::readAll( vector<double> &data ) {
+    if( !file ) return false;
+    data.resize( fileHeader.samples );
+    int64_t offset = 0;
+    for( int b = 0; b < blocks(); b++ ) {
+        if( offset + index[b].samples > (int64_t)data.size() || !decodeBlock( b, &data[offset] ) )
+            return false;
+        offset += index[b].samples;
+    }
+    return offset == (int64_t)data.size();
+}
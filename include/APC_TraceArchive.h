@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceArchive.h
+ * Compressed trace files for Vm recording slots, written on the worker
+ * thread and read back whole or one beat at a time
+ *
+ *** NOTES
+ *
+ * A trace is cut into blocks of one beat each (the last one may be
+ * shorter) and every block is coded on its own by TraceCodec. The file
+ * is a TraceFileHeader, the block index and the blocks, so any beat is
+ * decoded with one seek and without touching the others.
+ *
+ * Saving copies the slot and queues it, the worker encodes and writes
+ * the file. Loading is done by the caller, decoding runs at several
+ * hundred MB/s so it is not worth a round trip through the worker.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TRACEARCHIVE_H
+#define APC_TRACEARCHIVE_H
+
+#include "APC_WorkerTask.h"
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct TraceFileHeader {
+    char magic[4]; // "APCT"
+    int32_t version;
+    int32_t blocks;
+    int32_t blockLength; // Samples per block, except for the last one
+    int64_t samples;
+    double resolution; // mV
+    double period; // ms
+};
+
+struct TraceBlockEntry {
+    int64_t position; // Byte offset of the block in the file
+    int32_t samples;
+    int32_t bytes;
+};
+
+// Encodes and writes a trace file, error message returned by reference
+bool writeTraceFile( const std::string &, const std::vector<double> &, int, double, double, std::string & );
+
+class TraceArchiver : public WorkerTask {
+public:
+    TraceArchiver( void );
+    ~TraceArchiver( void );
+
+    // GUI thread
+    void save( const std::string &, std::vector<double>, int, double, double ); // File, trace, block length (samples), resolution (mV), period (ms)
+    int pending( void ) const { return pendingJobs.load( std::memory_order_acquire ); }
+    int failed( void ) const { return failedJobs.load( std::memory_order_relaxed ); }
+    std::string lastError( void );
+
+    // Worker thread
+    void process( void );
+
+private:
+    struct Job {
+        std::string file;
+        std::vector<double> data;
+        int blockLength;
+        double resolution;
+        double period;
+    };
+
+    std::mutex queueMutex; // Worker and GUI thread
+    std::deque<Job> jobs;
+    std::atomic<int> pendingJobs; // Queued or being written
+    std::atomic<int> failedJobs;
+    std::string error;
+};
+
+class TraceFileReader {
+public:
+    TraceFileReader( void );
+    ~TraceFileReader( void );
+
+    bool open( const std::string & ); // False if the file is missing or not a trace file
+    void close( void );
+    const TraceFileHeader &header( void ) const { return fileHeader; }
+    int blocks( void ) const { return index.size(); }
+    bool readBlock( int, std::vector<double> & );
+    bool readAll( std::vector<double> & );
+
+private:
+    bool decodeBlock( int, double * );
+
+    FILE *file;
+    TraceFileHeader fileHeader;
+    std::vector<TraceBlockEntry> index;
+    std::vector<uint8_t> buffer;
+};
+
+#endif // APC_TRACEARCHIVE_H
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceCodec.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_TraceCodec.h"
+
+#include <string.h>
+
+using namespace std;
+
+namespace {
+    class BitWriter {
+    public:
+        BitWriter( vector<uint8_t> &o ) : out( o ), bits( 0 ), count( 0 ) { }
+
+        void write( uint32_t value, int n ) { // n <= 32
+            bits |= (uint64_t)value << count;
+            count += n;
+            while( count >= 8 ) {
+                out.push_back( bits & 0xff );
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        void ones( int n ) {
+            while( n > 0 ) {
+                int m = n < 32 ? n : 32;
+                write( m == 32 ? 0xffffffffu : ( 1u << m ) - 1, m );
+                n -= m;
+            }
+        }
+        void flush( void ) {
+            if( count > 0 ) out.push_back( bits & 0xff );
+            bits = 0;
+            count = 0;
+        }
+
+    private:
+        vector<uint8_t> &out;
+        uint64_t bits;
+        int count;
+    };
+
+    class BitReader {
+    public:
+        BitReader( const uint8_t *i, size_t n ) : in( i ), end( i + n ), bits( 0 ), count( 0 ) { }
+
+        bool read( int n, uint32_t &value ) { // n <= 32
+            while( count < n ) {
+                if( in == end ) return false;
+                bits |= (uint64_t)*in++ << count;
+                count += 8;
+            }
+            value = n == 32 ? (uint32_t)bits : (uint32_t)( bits & ( ( 1u << n ) - 1 ) );
+            bits >>= n;
+            count -= n;
+            return true;
+        }
+        bool bit( uint32_t &value ) { return read( 1, value ); }
+
+    private:
+        const uint8_t *in;
+        const uint8_t *end;
+        uint64_t bits;
+        int count;
+    };
+
+    inline uint32_t zigzag( int32_t d ) { return ( (uint32_t)d << 1 ) ^ (uint32_t)( d >> 31 ); }
+    inline int32_t unzigzag( uint32_t u ) { return (int32_t)( u >> 1 ) ^ -(int32_t)( u & 1 ); }
+}
+
+TraceCodec::TraceCodec( double r ) : step( r > 0 ? r : 1 ) { }
+
+TraceCodec::~TraceCodec( void ) { }
+
+void TraceCodec::encodeQuantized( int n, vector<uint8_t> &out ) {
+    int32_t first = n > 0 ? quantized[0] : 0;
+    uint8_t header[5];
+    memcpy( header, &first, 4 );
+
+    // Parameter from the mean difference, 2^k is close to the mean
+    uint64_t sum = 0;
+    for( int i = 1; i < n; i++ )
+        sum += zigzag( quantized[i] - quantized[i-1] );
+    int k = 0;
+    while( k < 31 && ( (uint64_t)( n - 1 ) << ( k + 1 ) ) < sum )
+        k++;
+    header[4] = k;
+    out.insert( out.end(), header, header + 5 );
+
+    BitWriter writer( out );
+    for( int i = 1; i < n; i++ ) {
+        uint32_t u = zigzag( quantized[i] - quantized[i-1] );
+        uint32_t q = u >> k;
+        if( q >= (uint32_t)escapeLength ) { // Upstroke or artifact, cost is bounded
+            writer.ones( escapeLength );
+            writer.write( u, 32 );
+        }
+        else {
+            writer.ones( q );
+            writer.write( 0, 1 );
+            if( k > 0 ) writer.write( u & ( ( 1u << k ) - 1 ), k );
+        }
+    }
+    writer.flush();
+}
+
+bool TraceCodec::decodeQuantized( const uint8_t *in, size_t bytes, int n ) {
+    if( n == 0 ) return true;
+    if( bytes < 5 ) return false;
+
+    int32_t value;
+    memcpy( &value, in, 4 );
+    int k = in[4];
+    if( k > 31 ) return false;
+    quantized[0] = value;
+
+    BitReader reader( in + 5, bytes - 5 );
+    for( int i = 1; i < n; i++ ) {
+        uint32_t q = 0, b, u;
+        for( ;; ) {
+            if( !reader.bit( b ) ) return false;
+            if( !b ) break;
+            if( ++q == (uint32_t)escapeLength ) break;
+        }
+        if( q == (uint32_t)escapeLength ) {
+            if( !reader.read( 32, u ) ) return false;
+        }
+        else {
+            uint32_t low = 0;
+            if( k > 0 && !reader.read( k, low ) ) return false;
+            u = ( q << k ) | low;
+        }
+        value += unzigzag( u );
+        quantized[i] = value;
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceCodec.h
+ * Compression of traces in independently decodable blocks: quantization
+ * to a fixed resolution, first differences and Rice coding
+ *
+ *** NOTES
+ *
+ * Samples are rounded to multiples of the resolution, which should be
+ * at or below the converter step so nothing the converter resolved is
+ * lost. Decoding gives back the quantized values exactly, the error
+ * against the input is at most half a step. Vm traces sampled at 10 to
+ * 50 kHz change by a few steps per sample outside the upstroke, so the
+ * differences cost 3 to 6 bits instead of 64.
+ *
+ * Block layout (little endian host assumed, like the other files):
+ *   int32 first quantized sample
+ *   uint8 Rice parameter k
+ *   zigzag coded differences of the remaining samples, each as
+ *   q = u >> k ones, a zero and the k low bits of u; q >= escapeLength
+ *   is written as escapeLength ones followed by u in 32 bits
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TRACECODEC_H
+#define APC_TRACECODEC_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TraceCodec {
+public:
+    TraceCodec( double ); // Resolution, in the units of the samples
+    ~TraceCodec( void );
+
+    double resolution( void ) const { return step; }
+
+    // Appends one block of n samples to out
+    template<typename T> void encode( const T *in, int n, std::vector<uint8_t> &out ) {
+        quantized.resize( n );
+        for( int i = 0; i < n; i++ )
+            quantized[i] = quantize( in[i] );
+        encodeQuantized( n, out );
+    }
+
+    // Decodes one block of n samples, false if the block is shorter than its content
+    template<typename T> bool decode( const uint8_t *in, size_t bytes, int n, T *out ) {
+        quantized.resize( n );
+        if( !decodeQuantized( in, bytes, n ) ) return false;
+        for( int i = 0; i < n; i++ )
+            out[i] = quantized[i] * step;
+        return true;
+    }
+
+private:
+    static const int32_t maxQuantized = 1 << 30; // Differences always fit in 32 bits
+    static const int escapeLength = 24;
+
+    int32_t quantize( double x ) const {
+        double q = floor( x / step + 0.5 );
+        if( !( q > -maxQuantized ) ) return -maxQuantized; // Also catches NaN
+        if( q > maxQuantized ) return maxQuantized;
+        return (int32_t)q;
+    }
+    void encodeQuantized( int, std::vector<uint8_t> & );
+    bool decodeQuantized( const uint8_t *, size_t, int );
+
+    double step;
+    std::vector<int32_t> quantized; // Scratch, reused by every block
+};
+
+#endif // APC_TRACECODEC_H
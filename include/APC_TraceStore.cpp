@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceStore.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_TraceStore.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+    typedef TypedTraceSlot<double, TraceSlot::DOUBLE> DoubleTraceSlot;
+    typedef TypedTraceSlot<float, TraceSlot::FLOAT> FloatTraceSlot;
+    typedef TypedTraceSlot<int16_t, TraceSlot::INT16> Int16TraceSlot;
+}
+
+template<> void SampleCodec<float>::decode( const float *in, size_t n, double *out, double, double ) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for( ; i + 4 <= n; i += 4 ) {
+        __m128 v = _mm_loadu_ps( in + i );
+        _mm_storeu_pd( out + i, _mm_cvtps_pd( v ) );
+        _mm_storeu_pd( out + i + 2, _mm_cvtps_pd( _mm_movehl_ps( v, v ) ) );
+    }
+#endif
+    for( ; i < n; i++ )
+        out[i] = in[i];
+}
+
+void SampleCodec<int16_t>::decode( const int16_t *in, size_t n, double *out, double scale, double offset ) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128d vs = _mm_set1_pd( scale );
+    __m128d vo = _mm_set1_pd( offset );
+    for( ; i + 8 <= n; i += 8 ) {
+        __m128i s = _mm_loadu_si128( (const __m128i *)( in + i ) );
+        __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 ); // Sign extended to 32 bits
+        __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+        _mm_storeu_pd( out + i, _mm_add_pd( _mm_mul_pd( _mm_cvtepi32_pd( lo ), vs ), vo ) );
+        _mm_storeu_pd( out + i + 2, _mm_add_pd( _mm_mul_pd( _mm_cvtepi32_pd( _mm_srli_si128( lo, 8 ) ), vs ), vo ) );
+        _mm_storeu_pd( out + i + 4, _mm_add_pd( _mm_mul_pd( _mm_cvtepi32_pd( hi ), vs ), vo ) );
+        _mm_storeu_pd( out + i + 6, _mm_add_pd( _mm_mul_pd( _mm_cvtepi32_pd( _mm_srli_si128( hi, 8 ) ), vs ), vo ) );
+    }
+#endif
+    for( ; i < n; i++ )
+        out[i] = scale * in[i] + offset;
+}
+
+const char *TraceSlot::formatName( format_t f ) {
+    const char *names[] = { "double", "float", "int16" };
+    return ( f >= 0 && f < numFormats ) ? names[f] : "unknown";
+}
+
+TraceStore::TraceStore( int n ) {
+    for( int i = 0; i < n; i++ )
+        slots.push_back( new DoubleTraceSlot() );
+}
+
+TraceStore::~TraceStore( void ) {
+    for( size_t i = 0; i < slots.size(); i++ )
+        delete slots[i];
+}
+
+TraceSlot *TraceStore::create( TraceSlot::format_t f, double scale, double offset ) {
+    switch( f ) {
+    case TraceSlot::FLOAT: return new FloatTraceSlot();
+    case TraceSlot::INT16: return new Int16TraceSlot( scale > 0 ? scale : 1, offset );
+    default: return new DoubleTraceSlot();
+    }
+}
+
+void TraceStore::setFormat( int i, TraceSlot::format_t f, double scale, double offset ) {
+    TraceSlot *old = slots[i];
+    TraceSlot *slot = create( f, scale, offset );
+
+    vector<double> samples( old->size() );
+    old->read( 0, samples.size(), samples.empty() ? 0 : &samples[0] );
+    slot->resize( samples.size() );
+    slot->write( 0, samples.size(), samples.empty() ? 0 : &samples[0] );
+
+    slot->setPeriod( old->period() );
+    slots[i] = slot;
+    delete old;
+}
+
+bool TraceStore::resample( int i, double period ) {
+    TraceSlot *slot = slots[i];
+    if( slot->size() == 0 || !( slot->period() > 0 ) || slot->period() == period ) {
+        slot->setPeriod( period );
+        return false;
+    }
+
+    vector<double> samples( slot->size() ), resampled;
+    slot->read( 0, samples.size(), &samples[0] );
+    resampleTrace( samples, slot->period(), resampled, period );
+    slot->clear();
+    slot->resize( resampled.size() );
+    slot->write( 0, resampled.size(), &resampled[0] );
+    slot->setPeriod( period );
+    return true;
+}
+
+void TracePlayer::start( const TraceSlot *t, double period ) {
+    trace = t;
+    first = count = 0;
+    ratio = ( t->period() > 0 && t->period() != period ) ? period / t->period() : 1;
+    samples = ( ratio == 1 ) ? t->size() : resampledLength( t->size(), t->period(), period );
+}
+
+// Slot samples are converted in one bulk read, interpolated one by one only at a changed period
+void TracePlayer::fill( int offset ) {
+    first = offset;
+    count = 0;
+    if( !trace || offset < 0 || offset >= (int)samples ) return ;
+    count = samples - offset < (size_t)playbackBlock ? samples - offset : playbackBlock;
+    if( ratio == 1 ) {
+        trace->read( offset, count, buffer );
+        return ;
+    }
+    for( int k = 0; k < count; k++ ) {
+        double x = ( offset + k ) * ratio;
+        size_t i = (size_t)x;
+        if( i + 1 >= trace->size() )
+            buffer[k] = trace->at( trace->size() - 1 );
+        else
+            buffer[k] = trace->at( i ) + ( x - i ) * ( trace->at( i + 1 ) - trace->at( i ) );
+    }
+}
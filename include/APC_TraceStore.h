@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TraceStore.h
+ * Vm recording slots with a per-slot sample type, and the prefetching
+ * reader used for AP clamp playback
+ *
+ *** NOTES
+ *
+ * A slot stores double, float or int16 samples. int16 samples are
+ *   v = scale * s + offset
+ * rounded and saturated on write, 0.01 mV steps cover +-327 mV. A slot
+ * of 16 bit samples takes a quarter of the memory of a double slot, so
+ * long AP clamp commands stay cache and bandwidth friendly.
+ *
+ * Samples are always read and written as doubles. Bulk reads convert a
+ * whole run of samples at once (SSE2 when the compiler targets it), the
+ * RT thread plays AP clamp commands through TracePlayer, which refills
+ * a small buffer of converted samples once every playbackBlock ticks.
+ * Averages are summed in a separate double accumulator and written to
+ * the slot once the step is over, so the slot type never limits them.
+ *
+ * Each slot keeps the period its samples were taken at. A slot used at
+ * another period is resampled by resample() the next time a protocol
+ * starts, and TracePlayer interpolates on the fly if the period changes
+ * while the protocol is running.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TRACESTORE_H
+#define APC_TRACESTORE_H
+
+#include "APC_TimeBase.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TraceSlot {
+public:
+    enum format_t { DOUBLE, FLOAT, INT16 };
+    static const int numFormats = 3;
+    static const char *formatName( format_t );
+
+    virtual ~TraceSlot( void ) { }
+    virtual format_t format( void ) const = 0;
+    virtual size_t size( void ) const = 0;
+    virtual size_t bytes( void ) const = 0; // Memory held, including spare capacity
+    virtual void clear( void ) = 0;
+    virtual void reserve( size_t ) = 0;
+    virtual void resize( size_t ) = 0; // New samples are 0 V
+    virtual void push( double ) = 0; // Allocates only once the reserved capacity is used up
+    virtual double at( size_t ) const = 0;
+    virtual void read( size_t, size_t, double * ) const = 0; // First sample and number of samples, converted
+    virtual void write( size_t, size_t, const double * ) = 0;
+
+    double scale( void ) const { return sampleScale; }
+    double offset( void ) const { return sampleOffset; }
+    double period( void ) const { return samplePeriod; } // ms, 0 if unknown
+    void setPeriod( double p ) { samplePeriod = p; }
+
+protected:
+    TraceSlot( double s, double o ) : sampleScale( s ), sampleOffset( o ), samplePeriod( 0 ) { }
+    double sampleScale;
+    double sampleOffset;
+    double samplePeriod;
+};
+
+// Conversion between doubles and stored samples, bulk decode is specialized in the .cpp
+template<typename T> struct SampleCodec {
+    static T encode( double v, double, double ) { return v; }
+    static double decode( T s, double, double ) { return s; }
+    static void decode( const T *in, size_t n, double *out, double, double ) {
+        for( size_t i = 0; i < n; i++ ) out[i] = in[i];
+    }
+};
+
+template<> struct SampleCodec<int16_t> {
+    static int16_t encode( double v, double scale, double offset ) {
+        double s = floor( ( v - offset ) / scale + 0.5 );
+        if( !( s > -32768 ) ) return -32768; // Also catches NaN
+        if( s > 32767 ) return 32767;
+        return (int16_t)s;
+    }
+    static double decode( int16_t s, double scale, double offset ) { return scale * s + offset; }
+    static void decode( const int16_t *, size_t, double *, double, double );
+};
+
+template<> void SampleCodec<float>::decode( const float *, size_t, double *, double, double );
+
+template<typename T, TraceSlot::format_t F>
+class TypedTraceSlot : public TraceSlot {
+public:
+    TypedTraceSlot( double s = 1, double o = 0 ) : TraceSlot( s, o ) { }
+
+    format_t format( void ) const { return F; }
+    size_t size( void ) const { return data.size(); }
+    size_t bytes( void ) const { return data.capacity() * sizeof(T); }
+    void clear( void ) { data.clear(); }
+    void reserve( size_t n ) { data.reserve( n ); }
+    void resize( size_t n ) { data.resize( n, SampleCodec<T>::encode( 0, sampleScale, sampleOffset ) ); }
+    void push( double v ) { data.push_back( SampleCodec<T>::encode( v, sampleScale, sampleOffset ) ); }
+    double at( size_t i ) const { return SampleCodec<T>::decode( data.at( i ), sampleScale, sampleOffset ); }
+    void read( size_t first, size_t n, double *out ) const {
+        if( n > 0 ) SampleCodec<T>::decode( &data[first], n, out, sampleScale, sampleOffset );
+    }
+    void write( size_t first, size_t n, const double *in ) {
+        for( size_t i = 0; i < n; i++ )
+            data[first + i] = SampleCodec<T>::encode( in[i], sampleScale, sampleOffset );
+    }
+
+private:
+    std::vector<T> data;
+};
+
+// Fixed set of slots, addressed by the recordIdx of protocol steps
+class TraceStore {
+public:
+    TraceStore( int ); // Number of slots, all double
+    ~TraceStore( void );
+
+    int size( void ) const { return slots.size(); }
+    TraceSlot *slot( int i ) { return slots[i]; }
+    const TraceSlot *slot( int i ) const { return slots[i]; }
+    static TraceSlot *create( TraceSlot::format_t, double, double ); // Format, scale and offset (int16 only)
+    void setFormat( int, TraceSlot::format_t, double, double ); // Converts the slot, only while the RT thread is not using it
+    bool resample( int, double ); // Resamples the slot to a period (ms) if it was taken at another one, same restriction
+
+private:
+    std::vector<TraceSlot *> slots;
+};
+
+// AP clamp playback, converts playbackBlock samples at a time so the RT thread reads a plain double buffer
+class TracePlayer {
+public:
+    static const int playbackBlock = 256;
+
+    TracePlayer( void ) : trace( 0 ), ratio( 1 ), samples( 0 ), first( 0 ), count( 0 ) { }
+
+    void start( const TraceSlot *, double ); // Slot and playback period (ms)
+    size_t length( void ) const { return samples; } // Samples at the playback period
+    double sample( int offset ) { // 0 outside the trace
+        if( offset < first || offset >= first + count ) fill( offset );
+        return count > 0 ? buffer[offset - first] : 0;
+    }
+
+private:
+    void fill( int );
+
+    const TraceSlot *trace;
+    double ratio; // Slot samples per played sample, 1 unless the period changed since the slot was resampled
+    size_t samples;
+    int first;
+    int count;
+    double buffer[playbackBlock];
+};
+
+#endif // APC_TRACESTORE_H
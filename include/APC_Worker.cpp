@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Worker.cpp, v1.0
+ *
+ * Author: Francis A. Ortega (2015)
+ *
+ * Notes in header
+ *
+ ***/
+
+#include "APC_Worker.h"
+
+namespace {
+    const int dispatchLatency = 1; // ms, bounds the delay of tasks posted by the RT thread, which cannot wake a pool thread
+    const int maxIdleWait = 100; // ms, idle wait of threads other than the poller doubles up to this while the RT ring stays empty
+}
+
+WorkerPool::WorkerPool( int n, int i, size_t ring ) :
+    numTasks( 0 ), requests( ring ), dispatching( false ), nextService( 0 ), droppedPosts( 0 ), running( false ),
+    active( false ), polling( false ), interval( i ) {
+    if( n < 1 ) n = QThread::idealThreadCount() - 1; // One core is left to the GUI, RT has its own
+    if( n < 1 ) n = 1;
+    if( n > 4 ) n = 4;
+    for( int t = 0; t < maxTasks; t++ ) {
+        tasks[t] = NULL;
+        states[t].store( REMOVED );
+    }
+    for( int t = 0; t < n; t++ ) {
+        queues.push_back( new TaskQueue() );
+        pool.push_back( new PoolThread( this, t ) );
+    }
+}
+
+WorkerPool::~WorkerPool( void ) {
+    stop();
+    for( size_t t = 0; t < pool.size(); t++ ) {
+        delete pool[t];
+        delete queues[t];
+    }
+}
+
+int WorkerPool::addTask( WorkerTask *task ) {
+    QMutexLocker lock( &taskMutex );
+    int handle = numTasks.load();
+    if( handle >= maxTasks ) return -1;
+    tasks[handle] = task;
+    states[handle].store( IDLE, std::memory_order_release );
+    numTasks.store( handle + 1, std::memory_order_release );
+    return handle;
+}
+
+void WorkerPool::removeTask( WorkerTask *task ) {
+    QMutexLocker lock( &taskMutex );
+    for( int h = 0; h < numTasks.load(); h++ ) {
+        if( tasks[h] != task ) continue;
+        for( ;; ) { // A queued task is run once more before it can be removed
+            int state = IDLE;
+            if( states[h].compare_exchange_strong( state, REMOVED ) || state == REMOVED ) break;
+            QThread::yieldCurrentThread();
+        }
+    }
+}
+
+void WorkerPool::start( void ) {
+    if( running.exchange( true ) ) return ;
+    clock.start();
+    nextService = 0;
+    for( size_t t = 0; t < pool.size(); t++ )
+        pool[t]->start();
+}
+
+void WorkerPool::stop( void ) {
+    running = false;
+    wake.wakeAll();
+    for( size_t t = 0; t < pool.size(); t++ )
+        pool[t]->wait();
+}
+
+void WorkerPool::work( int index ) {
+    int idleWait = dispatchLatency;
+    while( running ) {
+        bool posted = false;
+        qint64 due = dispatch( index, posted );
+        if( posted ) idleWait = dispatchLatency;
+
+        int handle;
+        if( next( index, handle ) ) {
+            runTask( index, handle );
+            continue;
+        }
+
+        bool poller = false; // During a run one idle thread keeps polling the RT ring, the others back off
+        if( active.load( std::memory_order_relaxed ) && !polling.load( std::memory_order_relaxed ) )
+            poller = !polling.exchange( true, std::memory_order_acquire );
+
+        int wait = poller ? dispatchLatency : idleWait;
+        if( due >= 0 && due < wait ) wait = qMax<qint64>( due, dispatchLatency ); // Dispatcher wakes for the service
+        bool woken;
+        {
+            QMutexLocker lock( &sleepMutex );
+            woken = wake.wait( &sleepMutex, wait );
+        }
+        if( poller ) polling.store( false, std::memory_order_release );
+        else if( !woken && wait == idleWait ) idleWait = qMin( 2 * idleWait, maxIdleWait );
+    }
+}
+
+// Ring has a single consumer, the flag hands it from thread to thread
+qint64 WorkerPool::dispatch( int index, bool &posted ) {
+    if( dispatching.exchange( true, std::memory_order_acquire ) ) return -1;
+
+    int handle;
+    while( requests.pop( handle ) ) {
+        posted = true;
+        if( handle < numTasks.load( std::memory_order_acquire ) ) schedule( index, handle );
+    }
+    if( clock.elapsed() >= nextService ) {
+        nextService = clock.elapsed() + interval;
+        for( int h = 0; h < numTasks.load( std::memory_order_acquire ); h++ )
+            schedule( ( index + h ) % pool.size(), h ); // Spread over the queues, idle threads steal the rest
+    }
+    qint64 due = nextService - clock.elapsed();
+    dispatching.store( false, std::memory_order_release );
+    return due;
+}
+
+void WorkerPool::schedule( int index, int handle ) {
+    for( ;; ) {
+        int state = states[handle].load( std::memory_order_acquire );
+        if( state == IDLE ) {
+            if( !states[handle].compare_exchange_weak( state, QUEUED ) ) continue;
+            {
+                QMutexLocker lock( &queues[index]->mutex );
+                queues[index]->handles.push_back( handle );
+            }
+            wake.wakeOne();
+            return ;
+        }
+        if( state == RUNNING ) { // Runs again once the current pass is over
+            if( !states[handle].compare_exchange_weak( state, RERUN ) ) continue;
+        }
+        return ; // Already queued, rerun pending or removed
+    }
+}
+
+bool WorkerPool::next( int index, int &handle ) {
+    {
+        QMutexLocker lock( &queues[index]->mutex );
+        if( !queues[index]->handles.empty() ) {
+            handle = queues[index]->handles.back();
+            queues[index]->handles.pop_back();
+            return true;
+        }
+    }
+    for( size_t k = 1; k < queues.size(); k++ ) {
+        TaskQueue *victim = queues[( index + k ) % queues.size()];
+        QMutexLocker lock( &victim->mutex );
+        if( !victim->handles.empty() ) {
+            handle = victim->handles.front();
+            victim->handles.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::runTask( int index, int handle ) {
+    states[handle].store( RUNNING, std::memory_order_release ); // Only the thread that dequeued it leaves QUEUED
+    tasks[handle]->process();
+
+    int state = RUNNING;
+    if( states[handle].compare_exchange_strong( state, IDLE, std::memory_order_acq_rel ) ) return ;
+    states[handle].store( IDLE, std::memory_order_release ); // Woken while running
+    schedule( index, handle );
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_Worker.h
+ * Small work-stealing thread pool that services analysis tasks fed by
+ * the RT thread, keeping that work off both the RT and GUI threads
+ *
+ *** NOTES
+ *
+ * Every task is serviced once per interval, as with the single worker
+ * thread this pool replaces, and can also be woken at once with post().
+ * post() only pushes the task handle into a preallocated lock-free
+ * ring, so the RT thread can call it at the end of a step or test pulse
+ * without allocating or locking. A post dropped because the ring is full
+ * only delays the task until the next interval.
+ *
+ * Each pool thread keeps its own queue of task handles and takes work
+ * from its back. A thread with nothing to do steals from the front of
+ * the other queues, so a slow analysis (a long sweep average, a fit)
+ * holds up one thread while the others keep servicing the rest. Any
+ * idle thread drains the RT ring and queues the periodic service, one
+ * at a time, so a long task never delays a posted one.
+ *
+ * post() cannot wake a pool thread, since signalling a condition variable
+ * may lock, so posted tasks are only seen when an idle thread wakes on its
+ * own. While a run is in progress (setActive(), updated by the RT thread)
+ * one idle thread at a time is the poller and wakes every 1 ms, so a step
+ * end or test pulse fit is dispatched within 1 ms whenever a thread is
+ * idle; if every thread is busy, within the rest of the shortest task
+ * running. The other idle threads, and all of them between runs, double
+ * their wait each time they wake to an empty ring, up to 100 ms, and drop
+ * back to 1 ms when they drain a post. The thread that last dispatched
+ * never sleeps past the next periodic service, so between runs a post
+ * waits at most one service interval. Tasks queued by the pool itself
+ * wake a thread at once and do not depend on these waits.
+ *
+ * A task is never run by two threads at once: it is queued at most once,
+ * and a wake-up that arrives while it runs makes it run again right
+ * after. process() therefore keeps the single consumer guarantee the
+ * ring buffers of the tasks rely on. Different tasks do run in parallel,
+ * so tasks must not share state with each other.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_WORKER_H
+#define APC_WORKER_H
+
+#include "APC_RingBuffer.h"
+#include "APC_WorkerTask.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+class WorkerPool {
+public:
+    static const int maxTasks = 32;
+
+    WorkerPool( int, int, size_t ); // Threads (0 picks from the number of cores), service interval (ms), RT ring size
+    ~WorkerPool( void );
+
+    // GUI thread
+    int addTask( WorkerTask * ); // Task is not owned by the pool, returns its handle for post(), -1 if full
+    void removeTask( WorkerTask * ); // Blocks until the task is no longer running
+    void start( void );
+    void stop( void ); // Blocks until every thread has exited
+    int threads( void ) const { return pool.size(); }
+    int dropped( void ) const { return droppedPosts.load( std::memory_order_relaxed ); }
+
+    // RT thread
+    void post( int handle ) { // Services the task as soon as a pool thread is free
+        if( handle < 0 || !requests.push( handle ) ) droppedPosts.fetch_add( 1, std::memory_order_relaxed );
+    }
+    void setActive( bool a ) { // Run in progress, posts are then polled for every dispatchLatency, written only on change
+        if( active.load( std::memory_order_relaxed ) != a ) active.store( a, std::memory_order_relaxed );
+    }
+
+private:
+    enum { IDLE, QUEUED, RUNNING, RERUN, REMOVED }; // Task states
+
+    class PoolThread : public QThread {
+    public:
+        PoolThread( WorkerPool *p, int i ) : owner( p ), index( i ) { }
+    protected:
+        void run( void ) { owner->work( index ); }
+    private:
+        WorkerPool *owner;
+        int index;
+    };
+
+    struct TaskQueue {
+        QMutex mutex;
+        std::deque<int> handles;
+    };
+
+    void work( int ); // Loop of pool thread i
+    qint64 dispatch( int, bool & ); // Drains the RT ring and queues the periodic service on thread i, returns ms to the next service or -1
+    void schedule( int, int ); // Queues task handle on thread i unless it is queued already
+    bool next( int, int & ); // Own queue first, then steals
+    void runTask( int, int );
+
+    WorkerTask *tasks[maxTasks]; // Slots are never reused, so threads read them without locking
+    std::atomic<int> states[maxTasks];
+    std::atomic<int> numTasks;
+    QMutex taskMutex; // Serializes addTask and removeTask, never taken by the RT thread
+
+    std::vector<PoolThread *> pool;
+    std::vector<TaskQueue *> queues;
+    QMutex sleepMutex; // Only guards the wait condition
+    QWaitCondition wake;
+    RingBuffer<int> requests; // Task handles posted by the RT thread, consumed by the thread holding dispatching
+    std::atomic<bool> dispatching;
+    QElapsedTimer clock; // Read only while holding dispatching
+    qint64 nextService;
+    std::atomic<int> droppedPosts;
+    std::atomic<bool> running;
+    std::atomic<bool> active; // Set by the RT thread while a run is in progress
+    std::atomic<bool> polling; // An idle thread is waiting at dispatchLatency
+    int interval;
+};
+
+#endif // APC_WORKER_H
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_WorkerTask.h
+ * Interface of the analysis tasks serviced by the worker pool
+ *
+ *** NOTES
+ *
+ * Kept apart from the pool so the tasks, and the engine that feeds
+ * them, build without Qt. Only the plugin needs APC_Worker.h.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_WORKERTASK_H
+#define APC_WORKERTASK_H
+
+// Unit of work serviced by the pool, process() drains whatever input has accumulated
+class WorkerTask {
+public:
+    virtual ~WorkerTask( void ) { }
+    virtual void process( void ) = 0;
+};
+
+#endif // APC_WORKERTASK_H
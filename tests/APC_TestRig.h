@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * APC_TestRig.h
+ * Headless host, model cell and checks shared by the engine tests,
+ * the regression harness and the benchmarks
+ *
+ *** NOTES
+ *
+ * TestHost stands in for the plugin. It registers the same analysis
+ * tasks the plugin gives its worker pool, but services them on the
+ * calling thread: a post runs the task at once, and service() runs
+ * every task, as the pool does once per interval. Runs are therefore
+ * repeatable tick for tick. Like the plugin, it turns GSL's error
+ * handler off when it is constructed.
+ *
+ * ModelCell is the other side of the amplifier. Its action potential
+ * is defined in ms, not in ticks, so the same cell paced at any period
+ * has the same APD. A stimulus above stimThreshold fires it, the
+ * duration follows a simple restitution curve
+ *   D = APDmax * DI / ( DI + tau )
+ * and the waveform is a plateau followed by a linear repolarization,
+ * so the APD at any repolarization percentage is known exactly. While
+ * the engine runs an AP clamp step the cell is in voltage clamp and
+ * is charged through a series resistance: the current the engine reads
+ * has the capacitive transient of Rs * Cm and a nonlinear leak, so test
+ * pulses can be fitted. Only plain arithmetic is used, no libm, so the waveform is the same bit for
+ * bit on every build.
+ *
+ * Tests are plain programs, CHECK() counts failures and main returns
+ * failures(), 0 when every check held.
+ *
+ * v1.0 - Initial Version
+ *
+ ***/
+
+#ifndef APC_TESTRIG_H
+#define APC_TESTRIG_H
+
+#include "APC_Engine.h"
+
+#include <gsl/gsl_errno.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+inline int &failureCount( void ) {
+    static int count = 0;
+    return count;
+}
+
+inline int failures( void ) {
+    if( failureCount() ) printf( "%d check(s) failed\n", failureCount() );
+    return failureCount() ? 1 : 0;
+}
+
+inline bool checkResult( bool ok, const char *what, const char *file, int line ) {
+    if( !ok ) {
+        printf( "%s:%d: check failed: %s\n", file, line, what );
+        failureCount()++;
+    }
+    return ok;
+}
+
+inline bool checkNear( double value, double expected, double tolerance, const char *what, const char *file, int line ) {
+    bool ok = ( value >= expected - tolerance && value <= expected + tolerance );
+    if( !ok ) {
+        printf( "%s:%d: check failed: %s = %.9g, expected %.9g +- %g\n", file, line, what, value, expected, tolerance );
+        failureCount()++;
+    }
+    return ok;
+}
+
+#define CHECK( c ) checkResult( ( c ), #c, __FILE__, __LINE__ )
+#define CHECK_NEAR( v, e, tol ) checkNear( ( v ), ( e ), ( tol ), #v, __FILE__, __LINE__ )
+
+class TestHost : public EngineHost {
+public:
+    TestHost( void ) : recorderOn( false ), records( 0 ), posts( 0 ), errors( 0 ) {
+        gsl_set_error_handler_off(); // As the plugin does when it is constructed
+    }
+
+    // Same tasks and handles as the plugin, engine->leakTask etc. are set here
+    void attach( ClampEngine *engine ) {
+        tasks.clear();
+        tasks.push_back( engine->traceDecimator );
+        tasks.push_back( engine->artifact );
+        engine->leakTask = add( engine->leak );
+        engine->sweepTask = add( engine->sweeps );
+        engine->restitutionTask = add( engine->restitution );
+        tasks.push_back( engine->beatRecorder );
+    }
+
+    void service( void ) { // Periodic service of every task
+        for( size_t h = 0; h < tasks.size(); h++ )
+            tasks[h]->process();
+    }
+
+    void engineRecord( bool on ) { recorderOn = on; records++; }
+    void enginePost( int handle ) {
+        posts++;
+        if( handle >= 0 && handle < (int)tasks.size() ) tasks[handle]->process();
+    }
+    void engineError( const char *message ) { errors++; lastError = message; }
+    long long engineClock( void ) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    bool recorderOn;
+    int records;
+    int posts;
+    int errors;
+    std::string lastError;
+
+private:
+    int add( WorkerTask *task ) {
+        tasks.push_back( task );
+        return tasks.size() - 1;
+    }
+
+    std::vector<WorkerTask *> tasks;
+};
+
+class ModelCell {
+public:
+    ModelCell( void ) :
+        rest( -80 ), peak( 30 ), APDmax( 250 ), tau( 40 ), minAPD( 60 ), plateau( 0.4 ), stimThreshold( 1 ),
+        noise( 0 ), Rs( 10 ), Cm( 30 ), t( 0 ), tAP( 0 ), duration( 0 ), lastRepolarization( -1e9 ), firing( false ),
+        clamped( false ), membrane( rest ), seed( 12345 ), value( rest ) { }
+
+    // Parameters
+    double rest; // mV
+    double peak; // mV
+    double APDmax; // ms
+    double tau; // ms, restitution time constant
+    double minAPD; // ms
+    double plateau; // Fraction of the AP spent at peak
+    double stimThreshold; // nA
+    double noise; // Peak to peak (mV), 0 is off
+    double Rs; // Series resistance in voltage clamp (MOhm)
+    double Cm; // pF
+
+    double input( void ) const { return clamped ? value * 1e-12 : value * 1e-3; } // A in voltage clamp, V otherwise
+    double vm( void ) const { return value; }
+    double lastAPD( void ) const { return duration; }
+    double APDAt( double repol ) const { // APD the engine should measure at repol (fraction) for the last AP
+        return duration * ( plateau + ( 1 - plateau ) * repol );
+    }
+    bool firingNow( void ) const { return firing; }
+
+    // Answers the outputs of the tick the engine just ran, which lasted engine.period ms
+    void respond( const ClampEngine &engine ) {
+        double dt = engine.period;
+        t += dt;
+        bool wasClamped = clamped;
+        clamped = ( engine.executeMode == ClampEngine::PROTOCOL && engine.protocolMode == ClampEngine::EXEC &&
+                    engine.stepType == ProtocolDefs::APCLAMP );
+        if( clamped ) { // Command in V, membrane charged through Rs, current in pA
+            if( !wasClamped ) membrane = rest;
+            double command = engine.outputs[0] * 1e3 - engine.LJP;
+            double d = membrane - rest;
+            double leak = 0.5 * d + 2e-3 * d * d; // pA
+            double access = ( command - membrane ) / Rs * 1e3; // mV / MOhm is nA
+            membrane += dt * ( access - leak ) / Cm; // pA / pF is mV / ms
+            value = access;
+            firing = false;
+            return ;
+        }
+
+        if( firing ) {
+            tAP += dt;
+            if( tAP >= duration ) {
+                firing = false;
+                lastRepolarization = t;
+            }
+        }
+        if( !firing && engine.outputs[0] * 1e9 >= stimThreshold ) { // Fires on the tick after the stimulus starts
+            double DI = t - lastRepolarization;
+            duration = APDmax * DI / ( DI + tau );
+            if( duration < minAPD ) duration = minAPD;
+            tAP = 0;
+            firing = true;
+        }
+
+        if( !firing ) value = rest;
+        else if( tAP < plateau * duration ) value = peak;
+        else value = peak - ( peak - rest ) * ( tAP - plateau * duration ) / ( ( 1 - plateau ) * duration );
+        if( noise > 0 ) value += noise * ( next() - 0.5 );
+    }
+
+private:
+    double next( void ) { // Uniform in [0, 1), same sequence everywhere
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return ( seed >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    }
+
+    double t; // ms
+    double tAP; // ms into the current AP
+    double duration; // ms, APD of the current or last AP
+    double lastRepolarization; // ms
+    bool firing;
+    bool clamped;
+    double membrane; // mV in voltage clamp
+    unsigned long long seed;
+    double value; // mV, or pA in voltage clamp
+};
+
+// One tick of the engine with the cell on the other side of the amplifier
+inline void drive( ClampEngine &engine, ModelCell &cell ) {
+    engine.inputs[0] = cell.input();
+    engine.tick();
+    cell.respond( engine );
+}
+
+// Idle ticks, as the plugin runs before a run starts, so the engine holds the resting Vm
+inline void settle( ClampEngine &engine, ModelCell &cell, int ticks = 10 ) {
+    for( int t = 0; t < ticks; t++ )
+        drive( engine, cell );
+}
+
+// Instructions as Protocol::compile() emits them
+inline ProtocolInstruction protocolStep( ProtocolDefs::stepType_t type, double BCL = 0, int numBeats = 0, int recordIdx = 0,
+                                         int waitTime = 0 ) {
+    ProtocolInstruction i;
+    i.op = ProtocolInstruction::EXEC;
+    i.condition = i.action = i.jump = i.count = 0;
+    i.scale = 1;
+    i.sweep = i.reference = -1;
+    i.type = type;
+    i.BCL = BCL;
+    i.numBeats = numBeats;
+    i.recordIdx = recordIdx;
+    i.waitTime = waitTime;
+    i.digitalOut = 0;
+    i.convergeMode = 0;
+    i.convergeBeats = 0;
+    i.convergeTol = 0;
+    return i;
+}
+
+inline ProtocolInstruction controlStep( ProtocolInstruction::opcode_t op, int jump, int count = 0, int condition = 0,
+                                        int action = 0, double scale = 1 ) {
+    ProtocolInstruction i = protocolStep( op == ProtocolInstruction::LOOP ? ProtocolDefs::LOOP :
+                                          op == ProtocolInstruction::ENDLOOP ? ProtocolDefs::ENDLOOP : ProtocolDefs::BRANCH );
+    i.op = op;
+    i.jump = jump;
+    i.count = count;
+    i.condition = condition;
+    i.action = action;
+    i.scale = scale;
+    return i;
+}
+
+#endif // APC_TESTRIG_H
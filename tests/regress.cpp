@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * regress.cpp
+ * Golden output regression harness, runs the engine headless over
+ * recorded input and compares the digest of every run with the one
+ * in tests/golden
+ *
+ *** NOTES
+ *
+ * The recorded input is taken first: the model cell is paced in closed
+ * loop by a STARTVM / PACE / STOPVM protocol, which fills slot 0. That
+ * run is itself the "record" case. Every case marked replayed plays
+ * slot 0 as Vm, as "digest on 0" does in the plugin. The others keep
+ * the cell in the loop because their outcome depends on the stimulus
+ * (threshold search, retry branches). AP clamp steps always answer the
+ * command with the current of the cell in voltage clamp.
+ *
+ * Each case covers one step type or control path, so a change in the
+ * digest points at the part of tick() that changed. There is no SCAN
+ * step, a restitution scan is a series of PACE steps at decreasing BCL
+ * and is run as the "scan" case.
+ *
+ * A digest is the 64 bit FNV-1a of every output and state sample of
+ * every tick (APC_StreamDigest.h). Golden files hold the digest and the
+ * tick count. An intended change of behaviour is recorded with
+ * make golden, and the new files are committed with it.
+ *
+ *   regress --check DIR [case...]   Nonzero status if any digest differs
+ *   regress --write DIR [case...]   New golden files
+ *   regress [case...]               Digests and throughput only
+ *
+ ***/
+
+#include "APC_TestRig.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+const double period = 0.05; // ms, 20 kHz
+const double serviceInterval = 20; // ms, same as the plugin's worker pool
+const int recordSlot = 0;
+const int averageSlot = 1;
+
+struct Run {
+    Run( void ) : engine( &host, period ) {
+        host.attach( &engine );
+        settle( engine, cell );
+    }
+
+    // Runs until the protocol ends or for at most ms, the period can change at changeAt (ms)
+    void run( double ms, double changeAt = -1, double newPeriod = 0 ) {
+        if( changeAt >= 0 ) {
+            run( changeAt );
+            engine.setPeriod( newPeriod );
+            ms -= changeAt;
+        }
+        int service = engine.timeBase.ticks( serviceInterval );
+        int ticks = engine.timeBase.ticks( ms );
+        for( int t = 0; t < ticks && engine.executeMode != ClampEngine::IDLE; t++ ) {
+            drive( engine, cell );
+            if( t % service == service - 1 ) host.service();
+        }
+        host.service();
+    }
+
+    // Recorded input in slot 0, not digested
+    void record( void ) {
+        ProtocolProgram program;
+        program.push_back( protocolStep( ProtocolDefs::STARTVM, 0, 0, recordSlot ) );
+        program.push_back( protocolStep( ProtocolDefs::PACE, 500, 14 ) );
+        program.push_back( protocolStep( ProtocolDefs::STOPVM ) );
+        engine.startProtocol( program, 0 );
+        run( 8000 );
+    }
+
+    void replay( void ) {
+        record();
+        engine.digestRequested = true;
+        engine.replaySlot = recordSlot;
+    }
+
+    TestHost host;
+    ClampEngine engine;
+    ModelCell cell;
+};
+
+void caseRecord( Run &r ) {
+    r.engine.digestRequested = true;
+    r.record();
+}
+
+void casePace( Run &r ) {
+    r.replay();
+    r.engine.BCL = 500; // Same as the recording
+    r.engine.startPace();
+    r.run( 5500 );
+}
+
+void caseThreshold( Run &r ) {
+    r.cell.stimThreshold = 2.35; // Found on the fifth stimulus
+    r.engine.digestRequested = true;
+    r.engine.startThreshold( r.engine.voltage );
+    r.run( 5000 );
+}
+
+void caseAverage( Run &r ) {
+    r.replay();
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::AVERAGE, 500, 6, averageSlot ) );
+    program.back().digitalOut = 1;
+    r.engine.startProtocol( program, 0 );
+    r.run( 5000 );
+}
+
+// Command averaged from the replay, test pulses before the first beat and every second one, current kept in sweep 0
+void caseAPClamp( Run &r, TraceSlot::format_t format ) {
+    r.replay();
+    r.engine.traces->setFormat( averageSlot, format, 0.01, 0 );
+    r.engine.testPulseAmplitude = -5;
+    r.engine.testPulseBeats = 2; // Rs compensation stays off, Rs is fitted with libm, which may round differently elsewhere
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::AVERAGE, 500, 3, averageSlot ) );
+    program.push_back( protocolStep( ProtocolDefs::APCLAMP, 500, 5, averageSlot ) );
+    program.back().digitalOut = 1;
+    program.back().sweep = 0;
+    r.engine.startProtocol( program, 1 );
+    r.run( 6000 );
+}
+
+void caseAPClampDouble( Run &r ) { caseAPClamp( r, TraceSlot::DOUBLE ); }
+void caseAPClampInt16( Run &r ) { caseAPClamp( r, TraceSlot::INT16 ); }
+
+void caseWait( Run &r ) {
+    r.replay();
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::STARTRECORD ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 2 ) );
+    program.push_back( protocolStep( ProtocolDefs::WAIT, 0, 0, 0, 500 ) ); // Replay stays in step with the beats
+    program.push_back( protocolStep( ProtocolDefs::WAIT, 0, 0, 0, 0 ) ); // Zero-length step
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 2 ) );
+    program.push_back( protocolStep( ProtocolDefs::STOPRECORD ) );
+    r.engine.startProtocol( program, 0 );
+    r.run( 5000 );
+}
+
+// Loop body runs three times per trial, two trials
+void caseLoop( Run &r ) {
+    r.replay();
+    r.engine.numTrials = 2;
+    ProtocolProgram program;
+    program.push_back( controlStep( ProtocolInstruction::LOOP, 0, 3 ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 1 ) );
+    program.push_back( protocolStep( ProtocolDefs::WAIT, 0, 0, 0, 500 ) );
+    program.push_back( controlStep( ProtocolInstruction::ENDLOOP, 0 ) );
+    r.engine.startProtocol( program, 0 );
+    r.run( 6500 );
+}
+
+// Stimulus below threshold until the second retry raises it, then a GOTO skips the long step
+void caseBranch( Run &r ) {
+    r.engine.digestRequested = true;
+    r.engine.stimMag = 0.6;
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 2 ) );
+    program.push_back( controlStep( ProtocolInstruction::BRANCH, 0, 3, ProtocolDefs::CAPTUREFAILED, ProtocolDefs::RETRY, 1.5 ) );
+    program.push_back( controlStep( ProtocolInstruction::BRANCH, 4, 0, ProtocolDefs::ALWAYS, ProtocolDefs::GOTO ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 100 ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 400, 3 ) );
+    r.engine.startProtocol( program, 0 );
+    r.run( 8000 );
+}
+
+// Restitution scan, the first step ends early once the APD has settled
+void caseScan( Run &r ) {
+    r.engine.digestRequested = true;
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::PACE, 600, 20 ) );
+    program.back().convergeMode = ConvergenceDetector::DELTA;
+    program.back().convergeBeats = 3;
+    program.back().convergeTol = 1;
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 3 ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 400, 3 ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 300, 3 ) );
+    r.engine.startProtocol( program, 0 );
+    r.run( 15000 );
+}
+
+// Period halved during an AP, the replay and every counter are carried over
+void casePeriod( Run &r ) {
+    r.replay();
+    r.engine.BCL = 500;
+    r.engine.startPace();
+    r.run( 4500, 1100, 0.1 );
+}
+
+struct Case {
+    const char *name;
+    void (*run)( Run & );
+};
+
+const Case cases[] = {
+    { "record", caseRecord },
+    { "pace", casePace },
+    { "threshold", caseThreshold },
+    { "average", caseAverage },
+    { "apclamp", caseAPClampDouble },
+    { "apclamp-int16", caseAPClampInt16 },
+    { "wait", caseWait },
+    { "loop", caseLoop },
+    { "branch", caseBranch },
+    { "scan", caseScan },
+    { "period", casePeriod },
+};
+const int numCases = sizeof( cases ) / sizeof( cases[0] );
+
+bool readGolden( const std::string &file, unsigned long long &digest, long long &ticks ) {
+    std::ifstream in( file.c_str() );
+    return (bool)( in >> std::hex >> digest >> std::dec >> ticks );
+}
+
+bool writeGolden( const std::string &file, unsigned long long digest, long long ticks ) {
+    std::ofstream out( file.c_str() );
+    char line[64];
+    snprintf( line, sizeof(line), "%016llx %lld\n", digest, ticks );
+    out << line;
+    return (bool)out;
+}
+
+} // namespace
+
+int main( int argc, char **argv ) {
+    enum { SHOW, CHECK, WRITE } mode = SHOW;
+    std::string dir;
+    std::vector<std::string> selected;
+    for( int i = 1; i < argc; i++ ) {
+        if( ( !strcmp( argv[i], "--check" ) || !strcmp( argv[i], "--write" ) ) && i + 1 < argc ) {
+            mode = strcmp( argv[i], "--check" ) ? WRITE : CHECK;
+            dir = argv[++i];
+        }
+        else selected.push_back( argv[i] );
+    }
+
+    int failed = 0;
+    for( int c = 0; c < numCases; c++ ) {
+        bool wanted = selected.empty();
+        for( size_t s = 0; s < selected.size(); s++ )
+            wanted = wanted || selected[s] == cases[c].name;
+        if( !wanted ) continue;
+
+        Run r;
+        cases[c].run( r );
+        unsigned long long digest = r.engine.digest.value();
+        long long ticks = r.engine.digest.ticks();
+        if( r.host.errors ) printf( "%s: engine error: %s", cases[c].name, r.host.lastError.c_str() );
+        printf( "%-14s %016llx %8lld ticks %10.0f ticks/s", cases[c].name, digest, ticks, r.engine.digest.throughput() );
+
+        std::string file = dir + "/" + cases[c].name + ".digest";
+        if( mode == CHECK ) {
+            unsigned long long goldenDigest;
+            long long goldenTicks;
+            if( !readGolden( file, goldenDigest, goldenTicks ) ) {
+                printf( "  MISSING %s\n", file.c_str() );
+                failed++;
+            }
+            else if( goldenDigest != digest || goldenTicks != ticks ) {
+                printf( "  FAIL, golden %016llx %lld ticks\n", goldenDigest, goldenTicks );
+                failed++;
+            }
+            else printf( "  ok\n" );
+        }
+        else if( mode == WRITE ) {
+            if( !writeGolden( file, digest, ticks ) ) {
+                printf( "  cannot write %s\n", file.c_str() );
+                failed++;
+            }
+            else printf( "  written\n" );
+        }
+        else printf( "\n" );
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
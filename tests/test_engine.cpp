@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * test_engine.cpp
+ * Pacing and protocol runs of the engine against the model cell, beat
+ * times and APDs are checked against the ones the cell was built with
+ *
+ ***/
+
+#include "APC_TestRig.h"
+
+namespace {
+
+const double repol = 0.9; // Engine default, APDRepol = 90
+
+// Beats after the first one, whose stimulus is given by reset() before the clock starts
+void checkBeats( ClampEngine &engine, ModelCell &cell, double BCL, int expected ) {
+    BeatResult result;
+    int beats = 0;
+    double previousAPD = 0;
+    while( engine.beatFifo->pop( result ) ) {
+        beats++;
+        CHECK( result.complete );
+        CHECK( result.captured );
+        CHECK( result.beatClass == BeatClass::CAPTURED );
+        double lastAPD = previousAPD;
+        previousAPD = result.APD;
+        if( result.beat < 3 ) continue; // Restitution settles within two beats
+        CHECK_NEAR( result.time, ( result.beat - 1 ) * BCL, 1e-6 );
+        CHECK_NEAR( result.APD, cell.APDAt( repol ) + engine.period / 2, engine.period / 2 ); // Seen on the next tick
+        CHECK_NEAR( lastAPD + result.DI, BCL - engine.period, 1e-6 ); // Upstroke is seen a tick after the stimulus
+    }
+    CHECK( beats == expected );
+}
+
+void testPace( double period ) {
+    TestHost host;
+    ClampEngine engine( &host, period );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+
+    engine.startPace();
+    int ticks = engine.timeBase.ticks( 10000 ); // 10 beats, the 11th starts on the last tick
+    for( int t = 0; t < ticks; t++ )
+        drive( engine, cell );
+    CHECK( engine.beatNum == 10 );
+    checkBeats( engine, cell, engine.BCL, 9 );
+    CHECK( host.errors == 0 );
+}
+
+// As if the run had paced for hours: the clock, the step counters and the stamps move on by whole beats
+void fastForward( ClampEngine &engine, int beats ) {
+    int64_t skip = (int64_t)beats * engine.BCLInt;
+    engine.timeBase.restartClock( engine.timeBase.now() + skip );
+    engine.stepTime += skip;
+    engine.cycleStartTime += skip;
+    engine.APStart += skip;
+    engine.peakTime += skip;
+    engine.beatStartTime += skip;
+    engine.repolarization += skip;
+    engine.eventPulseEnd += skip;
+    engine.thresholdStimulus += skip;
+    engine.responseTime += skip;
+    engine.beatNum += beats;
+}
+
+// Overnight run at 50 kHz, the step counters pass 2^31 ticks
+void testLongPace( void ) {
+    TestHost host;
+    ClampEngine engine( &host, 0.02 );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+
+    engine.startPace();
+    for( int t = engine.timeBase.ticks( 3500 ); t > 0; t-- )
+        drive( engine, cell );
+    BeatResult result;
+    while( engine.beatFifo->pop( result ) ) { }
+
+    int beats = ( ( (int64_t)1 << 31 ) - engine.timeBase.ticks( 5000 ) ) / engine.BCLInt;
+    fastForward( engine, beats );
+    CHECK( engine.stepTime < ( (int64_t)1 << 31 ) );
+    for( int t = engine.timeBase.ticks( 10000 ); t > 0; t-- )
+        drive( engine, cell );
+    CHECK( engine.stepTime > ( (int64_t)1 << 31 ) );
+    CHECK( engine.beatNum == beats + 14 );
+
+    int popped = 0;
+    double previousAPD = -1;
+    while( engine.beatFifo->pop( result ) ) {
+        popped++;
+        CHECK( result.beatClass == BeatClass::CAPTURED );
+        CHECK_NEAR( result.time, ( result.beat - 1 ) * engine.BCL, 1e-6 );
+        CHECK_NEAR( result.APD, cell.APDAt( repol ) + engine.period / 2, engine.period / 2 );
+        if( previousAPD >= 0 )
+            CHECK_NEAR( previousAPD + result.DI, engine.BCL - engine.period, 1e-6 );
+        previousAPD = result.APD;
+    }
+    CHECK( popped == 10 );
+}
+
+// Beat and APD in progress are carried over, the cell's AP is the same in ms whatever the period
+void testPeriodChange( double from, double to, double at ) {
+    TestHost host;
+    ClampEngine engine( &host, from );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+
+    engine.startPace();
+    int ticks = engine.timeBase.ticks( at );
+    for( int t = 0; t < ticks; t++ )
+        drive( engine, cell );
+    engine.setPeriod( to );
+    ticks = engine.timeBase.ticks( 9990 - at ); // Beat 11 is not started, however the ticks were rounded
+    for( int t = 0; t < ticks; t++ )
+        drive( engine, cell );
+    CHECK( engine.beatNum == 10 );
+
+    BeatResult result;
+    int beats = 0;
+    double previousAPD = 0;
+    double tolerance = from + to; // Half a tick for the rescaled stamp, a tick to see the crossing
+    while( engine.beatFifo->pop( result ) ) {
+        beats++;
+        double lastAPD = previousAPD;
+        previousAPD = result.APD;
+        CHECK( result.beatClass == BeatClass::CAPTURED );
+        if( result.beat < 3 ) continue;
+        CHECK_NEAR( result.time, ( result.beat - 1 ) * engine.BCL, tolerance );
+        CHECK_NEAR( result.APD, cell.APDAt( repol ), tolerance );
+        CHECK_NEAR( lastAPD + result.DI, engine.BCL, tolerance );
+    }
+    CHECK( beats == 9 );
+}
+
+void testProtocol( double period ) {
+    TestHost host;
+    ClampEngine engine( &host, period );
+    host.attach( &engine );
+    ModelCell cell;
+
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 8 ) );
+    program.push_back( protocolStep( ProtocolDefs::WAIT, 0, 0, 0, 200 ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 400, 5 ) );
+    engine.startProtocol( program, 0 );
+
+    int ticks = engine.timeBase.ticks( 8 * 500 + 200 + 5 * 400 );
+    int t = 0;
+    for( ; t < ticks + 10 && engine.protocolOn; t++ )
+        drive( engine, cell );
+    CHECK( !engine.protocolOn );
+    CHECK( engine.executeMode == ClampEngine::IDLE );
+    CHECK( t == ticks + 1 ); // Steps end on their last tick, the next tick ends the protocol
+
+    StatisticsSummary summary;
+    int steps = 0;
+    while( engine.statisticsFifo->pop( summary ) ) {
+        if( summary.step < 0 ) {
+            CHECK( summary.stepBeats == 13 );
+            continue;
+        }
+        CHECK( summary.classCounts[BeatClass::CAPTURED] == ( summary.step == 0 ? 8 : 5 ) );
+        steps++;
+    }
+    CHECK( steps == 2 );
+}
+
+// Average buffers are sized for the period the protocol started with, a later AVERAGE step must stay within them
+void testAverageAfterPeriodChange( double from, double to ) {
+    TestHost host;
+    ClampEngine engine( &host, from );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+
+    ProtocolProgram program;
+    program.push_back( protocolStep( ProtocolDefs::AVERAGE, 500, 3, 1 ) );
+    program.push_back( protocolStep( ProtocolDefs::AVERAGE, 500, 3, 2 ) );
+    engine.startProtocol( program, 0 );
+    size_t reserved = engine.traces->slot( 2 )->bytes();
+
+    int t = 0;
+    for( int ticks = engine.timeBase.ticks( 700 ); t < ticks; t++ ) // During the first step
+        drive( engine, cell );
+    engine.setPeriod( to );
+    for( int ticks = engine.timeBase.ticks( 2500 ); t < 10 * ticks && engine.protocolOn; t++ )
+        drive( engine, cell );
+    CHECK( !engine.protocolOn );
+    CHECK( host.errors == 0 );
+    CHECK( (int)engine.traces->slot( 2 )->size() == engine.timeBase.ticks( 500 * to / from ) ); // Truncated to the buffers
+    CHECK( engine.traces->slot( 2 )->bytes() == reserved ); // Not reallocated by the RT thread
+}
+
+// Branches that skip the only timed step of a loop body, each iteration must still take a tick
+void testUntimedLoop( double period, bool latched ) {
+    TestHost host;
+    ClampEngine engine( &host, period );
+    host.attach( &engine );
+    ModelCell cell;
+    settle( engine, cell );
+
+    const int iterations = 100000;
+    ProtocolProgram program;
+    int first = 0;
+    if( latched ) { // Capture fails below threshold and nothing in the loop clears it
+        engine.stimMag = 0.6;
+        program.push_back( protocolStep( ProtocolDefs::PACE, 500, 2 ) );
+        first = engine.timeBase.ticks( 1000 );
+    }
+    int loop = program.size();
+    program.push_back( controlStep( ProtocolInstruction::LOOP, 0, iterations ) );
+    program.push_back( controlStep( ProtocolInstruction::BRANCH, loop + 3, 0,
+                                    latched ? ProtocolDefs::CAPTUREFAILED : ProtocolDefs::ALWAYS, ProtocolDefs::GOTO ) );
+    program.push_back( protocolStep( ProtocolDefs::PACE, 500, 1 ) );
+    program.push_back( controlStep( ProtocolInstruction::ENDLOOP, loop ) );
+    engine.startProtocol( program, 0 );
+
+    int t = 0;
+    for( ; t < first + 2 * iterations && engine.protocolOn; t++ ) {
+        int step = engine.currentStep;
+        drive( engine, cell );
+        if( t > first && engine.protocolOn ) // One iteration per tick, held on the ENDLOOP
+            CHECK( engine.currentStep == step );
+    }
+    CHECK( !engine.protocolOn );
+    CHECK( t == first + iterations ); // The last iteration falls through to the end of the protocol
+    CHECK( host.errors == 0 );
+
+    StatisticsSummary summary;
+    while( engine.statisticsFifo->pop( summary ) )
+        CHECK( summary.step != loop + 2 ); // Skipped every time
+}
+
+} // namespace
+
+int main( void ) {
+    testPace( 0.1 );
+    testPace( 0.05 );
+    testPace( 0.025 );
+    testLongPace();
+    testPeriodChange( 0.05, 0.1, 2100 ); // During the AP of beat 3
+    testPeriodChange( 0.05, 0.025, 2100 );
+    testPeriodChange( 0.1, 0.05, 3500 ); // During the diastolic interval of beat 4
+    testProtocol( 0.1 );
+    testProtocol( 0.05 );
+    testAverageAfterPeriodChange( 0.1, 0.05 );
+    testUntimedLoop( 0.05, false );
+    testUntimedLoop( 0.05, true );
+    return failures();
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * test_restitution.cpp
+ * Restitution points and fit on synthetic curves with known APDmax, A
+ * and tau, through the same ring and worker path the engine uses
+ *
+ ***/
+
+#include "APC_TestRig.h"
+
+#include <math.h>
+
+namespace {
+
+const double APDmax = 300, A = 250, tau = 80; // ms
+const double DIs[] = { 40, 60, 90, 130, 180, 250, 350, 500 };
+const int numDIs = sizeof( DIs ) / sizeof( DIs[0] );
+
+double curve( double DI ) { return APDmax - A * exp( -DI / tau ); }
+
+// One pace step per DI, binBeats complete beats each, noise alternates in sign from beat to beat
+void addSteps( RestitutionAnalyzer &analyzer, int first, int last, double noise ) {
+    for( int s = first; s < last; s++ ) {
+        for( int b = 0; b < RestitutionAnalyzer::binBeats; b++ )
+            analyzer.addBeat( s, DIs[s], curve( DIs[s] ) + ( ( s + b ) % 2 ? noise : -noise ), true );
+        analyzer.endStep( s, DIs[s] + curve( DIs[s] ) );
+    }
+}
+
+void testExact( void ) {
+    RestitutionAnalyzer analyzer( 1024 );
+    std::vector<RestitutionPoint> points;
+    RestitutionFit fit;
+
+    addSteps( analyzer, 0, RestitutionAnalyzer::minPoints - 1, 0 );
+    analyzer.process();
+    analyzer.results( points, fit );
+    CHECK( (int)points.size() == RestitutionAnalyzer::minPoints - 1 );
+    CHECK( !fit.valid ); // Not enough points to fit
+
+    addSteps( analyzer, RestitutionAnalyzer::minPoints - 1, numDIs, 0 );
+    analyzer.process();
+    analyzer.results( points, fit );
+    CHECK( points.size() == (size_t)numDIs );
+    CHECK_NEAR( points[2].DI, DIs[2], 1e-9 );
+    CHECK_NEAR( points[2].APD, curve( DIs[2] ), 1e-9 );
+    CHECK( points[2].beats == RestitutionAnalyzer::binBeats );
+    CHECK( fit.valid );
+    CHECK( fit.points == numDIs );
+    CHECK_NEAR( fit.APDmax, APDmax, 1e-3 );
+    CHECK_NEAR( fit.A, A, 1e-3 );
+    CHECK_NEAR( fit.tau, tau, 1e-3 );
+    CHECK_NEAR( fit.minDI, DIs[0], 1e-9 );
+    CHECK_NEAR( fit.maxSlope, A / tau * exp( -DIs[0] / tau ), 1e-5 );
+    CHECK( fit.rms < 1e-6 );
+}
+
+// Beat to beat noise averages out within each point, only the fit residual is left
+void testNoise( void ) {
+    RestitutionAnalyzer analyzer( 1024 );
+    addSteps( analyzer, 0, numDIs, 2 );
+    analyzer.process();
+
+    std::vector<RestitutionPoint> points;
+    RestitutionFit fit;
+    analyzer.results( points, fit );
+    CHECK( fit.valid );
+    CHECK_NEAR( fit.APDmax, APDmax, 0.02 * APDmax );
+    CHECK_NEAR( fit.A, A, 0.05 * A );
+    CHECK_NEAR( fit.tau, tau, 0.05 * tau );
+    CHECK( fit.rms < 1 );
+}
+
+// Incomplete beats and beats without a DI are left out, a step without complete beats gives no point
+void testBins( void ) {
+    RestitutionAnalyzer analyzer( 1024 );
+    analyzer.addBeat( 0, -1, 200, true );
+    analyzer.addBeat( 0, 100, 0, false );
+    analyzer.addBeat( 0, 100, 210, true );
+    analyzer.endStep( 0, 310 );
+    analyzer.addBeat( 1, 100, 0, false );
+    analyzer.endStep( 1, 310 );
+    analyzer.process();
+
+    std::vector<RestitutionPoint> points;
+    RestitutionFit fit;
+    analyzer.results( points, fit );
+    CHECK( points.size() == 1 );
+    CHECK( points.size() == 1 && points[0].beats == 1 && points[0].APD == 210 );
+}
+
+// All points at one DI leave tau undetermined, the solver must give up quietly with the handler off
+void testDegenerate( void ) {
+    RestitutionAnalyzer analyzer( 1024 );
+    for( int s = 0; s < RestitutionAnalyzer::minPoints + 2; s++ ) {
+        analyzer.addBeat( s, 100, 200 + s, true );
+        analyzer.endStep( s, 300 );
+    }
+    analyzer.process();
+
+    std::vector<RestitutionPoint> points;
+    RestitutionFit fit;
+    analyzer.results( points, fit );
+    CHECK( points.size() == (size_t)RestitutionAnalyzer::minPoints + 2 );
+    CHECK( !fit.valid || ( isfinite( fit.APDmax ) && fit.tau > 0 ) );
+}
+
+} // namespace
+
+int main( void ) {
+    gsl_set_error_handler_off(); // As the plugin does when it is constructed
+    testExact();
+    testNoise();
+    testBins();
+    testDegenerate();
+    return failures();
+}
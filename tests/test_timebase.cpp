@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Weill Medical College of Cornell University
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*** INTRO
+ * Action Potential Clamp
+ *
+ * test_timebase.cpp
+ * Tick clock over 10^9 ticks and several period changes, checked
+ * against a long double reference, and the ms to tick conversions
+ *
+ ***/
+
+#include "APC_TestRig.h"
+
+#include <math.h>
+
+namespace {
+
+// RTXI periods are converted from ns, so ms / period can land just below a whole number
+void testTicks( void ) {
+    TimeBase timeBase( 100000 * 1e-6 );
+    CHECK( timeBase.ticks( 1000 ) == 10000 );
+    CHECK( timeBase.ticks( 0.05 ) == 0 );
+    CHECK( !timeBase.setPeriod( 100000 * 1e-6 ) );
+    CHECK( !timeBase.setPeriod( 0 ) );
+    CHECK( timeBase.setPeriod( 50000 * 1e-6 ) );
+    CHECK( timeBase.ticks( 1000 ) == 20000 );
+    CHECK( timeBase.rescale( 10000 ) == 20000 );
+}
+
+// One epoch per period, time() and since() of a stamp taken in the first epoch are checked every checkInterval ticks
+void testClock( void ) {
+    const int64_t totalTicks = 1000000000;
+    const int64_t checkInterval = 1000000;
+    const double periods[] = { 0.05, 0.1, 0.025, 1.0 / 30, 0.02, 0.05, 0.0625, 0.1 };
+    const int numPeriods = sizeof( periods ) / sizeof( periods[0] );
+    const int64_t epochTicks = totalTicks / numPeriods;
+
+    TimeBase timeBase( periods[0] );
+    timeBase.restartClock( -1 );
+    timeBase.tick(); // First tick is time 0
+    long double epochStart = 0; // ms, reference time of the first tick of the epoch
+    int64_t epochTick = 0;
+    int64_t stamp = 12345; // Clock tick of a stamp taken during the first epoch
+    long double stampTime = stamp * (long double)periods[0];
+    double worstTime = 0;
+    double worstSince = 0;
+    double stampError = 0; // Rounding of the stamp to whole ticks, in ms, up to half a tick per period change
+
+    for( int e = 0; e < numPeriods; e++ ) {
+        if( e > 0 ) {
+            epochStart += ( timeBase.now() - epochTick ) * (long double)periods[e - 1];
+            epochTick = timeBase.now();
+            CHECK( timeBase.setPeriod( periods[e] ) );
+            stamp = timeBase.rescaleStamp( stamp );
+            stampError += periods[e] / 2;
+        }
+        for( int64_t n = 0; n < epochTicks; n += checkInterval ) {
+            for( int64_t i = 0; i < checkInterval; i++ )
+                timeBase.tick();
+            long double reference = epochStart + ( timeBase.now() - epochTick ) * (long double)periods[e];
+            double timeError = fabs( (double)( timeBase.time() - reference ) );
+            double sinceError = fabs( (double)( timeBase.since( stamp ) - ( reference - stampTime ) ) );
+            if( timeError > worstTime ) worstTime = timeError;
+            if( sinceError > worstSince ) worstSince = sinceError;
+        }
+    }
+
+    CHECK( timeBase.now() == epochTicks * numPeriods );
+    CHECK( timeBase.now() >= totalTicks - epochTicks );
+    CHECK( worstTime < 1e-6 ); // ms, time is never accumulated
+    CHECK( worstSince <= stampError + 1e-6 );
+    CHECK_NEAR( timeBase.time( stamp ), (double)stampTime, stampError + 1e-6 );
+    printf( "%lld ticks, %.0f ms, worst time error %.3g ms, worst since error %.3g ms (stamp rounding %.3g)\n",
+            (long long)timeBase.now(), timeBase.time(), worstTime, worstSince, stampError );
+}
+
+} // namespace
+
+int main( void ) {
+    testTicks();
+    testClock();
+    return failures();
+}